@@ -39,12 +39,12 @@ class UnownedBuffer : public storage::BlockBuffer {
 }  // namespace
 
 Allocator::~Allocator() {
-  std::scoped_lock lock(lock_);
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
   ZX_ASSERT(pending_changes_.empty());
 }
 
 zx::status<> Allocator::LoadStorage(fs::BufferedOperationsBuilder* builder) {
-  std::scoped_lock lock(lock_);
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
   storage::OwnedVmoid vmoid;
   auto status = storage_->AttachVmo(map_.StorageUnsafe()->GetVmo(), &vmoid);
   if (status.is_error()) {
@@ -68,7 +68,7 @@ size_t Allocator::GetAvailableLocked() const {
 WriteData Allocator::GetMapDataLocked() { return map_.StorageUnsafe()->GetVmo().get(); }
 
 fbl::Vector<BlockRegion> Allocator::GetAllocatedRegions() const {
-  std::scoped_lock lock(lock_);
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
   fbl::Vector<BlockRegion> out_regions;
   uint64_t offset = 0;
   uint64_t end = 0;
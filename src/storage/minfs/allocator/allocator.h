@@ -22,6 +22,8 @@
 #include "src/storage/minfs/allocator/allocator_reservation.h"
 #include "src/storage/minfs/allocator/storage.h"
 #include "src/storage/minfs/format.h"
+#include "src/storage/minfs/lock_profile.h"
+#include "src/storage/minfs/object_pool.h"
 #include "src/storage/minfs/superblock.h"
 #include "src/storage/minfs/writeback.h"
 
@@ -63,8 +65,9 @@ class AllocatorReservationKey {
 // only one PendingChange for allocations and one PendingChange for deallocations for each allocator
 // we support (blocks and inodes), so that's 4 per transaction in total.
 //
-// This class is not thread-safe and should only be accessed by Allocator, under its lock.
-class PendingChange {
+// This class is not thread-safe and should only be accessed by Allocator, under its lock. Its
+// memory is recycled through an ObjectPool, and its bitmap elements through the Allocator.
+class PendingChange : public PooledObject<PendingChange> {
  public:
   enum class Kind { kAllocation, kDeallocation };
 
@@ -145,6 +148,10 @@ class Allocator {
   // Free an item from the allocator.
   void Free(AllocatorReservation* reservation, size_t index) __TA_EXCLUDES(lock_);
 
+  // Free the |count| items starting at |start|. Equivalent to freeing each in turn, but takes the
+  // lock once and records the range as runs rather than as individual items.
+  void Free(AllocatorReservation* reservation, size_t start, size_t count) __TA_EXCLUDES(lock_);
+
 #ifdef __Fuchsia__
   // Extract a vector of all currently allocated regions in the filesystem.
   fbl::Vector<BlockRegion> GetAllocatedRegions() const __TA_EXCLUDES(lock_);
@@ -153,6 +160,20 @@ class Allocator {
   // Returns |true| if |index| is allocated. Returns |false| otherwise.
   bool CheckAllocated(size_t index) const __TA_EXCLUDES(lock_);
 
+  // Returns the in-memory copy of the map, whose first |GetMapBlocks()| blocks are stored on disk.
+  // This is for verifying the map once it has been loaded, before the allocator is in use.
+  const void* GetMapData() __TA_EXCLUDES(lock_);
+  uint32_t GetMapBlocks() const { return storage_->PoolBlocks(); }
+
+  // Returns the first element of the first run of |count| elements which are free and not held by
+  // any pending change, or ZX_ERR_NO_SPACE if there is no such run. Nothing is reserved, so the run
+  // may be taken by a later allocation.
+  zx::status<size_t> FindFreeRun(size_t count) const __TA_EXCLUDES(lock_);
+
+  // Returns true if the |count| elements from |start| are all free and not held by any pending
+  // change, such as a run found by FindFreeRun which has not been taken since.
+  bool IsFreeRun(size_t start, size_t count) const __TA_EXCLUDES(lock_);
+
   // AllocatorReservation Methods:
   //
   // The following methods are restricted to AllocatorReservation via the passkey
@@ -161,6 +182,11 @@ class Allocator {
   // Allocate a single element and return its newly allocated index.
   size_t Allocate(AllocatorReservationKey, AllocatorReservation* reservation) __TA_EXCLUDES(lock_);
 
+  // Allocate |hint| if it is free and unreserved, and the first free element otherwise. Returns the
+  // newly allocated index.
+  size_t Allocate(AllocatorReservationKey, AllocatorReservation* reservation, size_t hint)
+      __TA_EXCLUDES(lock_);
+
   // Reserve |count| elements. This is required in order to later allocate them.
   // Outputs a |reservation| which contains reservation details.
   zx::status<> Reserve(AllocatorReservationKey, PendingWork* transaction, size_t count)
@@ -181,6 +207,13 @@ class Allocator {
   // resolving blocks for more than one vnode at a time.
   void Commit(PendingWork* transaction, AllocatorReservation* reservation) __TA_EXCLUDES(lock_);
 
+  // Records the acquisitions of the allocator's lock in |profile| as |site|. |profile| must outlive
+  // the allocator, and this must be called before the allocator is shared between threads.
+  void SetLockProfile(LockProfile* profile, LockSite site) {
+    lock_profile_ = profile;
+    lock_site_ = site;
+  }
+
  private:
   friend class PendingChange;  // For AddPendingChange & RemovePendingChange.
 
@@ -206,13 +239,26 @@ class Allocator {
   // called when reserved_ > 0.
   size_t FindNextUnreserved(size_t start) const __TA_REQUIRES(lock_);
 
+  // Returns true if |index| is free in the map and not held by any pending change.
+  bool IsFreeLocked(size_t index) const __TA_REQUIRES(lock_);
+
   // Adds & removes |change| from the vector of pending changes.
   void AddPendingChange(PendingChange* change);
   void RemovePendingChange(PendingChange* change);
 
+  // Sets and clears the range [start, end) of the bitmap of |change| with elements taken from and
+  // returned to |free_elements_| rather than the heap.
+  void SetPendingLocked(PendingChange& change, size_t start, size_t end) __TA_REQUIRES(lock_);
+  void ClearPendingLocked(PendingChange& change, size_t start, size_t end) __TA_REQUIRES(lock_);
+
+  // Returns |free_elements_| holding at least one element, taking one from the heap if need be.
+  bitmap::RleBitmap::FreeList* FreeElementsLocked() __TA_REQUIRES(lock_);
+
   // Protects the allocator's metadata.
   // Does NOT guard the allocator |storage_|.
   mutable std::mutex lock_;
+  LockProfile* lock_profile_ = nullptr;
+  LockSite lock_site_ = LockSite::kBlockAllocator;
 
   // Total number of elements reserved by AllocatorReservation objects. Represents the maximum
   // number of elements that are allowed to be allocated or swapped in at a given time. Once an
@@ -232,6 +278,10 @@ class Allocator {
   RawBitmap map_ __TA_GUARDED(lock_);
 
   std::vector<PendingChange*> pending_changes_ __TA_GUARDED(lock_);
+
+  // The elements of the bitmaps of pending changes which have been removed, which grows to the
+  // most elements pending at once. Setting or clearing a range uses at most one element.
+  bitmap::RleBitmap::FreeList free_elements_ __TA_GUARDED(lock_);
 };
 
 }  // namespace minfs
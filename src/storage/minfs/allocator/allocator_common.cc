@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <limits>
 #include <memory>
 #include <utility>
@@ -68,12 +69,12 @@ zx::status<std::unique_ptr<Allocator>> Allocator::Create(fs::BufferedOperationsB
 }
 
 size_t Allocator::GetAvailable() const {
-  std::scoped_lock lock(lock_);
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
   return GetAvailableLocked();
 }
 
 size_t Allocator::GetReserved() const {
-  std::scoped_lock lock(lock_);
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
   return reserved_;
 }
 
@@ -121,7 +122,7 @@ void Allocator::Commit(PendingWork* transaction, AllocatorReservation* reservati
   PendingAllocations& allocations = reservation->GetPendingAllocations(this);
   PendingDeallocations& deallocations = reservation->GetPendingDeallocations(this);
 
-  std::scoped_lock lock(lock_);
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
 
   ZX_ASSERT(!allocations.is_committed() && !deallocations.is_committed());
 
@@ -164,12 +165,36 @@ void Allocator::Commit(PendingWork* transaction, AllocatorReservation* reservati
 void Allocator::Free(AllocatorReservation* reservation, size_t index) {
   PendingAllocations& allocations = reservation->GetPendingAllocations(this);
   PendingDeallocations& deallocations = reservation->GetPendingDeallocations(this);
-  std::scoped_lock lock(lock_);
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
   if (allocations.bitmap().GetOne(index)) {
-    allocations.bitmap().ClearOne(index);
+    ClearPendingLocked(allocations, index, index + 1);
   } else {
     ZX_DEBUG_ASSERT(map_.GetOne(index));
-    ZX_ASSERT(deallocations.bitmap().SetOne(index) == ZX_OK);
+    SetPendingLocked(deallocations, index, index + 1);
+  }
+}
+
+void Allocator::Free(AllocatorReservation* reservation, size_t start, size_t count) {
+  PendingAllocations& allocations = reservation->GetPendingAllocations(this);
+  PendingDeallocations& deallocations = reservation->GetPendingDeallocations(this);
+  const size_t end = start + count;
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
+  // Split the range into runs which were allocated within this reservation, and so can simply be
+  // dropped, and runs which must be deallocated when the reservation is committed.
+  size_t index = start;
+  while (index < end) {
+    size_t run_end;
+    if (allocations.bitmap().GetOne(index)) {
+      allocations.bitmap().Get(index, end, &run_end);
+      ClearPendingLocked(allocations, index, run_end);
+    } else {
+      if (allocations.bitmap().Find(/*is_set=*/true, index, end, 1, &run_end) != ZX_OK) {
+        run_end = end;
+      }
+      ZX_DEBUG_ASSERT(map_.Get(index, run_end));
+      SetPendingLocked(deallocations, index, run_end);
+    }
+    index = run_end;
   }
 }
 
@@ -189,7 +214,7 @@ zx::status<size_t> Allocator::GrowMapLocked(size_t new_size) {
 }
 
 zx::status<> Allocator::Reserve(AllocatorReservationKey, PendingWork* transaction, size_t count) {
-  std::scoped_lock lock(lock_);
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
   if (GetAvailableLocked() < count) {
     // If we do not have enough free elements, attempt to extend the partition.
     auto grow_map = ([this](size_t pool_size)
@@ -209,37 +234,98 @@ zx::status<> Allocator::Reserve(AllocatorReservationKey, PendingWork* transactio
 }
 
 bool Allocator::CheckAllocated(size_t index) const {
-  std::scoped_lock lock(lock_);
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
   return map_.Get(index, index + 1);
 }
 
+const void* Allocator::GetMapData() {
+  std::scoped_lock lock(lock_);
+  return map_.StorageUnsafe()->GetData();
+}
+
+zx::status<size_t> Allocator::FindFreeRun(size_t count) const {
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
+  size_t start = first_free_;
+  size_t index;
+  while (count > 0 && map_.Find(false, start, map_.size(), count, &index) == ZX_OK) {
+    size_t end = index;
+    while (end < index + count && IsFreeLocked(end)) {
+      ++end;
+    }
+    if (end == index + count) {
+      return zx::ok(index);
+    }
+    start = end + 1;
+  }
+  return zx::error(ZX_ERR_NO_SPACE);
+}
+
+bool Allocator::IsFreeRun(size_t start, size_t count) const {
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
+  for (size_t index = start; index < start + count; ++index) {
+    if (!IsFreeLocked(index)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 size_t Allocator::Allocate(AllocatorReservationKey, AllocatorReservation* reservation) {
   PendingAllocations& allocations = reservation->GetPendingAllocations(this);
 
-  std::scoped_lock lock(lock_);
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
   ZX_DEBUG_ASSERT(reserved_ > 0);
 
   size_t new_index = FindLocked();
   ZX_DEBUG_ASSERT(!allocations.bitmap().GetOne(new_index));
-  ZX_ASSERT(allocations.bitmap().SetOne(new_index) == ZX_OK);
+  SetPendingLocked(allocations, new_index, new_index + 1);
   reserved_--;
   first_free_ = new_index + 1;
   return new_index;
 }
 
+size_t Allocator::Allocate(AllocatorReservationKey, AllocatorReservation* reservation,
+                           size_t hint) {
+  PendingAllocations& allocations = reservation->GetPendingAllocations(this);
+
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
+  ZX_DEBUG_ASSERT(reserved_ > 0);
+
+  const bool use_hint = IsFreeLocked(hint);
+  size_t new_index = use_hint ? hint : FindLocked();
+  ZX_DEBUG_ASSERT(!allocations.bitmap().GetOne(new_index));
+  SetPendingLocked(allocations, new_index, new_index + 1);
+  reserved_--;
+  // Nothing below |first_free_| is free, so it only moves if the hint was the first free element.
+  if (!use_hint || new_index == first_free_) {
+    first_free_ = new_index + 1;
+  }
+  return new_index;
+}
+
+bool Allocator::IsFreeLocked(size_t index) const {
+  if (index >= map_.size() || map_.GetOne(index)) {
+    return false;
+  }
+  return std::all_of(pending_changes_.begin(), pending_changes_.end(),
+                     [index](const PendingChange* change) {
+                       return change->GetNextUnreserved(index) == index;
+                     });
+}
+
 void Allocator::Unreserve(AllocatorReservationKey, size_t count) {
-  std::scoped_lock lock(lock_);
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
   ZX_DEBUG_ASSERT(reserved_ >= count);
   reserved_ -= count;
 }
 
 void Allocator::AddPendingChange(PendingChange* change) {
-  std::scoped_lock lock(lock_);
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
   pending_changes_.push_back(change);
 }
 
 void Allocator::RemovePendingChange(PendingChange* change) {
-  std::scoped_lock lock(lock_);
+  ProfiledLock lock(&lock_, lock_profile_, lock_site_);
   if (change->GetReservedCount() > 0) {
     auto range = change->bitmap().begin();
     if (range != change->bitmap().end() && range->start() < first_free_) {
@@ -248,6 +334,31 @@ void Allocator::RemovePendingChange(PendingChange* change) {
   }
   pending_changes_.erase(std::remove(pending_changes_.begin(), pending_changes_.end(), change),
                          pending_changes_.end());
+
+  // Keep the change's bitmap elements for the changes of later transactions.
+  if (change->bitmap().begin() != change->bitmap().end()) {
+    size_t end = 0;
+    for (const auto& range : change->bitmap()) {
+      end = range.end();
+    }
+    ClearPendingLocked(*change, change->bitmap().begin()->start(), end);
+  }
+}
+
+bitmap::RleBitmap::FreeList* Allocator::FreeElementsLocked() {
+  if (free_elements_.is_empty()) {
+    internal::RecordObjectPoolAllocation(true);
+    free_elements_.push_front(std::make_unique<bitmap::RleBitmapElement>());
+  }
+  return &free_elements_;
+}
+
+void Allocator::SetPendingLocked(PendingChange& change, size_t start, size_t end) {
+  ZX_ASSERT(change.bitmap().SetNoAlloc(start, end, FreeElementsLocked()) == ZX_OK);
+}
+
+void Allocator::ClearPendingLocked(PendingChange& change, size_t start, size_t end) {
+  ZX_ASSERT(change.bitmap().ClearNoAlloc(start, end, FreeElementsLocked()) == ZX_OK);
 }
 
 }  // namespace minfs
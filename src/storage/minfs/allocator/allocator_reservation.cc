@@ -40,14 +40,24 @@ size_t AllocatorReservation::Allocate() {
   return allocator_.Allocate({}, this);
 }
 
+size_t AllocatorReservation::Allocate(size_t hint) {
+  ZX_ASSERT(reserved_ > 0);
+  reserved_--;
+  return allocator_.Allocate({}, this, hint);
+}
+
 void AllocatorReservation::Deallocate(size_t element) { allocator_.Free(this, element); }
 
+void AllocatorReservation::Deallocate(size_t start, size_t count) {
+  allocator_.Free(this, start, count);
+}
+
 #ifdef __Fuchsia__
-size_t AllocatorReservation::Swap(size_t old_index) {
+size_t AllocatorReservation::Swap(size_t old_index, size_t hint) {
   if (old_index > 0) {
     allocator_.Free(this, old_index);
   }
-  return Allocate();
+  return hint ? Allocate(hint) : Allocate();
 }
 
 #endif
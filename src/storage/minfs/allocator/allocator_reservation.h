@@ -14,6 +14,7 @@
 #include <fbl/macros.h>
 
 #include "src/storage/minfs/format.h"
+#include "src/storage/minfs/object_pool.h"
 #include "src/storage/minfs/pending_work.h"
 #include "src/storage/minfs/superblock.h"
 
@@ -29,7 +30,9 @@ class PendingDeallocations;
 // AllocatorReservation class.
 // This class is thread-compatible.
 // This class is not assignable, copyable, or moveable.
-class AllocatorReservation {
+// One is created for the blocks of every transaction, so its memory is recycled through an
+// ObjectPool.
+class AllocatorReservation : public PooledObject<AllocatorReservation> {
  public:
   AllocatorReservation(Allocator* allocator);
 
@@ -51,17 +54,25 @@ class AllocatorReservation {
   // Allocate a new item in allocator_. Return the index of the newly allocated item.
   size_t Allocate();
 
+  // Allocate |hint| if it is free, and any new item otherwise. Return the index of the newly
+  // allocated item.
+  size_t Allocate(size_t hint);
+
   // Deallocate a new item from allocate_.
   void Deallocate(size_t element);
 
+  // Deallocate the |count| items starting at |start| from allocate_.
+  void Deallocate(size_t start, size_t count);
+
   // Unreserve all currently reserved items.
   void Cancel();
 
 #ifdef __Fuchsia__
   // Swap the element currently allocated at |old_index| for a new index.
   // If |old_index| is 0, a new block will still be allocated, but no blocks will be de-allocated.
-  // The swap will not be persisted until a call to Commit is made.
-  size_t Swap(size_t old_index);
+  // The swap will not be persisted until a call to Commit is made. A non-zero |hint| is allocated
+  // in preference to the first free element, as with Allocate(hint).
+  size_t Swap(size_t old_index, size_t hint = 0);
 
   //  size_t GetReserved() const { return reserved_; }
 #endif
@@ -11,19 +11,20 @@
 
 #include <storage/buffer/block_buffer.h>
 
+#include "src/storage/minfs/checksum.h"
 #include "src/storage/minfs/format.h"
 #include "src/storage/minfs/unowned_vmo_buffer.h"
 
 namespace minfs {
 
-InodeManager::InodeManager(blk_t start_block, uint32_t block_size)
-    : start_block_(start_block), block_size_(block_size) {}
+InodeManager::InodeManager(SuperblockManager* sb, blk_t start_block, uint32_t block_size)
+    : sb_(sb), start_block_(start_block), block_size_(block_size) {}
 
 zx::status<std::unique_ptr<InodeManager>> InodeManager::Create(
     block_client::BlockDevice* device, SuperblockManager* sb,
     fs::BufferedOperationsBuilder* builder, AllocatorMetadata metadata, blk_t start_block,
     size_t inodes) {
-  auto mgr = std::unique_ptr<InodeManager>(new InodeManager(start_block, sb->BlockSize()));
+  auto mgr = std::unique_ptr<InodeManager>(new InodeManager(sb, start_block, sb->BlockSize()));
   InodeManager* mgr_raw = mgr.get();
 
   auto grow_cb = [mgr_raw](uint32_t pool_size) { return mgr_raw->Grow(pool_size); };
@@ -72,8 +73,13 @@ void InodeManager::Update(PendingWork* transaction, ino_t ino, const Inode* inod
   const blk_t inoblock_abs = inoblock_rel + start_block_;
   ZX_DEBUG_ASSERT(inoblock_abs < kFVMBlockDataStart);
 
+  UnownedVmoBuffer buffer(zx::unowned_vmo(inode_table_.vmo()));
   char* inodata = reinterpret_cast<char*>(inode_table_.start()) + inoblock_rel * BlockSize();
+  InitializeBlock(inoblock_rel, inodata);
   memcpy(inodata + off_of_ino, inode, kMinfsInodeSize);
+  if (sb_->Info().UsesChecksums()) {
+    UpdateInodeChecksum(ino, reinterpret_cast<Inode*>(inodata + off_of_ino));
+  }
 
   storage::Operation operation = {
       .type = storage::OperationType::kWrite,
@@ -81,13 +87,19 @@ void InodeManager::Update(PendingWork* transaction, ino_t ino, const Inode* inod
       .dev_offset = inoblock_abs,
       .length = 1,
   };
-  UnownedVmoBuffer buffer(zx::unowned_vmo(inode_table_.vmo()));
   transaction->EnqueueMetadata(operation, &buffer);
 }
 
 const Allocator* InodeManager::GetInodeAllocator() const { return inode_allocator_.get(); }
 
 void InodeManager::Load(ino_t ino, Inode* out) const {
+  // Free inodes in uninitialised blocks may contain stale data.
+  if (!sb_->Info().IsInodeTableBlockInitialized(ino / kMinfsInodesPerBlock) &&
+      !CheckAllocated(ino)) {
+    *out = {};
+    return;
+  }
+
   // Obtain the block of the inode table we need.
   uint32_t off_of_ino = (ino % kMinfsInodesPerBlock) * kMinfsInodeSize;
   const char* inodata = reinterpret_cast<const char*>(inode_table_.start()) +
@@ -9,8 +9,10 @@
 #define SRC_STORAGE_MINFS_ALLOCATOR_INODE_MANAGER_H_
 
 #include <cstdio>
+#include <cstring>
 #include <memory>
 
+#include <bitmap/rle-bitmap.h>
 #include <fbl/macros.h>
 
 #include "src/storage/minfs/format.h"
@@ -100,11 +102,45 @@ class InodeManager : public InspectableInodeManager {
 
  private:
 #ifdef __Fuchsia__
-  explicit InodeManager(blk_t start_block, uint32_t block_size);
+  InodeManager(SuperblockManager* sb, blk_t start_block, uint32_t block_size);
 #else
-  InodeManager(Bcache* bc, blk_t start_block, uint32_t block_size);
+  InodeManager(Bcache* bc, SuperblockManager* sb, blk_t start_block, uint32_t block_size);
 #endif
 
+  // With kMinfsFlagLazyInodeTable, zeroes every inode slot in the inode table block
+  // |inoblock_rel| (held in |inodata|) that is not allocated. Inodes which are allocated were
+  // written either within this transaction or by a driver which predates the flag.
+  void ZeroFreeInodes(blk_t inoblock_rel, void* inodata) const {
+    for (uint32_t i = 0; i < kMinfsInodesPerBlock; ++i) {
+      if (!inode_allocator_->CheckAllocated(inoblock_rel * kMinfsInodesPerBlock + i)) {
+        memset(static_cast<uint8_t*>(inodata) + i * kMinfsInodeSize, 0, kMinfsInodeSize);
+      }
+    }
+  }
+
+  // With kMinfsFlagLazyInodeTable, initialises the inode table block |inoblock_rel| (held in
+  // |inodata|) before it is written, if it may still hold stale data. Only that block is touched,
+  // so a transaction writes no more inode table blocks than it updates. The high-water mark
+  // advances over it, and over any blocks after it which have already been initialised, once every
+  // block before it has been.
+  void InitializeBlock(blk_t inoblock_rel, void* inodata) {
+    if (sb_->Info().IsInodeTableBlockInitialized(inoblock_rel) ||
+        initialized_blocks_.GetOne(inoblock_rel)) {
+      return;
+    }
+    ZeroFreeInodes(inoblock_rel, inodata);
+    if (inoblock_rel != sb_->Info().ino_init_blocks) {
+      initialized_blocks_.SetOne(inoblock_rel);
+      return;
+    }
+    blk_t mark = inoblock_rel + 1;
+    while (initialized_blocks_.GetOne(mark)) {
+      initialized_blocks_.ClearOne(mark);
+      ++mark;
+    }
+    sb_->MutableInfo()->ino_init_blocks = mark;
+  }
+
   uint32_t BlockSize() const {
     // Either intentionally or unintenttionally, we do not want to change block
     // size to anything other than kMinfsBlockSize yet. This is because changing
@@ -115,11 +151,14 @@ class InodeManager : public InspectableInodeManager {
     return block_size_;
   }
 
+  SuperblockManager* sb_;
   blk_t start_block_;
 
   // Filesystem block size.
   uint32_t block_size_ = {};
   std::unique_ptr<Allocator> inode_allocator_;
+  // The inode table blocks beyond the high-water mark which have been initialised since mount.
+  bitmap::RleBitmapBase<blk_t> initialized_blocks_;
 #ifdef __Fuchsia__
   fzl::ResizeableVmoMapper inode_table_;
 #else
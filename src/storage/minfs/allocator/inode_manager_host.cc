@@ -7,17 +7,19 @@
 #include <memory>
 
 #include "src/storage/minfs/allocator/inode_manager.h"
+#include "src/storage/minfs/checksum.h"
 #include "src/storage/minfs/format.h"
 
 namespace minfs {
 
-InodeManager::InodeManager(Bcache* bc, blk_t start_block, uint32_t block_size)
-    : start_block_(start_block), block_size_(block_size), bc_(bc) {}
+InodeManager::InodeManager(Bcache* bc, SuperblockManager* sb, blk_t start_block,
+                           uint32_t block_size)
+    : sb_(sb), start_block_(start_block), block_size_(block_size), bc_(bc) {}
 
 zx::status<std::unique_ptr<InodeManager>> InodeManager::Create(
     Bcache* bc, SuperblockManager* sb, fs::BufferedOperationsBuilder* builder,
     AllocatorMetadata metadata, blk_t start_block, size_t inodes) {
-  auto mgr = std::unique_ptr<InodeManager>(new InodeManager(bc, start_block, sb->BlockSize()));
+  auto mgr = std::unique_ptr<InodeManager>(new InodeManager(bc, sb, start_block, sb->BlockSize()));
   InodeManager* mgr_raw = mgr.get();
 
   auto grow_cb = [mgr_raw](uint32_t pool_size) { return mgr_raw->Grow(pool_size); };
@@ -44,13 +46,24 @@ void InodeManager::Update(PendingWork* transaction, ino_t ino, const Inode* inod
   // write the single absolute inode block.
   uint8_t inodata[BlockSize()];
   (void)bc_->Readblk(inoblock_abs, inodata);
+  InitializeBlock(inoblock_rel, inodata);
   memcpy(inodata + off_of_ino, inode, kMinfsInodeSize);
+  if (sb_->Info().UsesChecksums()) {
+    UpdateInodeChecksum(ino, reinterpret_cast<Inode*>(inodata + off_of_ino));
+  }
   (void)bc_->Writeblk(inoblock_abs, inodata);
 }
 
 const Allocator* InodeManager::GetInodeAllocator() const { return inode_allocator_.get(); }
 
 void InodeManager::Load(ino_t ino, Inode* out) const {
+  // Free inodes in uninitialised blocks may contain stale data.
+  if (!sb_->Info().IsInodeTableBlockInitialized(ino / kMinfsInodesPerBlock) &&
+      !CheckAllocated(ino)) {
+    *out = {};
+    return;
+  }
+
   // obtain the block of the inode table we need
   uint32_t off_of_ino = (ino % kMinfsInodesPerBlock) * kMinfsInodeSize;
   uint8_t inodata[BlockSize()];
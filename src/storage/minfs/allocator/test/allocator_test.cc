@@ -312,6 +312,67 @@ TEST(AllocatorTest, Allocate) {
   ASSERT_NO_FATAL_FAILURE(PerformFree(allocator.get(), indices));
 }
 
+TEST(AllocatorTest, AllocateAtHint) {
+  std::unique_ptr<Allocator> allocator;
+  ASSERT_NO_FATAL_FAILURE(CreateAllocator(&allocator));
+
+  AllocatorReservation reservation(allocator.get());
+  ASSERT_NO_FATAL_FAILURE(InitializeReservation(4, &reservation));
+  ASSERT_EQ(reservation.Allocate(10), 10u);
+  ASSERT_EQ(reservation.Allocate(11), 11u);
+
+  // A hint which is already taken, or out of range, falls back to the first free element.
+  ASSERT_EQ(reservation.Allocate(10), 1u);
+  ASSERT_EQ(reservation.Allocate(kTotalElements + 1), 2u);
+  ASSERT_EQ(reservation.GetReserved(), 0u);
+
+  FakeTransaction transaction;
+  reservation.Commit(&transaction);
+  EXPECT_TRUE(allocator->CheckAllocated(10));
+  EXPECT_TRUE(allocator->CheckAllocated(11));
+  EXPECT_FALSE(allocator->CheckAllocated(3));
+  EXPECT_EQ(allocator->GetAvailable(), kTotalElements - 4);
+}
+
+TEST(AllocatorTest, FindFreeRun) {
+  std::unique_ptr<Allocator> allocator;
+  ASSERT_NO_FATAL_FAILURE(CreateAllocator(&allocator));
+  ASSERT_EQ(allocator->FindFreeRun(kTotalElements).value(), 1u);
+
+  AllocatorReservation reservation(allocator.get());
+  ASSERT_NO_FATAL_FAILURE(InitializeReservation(2, &reservation));
+  ASSERT_EQ(reservation.Allocate(3), 3u);
+  ASSERT_EQ(reservation.Allocate(6), 6u);
+
+  // Pending allocations are not free, whether or not they have been committed.
+  EXPECT_EQ(allocator->FindFreeRun(2).value(), 1u);
+  EXPECT_EQ(allocator->FindFreeRun(3).value(), 7u);
+  FakeTransaction transaction;
+  reservation.Commit(&transaction);
+  EXPECT_EQ(allocator->FindFreeRun(2).value(), 1u);
+  EXPECT_EQ(allocator->FindFreeRun(3).value(), 7u);
+  EXPECT_EQ(allocator->FindFreeRun(kTotalElements).status_value(), ZX_ERR_NO_SPACE);
+}
+
+TEST(AllocatorTest, IsFreeRun) {
+  std::unique_ptr<Allocator> allocator;
+  ASSERT_NO_FATAL_FAILURE(CreateAllocator(&allocator));
+  EXPECT_TRUE(allocator->IsFreeRun(1, kTotalElements - 1));
+  EXPECT_FALSE(allocator->IsFreeRun(1, kTotalElements));
+
+  AllocatorReservation reservation(allocator.get());
+  ASSERT_NO_FATAL_FAILURE(InitializeReservation(1, &reservation));
+  ASSERT_EQ(reservation.Allocate(6), 6u);
+
+  // A pending allocation takes the run as much as a committed one.
+  EXPECT_TRUE(allocator->IsFreeRun(1, 5));
+  EXPECT_FALSE(allocator->IsFreeRun(4, 3));
+  FakeTransaction transaction;
+  reservation.Commit(&transaction);
+  EXPECT_FALSE(allocator->IsFreeRun(6, 1));
+  EXPECT_TRUE(allocator->IsFreeRun(7, 2));
+}
+
 TEST(AllocatorTest, Swap) {
   std::unique_ptr<Allocator> allocator;
   ASSERT_NO_FATAL_FAILURE(CreateAllocator(&allocator));
@@ -444,5 +505,41 @@ TEST(AllocatorTest, PendingDeallocationIsReserved) {
   EXPECT_EQ(item, reservation.Allocate());
 }
 
+TEST(AllocatorTest, FreeRange) {
+  std::unique_ptr<Allocator> allocator;
+  ASSERT_NO_FATAL_FAILURE(CreateAllocator(&allocator));
+
+  constexpr size_t kHalf = kTotalElements / 2;
+  {
+    // Commit the allocation of the first half of the elements.
+    AllocatorReservation reservation(allocator.get());
+    FakeTransaction transaction;
+    ASSERT_TRUE(reservation.Reserve(&transaction, kHalf).is_ok());
+    for (size_t i = 0; i < kHalf; ++i) {
+      ASSERT_EQ(reservation.Allocate(), i + 1);
+    }
+    reservation.Commit(&transaction);
+  }
+
+  {
+    // Allocate the second half, then free a range which covers both committed elements and
+    // elements allocated within this reservation.
+    AllocatorReservation reservation(allocator.get());
+    FakeTransaction transaction;
+    ASSERT_TRUE(reservation.Reserve(&transaction, kHalf).is_ok());
+    for (size_t i = 0; i < kHalf; ++i) {
+      ASSERT_EQ(reservation.Allocate(), kHalf + i + 1);
+    }
+    reservation.Deallocate(kHalf / 2 + 1, kHalf);
+    reservation.Commit(&transaction);
+  }
+
+  EXPECT_EQ(allocator->GetAvailable(), kHalf);
+  for (size_t i = 1; i <= kTotalElements; ++i) {
+    const bool allocated = i <= kHalf / 2 || i > kHalf / 2 + kHalf;
+    EXPECT_EQ(allocator->CheckAllocated(i), allocated) << "element " << i;
+  }
+}
+
 }  // namespace
 }  // namespace minfs
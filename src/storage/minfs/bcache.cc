@@ -23,6 +23,7 @@
 #include <storage/operation/operation.h>
 
 #include "src/lib/storage/block_client/cpp/remote_block_device.h"
+#include "src/storage/minfs/checksum_table.h"
 #include "src/storage/minfs/format.h"
 #include "src/storage/minfs/minfs_private.h"
 
@@ -49,7 +50,7 @@ zx::status<> Bcache::Readblk(blk_t bno, void* data) {
     return zx::error(status);
   }
   memcpy(data, buffer_.Data(0), kMinfsBlockSize);
-  return zx::ok();
+  return VerifyChecksums(bno, 1, data);
 }
 
 zx::status<> Bcache::Writeblk(blk_t bno, const void* data) {
@@ -63,6 +64,13 @@ zx::status<> Bcache::Writeblk(blk_t bno, const void* data) {
   return zx::make_status(RunOperation(operation, &buffer_));
 }
 
+zx::status<> Bcache::VerifyChecksums(blk_t bno, blk_t count, const void* data) const {
+  if (checksums_ == nullptr) {
+    return zx::ok();
+  }
+  return checksums_->Verify(bno, count, data);
+}
+
 zx_status_t Bcache::BlockAttachVmo(const zx::vmo& vmo, storage::Vmoid* out) {
   return device()->BlockAttachVmo(vmo, out);
 }
@@ -21,6 +21,8 @@
 #include <fbl/unique_fd.h>
 
 #include "src/storage/minfs/format.h"
+#include "src/storage/minfs/io_accounting.h"
+#include "src/storage/minfs/lock_profile.h"
 
 #ifdef __Fuchsia__
 #include <lib/zx/vmo.h>
@@ -39,6 +41,8 @@
 
 namespace minfs {
 
+class ChecksumTable;
+
 #ifdef __Fuchsia__
 
 // A helper function for converting "fd" to "BlockDevice".
@@ -61,7 +65,12 @@ class Bcache : public fs::DeviceTransactionHandler, public storage::VmoidRegistr
   // fs::TransactionHandler interface.
 
   zx_status_t RunRequests(const std::vector<storage::BufferedOperation>& operations) override {
-    std::shared_lock lock(mutex_);
+    ProfiledSharedLock lock(&mutex_, lock_profile_, LockSite::kBcache);
+    if (io_accounting_) {
+      for (const storage::BufferedOperation& operation : operations) {
+        io_accounting_->RecordDevice(operation.op);
+      }
+    }
     return DeviceTransactionHandler::RunRequests(operations);
   }
 
@@ -112,6 +121,22 @@ class Bcache : public fs::DeviceTransactionHandler, public storage::VmoidRegistr
   // Resumes all I/O operations paused by the Pause method.
   void Resume();
 
+  // Sets the table against which Readblk verifies metadata blocks, or none if |table| is null.
+  // Reads issued with RunRequests are verified by their callers, using VerifyChecksums.
+  void SetChecksumTable(const ChecksumTable* table) { checksums_ = table; }
+
+  // Returns ZX_ERR_IO_DATA_INTEGRITY if any of the |count| blocks starting at |bno|, whose contents
+  // are at |data|, fails verification against the checksum table.
+  zx::status<> VerifyChecksums(blk_t bno, blk_t count, const void* data) const;
+
+  // Records every operation run on the device in the device view of |io_accounting|, which must
+  // outlive its use here. Pass null to stop recording.
+  void SetIoAccounting(IoAccounting* io_accounting) { io_accounting_ = io_accounting; }
+
+  // Records in |profile| how long requests wait for and hold the device lock, which they share
+  // and Pause holds exclusively. |profile| must outlive its use here. Pass null to stop recording.
+  void SetLockProfile(LockProfile* profile) { lock_profile_ = profile; }
+
  private:
   friend class BlockNode;
 
@@ -127,6 +152,9 @@ class Bcache : public fs::DeviceTransactionHandler, public storage::VmoidRegistr
   // This buffer is used as internal scratch space for the "Readblk/Writeblk" methods.
   storage::VmoBuffer buffer_;
   std::shared_mutex mutex_;
+  const ChecksumTable* checksums_ = nullptr;
+  IoAccounting* io_accounting_ = nullptr;
+  LockProfile* lock_profile_ = nullptr;
 };
 
 #else  // __Fuchsia__
@@ -171,16 +199,66 @@ class Bcache : public fs::TransactionHandler {
   // |extent_lengths| contains the length of each extent (in bytes)
   zx::status<> SetSparse(off_t offset, const fbl::Vector<size_t>& extent_lengths);
 
+  // When set, blocks which are written as all zeroes are punched out of the file rather than
+  // written, so that the file only takes up space for the blocks holding data.
+  void SetPunchHoles(bool punch_holes) { punch_holes_ = punch_holes; }
+
+  // Releases the storage behind |count| blocks from |start|, which read back as zeroes. Falls back
+  // to writing zeroes if the host file system cannot punch holes.
+  zx::status<> Discard(blk_t start, blk_t count);
+
+  // Returns the number of bytes the host file system has allocated for the file, which is less
+  // than its size if it has holes.
+  zx::status<uint64_t> AllocatedBytes() const;
+
   zx::status<> Sync();
 
+  // Sets the table against which Readblk and the reads issued with RunRequests verify metadata
+  // blocks, or none if |table| is null.
+  void SetChecksumTable(const ChecksumTable* table) { checksums_ = table; }
+
+  // Returns ZX_ERR_IO_DATA_INTEGRITY if any of the |count| blocks starting at |bno|, whose contents
+  // are at |data|, fails verification against the checksum table.
+  zx::status<> VerifyChecksums(blk_t bno, blk_t count, const void* data) const;
+
+  // Counts of the system calls made on the file, and of the bytes read and written through them.
+  struct IoStats {
+    uint64_t read_calls = 0;
+    uint64_t write_calls = 0;
+    // Hole punches, which move no data.
+    uint64_t other_calls = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+  };
+  const IoStats& GetIoStats() const { return io_stats_; }
+
+  // Records every operation run on the device in the device view of |io_accounting|, which must
+  // outlive its use here. Pass null to stop recording.
+  void SetIoAccounting(IoAccounting* io_accounting) { io_accounting_ = io_accounting; }
+
  private:
   friend class BlockNode;
 
   Bcache(fbl::unique_fd fd, uint32_t max_blocks);
 
+  // Wrappers for pread and pwrite which count the call and the bytes moved.
+  ssize_t Pread(void* data, size_t length, off_t off);
+  ssize_t Pwrite(const void* data, size_t length, off_t off);
+
+  // Writes |block_count| blocks from |data| at byte offset |off| of the file, skipping runs of
+  // all-zero blocks if |punch_holes_| is set.
+  zx::status<> WriteAt(const uint8_t* data, uint64_t block_count, off_t off);
+
+  // Punches |length| bytes at |off| out of the file.
+  zx::status<> PunchHole(off_t off, uint64_t length);
+
   const fbl::unique_fd fd_;
   uint32_t max_blocks_;
   off_t offset_ = 0;
+  const ChecksumTable* checksums_ = nullptr;
+  bool punch_holes_ = false;
+  IoStats io_stats_;
+  IoAccounting* io_accounting_ = nullptr;
 };
 
 #endif
@@ -3,12 +3,18 @@
 // found in the LICENSE file.
 
 #include <assert.h>
+#include <fcntl.h>
 #include <lib/syslog/cpp/macros.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/falloc.h>
+#endif
+
 #include <iomanip>
 #include <utility>
 
@@ -18,10 +24,18 @@
 #include <storage/operation/operation.h>
 
 #include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/checksum_table.h"
 #include "src/storage/minfs/format.h"
 #include "src/storage/minfs/minfs_private.h"
 
 namespace minfs {
+namespace {
+
+bool IsZeroBlock(const uint8_t* data) {
+  return data[0] == 0 && memcmp(data, data + 1, kMinfsBlockSize - 1) == 0;
+}
+
+}  // namespace
 
 zx_status_t Bcache::RunRequests(const std::vector<storage::BufferedOperation>& operations) {
   for (const storage::BufferedOperation& operation : operations) {
@@ -29,16 +43,22 @@ zx_status_t Bcache::RunRequests(const std::vector<storage::BufferedOperation>& o
         operation.op.type != storage::OperationType::kRead) {
       return ZX_ERR_NOT_SUPPORTED;
     }
+    if (io_accounting_) {
+      io_accounting_->RecordDevice(operation.op);
+    }
 
     // TODO(fxbug.dev/47947): Clean up this hack.
     void* data = static_cast<uint8_t*>(operation.data) + operation.op.vmo_offset * kMinfsBlockSize;
+    off_t off = static_cast<off_t>(operation.op.dev_offset * kMinfsBlockSize) + offset_;
     ssize_t result;
     if (operation.op.type == storage::OperationType::kRead) {
-      result = pread(fd_.get(), data, operation.op.length * kMinfsBlockSize,
-                     static_cast<off_t>(operation.op.dev_offset * kMinfsBlockSize));
+      result = Pread(data, operation.op.length * kMinfsBlockSize, off);
+    } else if (punch_holes_) {
+      result = WriteAt(static_cast<const uint8_t*>(data), operation.op.length, off).is_ok()
+                   ? static_cast<ssize_t>(operation.op.length * kMinfsBlockSize)
+                   : -1;
     } else {
-      result = pwrite(fd_.get(), data, operation.op.length * kMinfsBlockSize,
-                      static_cast<off_t>(operation.op.dev_offset * kMinfsBlockSize));
+      result = Pwrite(data, operation.op.length * kMinfsBlockSize, off);
     }
 
     if (result != static_cast<ssize_t>(operation.op.length * kMinfsBlockSize)) {
@@ -49,34 +69,48 @@ zx_status_t Bcache::RunRequests(const std::vector<storage::BufferedOperation>& o
                      << " result=" << std::dec << result;
       return ZX_ERR_IO;
     }
+    if (operation.op.type == storage::OperationType::kRead) {
+      if (auto status = VerifyChecksums(static_cast<blk_t>(operation.op.dev_offset),
+                                        static_cast<blk_t>(operation.op.length), data);
+          status.is_error()) {
+        return status.status_value();
+      }
+    }
   }
   return ZX_OK;
 }
 
 zx::status<> Bcache::Readblk(blk_t bno, void* data) {
+  if (io_accounting_) {
+    io_accounting_->RecordDevice(
+        storage::Operation{.type = storage::OperationType::kRead, .dev_offset = bno, .length = 1});
+  }
   off_t off = static_cast<off_t>(bno) * kMinfsBlockSize;
   assert(off / kMinfsBlockSize == bno);  // Overflow
   off += offset_;
-  if (lseek(fd_.get(), off, SEEK_SET) < 0) {
-    FX_LOGS(ERROR) << "cannot seek to block " << bno;
-    return zx::error(ZX_ERR_IO);
-  }
-  if (read(fd_.get(), data, kMinfsBlockSize) != kMinfsBlockSize) {
+  if (Pread(data, kMinfsBlockSize, off) != kMinfsBlockSize) {
     FX_LOGS(ERROR) << "cannot read block " << bno;
     return zx::error(ZX_ERR_IO);
   }
-  return zx::ok();
+  return VerifyChecksums(bno, 1, data);
 }
 
 zx::status<> Bcache::Writeblk(blk_t bno, const void* data) {
+  if (io_accounting_) {
+    io_accounting_->RecordDevice(
+        storage::Operation{.type = storage::OperationType::kWrite, .dev_offset = bno, .length = 1});
+  }
   off_t off = static_cast<off_t>(bno) * kMinfsBlockSize;
   assert(off / kMinfsBlockSize == bno);  // Overflow
   off += offset_;
-  if (lseek(fd_.get(), off, SEEK_SET) < 0) {
-    FX_LOGS(ERROR) << "cannot seek to block " << bno << ". " << errno;
-    return zx::error(ZX_ERR_IO);
+  if (punch_holes_) {
+    if (auto status = WriteAt(static_cast<const uint8_t*>(data), 1, off); status.is_error()) {
+      FX_LOGS(ERROR) << "cannot write block " << bno;
+      return status;
+    }
+    return zx::ok();
   }
-  ssize_t ret = write(fd_.get(), data, kMinfsBlockSize);
+  ssize_t ret = Pwrite(data, kMinfsBlockSize, off);
   if (ret != kMinfsBlockSize) {
     FX_LOGS(ERROR) << "cannot write block " << bno << " (" << ret << ")";
     return zx::error(ZX_ERR_IO);
@@ -84,6 +118,97 @@ zx::status<> Bcache::Writeblk(blk_t bno, const void* data) {
   return zx::ok();
 }
 
+zx::status<> Bcache::VerifyChecksums(blk_t bno, blk_t count, const void* data) const {
+  if (checksums_ == nullptr) {
+    return zx::ok();
+  }
+  return checksums_->Verify(bno, count, data);
+}
+
+zx::status<> Bcache::WriteAt(const uint8_t* data, uint64_t block_count, off_t off) {
+  uint64_t start = 0;
+  while (start < block_count) {
+    // Find the run of blocks which are all zero, or all not.
+    const bool zero = punch_holes_ && IsZeroBlock(data + start * kMinfsBlockSize);
+    uint64_t end = start + 1;
+    while (end < block_count &&
+           (punch_holes_ && IsZeroBlock(data + end * kMinfsBlockSize)) == zero) {
+      ++end;
+    }
+    const off_t run_off = off + static_cast<off_t>(start * kMinfsBlockSize);
+    const uint64_t run_length = (end - start) * kMinfsBlockSize;
+    if (zero) {
+      if (auto status = PunchHole(run_off, run_length); status.is_error()) {
+        return status;
+      }
+    } else if (Pwrite(data + start * kMinfsBlockSize, run_length, run_off) !=
+               static_cast<ssize_t>(run_length)) {
+      FX_LOGS(ERROR) << "cannot write " << run_length << " bytes at offset " << run_off;
+      return zx::error(ZX_ERR_IO);
+    }
+    start = end;
+  }
+  return zx::ok();
+}
+
+zx::status<> Bcache::PunchHole(off_t off, uint64_t length) {
+  ++io_stats_.other_calls;
+#if defined(__linux__)
+  if (fallocate(fd_.get(), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off,
+                static_cast<off_t>(length)) == 0) {
+    return zx::ok();
+  }
+#elif defined(__APPLE__)
+  fpunchhole_t args = {};
+  args.fp_offset = off;
+  args.fp_length = static_cast<off_t>(length);
+  if (fcntl(fd_.get(), F_PUNCHHOLE, &args) == 0) {
+    return zx::ok();
+  }
+#endif
+  // The host file system cannot punch holes, so write the zeroes out.
+  static const uint8_t kZeroes[kMinfsBlockSize] = {};
+  for (uint64_t done = 0; done < length; done += kMinfsBlockSize) {
+    if (Pwrite(kZeroes, kMinfsBlockSize, off + static_cast<off_t>(done)) != kMinfsBlockSize) {
+      FX_LOGS(ERROR) << "cannot write zeroes at offset " << off + static_cast<off_t>(done);
+      return zx::error(ZX_ERR_IO);
+    }
+  }
+  return zx::ok();
+}
+
+ssize_t Bcache::Pread(void* data, size_t length, off_t off) {
+  ++io_stats_.read_calls;
+  ssize_t result = pread(fd_.get(), data, length, off);
+  if (result > 0) {
+    io_stats_.bytes_read += result;
+  }
+  return result;
+}
+
+ssize_t Bcache::Pwrite(const void* data, size_t length, off_t off) {
+  ++io_stats_.write_calls;
+  ssize_t result = pwrite(fd_.get(), data, length, off);
+  if (result > 0) {
+    io_stats_.bytes_written += result;
+  }
+  return result;
+}
+
+zx::status<> Bcache::Discard(blk_t start, blk_t count) {
+  off_t off = static_cast<off_t>(start) * kMinfsBlockSize + offset_;
+  return PunchHole(off, uint64_t{count} * kMinfsBlockSize);
+}
+
+zx::status<uint64_t> Bcache::AllocatedBytes() const {
+  struct stat s;
+  if (fstat(fd_.get(), &s) < 0) {
+    return zx::error(ZX_ERR_IO);
+  }
+  // st_blocks is always in units of 512 bytes, whatever the file system's block size.
+  return zx::ok(static_cast<uint64_t>(s.st_blocks) * 512);
+}
+
 zx::status<> Bcache::Sync() {
   // No-op.
   return zx::ok();
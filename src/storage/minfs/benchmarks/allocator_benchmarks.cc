@@ -0,0 +1,199 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <lib/zx/status.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <perftest/perftest.h>
+
+#include "src/storage/minfs/allocator/allocator.h"
+#include "src/storage/minfs/allocator/allocator_reservation.h"
+
+namespace minfs {
+namespace {
+
+// Benchmarks are repeatable from run to run, so every random choice comes from this seed.
+constexpr uint32_t kSeed = 0x6d696e66;
+
+constexpr uint32_t kElements = 1 << 20;
+
+class FakeStorage : public AllocatorStorage {
+ public:
+  explicit FakeStorage(uint32_t units) : pool_total_(units) {}
+
+#ifdef __Fuchsia__
+  zx::status<> AttachVmo(const zx::vmo& vmo, storage::OwnedVmoid* vmoid) final { return zx::ok(); }
+#endif
+  void Load(fs::BufferedOperationsBuilder* builder, storage::BlockBuffer* data) final {}
+  zx::status<> Extend(PendingWork* transaction, WriteData data, GrowMapCallback grow_map) final {
+    return zx::error(ZX_ERR_NO_SPACE);
+  }
+  uint32_t PoolAvailable() const final { return pool_total_ - pool_used_; }
+  uint32_t PoolTotal() const final { return pool_total_; }
+  void PersistRange(PendingWork* transaction, WriteData data, size_t index, size_t count) final {}
+  void PersistAllocate(PendingWork* transaction, size_t count) final {
+    pool_used_ += static_cast<uint32_t>(count);
+  }
+  void PersistRelease(PendingWork* transaction, size_t count) final {
+    pool_used_ -= static_cast<uint32_t>(count);
+  }
+
+ private:
+  uint32_t pool_used_ = 0;
+  const uint32_t pool_total_;
+};
+
+class NullTransaction : public PendingWork {
+ public:
+  void EnqueueMetadata(storage::Operation operation, storage::BlockBuffer* buffer) final {}
+  void EnqueueData(storage::Operation operation, storage::BlockBuffer* buffer) final {}
+  size_t AllocateBlock() final { return 0; }
+  void DeallocateBlock(size_t) final {}
+};
+
+// Returns an allocator of kElements elements (plus the reserved element zero) of which
+// |fill_percent| percent are allocated, scattered at random.
+std::unique_ptr<Allocator> CreateAllocator(uint32_t fill_percent) {
+  fs::BufferedOperationsBuilder builder;
+  auto allocator_or = Allocator::Create(&builder, std::make_unique<FakeStorage>(kElements + 1));
+  ZX_ASSERT(allocator_or.is_ok());
+  std::unique_ptr<Allocator> allocator = std::move(allocator_or.value());
+  NullTransaction transaction;
+  {
+    AllocatorReservation reservation(allocator.get());
+    ZX_ASSERT(reservation.Reserve(&transaction, kElements + 1).is_ok());
+    for (uint32_t i = 0; i <= kElements; ++i) {
+      reservation.Allocate();
+    }
+    reservation.Commit(&transaction);
+  }
+  std::vector<uint32_t> elements(kElements);
+  for (uint32_t i = 0; i < kElements; ++i) {
+    elements[i] = i + 1;
+  }
+  std::mt19937 random(kSeed);
+  std::shuffle(elements.begin(), elements.end(), random);
+  {
+    AllocatorReservation reservation(allocator.get());
+    const uint32_t free_count = kElements - static_cast<uint32_t>(uint64_t{kElements} *
+                                                                  fill_percent / 100);
+    for (uint32_t i = 0; i < free_count; ++i) {
+      reservation.Deallocate(elements[i]);
+    }
+    reservation.Commit(&transaction);
+  }
+  return allocator;
+}
+
+// Allocates and then frees one element, each in its own committed reservation, as a write of one
+// block would.
+bool AllocateFreeTest(perftest::RepeatState* state, uint32_t fill_percent) {
+  std::unique_ptr<Allocator> allocator = CreateAllocator(fill_percent);
+  NullTransaction transaction;
+  state->DeclareStep("allocate");
+  state->DeclareStep("free");
+  while (state->KeepRunning()) {
+    size_t element;
+    {
+      AllocatorReservation reservation(allocator.get());
+      ZX_ASSERT(reservation.Reserve(&transaction, 1).is_ok());
+      element = reservation.Allocate();
+      reservation.Commit(&transaction);
+    }
+    state->NextStep();
+    {
+      AllocatorReservation reservation(allocator.get());
+      reservation.Deallocate(element);
+      reservation.Commit(&transaction);
+    }
+  }
+  return true;
+}
+
+// Allocates |count| elements in one reservation, as a large write would, and cancels them.
+bool AllocateManyTest(perftest::RepeatState* state, uint32_t fill_percent, uint32_t count) {
+  std::unique_ptr<Allocator> allocator = CreateAllocator(fill_percent);
+  NullTransaction transaction;
+  while (state->KeepRunning()) {
+    AllocatorReservation reservation(allocator.get());
+    ZX_ASSERT(reservation.Reserve(&transaction, count).is_ok());
+    for (uint32_t i = 0; i < count; ++i) {
+      perftest::DoNotOptimize(reservation.Allocate());
+    }
+  }
+  return true;
+}
+
+// Allocates a free element at a hint while another reservation holds |pending| uncommitted
+// allocations, each a separate run in its RleBitmap, which the allocator checks the hint against.
+bool AllocateAtHintWithPendingTest(perftest::RepeatState* state, uint32_t pending) {
+  std::unique_ptr<Allocator> allocator = CreateAllocator(100);
+  NullTransaction transaction;
+  {
+    AllocatorReservation reservation(allocator.get());
+    for (uint32_t i = 1; i <= pending + 1; ++i) {
+      reservation.Deallocate(2 * i);
+    }
+    reservation.Commit(&transaction);
+  }
+  AllocatorReservation held(allocator.get());
+  ZX_ASSERT(held.Reserve(&transaction, pending).is_ok());
+  for (uint32_t i = 1; i <= pending; ++i) {
+    held.Allocate(2 * i);
+  }
+  while (state->KeepRunning()) {
+    AllocatorReservation reservation(allocator.get());
+    ZX_ASSERT(reservation.Reserve(&transaction, 1).is_ok());
+    perftest::DoNotOptimize(reservation.Allocate(2 * pending + 2));
+  }
+  return true;
+}
+
+// Records |runs| random ranges as pending deallocations, as truncating a fragmented file would.
+bool FreeRangesTest(perftest::RepeatState* state, uint32_t runs) {
+  std::unique_ptr<Allocator> allocator = CreateAllocator(100);
+  std::mt19937 random(kSeed);
+  std::vector<std::pair<size_t, size_t>> ranges;
+  for (size_t start = 1; ranges.size() < runs;) {
+    const size_t count = std::uniform_int_distribution<size_t>(1, 16)(random);
+    ranges.emplace_back(start, count);
+    start += count + std::uniform_int_distribution<size_t>(1, 16)(random);
+  }
+  std::shuffle(ranges.begin(), ranges.end(), random);
+  while (state->KeepRunning()) {
+    AllocatorReservation reservation(allocator.get());
+    for (const auto& [start, count] : ranges) {
+      reservation.Deallocate(start, count);
+    }
+  }
+  return true;
+}
+
+void RegisterTests() {
+  for (uint32_t fill_percent : {0, 50, 90, 99}) {
+    const std::string fill = "/Fill" + std::to_string(fill_percent);
+    perftest::RegisterTest(("Minfs/Allocator/AllocateFree" + fill).c_str(), AllocateFreeTest,
+                           fill_percent);
+    perftest::RegisterTest(("Minfs/Allocator/Allocate256" + fill).c_str(), AllocateManyTest,
+                           fill_percent, 256u);
+  }
+  for (uint32_t pending : {16, 1024, 65536}) {
+    perftest::RegisterTest(
+        ("Minfs/Allocator/AllocateAtHintWithPending/" + std::to_string(pending)).c_str(),
+        AllocateAtHintWithPendingTest, pending);
+  }
+  for (uint32_t runs : {16, 1024}) {
+    perftest::RegisterTest(("Minfs/Allocator/FreeRanges/" + std::to_string(runs)).c_str(),
+                           FreeRangesTest, runs);
+  }
+}
+PERFTEST_CTOR(RegisterTests)
+
+}  // namespace
+}  // namespace minfs
@@ -0,0 +1,192 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <lib/zx/status.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <perftest/perftest.h>
+
+#include "src/storage/minfs/buffer_view.h"
+#include "src/storage/minfs/checksum.h"
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/lazy_reader.h"
+
+namespace minfs {
+namespace {
+
+// Benchmarks are repeatable from run to run, so every random choice comes from this seed.
+constexpr uint32_t kSeed = 0x6d696e66;
+
+// A reader which only counts the blocks it is asked for, so that only LazyReader is measured.
+class CountingReader : public LazyReader::ReaderInterface {
+ public:
+  zx::status<uint64_t> Enqueue(BlockRange range) final {
+    blocks_ += range.Length();
+    return zx::ok(range.Length());
+  }
+  zx::status<> RunRequests() final { return zx::ok(); }
+  uint32_t BlockSize() const final { return kMinfsBlockSize; }
+
+  uint64_t blocks() const { return blocks_; }
+
+ private:
+  uint64_t blocks_ = 0;
+};
+
+// Reads |blocks| blocks into a new LazyReader, so that all of them are enqueued.
+bool LazyReaderColdTest(perftest::RepeatState* state, uint64_t blocks) {
+  CountingReader reader;
+  state->SetBytesProcessedPerRun(blocks * kMinfsBlockSize);
+  while (state->KeepRunning()) {
+    LazyReader lazy_reader;
+    ZX_ASSERT(lazy_reader.Read(ByteRange(0, blocks * kMinfsBlockSize), &reader).is_ok());
+  }
+  perftest::DoNotOptimize(reader.blocks());
+  return true;
+}
+
+// Reads |blocks| blocks of which every other one is already loaded, so that the reads are split
+// around the loaded runs.
+bool LazyReaderPartialTest(perftest::RepeatState* state, uint64_t blocks) {
+  CountingReader reader;
+  state->DeclareStep("mark_loaded");
+  state->DeclareStep("read");
+  while (state->KeepRunning()) {
+    LazyReader lazy_reader;
+    for (uint64_t block = 0; block < blocks; block += 2) {
+      lazy_reader.SetLoaded(BlockRange(block, block + 1), true);
+    }
+    state->NextStep();
+    ZX_ASSERT(lazy_reader.Read(ByteRange(0, blocks * kMinfsBlockSize), &reader).is_ok());
+  }
+  perftest::DoNotOptimize(reader.blocks());
+  return true;
+}
+
+// Reads random 4 KiB ranges of a file of |blocks| blocks which is already loaded, as repeated reads
+// of a cached file do.
+bool LazyReaderWarmTest(perftest::RepeatState* state, uint64_t blocks) {
+  CountingReader reader;
+  LazyReader lazy_reader;
+  ZX_ASSERT(lazy_reader.Read(ByteRange(0, blocks * kMinfsBlockSize), &reader).is_ok());
+  std::mt19937_64 random(kSeed);
+  std::uniform_int_distribution<uint64_t> offsets(0, blocks * kMinfsBlockSize - 4096);
+  while (state->KeepRunning()) {
+    const uint64_t offset = offsets(random);
+    ZX_ASSERT(lazy_reader.Read(ByteRange(offset, offset + 4096), &reader).is_ok());
+  }
+  perftest::DoNotOptimize(reader.blocks());
+  return true;
+}
+
+// Sums every block pointer of an indirect block through a BufferView, as the vnode mapper does.
+bool BufferViewReadTest(perftest::RepeatState* state) {
+  std::vector<blk_t> block(kMinfsDirectPerIndirect);
+  for (size_t i = 0; i < block.size(); ++i) {
+    block[i] = static_cast<blk_t>(i);
+  }
+  while (state->KeepRunning()) {
+    BufferView<blk_t> view(BufferPtr::FromMemory(block.data()), 0, block.size());
+    uint64_t sum = 0;
+    for (size_t i = 0; i < view.count(); ++i) {
+      sum += view[i];
+    }
+    perftest::DoNotOptimize(sum);
+  }
+  return true;
+}
+
+// Updates every block pointer of an indirect block through a BufferView and flushes it.
+bool BufferViewWriteTest(perftest::RepeatState* state) {
+  std::vector<blk_t> block(kMinfsDirectPerIndirect);
+  uint64_t flushes = 0;
+  while (state->KeepRunning()) {
+    BufferView<blk_t> view(BufferPtr::FromMemory(block.data()), 0, block.size(),
+                           [&flushes](BaseBufferView* view) {
+                             ++flushes;
+                             return zx::ok();
+                           });
+    for (size_t i = 0; i < view.count(); ++i) {
+      view.mut_ref(i) = static_cast<blk_t>(i);
+    }
+    ZX_ASSERT(view.Flush().is_ok());
+  }
+  perftest::DoNotOptimize(flushes);
+  return true;
+}
+
+// Checksums |size| bytes of random data. The bytes processed give the CPU cost per MiB.
+template <uint32_t (*Checksum)(uint32_t, const void*, size_t)>
+bool Crc32cTest(perftest::RepeatState* state, size_t size) {
+  std::vector<uint8_t> data(size);
+  std::mt19937 random(kSeed);
+  for (uint8_t& byte : data) {
+    byte = static_cast<uint8_t>(random());
+  }
+  state->SetBytesProcessedPerRun(data.size());
+  while (state->KeepRunning()) {
+    perftest::DoNotOptimize(Checksum(0, data.data(), data.size()));
+  }
+  return true;
+}
+
+// Computes the checksum which every inode write carries when kMinfsFlagChecksums is set.
+bool InodeChecksumTest(perftest::RepeatState* state) {
+  Inode inode = {};
+  inode.magic = kMinfsMagicFile;
+  inode.size = 12345;
+  inode.block_count = 2;
+  inode.link_count = 1;
+  inode.dnum[0] = 100;
+  inode.dnum[1] = 101;
+  state->SetBytesProcessedPerRun(sizeof(inode));
+  while (state->KeepRunning()) {
+    perftest::DoNotOptimize(InodeChecksum(kMinfsRootIno + 1, inode));
+  }
+  return true;
+}
+
+// Checksums an extent tree node block, as every node written or loaded on a volume with
+// kMinfsFlagChecksums is.
+bool ExtentNodeChecksumTest(perftest::RepeatState* state) {
+  std::vector<uint8_t> data(kMinfsBlockSize);
+  std::mt19937 random(kSeed);
+  for (uint8_t& byte : data) {
+    byte = static_cast<uint8_t>(random());
+  }
+  state->SetBytesProcessedPerRun(data.size());
+  while (state->KeepRunning()) {
+    perftest::DoNotOptimize(ExtentNodeChecksum(100, data.data()));
+  }
+  return true;
+}
+
+void RegisterTests() {
+  for (uint64_t blocks : {16, 4096}) {
+    const std::string suffix = "/" + std::to_string(blocks) + "Blocks";
+    perftest::RegisterTest(("Minfs/LazyReader/Cold" + suffix).c_str(), LazyReaderColdTest,
+                           blocks);
+    perftest::RegisterTest(("Minfs/LazyReader/Partial" + suffix).c_str(), LazyReaderPartialTest,
+                           blocks);
+    perftest::RegisterTest(("Minfs/LazyReader/Warm" + suffix).c_str(), LazyReaderWarmTest, blocks);
+  }
+  perftest::RegisterTest("Minfs/BufferView/Read", BufferViewReadTest);
+  perftest::RegisterTest("Minfs/BufferView/Write", BufferViewWriteTest);
+  // Crc32c uses CRC32 instructions where the CPU has them, so compare it with the fallback.
+  for (size_t size : {size_t{kMinfsBlockSize}, size_t{1} << 20}) {
+    const std::string suffix = size == kMinfsBlockSize ? "/Block" : "/1MiB";
+    perftest::RegisterTest(("Minfs/Crc32c" + suffix).c_str(), Crc32cTest<Crc32c>, size);
+    perftest::RegisterTest(("Minfs/Crc32c" + suffix + "/Software").c_str(),
+                           Crc32cTest<Crc32cSoftware>, size);
+  }
+  perftest::RegisterTest("Minfs/Crc32c/Inode", InodeChecksumTest);
+  perftest::RegisterTest("Minfs/Crc32c/ExtentNode", ExtentNodeChecksumTest);
+}
+PERFTEST_CTOR(RegisterTests)
+
+}  // namespace
+}  // namespace minfs
@@ -0,0 +1,15 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Microbenchmarks of the minfs allocator, buffers, checksums, block mapping and directory lookups,
+// run on the host. Run with no arguments as a quick test that every benchmark works, or with
+//
+//   minfs_benchmarks -p --out=results.json
+//
+// to measure them and write the results in the fuchsiaperf JSON format. See
+// //zircon/system/ulib/perftest for other options, such as --filter to select benchmarks.
+
+#include <perftest/perftest.h>
+
+int main(int argc, char** argv) { return perftest::PerfTestMain(argc, argv, "fuchsia.minfs"); }
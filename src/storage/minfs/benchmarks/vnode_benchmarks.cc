@@ -0,0 +1,187 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fbl/unique_fd.h>
+#include <perftest/perftest.h>
+
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/runner.h"
+#include "src/storage/minfs/vnode_mapper.h"
+
+namespace minfs {
+namespace {
+
+// Benchmarks are repeatable from run to run, so every random choice comes from this seed.
+constexpr uint32_t kSeed = 0x6d696e66;
+
+constexpr uint32_t kDeviceBlocks = 1 << 16;
+constexpr uint64_t kFileBlocks = 4096;
+// Sparse files map every |kSparseStride|th block.
+constexpr uint64_t kSparseStride = 8;
+
+// A volume in a temporary file, mounted on the host for as long as this lives.
+class TestFilesystem {
+ public:
+  static std::unique_ptr<TestFilesystem> Create(const MountOptions& options) {
+    char path[] = "/tmp/minfs_benchmarks.XXXXXX";
+    fbl::unique_fd fd(mkstemp(path));
+    ZX_ASSERT(fd);
+    ZX_ASSERT(ftruncate(fd.get(), off_t{kDeviceBlocks} * kMinfsBlockSize) == 0);
+    auto bcache_or = Bcache::Create(std::move(fd), kDeviceBlocks);
+    ZX_ASSERT(bcache_or.is_ok());
+    ZX_ASSERT(Mkfs(options, bcache_or.value().get()).is_ok());
+    auto runner_or =
+        Runner::Create(nullptr, std::move(bcache_or.value()), MountOptions{.quiet = true});
+    ZX_ASSERT(runner_or.is_ok());
+    return std::unique_ptr<TestFilesystem>(
+        new TestFilesystem(path, std::move(runner_or.value())));
+  }
+
+  ~TestFilesystem() {
+    Runner::Destroy(std::move(runner_));
+    unlink(path_.c_str());
+  }
+
+  fbl::RefPtr<VnodeMinfs> Root() {
+    auto root_or = runner_->minfs().VnodeGet(kMinfsRootIno);
+    ZX_ASSERT(root_or.is_ok());
+    return std::move(root_or.value());
+  }
+
+ private:
+  TestFilesystem(std::string path, std::unique_ptr<Runner> runner)
+      : path_(std::move(path)), runner_(std::move(runner)) {}
+
+  const std::string path_;
+  std::unique_ptr<Runner> runner_;
+};
+
+// Creates a file which maps kFileBlocks blocks, either all together or spread kSparseStride apart.
+fbl::RefPtr<VnodeMinfs> CreateFile(TestFilesystem& fs, bool sparse) {
+  fbl::RefPtr<fs::Vnode> file;
+  ZX_ASSERT(fs.Root()->Create("file", 0, &file) == ZX_OK);
+  const uint64_t stride = sparse ? kSparseStride : 1;
+  const std::vector<uint8_t> data(kMinfsBlockSize, 0xab);
+  for (uint64_t block = 0; block < kFileBlocks; ++block) {
+    size_t actual;
+    ZX_ASSERT(file->Write(data.data(), data.size(), block * stride * kMinfsBlockSize, &actual) ==
+              ZX_OK);
+  }
+  return fbl::RefPtr<VnodeMinfs>::Downcast(std::move(file));
+}
+
+MountOptions FormatOptions(bool extents) {
+  MountOptions options;
+  options.extent_inodes = extents;
+  return options;
+}
+
+// Walks every block of a file with VnodeIterator, a run of contiguous blocks at a time, as reading
+// the whole file does.
+bool IteratorWalkTest(perftest::RepeatState* state, bool extents, bool sparse) {
+  auto fs = TestFilesystem::Create(FormatOptions(extents));
+  fbl::RefPtr<VnodeMinfs> file = CreateFile(*fs, sparse);
+  const uint64_t file_blocks = (sparse ? kSparseStride : 1) * kFileBlocks;
+  while (state->KeepRunning()) {
+    VnodeMapper mapper(file.get());
+    VnodeIterator iterator;
+    ZX_ASSERT(iterator.Init(&mapper, nullptr, 0).is_ok());
+    uint64_t mapped = 0;
+    for (uint64_t remaining = file_blocks; remaining > 0;) {
+      const uint64_t count = iterator.GetContiguousBlockCount(remaining);
+      if (iterator.Blk() != 0) {
+        mapped += count;
+      }
+      ZX_ASSERT(iterator.Advance(count).is_ok());
+      remaining -= count;
+    }
+    ZX_ASSERT(mapped == kFileBlocks);
+  }
+  ZX_ASSERT(file->Close() == ZX_OK);
+  return true;
+}
+
+// Maps single blocks of a file at random, as small random reads do.
+bool MapperRandomTest(perftest::RepeatState* state, bool extents, bool sparse) {
+  auto fs = TestFilesystem::Create(FormatOptions(extents));
+  fbl::RefPtr<VnodeMinfs> file = CreateFile(*fs, sparse);
+  std::mt19937_64 random(kSeed);
+  std::uniform_int_distribution<uint64_t> blocks(0, (sparse ? kSparseStride : 1) * kFileBlocks - 1);
+  VnodeMapper mapper(file.get());
+  while (state->KeepRunning()) {
+    const uint64_t block = blocks(random);
+    auto range_or = mapper.Map(BlockRange(block, block + 1));
+    ZX_ASSERT(range_or.is_ok());
+    perftest::DoNotOptimize(range_or.value());
+  }
+  ZX_ASSERT(file->Close() == ZX_OK);
+  return true;
+}
+
+std::string EntryName(uint32_t i) {
+  char name[16];
+  snprintf(name, sizeof(name), "e%05u", i);
+  return name;
+}
+
+// Looks up names at random in a directory of |entries| entries, which are hard links to one file
+// so that the directory can be larger than the inode table. Without a directory index, each lookup
+// scans the directory with ForEachDirent up to the entry, or to the end if |hit| is false.
+bool DirectoryLookupTest(perftest::RepeatState* state, uint32_t entries, bool hit) {
+  auto fs = TestFilesystem::Create(MountOptions());
+  fbl::RefPtr<fs::Vnode> dir;
+  ZX_ASSERT(fs->Root()->Create("dir", S_IFDIR, &dir) == ZX_OK);
+  fbl::RefPtr<fs::Vnode> file;
+  ZX_ASSERT(fs->Root()->Create("file", 0, &file) == ZX_OK);
+  for (uint32_t i = 0; i < entries; ++i) {
+    ZX_ASSERT(dir->Link(EntryName(i), file) == ZX_OK);
+  }
+
+  std::mt19937 random(kSeed);
+  std::uniform_int_distribution<uint32_t> names(0, entries - 1);
+  while (state->KeepRunning()) {
+    const std::string name = hit ? EntryName(names(random)) : "missing";
+    fbl::RefPtr<fs::Vnode> child;
+    ZX_ASSERT(dir->Lookup(name, &child) == (hit ? ZX_OK : ZX_ERR_NOT_FOUND));
+  }
+  ZX_ASSERT(file->Close() == ZX_OK);
+  ZX_ASSERT(dir->Close() == ZX_OK);
+  return true;
+}
+
+void RegisterTests() {
+  for (bool extents : {false, true}) {
+    for (bool sparse : {false, true}) {
+      const std::string suffix =
+          std::string(extents ? "/Extents" : "/Indirect") + (sparse ? "/Sparse" : "/Dense");
+      perftest::RegisterTest(("Minfs/VnodeIterator/Walk" + suffix).c_str(), IteratorWalkTest,
+                             extents, sparse);
+      perftest::RegisterTest(("Minfs/VnodeMapper/MapRandom" + suffix).c_str(), MapperRandomTest,
+                             extents, sparse);
+    }
+  }
+  for (uint32_t entries : {10, 1000, 50000}) {
+    const std::string suffix = "/" + std::to_string(entries);
+    perftest::RegisterTest(("Minfs/Directory/LookupHit" + suffix).c_str(), DirectoryLookupTest,
+                           entries, true);
+    perftest::RegisterTest(("Minfs/Directory/LookupMiss" + suffix).c_str(), DirectoryLookupTest,
+                           entries, false);
+  }
+}
+PERFTEST_CTOR(RegisterTests)
+
+}  // namespace
+}  // namespace minfs
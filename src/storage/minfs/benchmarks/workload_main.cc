@@ -0,0 +1,620 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Runs file system workloads against a minfs image mounted on the host with emu_mount, and
+// writes their throughput, latency, backing file I/O and the filesystem's internal statistics as
+// JSON.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <lib/fit/defer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fbl/unique_fd.h>
+
+#include "src/storage/minfs/host.h"
+#include "src/storage/minfs/host_trace.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string image;
+  uint64_t image_bytes = uint64_t{1} << 30;
+  std::vector<std::string> workloads = {"seq-write", "seq-read", "rand-write", "rand-read",
+                                        "create",    "tree",     "readdir",    "rename"};
+  std::vector<uint64_t> io_sizes = {4096, 65536, 1 << 20};
+  uint64_t file_bytes = 64 << 20;
+  uint32_t files = 5000;
+  uint32_t tree_depth = 4;
+  uint32_t tree_fanout = 8;
+  uint32_t readdir_entries = 10000;
+  uint32_t readdir_passes = 10;
+  uint32_t rename_ops = 20000;
+  uint32_t seed = 0x6d696e66;
+};
+
+// The measurements of one phase of a workload.
+struct Result {
+  std::string workload;
+  std::string phase;
+  uint64_t io_size = 0;
+  std::vector<uint64_t> latencies_ns;
+  uint64_t bytes = 0;
+  uint64_t elapsed_ns = 0;
+  minfs::Bcache::IoStats io;
+  // The internal statistics of the filesystem, see emu_get_stats_json.
+  std::string minfs_stats = "{}";
+};
+
+minfs::Bcache::IoStats GetIoStats() {
+  minfs::Bcache::IoStats stats;
+  emu_get_io_stats(&stats);
+  return stats;
+}
+
+// Times the operations of a phase, and the backing file I/O they cause.
+class Phase {
+ public:
+  Phase(std::string workload, std::string phase, uint64_t io_size = 0)
+      : io_before_(GetIoStats()), start_(Clock::now()) {
+    result_.workload = std::move(workload);
+    result_.phase = std::move(phase);
+    result_.io_size = io_size;
+    emu_reset_stats();
+  }
+
+  // Runs |op|, which moves |bytes| bytes of file data, and records how long it took. Returns false
+  // if |op| fails.
+  bool Run(const std::function<bool()>& op, uint64_t bytes = 0) {
+    const auto start = Clock::now();
+    const bool ok = op();
+    result_.latencies_ns.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    result_.bytes += bytes;
+    if (!ok) {
+      fprintf(stderr, "%s/%s failed: %s\n", result_.workload.c_str(), result_.phase.c_str(),
+              strerror(errno));
+    }
+    return ok;
+  }
+
+  Result Finish() {
+    result_.elapsed_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_).count();
+    const minfs::Bcache::IoStats after = GetIoStats();
+    result_.io.read_calls = after.read_calls - io_before_.read_calls;
+    result_.io.write_calls = after.write_calls - io_before_.write_calls;
+    result_.io.other_calls = after.other_calls - io_before_.other_calls;
+    result_.io.bytes_read = after.bytes_read - io_before_.bytes_read;
+    result_.io.bytes_written = after.bytes_written - io_before_.bytes_written;
+    emu_get_stats_json(&result_.minfs_stats);
+    return std::move(result_);
+  }
+
+ private:
+  const minfs::Bcache::IoStats io_before_;
+  const Clock::time_point start_;
+  Result result_;
+};
+
+// Formats and mounts a fresh image, so that each workload starts from an empty file system.
+bool MountImage(const Options& options) {
+  {
+    fbl::unique_fd fd(open(options.image.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644));
+    if (!fd || ftruncate(fd.get(), static_cast<off_t>(options.image_bytes)) != 0) {
+      fprintf(stderr, "Cannot create %s\n", options.image.c_str());
+      return false;
+    }
+  }
+  if (emu_mkfs(options.image.c_str()) != 0 || emu_mount(options.image.c_str()) != 0) {
+    fprintf(stderr, "Cannot format and mount %s\n", options.image.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::string Path(const char* format, uint32_t i) {
+  char path[64];
+  snprintf(path, sizeof(path), format, i);
+  return path;
+}
+
+bool WriteAll(int fd, const uint8_t* data, size_t length, off_t offset) {
+  while (length > 0) {
+    ssize_t written = emu_pwrite(fd, data, length, offset);
+    if (written <= 0) {
+      return false;
+    }
+    data += written;
+    length -= written;
+    offset += written;
+  }
+  return true;
+}
+
+bool ReadAll(int fd, uint8_t* data, size_t length, off_t offset) {
+  while (length > 0) {
+    ssize_t actual = emu_pread(fd, data, length, offset);
+    if (actual <= 0) {
+      return false;
+    }
+    data += actual;
+    length -= actual;
+    offset += actual;
+  }
+  return true;
+}
+
+// Reads or writes one file with |io_size| byte operations, in order or at random offsets. Reads
+// are of a file written beforehand.
+bool RunDataWorkload(const Options& options, const std::string& workload, uint64_t io_size,
+                     std::vector<Result>& results) {
+  const bool write = workload == "seq-write" || workload == "rand-write";
+  const bool random = workload == "rand-write" || workload == "rand-read";
+  const uint64_t ops = options.file_bytes / io_size;
+  std::vector<uint8_t> buffer(io_size, 0xab);
+
+  int fd = emu_open("::file", O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  if (!write) {
+    for (uint64_t i = 0; i < ops; ++i) {
+      if (!WriteAll(fd, buffer.data(), io_size, static_cast<off_t>(i * io_size))) {
+        emu_close(fd);
+        return false;
+      }
+    }
+  }
+
+  std::mt19937_64 random_engine(options.seed);
+  std::uniform_int_distribution<uint64_t> offsets(0, ops - 1);
+  Phase phase(workload, write ? "write" : "read", io_size);
+  for (uint64_t i = 0; i < ops; ++i) {
+    const off_t offset = static_cast<off_t>((random ? offsets(random_engine) : i) * io_size);
+    if (!phase.Run(
+            [&] {
+              return write ? WriteAll(fd, buffer.data(), io_size, offset)
+                           : ReadAll(fd, buffer.data(), io_size, offset);
+            },
+            io_size)) {
+      emu_close(fd);
+      return false;
+    }
+  }
+  results.push_back(phase.Finish());
+  return emu_close(fd) == 0;
+}
+
+// Creates, stats and unlinks many empty files in one directory.
+bool RunCreateWorkload(const Options& options, std::vector<Result>& results) {
+  if (emu_mkdir("::files", 0755) != 0) {
+    return false;
+  }
+  Phase create("create", "create");
+  for (uint32_t i = 0; i < options.files; ++i) {
+    const std::string path = Path("::files/f%06u", i);
+    if (!create.Run([&] {
+          int fd = emu_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+          return fd >= 0 && emu_close(fd) == 0;
+        })) {
+      return false;
+    }
+  }
+  results.push_back(create.Finish());
+
+  Phase stat_phase("create", "stat");
+  for (uint32_t i = 0; i < options.files; ++i) {
+    const std::string path = Path("::files/f%06u", i);
+    struct stat s;
+    if (!stat_phase.Run([&] { return emu_stat(path.c_str(), &s) == 0; })) {
+      return false;
+    }
+  }
+  results.push_back(stat_phase.Finish());
+
+  Phase unlink_phase("create", "unlink");
+  for (uint32_t i = 0; i < options.files; ++i) {
+    const std::string path = Path("::files/f%06u", i);
+    if (!unlink_phase.Run([&] { return emu_unlink(path.c_str()) == 0; })) {
+      return false;
+    }
+  }
+  results.push_back(unlink_phase.Finish());
+  return true;
+}
+
+// Returns the directories of a tree |depth| deep with |fanout| children in each directory, each
+// listed after its parent.
+std::vector<std::string> TreePaths(const Options& options) {
+  std::vector<std::string> paths;
+  std::vector<std::string> level = {"::tree"};
+  for (uint32_t depth = 0; depth < options.tree_depth; ++depth) {
+    std::vector<std::string> next;
+    for (const std::string& parent : level) {
+      for (uint32_t i = 0; i < options.tree_fanout; ++i) {
+        next.push_back(parent + Path("/d%u", i));
+      }
+    }
+    paths.insert(paths.end(), next.begin(), next.end());
+    level = std::move(next);
+  }
+  return paths;
+}
+
+// Builds a directory tree, stats every directory in it by its full path, and removes it.
+bool RunTreeWorkload(const Options& options, std::vector<Result>& results) {
+  if (emu_mkdir("::tree", 0755) != 0) {
+    return false;
+  }
+  const std::vector<std::string> paths = TreePaths(options);
+  Phase mkdir_phase("tree", "mkdir");
+  for (const std::string& path : paths) {
+    if (!mkdir_phase.Run([&] { return emu_mkdir(path.c_str(), 0755) == 0; })) {
+      return false;
+    }
+  }
+  results.push_back(mkdir_phase.Finish());
+
+  Phase stat_phase("tree", "stat");
+  for (const std::string& path : paths) {
+    struct stat s;
+    if (!stat_phase.Run([&] { return emu_stat(path.c_str(), &s) == 0; })) {
+      return false;
+    }
+  }
+  results.push_back(stat_phase.Finish());
+
+  Phase rmdir_phase("tree", "rmdir");
+  for (auto path = paths.rbegin(); path != paths.rend(); ++path) {
+    if (!rmdir_phase.Run([&] { return emu_unlink(path->c_str()) == 0; })) {
+      return false;
+    }
+  }
+  results.push_back(rmdir_phase.Finish());
+  return true;
+}
+
+// Reads a large directory from start to end, timing each entry read.
+bool RunReaddirWorkload(const Options& options, std::vector<Result>& results) {
+  if (emu_mkdir("::dir", 0755) != 0) {
+    return false;
+  }
+  for (uint32_t i = 0; i < options.readdir_entries; ++i) {
+    int fd = emu_open(Path("::dir/f%06u", i).c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 || emu_close(fd) != 0) {
+      return false;
+    }
+  }
+
+  Phase phase("readdir", "readdir");
+  for (uint32_t pass = 0; pass < options.readdir_passes; ++pass) {
+    DIR* dir = emu_opendir("::dir");
+    if (dir == nullptr) {
+      return false;
+    }
+    bool more = true;
+    while (more) {
+      phase.Run([&] {
+        more = emu_readdir(dir) != nullptr;
+        return true;
+      });
+    }
+    emu_closedir(dir);
+  }
+  results.push_back(phase.Finish());
+  return true;
+}
+
+// Moves files at random between two directories.
+bool RunRenameWorkload(const Options& options, std::vector<Result>& results) {
+  if (emu_mkdir("::a", 0755) != 0 || emu_mkdir("::b", 0755) != 0) {
+    return false;
+  }
+  std::vector<bool> in_b(options.files, false);
+  for (uint32_t i = 0; i < options.files; ++i) {
+    int fd = emu_open(Path("::a/f%06u", i).c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 || emu_close(fd) != 0) {
+      return false;
+    }
+  }
+
+  std::mt19937 random_engine(options.seed);
+  std::uniform_int_distribution<uint32_t> files(0, options.files - 1);
+  Phase phase("rename", "rename");
+  for (uint32_t op = 0; op < options.rename_ops; ++op) {
+    const uint32_t i = files(random_engine);
+    const std::string from = Path(in_b[i] ? "::b/f%06u" : "::a/f%06u", i);
+    const std::string to = Path(in_b[i] ? "::a/f%06u" : "::b/f%06u", i);
+    if (!phase.Run([&] { return emu_rename(from.c_str(), to.c_str()) == 0; })) {
+      return false;
+    }
+    in_b[i] = !in_b[i];
+  }
+  results.push_back(phase.Finish());
+  return true;
+}
+
+// Returns the latency below which |fraction| of |sorted| fall.
+uint64_t Percentile(const std::vector<uint64_t>& sorted, double fraction) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t rank = static_cast<size_t>(fraction * static_cast<double>(sorted.size()));
+  return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+void WriteResults(const Options& options, std::vector<Result>& results, FILE* out) {
+  fprintf(out, "{\n  \"image_bytes\": %" PRIu64 ",\n  \"seed\": %u,\n  \"results\": [",
+          options.image_bytes, options.seed);
+  for (size_t i = 0; i < results.size(); ++i) {
+    Result& result = results[i];
+    std::sort(result.latencies_ns.begin(), result.latencies_ns.end());
+    const uint64_t ops = result.latencies_ns.size();
+    const double seconds = static_cast<double>(result.elapsed_ns) / 1e9;
+    fprintf(out, "%s\n    {\"workload\": \"%s\", \"phase\": \"%s\"", i ? "," : "",
+            result.workload.c_str(), result.phase.c_str());
+    if (result.io_size) {
+      fprintf(out, ", \"io_size\": %" PRIu64, result.io_size);
+    }
+    fprintf(out, ", \"ops\": %" PRIu64 ", \"bytes\": %" PRIu64 ", \"seconds\": %.6f", ops,
+            result.bytes, seconds);
+    fprintf(out, ", \"ops_per_second\": %.1f, \"bytes_per_second\": %.1f",
+            seconds > 0 ? static_cast<double>(ops) / seconds : 0.0,
+            seconds > 0 ? static_cast<double>(result.bytes) / seconds : 0.0);
+    fprintf(out,
+            ",\n     \"latency_ns\": {\"min\": %" PRIu64 ", \"p50\": %" PRIu64 ", \"p99\": %" PRIu64
+            ", \"p999\": %" PRIu64 ", \"max\": %" PRIu64 "}",
+            ops ? result.latencies_ns.front() : 0, Percentile(result.latencies_ns, 0.5),
+            Percentile(result.latencies_ns, 0.99), Percentile(result.latencies_ns, 0.999),
+            ops ? result.latencies_ns.back() : 0);
+    fprintf(out,
+            ",\n     \"backing_file\": {\"read_calls\": %" PRIu64 ", \"write_calls\": %" PRIu64
+            ", \"other_calls\": %" PRIu64 ", \"bytes_read\": %" PRIu64
+            ", \"bytes_written\": %" PRIu64 "}",
+            result.io.read_calls, result.io.write_calls, result.io.other_calls,
+            result.io.bytes_read, result.io.bytes_written);
+    fprintf(out, ",\n     \"minfs\": %s}", result.minfs_stats.c_str());
+  }
+  fprintf(out, "\n  ]\n}\n");
+}
+
+bool RunWorkload(const Options& options, const std::string& workload,
+                 std::vector<Result>& results) {
+  if (workload == "seq-write" || workload == "seq-read" || workload == "rand-write" ||
+      workload == "rand-read") {
+    for (uint64_t io_size : options.io_sizes) {
+      if (!MountImage(options)) {
+        return false;
+      }
+      const bool ok = RunDataWorkload(options, workload, io_size, results);
+      emu_unmount();
+      if (!ok) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool (*run)(const Options&, std::vector<Result>&) = nullptr;
+  if (workload == "create") {
+    run = RunCreateWorkload;
+  } else if (workload == "tree") {
+    run = RunTreeWorkload;
+  } else if (workload == "readdir") {
+    run = RunReaddirWorkload;
+  } else if (workload == "rename") {
+    run = RunRenameWorkload;
+  } else {
+    fprintf(stderr, "Unknown workload %s\n", workload.c_str());
+    return false;
+  }
+  if (!MountImage(options)) {
+    return false;
+  }
+  const bool ok = run(options, results);
+  emu_unmount();
+  return ok;
+}
+
+std::vector<std::string> Split(const std::string& list) {
+  std::vector<std::string> items;
+  for (size_t start = 0; start <= list.size();) {
+    size_t end = std::min(list.find(',', start), list.size());
+    if (end > start) {
+      items.push_back(list.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return items;
+}
+
+void Usage() {
+  fprintf(stderr,
+          "usage: minfs_workload [options]\n"
+          "\n"
+          "Runs each workload on a freshly formatted image and writes the results as JSON.\n"
+          "\n"
+          "  --workloads <list>      Comma separated workloads to run (default all):\n"
+          "                          seq-write, seq-read, rand-write, rand-read, create, tree,\n"
+          "                          readdir, rename\n"
+          "  --io-sizes <list>       Bytes per read or write (default 4096,65536,1048576)\n"
+          "  --file-mb <n>           Size of the file read and written (default 64)\n"
+          "  --files <n>             Files to create or rename (default 5000)\n"
+          "  --rename-ops <n>        Renames to make (default 20000)\n"
+          "  --tree-depth <n>        Depth of the directory tree (default 4)\n"
+          "  --tree-fanout <n>       Subdirectories of each directory in the tree (default 8)\n"
+          "  --readdir-entries <n>   Entries in the directory read (default 10000)\n"
+          "  --readdir-passes <n>    Times to read the directory (default 10)\n"
+          "  --image <path>          Image file to use (default a temporary file)\n"
+          "  --image-mb <n>          Size of the image (default 1024)\n"
+          "  --seed <n>              Seed for random choices\n"
+          "  --out <path>            Write the results to <path> rather than stdout\n"
+          "  --trace <path>          Write a Chrome JSON trace of the run to <path>\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  enum {
+    kWorkloads = 1,
+    kIoSizes,
+    kFileMb,
+    kFiles,
+    kRenameOps,
+    kTreeDepth,
+    kTreeFanout,
+    kReaddirEntries,
+    kReaddirPasses,
+    kImage,
+    kImageMb,
+    kSeed,
+    kOut,
+    kTrace,
+    kHelp,
+  };
+  static const option kOptions[] = {
+      {"workloads", required_argument, nullptr, kWorkloads},
+      {"io-sizes", required_argument, nullptr, kIoSizes},
+      {"file-mb", required_argument, nullptr, kFileMb},
+      {"files", required_argument, nullptr, kFiles},
+      {"rename-ops", required_argument, nullptr, kRenameOps},
+      {"tree-depth", required_argument, nullptr, kTreeDepth},
+      {"tree-fanout", required_argument, nullptr, kTreeFanout},
+      {"readdir-entries", required_argument, nullptr, kReaddirEntries},
+      {"readdir-passes", required_argument, nullptr, kReaddirPasses},
+      {"image", required_argument, nullptr, kImage},
+      {"image-mb", required_argument, nullptr, kImageMb},
+      {"seed", required_argument, nullptr, kSeed},
+      {"out", required_argument, nullptr, kOut},
+      {"trace", required_argument, nullptr, kTrace},
+      {"help", no_argument, nullptr, kHelp},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  Options options;
+  std::string out_path;
+  std::string trace_path;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", kOptions, nullptr)) != -1) {
+    switch (opt) {
+      case kWorkloads:
+        options.workloads = Split(optarg);
+        break;
+      case kIoSizes:
+        options.io_sizes.clear();
+        for (const std::string& size : Split(optarg)) {
+          options.io_sizes.push_back(strtoull(size.c_str(), nullptr, 0));
+        }
+        break;
+      case kFileMb:
+        options.file_bytes = strtoull(optarg, nullptr, 0) << 20;
+        break;
+      case kFiles:
+        options.files = static_cast<uint32_t>(strtoul(optarg, nullptr, 0));
+        break;
+      case kRenameOps:
+        options.rename_ops = static_cast<uint32_t>(strtoul(optarg, nullptr, 0));
+        break;
+      case kTreeDepth:
+        options.tree_depth = static_cast<uint32_t>(strtoul(optarg, nullptr, 0));
+        break;
+      case kTreeFanout:
+        options.tree_fanout = static_cast<uint32_t>(strtoul(optarg, nullptr, 0));
+        break;
+      case kReaddirEntries:
+        options.readdir_entries = static_cast<uint32_t>(strtoul(optarg, nullptr, 0));
+        break;
+      case kReaddirPasses:
+        options.readdir_passes = static_cast<uint32_t>(strtoul(optarg, nullptr, 0));
+        break;
+      case kImage:
+        options.image = optarg;
+        break;
+      case kImageMb:
+        options.image_bytes = strtoull(optarg, nullptr, 0) << 20;
+        break;
+      case kSeed:
+        options.seed = static_cast<uint32_t>(strtoul(optarg, nullptr, 0));
+        break;
+      case kOut:
+        out_path = optarg;
+        break;
+      case kTrace:
+        trace_path = optarg;
+        break;
+      default:
+        Usage();
+        return opt == kHelp ? 0 : 1;
+    }
+  }
+  if (optind != argc || options.files == 0 ||
+      std::any_of(options.io_sizes.begin(), options.io_sizes.end(), [&](uint64_t size) {
+        return size == 0 || size > options.file_bytes;
+      })) {
+    Usage();
+    return 1;
+  }
+
+  // Written however this returns, so that failures can be profiled too.
+  auto write_trace = fit::defer([&trace_path] {
+    if (!trace_path.empty()) {
+      minfs::StopHostTrace();
+      [[maybe_unused]] auto status = minfs::WriteHostTrace(trace_path);
+    }
+  });
+  if (!trace_path.empty()) {
+    minfs::StartHostTrace();
+  }
+
+  bool temporary_image = options.image.empty();
+  if (temporary_image) {
+    char path[] = "/tmp/minfs_workload.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+      fprintf(stderr, "Cannot create a temporary image\n");
+      return 1;
+    }
+    close(fd);
+    options.image = path;
+  }
+
+  std::vector<Result> results;
+  bool ok = true;
+  for (const std::string& workload : options.workloads) {
+    if (!RunWorkload(options, workload, results)) {
+      ok = false;
+      break;
+    }
+  }
+  if (temporary_image) {
+    unlink(options.image.c_str());
+  }
+  if (!ok) {
+    return 1;
+  }
+
+  FILE* out = out_path.empty() ? stdout : fopen(out_path.c_str(), "w");
+  if (out == nullptr) {
+    fprintf(stderr, "Cannot write %s\n", out_path.c_str());
+    return 1;
+  }
+  WriteResults(options, results, out);
+  return out == stdout || fclose(out) == 0 ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/checksum.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <array>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace minfs {
+namespace {
+
+// The reflected CRC32C polynomial.
+constexpr uint32_t kCrc32cPolynomial = 0x82f63b78;
+
+constexpr std::array<uint32_t, 256> MakeCrc32cTable() {
+  std::array<uint32_t, 256> table = {};
+  for (uint32_t i = 0; i < table.size(); ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ ((crc & 1) ? kCrc32cPolynomial : 0);
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+constexpr std::array<uint32_t, 256> kCrc32cTable = MakeCrc32cTable();
+
+// The following operate on the inverted CRC, as the instructions do.
+uint32_t UpdateSoftware(uint32_t crc, const uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; ++i) {
+    crc = kCrc32cTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+
+bool HasCrc32Instructions() {
+  static const bool has_sse42 = [] {
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2) != 0;
+  }();
+  return has_sse42;
+}
+
+__attribute__((target("sse4.2"))) uint32_t UpdateHardware(uint32_t crc, const uint8_t* data,
+                                                           size_t length) {
+  uint64_t crc64 = crc;
+  for (; length >= sizeof(uint64_t); length -= sizeof(uint64_t), data += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+  for (; length > 0; --length, ++data) {
+    crc = _mm_crc32_u8(crc, *data);
+  }
+  return crc;
+}
+
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+
+// The target was built for CPUs which all have the CRC32 instructions.
+bool HasCrc32Instructions() { return true; }
+
+uint32_t UpdateHardware(uint32_t crc, const uint8_t* data, size_t length) {
+  for (; length >= sizeof(uint64_t); length -= sizeof(uint64_t), data += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc = __crc32cd(crc, word);
+  }
+  for (; length > 0; --length, ++data) {
+    crc = __crc32cb(crc, *data);
+  }
+  return crc;
+}
+
+#else
+
+bool HasCrc32Instructions() { return false; }
+
+uint32_t UpdateHardware(uint32_t crc, const uint8_t* data, size_t length) {
+  return UpdateSoftware(crc, data, length);
+}
+
+#endif
+
+}  // namespace
+
+uint32_t Crc32c(uint32_t crc, const void* data, size_t length) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  if (HasCrc32Instructions()) {
+    return ~UpdateHardware(~crc, bytes, length);
+  }
+  return ~UpdateSoftware(~crc, bytes, length);
+}
+
+uint32_t Crc32cSoftware(uint32_t crc, const void* data, size_t length) {
+  return ~UpdateSoftware(~crc, static_cast<const uint8_t*>(data), length);
+}
+
+bool Crc32cIsAccelerated() { return HasCrc32Instructions(); }
+
+uint32_t InodeChecksum(ino_t ino, const Inode& inode) {
+  Inode copy = inode;
+  copy.checksum = 0;
+  return Crc32c(Crc32c(0, &ino, sizeof(ino)), &copy, sizeof(copy));
+}
+
+uint16_t ExtentNodeChecksum(blk_t block, const void* data) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  ExtentHeader header;
+  memcpy(&header, bytes, sizeof(header));
+  header.checksum = 0;
+  uint32_t crc = Crc32c(0, &block, sizeof(block));
+  crc = Crc32c(crc, &header, sizeof(header));
+  crc = Crc32c(crc, bytes + sizeof(header), kMinfsBlockSize - sizeof(header));
+  return static_cast<uint16_t>(crc);
+}
+
+bool VerifyExtentNodeChecksum(blk_t block, const void* data) {
+  ExtentHeader header;
+  memcpy(&header, data, sizeof(header));
+  return header.checksum == ExtentNodeChecksum(block, data);
+}
+
+uint32_t DirIndexChecksum(ino_t ino, const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  DirIndexHeader header;
+  memcpy(&header, bytes, sizeof(header));
+  header.checksum = 0;
+  uint32_t crc = Crc32c(0, &ino, sizeof(ino));
+  crc = Crc32c(crc, &header, sizeof(header));
+  return Crc32c(crc, bytes + sizeof(header), size - sizeof(header));
+}
+
+void UpdateDirIndexChecksum(ino_t ino, void* data, size_t size) {
+  const uint32_t checksum = DirIndexChecksum(ino, data, size);
+  memcpy(static_cast<uint8_t*>(data) + offsetof(DirIndexHeader, checksum), &checksum,
+         sizeof(checksum));
+}
+
+bool VerifyDirIndexChecksum(ino_t ino, const void* data, size_t size) {
+  DirIndexHeader header;
+  memcpy(&header, data, sizeof(header));
+  return header.checksum == DirIndexChecksum(ino, data, size);
+}
+
+}  // namespace minfs
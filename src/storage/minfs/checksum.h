@@ -0,0 +1,64 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// This file describes the checksums which protect minfs metadata.
+
+#ifndef SRC_STORAGE_MINFS_CHECKSUM_H_
+#define SRC_STORAGE_MINFS_CHECKSUM_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "src/storage/minfs/format.h"
+
+namespace minfs {
+
+// Returns the CRC32C (Castagnoli) of the |length| bytes at |data|. A checksum of several buffers
+// can be built up by passing the result for the previous ones as |crc|; start with zero. This uses
+// the SSE4.2 or ARMv8 CRC32 instructions where the CPU has them.
+uint32_t Crc32c(uint32_t crc, const void* data, size_t length);
+
+// As Crc32c, but always computed a byte at a time without special instructions.
+uint32_t Crc32cSoftware(uint32_t crc, const void* data, size_t length);
+
+// Returns true if Crc32c uses CRC32 instructions rather than Crc32cSoftware.
+bool Crc32cIsAccelerated();
+
+// Returns the checksum of |inode| (see kMinfsFlagChecksums) in slot |ino| of the inode table,
+// which excludes the |Inode::checksum| field itself. The inode number is covered so that an inode
+// written to the wrong slot fails verification.
+uint32_t InodeChecksum(ino_t ino, const Inode& inode);
+
+// Sets |inode->checksum| to match the rest of inode |ino|.
+inline void UpdateInodeChecksum(ino_t ino, Inode* inode) {
+  inode->checksum = InodeChecksum(ino, *inode);
+}
+
+// Returns true if |inode|, loaded from slot |ino|, is in use and its checksum matches. Only inodes
+// in use carry checksums, so this must only be asked of inodes which are expected to be; a free
+// inode, which has no magic, always fails.
+inline bool VerifyInodeChecksum(ino_t ino, const Inode& inode) {
+  return inode.magic != 0 && inode.checksum == InodeChecksum(ino, inode);
+}
+
+// Returns the checksum of the extent tree node held in data block |block|, whose kMinfsBlockSize
+// bytes are at |data|, excluding |ExtentHeader::checksum|.
+uint16_t ExtentNodeChecksum(blk_t block, const void* data);
+
+// Returns true if the checksum of the extent tree node at |data| matches.
+bool VerifyExtentNodeChecksum(blk_t block, const void* data);
+
+// Returns the checksum of the index block at |data|, |size| bytes long, of directory |ino|,
+// excluding |DirIndexHeader::checksum|.
+uint32_t DirIndexChecksum(ino_t ino, const void* data, size_t size);
+
+// Sets the checksum in the header of the directory index block at |data|.
+void UpdateDirIndexChecksum(ino_t ino, void* data, size_t size);
+
+// Returns true if the checksum of the directory index block at |data| matches.
+bool VerifyDirIndexChecksum(ino_t ino, const void* data, size_t size);
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_CHECKSUM_H_
@@ -0,0 +1,252 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/checksum_table.h"
+
+#include <lib/syslog/cpp/macros.h>
+#include <string.h>
+
+#include <utility>
+
+#include <fbl/algorithm.h>
+
+#include "src/lib/storage/vfs/cpp/transaction/buffered_operations_builder.h"
+#include "src/storage/minfs/checksum.h"
+
+namespace minfs {
+
+// static
+uint32_t ChecksumTable::BlocksNeeded(uint32_t ibm_blocks, uint32_t abm_blocks,
+                                     uint32_t dat_blocks) {
+  const uint64_t entries = uint64_t{ibm_blocks} + abm_blocks + dat_blocks;
+  return static_cast<uint32_t>(fbl::round_up(entries, uint64_t{kMinfsChecksumsPerBlock}) /
+                               kMinfsChecksumsPerBlock);
+}
+
+// static
+uint32_t ChecksumTable::BlockChecksum(blk_t bno, const void* data) {
+  const uint32_t crc = Crc32c(Crc32c(0, &bno, sizeof(bno)), data, kMinfsBlockSize);
+  return crc == 0 ? 1 : crc;
+}
+
+ChecksumTable::ChecksumTable(const Superblock& info)
+    : table_block_(info.dat_block + info.csum_block),
+      table_blocks_(info.csum_blocks),
+      ibm_block_(info.ibm_block),
+      ibm_blocks_(info.csum_ibm_blocks),
+      abm_block_(info.abm_block),
+      abm_blocks_(info.csum_abm_blocks),
+      dat_block_(info.dat_block),
+      dat_blocks_(info.csum_dat_blocks)
+#ifndef __Fuchsia__
+      ,
+      buffer_(info.csum_blocks, kMinfsBlockSize)
+#endif
+{
+}
+
+// static
+zx::status<std::unique_ptr<ChecksumTable>> ChecksumTable::CreateEmpty(Bcache* bcache,
+                                                                      const Superblock& info) {
+  ZX_DEBUG_ASSERT(info.UsesChecksums());
+  std::unique_ptr<ChecksumTable> table(new ChecksumTable(info));
+#ifdef __Fuchsia__
+  std::lock_guard lock(table->mutex_);
+  if (zx_status_t status = table->buffer_.Initialize(bcache, info.csum_blocks, kMinfsBlockSize,
+                                                     "minfs-checksum-table");
+      status != ZX_OK) {
+    FX_LOGS(ERROR) << "Failed to allocate checksum table: " << status;
+    return zx::error(status);
+  }
+  table->scratch_ = std::make_unique<uint8_t[]>(kMinfsBlockSize);
+#endif
+  return zx::ok(std::move(table));
+}
+
+// static
+zx::status<std::unique_ptr<ChecksumTable>> ChecksumTable::Load(Bcache* bcache,
+                                                               const Superblock& info) {
+  auto table_or = CreateEmpty(bcache, info);
+  if (table_or.is_error()) {
+    return table_or.take_error();
+  }
+  ChecksumTable& table = *table_or.value();
+
+  std::lock_guard lock(table.mutex_);
+  fs::BufferedOperationsBuilder builder;
+  builder.Add(storage::Operation{.type = storage::OperationType::kRead,
+                                 .vmo_offset = 0,
+                                 .dev_offset = table.table_block_,
+                                 .length = table.table_blocks_},
+              &table.buffer_);
+  if (zx_status_t status = bcache->RunRequests(builder.TakeOperations()); status != ZX_OK) {
+    FX_LOGS(ERROR) << "Failed to read checksum table: " << status;
+    return zx::error(status);
+  }
+  return table_or;
+}
+
+std::optional<size_t> ChecksumTable::EntryIndex(blk_t bno) const {
+  if (bno >= ibm_block_ && bno - ibm_block_ < ibm_blocks_) {
+    return bno - ibm_block_;
+  }
+  if (bno >= abm_block_ && bno - abm_block_ < abm_blocks_) {
+    return size_t{ibm_blocks_} + (bno - abm_block_);
+  }
+  if (bno >= table_block_ && bno - table_block_ < table_blocks_) {
+    return std::nullopt;
+  }
+  if (bno >= dat_block_ && bno - dat_block_ < dat_blocks_) {
+    return size_t{ibm_blocks_} + abm_blocks_ + (bno - dat_block_);
+  }
+  return std::nullopt;
+}
+
+zx::status<> ChecksumTable::Verify(blk_t bno, blk_t count, const void* data) const {
+  std::lock_guard lock(mutex_);
+  return VerifyLocked(bno, count, data);
+}
+
+zx::status<> ChecksumTable::VerifyLocked(blk_t bno, blk_t count, const void* data) const {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (blk_t i = 0; i < count; ++i) {
+    std::optional<size_t> index = EntryIndex(bno + i);
+    if (!index) {
+      continue;
+    }
+    const uint32_t entry = entries()[*index];
+    if (entry != 0 && entry != BlockChecksum(bno + i, bytes + size_t{i} * kMinfsBlockSize)) {
+      FX_LOGS(ERROR) << "Block " << bno + i << " failed checksum verification";
+      return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+    }
+  }
+  return zx::ok();
+}
+
+void ChecksumTable::Update(blk_t bno, blk_t count, const void* data) {
+  std::lock_guard lock(mutex_);
+  UpdateLocked(bno, count, data);
+}
+
+void ChecksumTable::UpdateLocked(blk_t bno, blk_t count, const void* data) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (blk_t i = 0; i < count; ++i) {
+    std::optional<size_t> index = EntryIndex(bno + i);
+    if (!index) {
+      continue;
+    }
+    const uint32_t entry = BlockChecksum(bno + i, bytes + size_t{i} * kMinfsBlockSize);
+    if (entries()[*index] != entry) {
+      entries()[*index] = entry;
+      const blk_t table_block = static_cast<blk_t>(*index / kMinfsChecksumsPerBlock);
+      ZX_ASSERT(dirty_.SetOne(table_block) == ZX_OK);
+    }
+  }
+}
+
+void ChecksumTable::Clear(blk_t bno) {
+  std::lock_guard lock(mutex_);
+  std::optional<size_t> index = EntryIndex(bno);
+  // Most blocks being allocated held file contents, so have no entry to clear.
+  if (!index || entries()[*index] == 0) {
+    return;
+  }
+  entries()[*index] = 0;
+  const blk_t table_block = static_cast<blk_t>(*index / kMinfsChecksumsPerBlock);
+  ZX_ASSERT(dirty_.SetOne(table_block) == ZX_OK);
+}
+
+#ifdef __Fuchsia__
+
+zx::status<> ChecksumTable::Commit(std::vector<storage::UnbufferedOperation>* operations) {
+  std::lock_guard lock(mutex_);
+  for (const storage::UnbufferedOperation& operation : *operations) {
+    if (operation.op.type != storage::OperationType::kWrite) {
+      continue;
+    }
+    for (uint64_t i = 0; i < operation.op.length; ++i) {
+      const blk_t bno = static_cast<blk_t>(operation.op.dev_offset + i);
+      if (!EntryIndex(bno)) {
+        continue;
+      }
+      if (zx_status_t status = operation.vmo->read(
+              scratch_.get(), (operation.op.vmo_offset + i) * kMinfsBlockSize, kMinfsBlockSize);
+          status != ZX_OK) {
+        return zx::error(status);
+      }
+      UpdateLocked(bno, 1, scratch_.get());
+    }
+  }
+  for (const auto& range : dirty_) {
+    operations->push_back(storage::UnbufferedOperation{
+        .vmo = zx::unowned_vmo(buffer_.Vmo()),
+        .op = {.type = storage::OperationType::kWrite,
+               .vmo_offset = range.bitoff,
+               .dev_offset = table_block_ + range.bitoff,
+               .length = range.bitlen}});
+  }
+  dirty_.ClearAll();
+  return zx::ok();
+}
+
+zx::status<> ChecksumTable::VerifyVmo(const zx::vmo& vmo, uint64_t vmo_offset, blk_t bno,
+                                      blk_t count) const {
+  std::lock_guard lock(mutex_);
+  for (blk_t i = 0; i < count; ++i) {
+    if (!EntryIndex(bno + i)) {
+      continue;
+    }
+    if (zx_status_t status =
+            vmo.read(scratch_.get(), (vmo_offset + i) * kMinfsBlockSize, kMinfsBlockSize);
+        status != ZX_OK) {
+      return zx::error(status);
+    }
+    if (auto status = VerifyLocked(bno + i, 1, scratch_.get()); status.is_error()) {
+      return status;
+    }
+  }
+  return zx::ok();
+}
+
+#else
+
+void ChecksumTable::Commit(std::vector<storage::BufferedOperation>* operations) {
+  std::lock_guard lock(mutex_);
+  for (const storage::BufferedOperation& operation : *operations) {
+    if (operation.op.type == storage::OperationType::kWrite) {
+      UpdateLocked(static_cast<blk_t>(operation.op.dev_offset),
+                   static_cast<blk_t>(operation.op.length),
+                   static_cast<const uint8_t*>(operation.data) +
+                       operation.op.vmo_offset * kMinfsBlockSize);
+    }
+  }
+  for (const auto& range : dirty_) {
+    operations->push_back(storage::BufferedOperation{
+        .data = buffer_.Data(0),
+        .op = {.type = storage::OperationType::kWrite,
+               .vmo_offset = range.bitoff,
+               .dev_offset = table_block_ + range.bitoff,
+               .length = range.bitlen}});
+  }
+  dirty_.ClearAll();
+}
+
+#endif
+
+zx::status<> ChecksumTable::Write(Bcache* bcache) {
+  std::lock_guard lock(mutex_);
+  fs::BufferedOperationsBuilder builder;
+  builder.Add(storage::Operation{.type = storage::OperationType::kWrite,
+                                 .vmo_offset = 0,
+                                 .dev_offset = table_block_,
+                                 .length = table_blocks_},
+              &buffer_);
+  if (zx_status_t status = bcache->RunRequests(builder.TakeOperations()); status != ZX_OK) {
+    return zx::error(status);
+  }
+  dirty_.ClearAll();
+  return zx::ok();
+}
+
+}  // namespace minfs
@@ -0,0 +1,132 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// This file describes the checksum table, which protects the minfs metadata blocks that have no
+// room for a checksum of their own: the bitmaps, indirect blocks and directory blocks.
+
+#ifndef SRC_STORAGE_MINFS_CHECKSUM_TABLE_H_
+#define SRC_STORAGE_MINFS_CHECKSUM_TABLE_H_
+
+#include <lib/zx/status.h>
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <bitmap/rle-bitmap.h>
+#include <storage/operation/operation.h>
+
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/format.h"
+
+#ifdef __Fuchsia__
+#include <lib/zx/vmo.h>
+
+#include <storage/buffer/vmo_buffer.h>
+#include <storage/operation/unbuffered_operation.h>
+#else
+#include <storage/buffer/array_buffer.h>
+#endif
+
+namespace minfs {
+
+// The in-memory copy of the checksum table of a volume with kMinfsFlagChecksums. Entries are set
+// for the metadata blocks written by each transaction as it is committed, and cleared as blocks
+// are allocated, since data blocks holding file contents have no checksum. Superblock::csum_block
+// describes the on-disk layout.
+//
+// The table only covers the blocks which the volume had when it was formatted; bitmap and data
+// blocks added when an FVM volume grows have no entries, and so are never verified.
+//
+// This class is thread-safe.
+class ChecksumTable {
+ public:
+  // Returns the number of blocks needed for a table with entries for |ibm_blocks| inode bitmap
+  // blocks, |abm_blocks| block bitmap blocks and |dat_blocks| data blocks.
+  static uint32_t BlocksNeeded(uint32_t ibm_blocks, uint32_t abm_blocks, uint32_t dat_blocks);
+
+  // Returns the entry for device block |bno| holding the kMinfsBlockSize bytes at |data|. This is
+  // never zero, which marks blocks without a checksum. The block number is covered so that a block
+  // written to the wrong place fails verification.
+  static uint32_t BlockChecksum(blk_t bno, const void* data);
+
+  // Returns a table for the volume described by |info| in which no block has a checksum.
+  static zx::status<std::unique_ptr<ChecksumTable>> CreateEmpty(Bcache* bcache,
+                                                               const Superblock& info);
+
+  // Reads the table of the volume described by |info| from |bcache|.
+  static zx::status<std::unique_ptr<ChecksumTable>> Load(Bcache* bcache, const Superblock& info);
+
+  ChecksumTable(const ChecksumTable&) = delete;
+  ChecksumTable& operator=(const ChecksumTable&) = delete;
+
+  // Returns ZX_ERR_IO_DATA_INTEGRITY if any of the |count| device blocks starting at |bno|, whose
+  // contents are at |data|, has a checksum which does not match. Blocks without one always pass.
+  zx::status<> Verify(blk_t bno, blk_t count, const void* data) const;
+
+  // Sets the entries of the |count| device blocks starting at |bno| to match the contents at
+  // |data|, ignoring blocks which the table does not cover. Changed table blocks are written out by
+  // the next call to Commit.
+  void Update(blk_t bno, blk_t count, const void* data);
+
+  // Clears the entry of device block |bno|, which is about to be reused and may hold file contents.
+  void Clear(blk_t bno);
+
+#ifdef __Fuchsia__
+  // Sets the entries of the blocks written by |operations|, reading them back from their VMOs, and
+  // appends writes of the table blocks which have changed since the last commit.
+  zx::status<> Commit(std::vector<storage::UnbufferedOperation>* operations);
+
+  // As Verify, for |count| blocks read into |vmo| starting at block |vmo_offset|.
+  zx::status<> VerifyVmo(const zx::vmo& vmo, uint64_t vmo_offset, blk_t bno, blk_t count) const;
+#else
+  // Sets the entries of the blocks written by |operations| and appends writes of the table blocks
+  // which have changed since the last commit.
+  void Commit(std::vector<storage::BufferedOperation>* operations);
+#endif
+
+  // Writes the whole table to |bcache| immediately, e.g. when formatting.
+  zx::status<> Write(Bcache* bcache);
+
+ private:
+  explicit ChecksumTable(const Superblock& info);
+
+  // Returns the index of the entry for device block |bno|, if it has one.
+  std::optional<size_t> EntryIndex(blk_t bno) const;
+
+  void UpdateLocked(blk_t bno, blk_t count, const void* data) __TA_REQUIRES(mutex_);
+  zx::status<> VerifyLocked(blk_t bno, blk_t count, const void* data) const
+      __TA_REQUIRES(mutex_);
+
+  uint32_t* entries() __TA_REQUIRES(mutex_) { return static_cast<uint32_t*>(buffer_.Data(0)); }
+  const uint32_t* entries() const __TA_REQUIRES(mutex_) {
+    return static_cast<const uint32_t*>(buffer_.Data(0));
+  }
+
+  // The device blocks of the table and of the regions whose blocks it covers.
+  const blk_t table_block_;
+  const blk_t table_blocks_;
+  const blk_t ibm_block_;
+  const blk_t ibm_blocks_;
+  const blk_t abm_block_;
+  const blk_t abm_blocks_;
+  const blk_t dat_block_;
+  const blk_t dat_blocks_;
+
+  mutable std::mutex mutex_;
+#ifdef __Fuchsia__
+  storage::VmoBuffer buffer_ __TA_GUARDED(mutex_);
+  // Space for reading back one block of a committed operation.
+  std::unique_ptr<uint8_t[]> scratch_ __TA_GUARDED(mutex_);
+#else
+  storage::ArrayBuffer buffer_ __TA_GUARDED(mutex_);
+#endif
+  // The table blocks which have changed since the last commit.
+  bitmap::RleBitmapBase<blk_t> dirty_ __TA_GUARDED(mutex_);
+};
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_CHECKSUM_TABLE_H_
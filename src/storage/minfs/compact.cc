@@ -0,0 +1,137 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/compact.h"
+
+#include <fcntl.h>
+#include <lib/syslog/cpp/macros.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <fbl/unique_fd.h>
+
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/relocate.h"
+#include "src/storage/minfs/runner.h"
+
+namespace minfs {
+
+blk_t DataHighWaterMark(Minfs& fs) {
+  const Allocator& allocator = fs.GetBlockAllocator();
+  blk_t end = fs.Info().block_count;
+  while (end > 0 && !allocator.CheckAllocated(end - 1)) {
+    --end;
+  }
+  return end;
+}
+
+zx::status<CompactStats> CompactImage(Minfs& fs) {
+  CompactStats stats;
+  stats.high_water_before = DataHighWaterMark(fs);
+
+  auto runs_or = ListBlockRuns(fs);
+  if (runs_or.is_error()) {
+    return runs_or.take_error();
+  }
+  std::vector<BlockRun>& runs = runs_or.value();
+  std::sort(runs.begin(), runs.end(),
+            [](const BlockRun& a, const BlockRun& b) { return a.block > b.block; });
+
+  // Allocation is first fit, so new blocks come from the lowest free ones. Count the free blocks
+  // below each run to know how much of it can move down, highest blocks first.
+  const Allocator& allocator = fs.GetBlockAllocator();
+  blk_t next_free = 1;
+  for (const BlockRun& run : runs) {
+    uint64_t movable = 0;
+    while (movable < run.count) {
+      const blk_t block = run.block + static_cast<blk_t>(run.count - movable - 1);
+      while (next_free < block && allocator.CheckAllocated(next_free)) {
+        ++next_free;
+      }
+      if (next_free >= block) {
+        break;
+      }
+      ++next_free;
+      ++movable;
+    }
+    if (movable == 0) {
+      break;
+    }
+    auto vnode_or = fs.VnodeGet(run.ino);
+    if (vnode_or.is_error()) {
+      return vnode_or.take_error();
+    }
+    const uint64_t first = run.count - movable;
+    if (auto status = RelocateBlocks(fs, *vnode_or.value(), run.file_block + first,
+                                     run.block + static_cast<blk_t>(first), movable, 0);
+        status.is_error()) {
+      FX_LOGS(ERROR) << "Cannot move the blocks of inode " << run.ino << ": "
+                     << status.status_string();
+      return status.take_error();
+    }
+    stats.blocks_moved += movable;
+  }
+
+  stats.high_water_after = DataHighWaterMark(fs);
+  return zx::ok(stats);
+}
+
+zx::status<> DiscardFreeBlocks(Minfs& fs) {
+  const Allocator& allocator = fs.GetBlockAllocator();
+  const blk_t block_count = fs.Info().block_count;
+  for (blk_t start = 0; start < block_count;) {
+    if (allocator.CheckAllocated(start)) {
+      ++start;
+      continue;
+    }
+    blk_t end = start + 1;
+    while (end < block_count && !allocator.CheckAllocated(end)) {
+      ++end;
+    }
+    if (auto status = fs.bc_->Discard(fs.Info().dat_block + start, end - start);
+        status.is_error()) {
+      return status;
+    }
+    start = end;
+  }
+  return zx::ok();
+}
+
+zx::status<CompactStats> CompactImage(const std::string& path) {
+  fbl::unique_fd fd(open(path.c_str(), O_RDWR));
+  if (!fd) {
+    FX_LOGS(ERROR) << "Cannot open " << path;
+    return zx::error(ZX_ERR_IO);
+  }
+  struct stat s;
+  if (fstat(fd.get(), &s) < 0) {
+    return zx::error(ZX_ERR_IO);
+  }
+  auto bcache_or =
+      Bcache::Create(std::move(fd), static_cast<uint32_t>(s.st_size / kMinfsBlockSize));
+  if (bcache_or.is_error()) {
+    return bcache_or.take_error();
+  }
+  bcache_or->SetPunchHoles(true);
+  auto runner_or =
+      Runner::Create(nullptr, std::move(bcache_or.value()), MountOptions{.quiet = true});
+  if (runner_or.is_error()) {
+    return runner_or.take_error();
+  }
+  std::unique_ptr<Runner> runner = std::move(runner_or.value());
+  auto stats_or = CompactImage(runner->minfs());
+  if (stats_or.is_ok()) {
+    if (auto status = DiscardFreeBlocks(runner->minfs()); status.is_error()) {
+      stats_or = status.take_error();
+    }
+  }
+  Runner::Destroy(std::move(runner));
+  return stats_or;
+}
+
+}  // namespace minfs
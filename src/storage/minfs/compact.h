@@ -0,0 +1,46 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_STORAGE_MINFS_COMPACT_H_
+#define SRC_STORAGE_MINFS_COMPACT_H_
+
+#ifdef __Fuchsia__
+#error Host-only Header
+#endif
+
+#include <lib/zx/status.h>
+
+#include <string>
+
+#include "src/storage/minfs/format.h"
+
+namespace minfs {
+
+class Minfs;
+
+struct CompactStats {
+  // One past the highest data block in use, before and after compacting.
+  blk_t high_water_before = 0;
+  blk_t high_water_after = 0;
+  uint64_t blocks_moved = 0;
+};
+
+// Returns one past the highest allocated data block of |fs|.
+blk_t DataHighWaterMark(Minfs& fs);
+
+// Moves the blocks of files and directories, highest first, into the lowest free data blocks, so
+// that the data of the image ends as early in the volume as it can. Indirect blocks and extent tree
+// nodes are left where they are. See RelocateBlocks for how the data is moved and when that is
+// safe.
+zx::status<CompactStats> CompactImage(Minfs& fs);
+
+// Releases the storage behind every free data block of |fs| (see Bcache::Discard).
+zx::status<> DiscardFreeBlocks(Minfs& fs);
+
+// Compacts the image at |path| and punches out its free blocks, leaving a sparse file.
+zx::status<CompactStats> CompactImage(const std::string& path);
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_COMPACT_H_
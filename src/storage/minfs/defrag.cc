@@ -0,0 +1,216 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/defrag.h"
+
+#include <fcntl.h>
+#include <lib/syslog/cpp/macros.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include <fbl/unique_fd.h>
+
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/relocate.h"
+#include "src/storage/minfs/runner.h"
+
+namespace minfs {
+namespace {
+
+// Runs of free data blocks, from their first block to their length.
+using FreeRuns = std::map<blk_t, blk_t>;
+
+FreeRuns GetFreeRuns(Minfs& fs) {
+  FreeRuns runs;
+  const Allocator& allocator = fs.GetBlockAllocator();
+  const blk_t block_count = fs.Info().block_count;
+  for (blk_t start = 0; start < block_count;) {
+    if (allocator.CheckAllocated(start)) {
+      ++start;
+      continue;
+    }
+    blk_t end = start + 1;
+    while (end < block_count && !allocator.CheckAllocated(end)) {
+      ++end;
+    }
+    runs[start] = end - start;
+    start = end;
+  }
+  return runs;
+}
+
+void AddFreeRun(FreeRuns& runs, blk_t start, blk_t count) {
+  auto next = runs.lower_bound(start);
+  if (next != runs.end() && start + count == next->first) {
+    count += next->second;
+    next = runs.erase(next);
+  }
+  if (next != runs.begin()) {
+    auto previous = std::prev(next);
+    if (previous->first + previous->second == start) {
+      previous->second += count;
+      return;
+    }
+  }
+  runs.emplace_hint(next, start, count);
+}
+
+// Takes the smallest free run which holds |count| blocks, and returns its first block, or zero if
+// there is none.
+blk_t TakeFreeRun(FreeRuns& runs, uint64_t count) {
+  auto best = runs.end();
+  for (auto run = runs.begin(); run != runs.end(); ++run) {
+    if (run->second >= count && (best == runs.end() || run->second < best->second)) {
+      best = run;
+    }
+  }
+  if (best == runs.end()) {
+    return 0;
+  }
+  const blk_t start = best->first;
+  const blk_t remaining = best->second - static_cast<blk_t>(count);
+  runs.erase(best);
+  if (remaining > 0) {
+    runs[start + static_cast<blk_t>(count)] = remaining;
+  }
+  return start;
+}
+
+// Calls |callback| with the runs of each inode in turn. |runs| is in inode order.
+template <typename Callback>
+zx::status<> ForEachFile(const std::vector<BlockRun>& runs, Callback callback) {
+  for (auto first = runs.begin(); first != runs.end();) {
+    auto last = std::find_if(first, runs.end(),
+                             [ino = first->ino](const BlockRun& run) { return run.ino != ino; });
+    if (auto status = callback(first, last); status.is_error()) {
+      return status;
+    }
+    first = last;
+  }
+  return zx::ok();
+}
+
+}  // namespace
+
+zx::status<FragmentationReport> GetFragmentationReport(Minfs& fs) {
+  auto runs_or = ListBlockRuns(fs);
+  if (runs_or.is_error()) {
+    return runs_or.take_error();
+  }
+  FragmentationReport report;
+  auto status = ForEachFile(runs_or.value(), [&report](auto first, auto last) -> zx::status<> {
+    FileFragmentation file{.ino = first->ino};
+    for (auto run = first; run != last; ++run) {
+      file.blocks += run->count;
+      ++file.extents;
+    }
+    report.blocks += file.blocks;
+    report.extents += file.extents;
+    if (file.extents > 1) {
+      ++report.fragmented_files;
+    }
+    report.files.push_back(file);
+    return zx::ok();
+  });
+  if (status.is_error()) {
+    return status.take_error();
+  }
+  std::stable_sort(report.files.begin(), report.files.end(),
+                   [](const FileFragmentation& a, const FileFragmentation& b) {
+                     return a.extents > b.extents;
+                   });
+
+  for (const auto& [start, count] : GetFreeRuns(fs)) {
+    report.free_blocks += count;
+    ++report.free_extents;
+    report.largest_free_extent = std::max<uint64_t>(report.largest_free_extent, count);
+  }
+  return zx::ok(std::move(report));
+}
+
+zx::status<DefragStats> Defragment(Minfs& fs) {
+  auto runs_or = ListBlockRuns(fs);
+  if (runs_or.is_error()) {
+    return runs_or.take_error();
+  }
+  FreeRuns free_runs = GetFreeRuns(fs);
+  DefragStats stats;
+  auto status = ForEachFile(runs_or.value(), [&](auto first, auto last) -> zx::status<> {
+    if (std::next(first) == last) {
+      return zx::ok();
+    }
+    uint64_t blocks = 0;
+    for (auto run = first; run != last; ++run) {
+      blocks += run->count;
+    }
+    blk_t destination = TakeFreeRun(free_runs, blocks);
+    if (destination == 0) {
+      ++stats.files_skipped;
+      return zx::ok();
+    }
+    auto vnode_or = fs.VnodeGet(first->ino);
+    if (vnode_or.is_error()) {
+      return vnode_or.take_error();
+    }
+    for (auto run = first; run != last; ++run) {
+      if (auto status = RelocateBlocks(fs, *vnode_or.value(), run->file_block, run->block,
+                                       run->count, destination);
+          status.is_error()) {
+        if (status.status_value() == ZX_ERR_NO_SPACE) {
+          // Part of the file has moved, and the blocks it used and freed are no longer as planned.
+          FX_LOGS(WARNING) << "Inode " << run->ino << " was left in more than one extent";
+          ++stats.files_left_fragmented;
+          free_runs = GetFreeRuns(fs);
+          return zx::ok();
+        }
+        FX_LOGS(ERROR) << "Cannot move the blocks of inode " << run->ino << ": "
+                       << status.status_string();
+        return status;
+      }
+      destination += static_cast<blk_t>(run->count);
+    }
+    for (auto run = first; run != last; ++run) {
+      AddFreeRun(free_runs, run->block, static_cast<blk_t>(run->count));
+    }
+    ++stats.files_moved;
+    stats.blocks_moved += blocks;
+    return zx::ok();
+  });
+  if (status.is_error()) {
+    return status.take_error();
+  }
+  return zx::ok(stats);
+}
+
+zx::status<DefragStats> Defragment(const std::string& path) {
+  fbl::unique_fd fd(open(path.c_str(), O_RDWR));
+  if (!fd) {
+    FX_LOGS(ERROR) << "Cannot open " << path;
+    return zx::error(ZX_ERR_IO);
+  }
+  struct stat s;
+  if (fstat(fd.get(), &s) < 0) {
+    return zx::error(ZX_ERR_IO);
+  }
+  auto bcache_or =
+      Bcache::Create(std::move(fd), static_cast<uint32_t>(s.st_size / kMinfsBlockSize));
+  if (bcache_or.is_error()) {
+    return bcache_or.take_error();
+  }
+  auto runner_or =
+      Runner::Create(nullptr, std::move(bcache_or.value()), MountOptions{.quiet = true});
+  if (runner_or.is_error()) {
+    return runner_or.take_error();
+  }
+  std::unique_ptr<Runner> runner = std::move(runner_or.value());
+  auto stats_or = Defragment(runner->minfs());
+  Runner::Destroy(std::move(runner));
+  return stats_or;
+}
+
+}  // namespace minfs
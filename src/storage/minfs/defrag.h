@@ -0,0 +1,70 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_STORAGE_MINFS_DEFRAG_H_
+#define SRC_STORAGE_MINFS_DEFRAG_H_
+
+#ifdef __Fuchsia__
+#error Host-only Header
+#endif
+
+#include <lib/zx/status.h>
+
+#include <string>
+#include <vector>
+
+#include "src/storage/minfs/format.h"
+
+namespace minfs {
+
+class Minfs;
+
+// How the data blocks of one file or directory are laid out.
+struct FileFragmentation {
+  ino_t ino = 0;
+  uint64_t blocks = 0;
+  // The number of runs of blocks which are contiguous both in the file and on disk. One is ideal.
+  uint64_t extents = 0;
+};
+
+struct FragmentationReport {
+  // Files and directories which hold data blocks, most fragmented first.
+  std::vector<FileFragmentation> files;
+  uint64_t fragmented_files = 0;
+  uint64_t blocks = 0;
+  uint64_t extents = 0;
+
+  // The free space of the volume, as runs of free data blocks.
+  uint64_t free_blocks = 0;
+  uint64_t free_extents = 0;
+  uint64_t largest_free_extent = 0;
+};
+
+// Returns the fragmentation of every file and directory in |fs|, and of its free space.
+zx::status<FragmentationReport> GetFragmentationReport(Minfs& fs);
+
+struct DefragStats {
+  // Files and directories moved into a single extent, and their blocks.
+  uint64_t files_moved = 0;
+  uint64_t blocks_moved = 0;
+  // Fragmented files for which there was no free run of blocks large enough.
+  uint64_t files_skipped = 0;
+  // Files which were partly moved but not left in a single extent, because blocks allocated while
+  // moving them, such as indirect blocks, took part of the free run planned for them.
+  uint64_t files_left_fragmented = 0;
+};
+
+// Moves the blocks of each fragmented file and directory of |fs| into a single run of free blocks,
+// planned from the block bitmap, choosing the smallest free run that holds the whole file. Blocks
+// freed by one file are available to the next. A file is only counted as moved if each of its
+// blocks landed where it was planned. See RelocateBlocks for how the data is moved and
+// when that is safe.
+zx::status<DefragStats> Defragment(Minfs& fs);
+
+// Defragments the image at |path|.
+zx::status<DefragStats> Defragment(const std::string& path);
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_DEFRAG_H_
@@ -15,9 +15,14 @@
 #include <unistd.h>
 #include <zircon/time.h>
 
+#include <algorithm>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <string_view>
 #include <utility>
+#include <vector>
 
 #include <fbl/algorithm.h>
 
@@ -36,25 +41,35 @@
 #include <fbl/auto_lock.h>
 #endif
 
+#include "src/storage/minfs/checksum.h"
 #include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/trace.h"
 #include "src/storage/minfs/unowned_vmo_buffer.h"
 #include "src/storage/minfs/vnode.h"
 
 namespace minfs {
 namespace {
 
-zx::status<> ValidateDirent(Dirent* de, size_t bytes_read, size_t off) {
+// Checks the dirent |de|, of which |bytes_read| bytes were read from offset |off|. |leaf_end| is
+// the result of Directory::LeafEnd(off): for indexed directories, the record must not extend past
+// the end of its leaf.
+zx::status<> ValidateDirent(Dirent* de, size_t bytes_read, size_t off, size_t leaf_end) {
   if (bytes_read < kMinfsDirentSize) {
     FX_LOGS(ERROR) << "vn_dir: Short read (" << bytes_read << " bytes) at offset " << off;
     return zx::error(ZX_ERR_IO);
   }
+  if (leaf_end != 0 && (de->reclen & kMinfsReclenLast)) {
+    FX_LOGS(ERROR) << "vn_dir: last record flag in indexed directory at offset " << off;
+    return zx::error(ZX_ERR_IO);
+  }
   uint32_t reclen = static_cast<uint32_t>(DirentReservedSize(de, off));
   if (reclen < kMinfsDirentSize) {
     FX_LOGS(ERROR) << "vn_dir: Could not read dirent at offset: " << off;
     return zx::error(ZX_ERR_IO);
   }
-  if ((off + reclen > kMinfsMaxDirectorySize) || (reclen & kMinfsDirentAlignmentMask)) {
-    FX_LOGS(ERROR) << "vn_dir: bad reclen " << reclen << " > " << kMinfsMaxDirectorySize;
+  const size_t limit = leaf_end != 0 ? leaf_end : kMinfsMaxDirectorySize;
+  if ((off + reclen > limit) || (reclen & kMinfsDirentAlignmentMask)) {
+    FX_LOGS(ERROR) << "vn_dir: bad reclen " << reclen << " at " << off << " > " << limit;
     return zx::error(ZX_ERR_IO);
   }
   if (de->ino != 0) {
@@ -66,6 +81,17 @@ zx::status<> ValidateDirent(Dirent* de, size_t bytes_read, size_t off) {
   return zx::ok();
 }
 
+// Returns the record of |entries|, the index of an indexed directory, which covers |hash|: the
+// last of any continuation leaves.
+std::vector<DirIndexEntry>::iterator FindIndexEntry(std::vector<DirIndexEntry>& entries,
+                                                    uint32_t hash) {
+  // The first record has a hash of zero, so it covers any hash below the second.
+  auto next = std::upper_bound(
+      entries.begin(), entries.end(), hash,
+      [](uint32_t hash, const DirIndexEntry& entry) { return hash < entry.hash; });
+  return std::prev(next);
+}
+
 }  // namespace
 
 Directory::Directory(Minfs* fs) : VnodeMinfs(fs) {}
@@ -74,9 +100,191 @@ Directory::~Directory() = default;
 
 blk_t Directory::GetBlockCount() const { return GetInode()->block_count; }
 
-uint64_t Directory::GetSize() const { return GetInode()->size; }
+uint64_t Directory::GetSize() const { return GetInodeSize(*GetInode()); }
+
+void Directory::SetSize(uint64_t new_size) { SetInodeSize(GetMutableInode(), new_size); }
+
+size_t Directory::LeafEnd(size_t off) {
+  if (!IsIndexed()) {
+    return 0;
+  }
+  return fbl::round_down(off, size_t{Vfs()->BlockSize()}) + Vfs()->BlockSize();
+}
+
+zx::status<std::vector<DirIndexEntry>> Directory::ReadDirIndex(PendingWork* transaction) {
+  const uint32_t block_size = Vfs()->BlockSize();
+  std::vector<uint8_t> block(block_size);
+  if (auto status = ReadExactInternal(transaction, block.data(), block_size, 0);
+      status.is_error()) {
+    FX_LOGS(ERROR) << "Failed to read directory index: " << status.status_value();
+    return status.take_error();
+  }
+  DirIndexHeader header;
+  memcpy(&header, block.data(), sizeof(header));
+  const uint64_t leaf_count = GetSize() / block_size - 1;
+  if (header.magic != kMinfsDirIndexMagic || header.count == 0 ||
+      header.count > kMinfsDirIndexMaxEntries || header.count != leaf_count) {
+    FX_LOGS(ERROR) << "Bad directory index: magic " << header.magic << ", " << header.count
+                   << " records for " << leaf_count << " leaves";
+    return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
+  if (Vfs()->Info().UsesChecksums() &&
+      !VerifyDirIndexChecksum(GetIno(), block.data(), block.size())) {
+    FX_LOGS(ERROR) << "Directory index of inode " << GetIno() << " failed checksum verification";
+    return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
+  std::vector<DirIndexEntry> entries(header.count);
+  memcpy(entries.data(), block.data() + sizeof(header), entries.size() * sizeof(DirIndexEntry));
+  if (entries[0].hash != 0) {
+    FX_LOGS(ERROR) << "Bad directory index: first hash " << entries[0].hash;
+    return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
+  return zx::ok(std::move(entries));
+}
+
+zx::status<> Directory::WriteDirIndex(Transaction* transaction,
+                                      const std::vector<DirIndexEntry>& entries) {
+  ZX_DEBUG_ASSERT(!entries.empty() && entries.size() <= kMinfsDirIndexMaxEntries);
+  std::vector<uint8_t> block(Vfs()->BlockSize(), 0);
+  DirIndexHeader header = {};
+  header.magic = kMinfsDirIndexMagic;
+  header.count = static_cast<uint32_t>(entries.size());
+  memcpy(block.data(), &header, sizeof(header));
+  memcpy(block.data() + sizeof(header), entries.data(), entries.size() * sizeof(DirIndexEntry));
+  if (Vfs()->Info().UsesChecksums()) {
+    UpdateDirIndexChecksum(GetIno(), block.data(), block.size());
+  }
+  return WriteExactInternal(transaction, block.data(), block.size(), 0);
+}
 
-void Directory::SetSize(uint32_t new_size) { GetMutableInode()->size = new_size; }
+zx::status<std::vector<uint32_t>> Directory::LookupLeaves(PendingWork* transaction,
+                                                          std::string_view name) {
+  auto entries_or = ReadDirIndex(transaction);
+  if (entries_or.is_error()) {
+    return entries_or.take_error();
+  }
+  std::vector<DirIndexEntry>& entries = entries_or.value();
+  const uint32_t hash = Vfs()->HashDirentName(name);
+  auto last = FindIndexEntry(entries, hash);
+  auto first = last;
+  if (last->hash == hash) {
+    while (first != entries.begin() && std::prev(first)->hash == hash) {
+      --first;
+    }
+  }
+  std::vector<uint32_t> leaves;
+  for (auto entry = first; entry <= last; ++entry) {
+    if (entry->block == 0 || entry->block > entries.size()) {
+      FX_LOGS(ERROR) << "Bad directory index: leaf block " << entry->block;
+      return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+    }
+    leaves.push_back(entry->block);
+  }
+  return zx::ok(std::move(leaves));
+}
+
+zx::status<> Directory::SplitLeaf(Transaction* transaction, std::string_view name) {
+  auto entries_or = ReadDirIndex(transaction);
+  if (entries_or.is_error()) {
+    return entries_or.take_error();
+  }
+  std::vector<DirIndexEntry>& entries = entries_or.value();
+  if (entries.size() >= kMinfsDirIndexMaxEntries) {
+    FX_LOGS(WARNING) << "Directory index is full";
+    return zx::error(ZX_ERR_NO_SPACE);
+  }
+  auto index = FindIndexEntry(entries, Vfs()->HashDirentName(name));
+
+  const uint32_t block_size = Vfs()->BlockSize();
+  const size_t leaf_off = size_t{index->block} * block_size;
+  std::vector<uint8_t> leaf(block_size);
+  if (auto status = ReadExactInternal(transaction, leaf.data(), block_size, leaf_off);
+      status.is_error()) {
+    return status.take_error();
+  }
+
+  // Gather the records in use, ordered by hash.
+  struct Record {
+    uint32_t hash;
+    size_t off;
+    uint32_t size;
+  };
+  std::vector<Record> records;
+  size_t used_size = 0;
+  for (size_t off = 0; off < block_size;) {
+    Dirent* de = reinterpret_cast<Dirent*>(&leaf[off]);
+    if (auto status = ValidateDirent(de, block_size - off, leaf_off + off, leaf_off + block_size);
+        status.is_error()) {
+      return status.take_error();
+    }
+    if (de->ino != 0) {
+      records.push_back({Vfs()->HashDirentName(std::string_view(de->name, de->namelen)), off,
+                         DirentSize(de->namelen)});
+      used_size += records.back().size;
+    }
+    off += DirentReservedSize(de, leaf_off + off);
+  }
+  std::stable_sort(records.begin(), records.end(),
+                   [](const Record& a, const Record& b) { return a.hash < b.hash; });
+
+  // Split where about half of the space in use falls on either side, between two different hashes
+  // so that each name still belongs to exactly one leaf. If every name has the same hash, above
+  // that of the leaf, they all move to the new leaf.
+  std::optional<size_t> split;
+  size_t best_imbalance = std::numeric_limits<size_t>::max();
+  size_t lower_size = 0;
+  for (size_t i = 0; i < records.size(); ++i) {
+    if (i > 0) {
+      lower_size += records[i - 1].size;
+    }
+    if (i > 0 ? records[i].hash == records[i - 1].hash : records[i].hash == index->hash) {
+      continue;
+    }
+    size_t imbalance = lower_size * 2 > used_size ? lower_size * 2 - used_size
+                                                  : used_size - lower_size * 2;
+    if (!split || imbalance < best_imbalance) {
+      best_imbalance = imbalance;
+      split = i;
+    }
+  }
+
+  // Packs |count| records starting at |first| into a leaf, the last one taking up the remainder.
+  // With no records, the leaf is a single free one.
+  auto pack = [&](const Record* first, size_t count) {
+    std::vector<uint8_t> packed(block_size, 0);
+    size_t off = 0;
+    Dirent* de = reinterpret_cast<Dirent*>(packed.data());
+    for (const Record* record = first; record < first + count; ++record) {
+      memcpy(&packed[off], &leaf[record->off], record->size);
+      de = reinterpret_cast<Dirent*>(&packed[off]);
+      de->reclen = record->size;
+      off += record->size;
+    }
+    de->reclen += static_cast<uint32_t>(block_size - off);
+    return packed;
+  };
+
+  // If every name has the leaf's own hash, the leaf is left as it is and an empty continuation
+  // leaf with the same hash follows it.
+  const size_t upper_first = split.value_or(records.size());
+  const uint32_t upper_hash = split ? records[*split].hash : index->hash;
+  if (split) {
+    std::vector<uint8_t> lower = pack(records.data(), *split);
+    if (auto status = WriteExactInternal(transaction, lower.data(), block_size, leaf_off);
+        status.is_error()) {
+      return status.take_error();
+    }
+  }
+  std::vector<uint8_t> upper = pack(records.data() + upper_first, records.size() - upper_first);
+  const uint32_t new_block = static_cast<uint32_t>(GetSize() / block_size);
+  if (auto status =
+          WriteExactInternal(transaction, upper.data(), block_size, size_t{new_block} * block_size);
+      status.is_error()) {
+    return status.take_error();
+  }
+  entries.insert(index + 1, DirIndexEntry{.hash = upper_hash, .block = new_block});
+  return WriteDirIndex(transaction, entries);
+}
 
 void Directory::AcquireWritableBlock(Transaction* transaction, blk_t local_bno, blk_t old_bno,
                                      blk_t* out_bno) {
@@ -96,6 +304,12 @@ void Directory::DeleteBlock(PendingWork* transaction, blk_t local_bno, blk_t old
   }
 }
 
+void Directory::DeleteBlocks(PendingWork* transaction, blk_t local_bno, blk_t old_bno,
+                             blk_t count) {
+  transaction->DeallocateBlocks(old_bno, count);
+  GetMutableInode()->block_count -= count;
+}
+
 #ifdef __Fuchsia__
 void Directory::IssueWriteback(Transaction* transaction, blk_t vmo_offset, blk_t dev_offset,
                                blk_t count) {
@@ -106,7 +320,7 @@ void Directory::IssueWriteback(Transaction* transaction, blk_t vmo_offset, blk_t
       .length = count,
   };
   UnownedVmoBuffer buffer(vmo());
-  transaction->EnqueueMetadata(operation, &buffer);
+  transaction->EnqueueMetadata(operation, &buffer, IoSource::kDirectory);
 }
 
 bool Directory::HasPendingAllocation(blk_t vmo_offset) { return false; }
@@ -152,15 +366,16 @@ zx::status<Directory::IteratorCommand> Directory::UnlinkChild(Transaction* trans
   // Verify they are free and small enough to merge.
   size_t coalesced_size = DirentReservedSize(de, off);
   // Coalesce with "next" first, so the kMinfsReclenLast bit can easily flow
-  // back to "de" and "de_prev".
-  if (!(de->reclen & kMinfsReclenLast)) {
+  // back to "de" and "de_prev". Records are never merged across the leaves of an indexed directory.
+  if (!(de->reclen & kMinfsReclenLast) && off_next != LeafEnd(off)) {
     Dirent de_next;
     size_t len = kMinfsDirentSize;
     if (auto status = ReadExactInternal(transaction, &de_next, len, off_next); status.is_error()) {
       FX_LOGS(ERROR) << "unlink: Failed to read next dirent";
       return status.take_error();
     }
-    if (auto status = ValidateDirent(&de_next, len, off_next); status.is_error()) {
+    if (auto status = ValidateDirent(&de_next, len, off_next, LeafEnd(off_next));
+        status.is_error()) {
       FX_LOGS(ERROR) << "unlink: Read invalid dirent";
       return status.take_error();
     }
@@ -177,7 +392,8 @@ zx::status<Directory::IteratorCommand> Directory::UnlinkChild(Transaction* trans
       FX_LOGS(ERROR) << "unlink: Failed to read previous dirent";
       return status.take_error();
     }
-    if (auto status = ValidateDirent(&de_prev, len, off_prev); status.is_error()) {
+    if (auto status = ValidateDirent(&de_prev, len, off_prev, LeafEnd(off_prev));
+        status.is_error()) {
       FX_LOGS(ERROR) << "unlink: Read invalid dirent";
       return status.take_error();
     }
@@ -367,17 +583,60 @@ zx::status<Directory::IteratorCommand> Directory::NextDirent(Dirent* de, Directo
   return zx::ok(IteratorCommand::kIteratorNext);
 }
 
+zx::status<bool> Directory::FindDirentSpace(DirArgs* args) {
+  args->split_leaf = false;
+  zx::status<bool> found_or = ForEachDirent(args, DirentCallbackFindSpace);
+  if (found_or.is_error() || found_or.value() || !IsIndexed()) {
+    return found_or;
+  }
+  // The leaf is full, so it must be split unless the index has no room for another leaf.
+  if (GetSize() / Vfs()->BlockSize() > kMinfsDirIndexMaxEntries) {
+    return zx::ok(false);
+  }
+  args->split_leaf = true;
+  return zx::ok(true);
+}
+
+zx::status<blk_t> Directory::GetRequiredDirentBlocks(const DirArgs& args) {
+  // Splitting a leaf adds a block at the end of the directory, and AppendDirent may split twice.
+  // Otherwise, assume that the new direntry goes at the end of the directory too.
+  return GetRequiredBlockCount(Vfs()->Info(), GetSize(),
+                               args.split_leaf ? 2 * Vfs()->BlockSize() : args.reclen);
+}
+
 zx::status<> Directory::AppendDirent(DirArgs* args) {
   DirentBuffer dirent_buffer;
   Dirent* de = &dirent_buffer.dirent;
 
+  if (args->split_leaf) {
+    // When every name in the leaf has the new name's hash, above the leaf's own, the first split
+    // moves them all to a new leaf, which the second continues.
+    args->split_leaf = false;
+    bool found = false;
+    for (int splits = 0; !found && splits < 2; ++splits) {
+      if (auto status = SplitLeaf(args->transaction, args->name); status.is_error()) {
+        return status;
+      }
+      zx::status<bool> found_or = ForEachDirent(args, DirentCallbackFindSpace);
+      if (found_or.is_error()) {
+        return found_or.take_error();
+      }
+      found = found_or.value();
+    }
+    if (!found) {
+      FX_LOGS(ERROR) << "Directory::AppendDirent: no space after splitting leaf.";
+      return zx::error(ZX_ERR_NO_SPACE);
+    }
+  }
+
   size_t r;
   if (auto status = ReadInternal(args->transaction, de, kMinfsMaxDirentSize, args->offs.off, &r);
       status.is_error()) {
     return status;
   }
 
-  if (auto status = ValidateDirent(de, r, args->offs.off); status.is_error()) {
+  if (auto status = ValidateDirent(de, r, args->offs.off, LeafEnd(args->offs.off));
+      status.is_error()) {
     return status;
   }
 
@@ -448,13 +707,42 @@ zx::status<> Directory::AppendDirent(DirArgs* args) {
 //  'offs': Offset info about where in the directory this direntry is located.
 //          Since 'func' may create / remove surrounding dirents, it is responsible for
 //          updating the offset information to access the next dirent.
+//
+// Every callback acts on the direntry named 'args->name', so only the leaves which may hold that
+// name are visited in an indexed directory.
 zx::status<bool> Directory::ForEachDirent(DirArgs* args, const DirentCallback func) {
+  std::vector<uint32_t> leaves;
+  if (IsIndexed()) {
+    auto leaves_or = LookupLeaves(args->transaction, args->name);
+    if (leaves_or.is_error()) {
+      return leaves_or.take_error();
+    }
+    leaves = std::move(leaves_or.value());
+  }
+
+  for (size_t i = 0; i < (IsIndexed() ? leaves.size() : 1); ++i) {
+    size_t start = 0;
+    size_t end = std::min<uint64_t>(GetSize(), kMinfsMaxDirectorySize - kMinfsDirentSize);
+    if (IsIndexed()) {
+      start = size_t{leaves[i]} * Vfs()->BlockSize();
+      end = start + Vfs()->BlockSize();
+    }
+    if (auto found_or = ForEachDirentInRange(args, func, start, end);
+        found_or.is_error() || found_or.value()) {
+      return found_or;
+    }
+  }
+  return zx::ok(false);
+}
+
+zx::status<bool> Directory::ForEachDirentInRange(DirArgs* args, const DirentCallback func,
+                                                 size_t start, size_t end) {
   DirentBuffer dirent_buffer;
   Dirent* de = &dirent_buffer.dirent;
 
-  args->offs.off = 0;
-  args->offs.off_prev = 0;
-  while (args->offs.off + kMinfsDirentSize < kMinfsMaxDirectorySize && args->offs.off < GetSize()) {
+  args->offs.off = start;
+  args->offs.off_prev = start;
+  while (args->offs.off < end) {
     FX_LOGS(DEBUG) << "Reading dirent at offset " << args->offs.off;
     size_t r;
 
@@ -462,7 +750,8 @@ zx::status<bool> Directory::ForEachDirent(DirArgs* args, const DirentCallback fu
         status.is_error()) {
       return status.take_error();
     }
-    if (auto status = ValidateDirent(de, r, args->offs.off); status.is_error()) {
+    if (auto status = ValidateDirent(de, r, args->offs.off, LeafEnd(args->offs.off));
+        status.is_error()) {
       return status.take_error();
     }
 
@@ -504,6 +793,7 @@ zx_status_t Directory::Append(const void* data, size_t len, size_t* out_end, siz
 zx_status_t Directory::Lookup(std::string_view name, fbl::RefPtr<fs::Vnode>* out) {
   TRACE_DURATION("minfs", "Directory::Lookup", "name", name);
   ZX_DEBUG_ASSERT(fs::IsValidName(name));
+  ScopedLatency latency(Vfs()->Latencies(), LatencyPhase::kDirectoryLookup);
 
   return Vfs()->GetNodeOperations()->lookup.Track([&] {
     auto vn_or = LookupInternal(name);
@@ -562,6 +852,13 @@ zx_status_t Directory::Readdir(fs::VdirCookie* cookie, void* dirents, size_t len
     size_t off = dc->off;
     size_t r;
 
+    // The leaves of an indexed directory follow its index block.
+    size_t end = kMinfsMaxDirectorySize - kMinfsDirentSize;
+    if (IsIndexed()) {
+      off = std::max<size_t>(off, Vfs()->BlockSize());
+      end = GetSize();
+    }
+
     DirentBuffer dirent_buffer;
     Dirent* de = &dirent_buffer.dirent;
 
@@ -569,15 +866,17 @@ zx_status_t Directory::Readdir(fs::VdirCookie* cookie, void* dirents, size_t len
       // The offset *might* be invalid, if we called Readdir after a directory
       // has been modified. In this case, we need to re-read the directory
       // until we get to the direntry at or after the previously identified offset.
+      // Records never cross the leaves of an indexed directory, so start from the leaf.
 
-      size_t off_recovered = 0;
+      size_t off_recovered = IsIndexed() ? fbl::round_down(off, size_t{Vfs()->BlockSize()}) : 0;
       while (off_recovered < off) {
-        if (off_recovered + kMinfsDirentSize >= kMinfsMaxDirectorySize) {
+        if (off_recovered >= end) {
           FX_LOGS(ERROR) << "Readdir: Corrupt dirent; dirent reclen too large";
           goto fail;
         }
         auto read_status = ReadInternal(nullptr, de, kMinfsMaxDirentSize, off_recovered, &r);
-        if (read_status.is_error() || ValidateDirent(de, r, off_recovered).is_error()) {
+        if (read_status.is_error() ||
+            ValidateDirent(de, r, off_recovered, LeafEnd(off_recovered)).is_error()) {
           FX_LOGS(ERROR) << "Readdir: Corrupt dirent unreadable/failed validation";
           goto fail;
         }
@@ -586,13 +885,13 @@ zx_status_t Directory::Readdir(fs::VdirCookie* cookie, void* dirents, size_t len
       off = off_recovered;
     }
 
-    while (off + kMinfsDirentSize < kMinfsMaxDirectorySize) {
+    while (off < end) {
       if (auto status = ReadInternal(nullptr, de, kMinfsMaxDirentSize, off, &r);
           status.is_error()) {
         FX_LOGS(ERROR) << "Readdir: Unreadable dirent " << status.status_value();
         goto fail;
       }
-      if (auto status = ValidateDirent(de, r, off); status.is_error()) {
+      if (auto status = ValidateDirent(de, r, off, LeafEnd(off)); status.is_error()) {
         FX_LOGS(ERROR) << "Readdir: Corrupt dirent failed validation " << status.status_value();
         goto fail;
       }
@@ -659,7 +958,7 @@ zx_status_t Directory::Create(std::string_view name, uint32_t mode, fbl::RefPtr<
     TRACE_DURATION("minfs", "Directory::Create::SpaceCheck");
     args.type = type;
     args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(name.length())));
-    zx::status<bool> found_or = ForEachDirent(&args, DirentCallbackFindSpace);
+    zx::status<bool> found_or = FindDirentSpace(&args);
     if (found_or.is_error()) {
       return found_or.error_value();
     }
@@ -670,14 +969,14 @@ zx_status_t Directory::Create(std::string_view name, uint32_t mode, fbl::RefPtr<
   }
 
   // Calculate maximum blocks to reserve for the current directory, based on the size and offset
-  // of the new direntry (Assuming that the offset is the current size of the directory).
-  auto reserve_blocks_or = GetRequiredBlockCount(GetSize(), args.reclen, Vfs()->BlockSize());
+  // of the new direntry.
+  auto reserve_blocks_or = GetRequiredDirentBlocks(args);
   if (reserve_blocks_or.is_error()) {
     return reserve_blocks_or.error_value();
   }
 
-  // Reserve 1 additional block for the new directory's initial . and .. entries.
-  blk_t reserve_blocks = reserve_blocks_or.value() + 1;
+  // Reserve additional blocks for the new directory's initial . and .. entries, and its index.
+  blk_t reserve_blocks = reserve_blocks_or.value() + (Vfs()->Info().UsesDirIndex() ? 2 : 1);
 
   ZX_DEBUG_ASSERT(reserve_blocks <= Vfs()->Limits().GetMaximumMetaDataBlocks());
   zx_status_t status;
@@ -697,10 +996,18 @@ zx_status_t Directory::Create(std::string_view name, uint32_t mode, fbl::RefPtr<
   // If the new node is a directory, fill it with '.' and '..'.
   if (type == kMinfsTypeDir) {
     TRACE_DURATION("minfs", "Directory::Create::InitDir");
-    char bdata[DirentSize(1) + DirentSize(2)];
-    InitializeDirectory(bdata, vn_or->GetIno(), GetIno());
-    size_t expected = DirentSize(1) + DirentSize(2);
-    if (auto status = vn_or->WriteExactInternal(transaction_or.value().get(), bdata, expected, 0);
+    std::vector<uint8_t> bdata;
+    if (Vfs()->Info().UsesDirIndex()) {
+      // VnodeNew made the new directory an indexed one.
+      bdata.resize(2 * size_t{Vfs()->BlockSize()}, 0);
+      InitializeIndexedDirectory(bdata.data(), Vfs()->BlockSize(), vn_or->GetIno(), GetIno(),
+                                 Vfs()->Info().UsesChecksums());
+    } else {
+      bdata.resize(DirentSize(1) + DirentSize(2));
+      InitializeDirectory(bdata.data(), vn_or->GetIno(), GetIno());
+    }
+    if (auto status = vn_or->WriteExactInternal(transaction_or.value().get(), bdata.data(),
+                                                bdata.size(), 0);
         status.is_error()) {
       FX_LOGS(ERROR) << "Create: Failed to initialize empty directory: " << status.status_value();
       return ZX_ERR_IO;
@@ -825,12 +1132,13 @@ zx_status_t Directory::Rename(fbl::RefPtr<fs::Vnode> _newdir, std::string_view o
   }
 
   // Ensure that we have enough space to write the vnode's new direntry
-  // before updating any other metadata.
+  // before updating any other metadata. The space must be in the leaf for 'newname' if newdir is
+  // indexed.
+  args.name = newname;
   args.type = oldvn_or->IsDirectory() ? kMinfsTypeDir : kMinfsTypeFile;
   args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(newname.length())));
 
-  if (zx::status<bool> found_or = newdir->ForEachDirent(&args, DirentCallbackFindSpace);
-      found_or.is_error()) {
+  if (zx::status<bool> found_or = newdir->FindDirentSpace(&args); found_or.is_error()) {
     return found_or.error_value();
   } else if (!found_or.value()) {
     FX_LOGS(WARNING) << "Directory::Rename: Can't find a dirent to put this file.";
@@ -840,8 +1148,7 @@ zx_status_t Directory::Rename(fbl::RefPtr<fs::Vnode> _newdir, std::string_view o
   DirectoryOffset append_offs = args.offs;
 
   // Reserve potential blocks to add a new direntry to newdir.
-  auto reserved_blocks_or =
-      GetRequiredBlockCount(newdir->GetInode()->size, args.reclen, Vfs()->BlockSize());
+  auto reserved_blocks_or = newdir->GetRequiredDirentBlocks(args);
   if (reserved_blocks_or.is_error()) {
     return reserved_blocks_or.error_value();
   }
@@ -936,8 +1243,7 @@ zx_status_t Directory::Link(std::string_view name, fbl::RefPtr<fs::Vnode> _targe
     // before updating any other metadata.
     args.type = kMinfsTypeFile;  // We can't hard link directories
     args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(name.length())));
-    if (zx::status<bool> found_or = ForEachDirent(&args, DirentCallbackFindSpace);
-        found_or.is_error()) {
+    if (zx::status<bool> found_or = FindDirentSpace(&args); found_or.is_error()) {
       return found_or.error_value();
     } else if (!found_or.value()) {
       FX_LOGS(WARNING) << "Directory::Link: Can't find a dirent to put this file.";
@@ -945,8 +1251,7 @@ zx_status_t Directory::Link(std::string_view name, fbl::RefPtr<fs::Vnode> _targe
     }
 
     // Reserve potential blocks to write a new direntry.
-    auto reserved_blocks_or =
-        GetRequiredBlockCount(GetInode()->size, args.reclen, Vfs()->BlockSize());
+    auto reserved_blocks_or = GetRequiredDirentBlocks(args);
     if (reserved_blocks_or.is_error()) {
       return reserved_blocks_or.error_value();
     }
@@ -8,6 +8,7 @@
 #include <lib/zx/status.h>
 
 #include <string_view>
+#include <vector>
 
 #include <fbl/algorithm.h>
 #include <fbl/ref_ptr.h>
@@ -34,6 +35,8 @@ struct DirArgs {
   uint32_t reclen = 0;
   Transaction* transaction = nullptr;
   DirectoryOffset offs;
+  // Set by FindDirentSpace if the leaf of an indexed directory must be split to make space.
+  bool split_leaf = false;
 };
 
 // A specialization of the Minfs Vnode which implements a directory interface.
@@ -74,10 +77,11 @@ class Directory final : public VnodeMinfs, public fbl::Recyclable<Directory> {
   zx::status<> CanUnlink() const final;
   blk_t GetBlockCount() const final;
   uint64_t GetSize() const final;
-  void SetSize(uint32_t new_size) final;
+  void SetSize(uint64_t new_size) final;
   void AcquireWritableBlock(Transaction* transaction, blk_t local_bno, blk_t old_bno,
                             blk_t* out_bno) final;
   void DeleteBlock(PendingWork* transaction, blk_t local_bno, blk_t old_bno, bool indirect) final;
+  void DeleteBlocks(PendingWork* transaction, blk_t local_bno, blk_t old_bno, blk_t count) final;
   bool IsDirectory() const final { return true; }
   bool DirtyCacheEnabled() const final {
     // We don't yet enable dirty cache for directory.
@@ -96,6 +100,25 @@ class Directory final : public VnodeMinfs, public fbl::Recyclable<Directory> {
 
   // Other, non-virtual methods:
 
+  // Returns true if the directory is hash indexed (see kMinfsInodeFlagDirIndex).
+  bool IsIndexed() const { return (GetInode()->flags & kMinfsInodeFlagDirIndex) != 0; }
+
+  // Returns the end of the leaf block holding the record at |off| in an indexed directory, or zero
+  // if the directory is not indexed.
+  size_t LeafEnd(size_t off);
+
+  // Reads the records of the index of an indexed directory, checking its header.
+  zx::status<std::vector<DirIndexEntry>> ReadDirIndex(PendingWork* transaction);
+  zx::status<> WriteDirIndex(Transaction* transaction, const std::vector<DirIndexEntry>& entries);
+
+  // Returns the file blocks of the leaves which may hold |name| in an indexed directory: the leaf
+  // which covers its hash, preceded by any leaves it continues.
+  zx::status<std::vector<uint32_t>> LookupLeaves(PendingWork* transaction, std::string_view name);
+
+  // Moves about half of the records in the leaf which covers |name| to a new leaf at the end of the
+  // indexed directory, or adds an empty continuation leaf if all of its names share its hash.
+  zx::status<> SplitLeaf(Transaction* transaction, std::string_view name);
+
   // Lookup which can traverse '..'
   zx::status<fbl::RefPtr<fs::Vnode>> LookupInternal(std::string_view name);
 
@@ -109,6 +132,9 @@ class Directory final : public VnodeMinfs, public fbl::Recyclable<Directory> {
   // On success returns true if the exit was a result of the callback, and false if the listing was
   // exhausted with no action taken.
   zx::status<bool> ForEachDirent(DirArgs* args, DirentCallback func);
+  // Enumerates the direntries from offset |start| up to |end|, as ForEachDirent does.
+  zx::status<bool> ForEachDirentInRange(DirArgs* args, DirentCallback func, size_t start,
+                                        size_t end);
 
   // Directory callback functions.
   //
@@ -129,9 +155,18 @@ class Directory final : public VnodeMinfs, public fbl::Recyclable<Directory> {
 
   static zx::status<IteratorCommand> NextDirent(Dirent* de, DirectoryOffset* offs);
 
+  // Looks for space for a direntry of |args->reclen| bytes named |args->name|, as
+  // DirentCallbackFindSpace does. If the leaves of an indexed directory which may hold the name are
+  // full, sets |args->split_leaf| and returns true unless the index is full too.
+  zx::status<bool> FindDirentSpace(DirArgs* args);
+
+  // Returns the number of blocks to reserve for AppendDirent, given the |args| which were passed
+  // to FindDirentSpace.
+  zx::status<blk_t> GetRequiredDirentBlocks(const DirArgs& args);
+
   // Appends a new directory at the specified offset within |args|. This requires a prior call to
-  // DirentCallbackFindSpace to find an offset where there is space for the direntry. It takes
-  // the same |args| that were passed into DirentCallbackFindSpace.
+  // FindDirentSpace to find an offset where there is space for the direntry. It takes the same
+  // |args| that were passed into FindDirentSpace.
   zx::status<> AppendDirent(DirArgs* args);
 
   zx::status<IteratorCommand> UnlinkChild(Transaction* transaction, fbl::RefPtr<VnodeMinfs> child,
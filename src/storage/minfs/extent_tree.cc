@@ -0,0 +1,483 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/extent_tree.h"
+
+#include <lib/syslog/cpp/macros.h>
+#include <stddef.h>
+#include <string.h>
+#include <zircon/assert.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include "src/storage/minfs/checksum.h"
+
+namespace minfs {
+
+struct ExtentTree::Node {
+  // Returns the number of records held by the node.
+  size_t size() const { return depth == 0 ? extents.size() : children.size(); }
+
+  uint16_t depth = 0;
+  // The block holding the node; zero for the root.
+  blk_t block = 0;
+  size_t slot = 0;
+  bool dirty = false;
+  // Leaf nodes only.
+  std::vector<Extent> extents;
+  // Interior nodes only: the first file block covered by each child, and the child. The first
+  // child also covers everything below its file block.
+  std::vector<std::pair<uint32_t, std::unique_ptr<Node>>> children;
+};
+
+struct ExtentTree::PathEntry {
+  Node* node;
+  // The index of the child followed from |node|.
+  size_t index;
+};
+
+namespace {
+
+const uint8_t* RootData(const Inode& inode) {
+  return reinterpret_cast<const uint8_t*>(&inode) + offsetof(Inode, dnum);
+}
+
+uint8_t* RootData(Inode* inode) {
+  return reinterpret_cast<uint8_t*>(inode) + offsetof(Inode, dnum);
+}
+
+uint64_t ExtentEnd(const Extent& extent) { return uint64_t{extent.file_block} + extent.length; }
+
+// Returns the first extent in the sorted |extents| which starts after |file_block|.
+template <typename Iterator>
+Iterator ExtentAfter(Iterator begin, Iterator end, uint64_t file_block) {
+  return std::upper_bound(begin, end, file_block, [](uint64_t file_block, const Extent& extent) {
+    return file_block < extent.file_block;
+  });
+}
+
+// Removes the mappings for file blocks [start, end) from the sorted |extents|. Returns true if
+// anything was removed.
+bool RemoveRange(std::vector<Extent>& extents, uint64_t start, uint64_t end) {
+  auto it = ExtentAfter(extents.begin(), extents.end(), start);
+  if (it != extents.begin() && ExtentEnd(*(it - 1)) > start)
+    --it;
+  bool changed = false;
+  while (it != extents.end() && it->file_block < end) {
+    changed = true;
+    const uint64_t extent_end = ExtentEnd(*it);
+    if (it->file_block < start) {
+      const uint32_t kept = static_cast<uint32_t>(start - it->file_block);
+      if (extent_end > end) {
+        // The range is in the middle of the extent, which has to be split in two.
+        const Extent tail = {
+            .file_block = static_cast<uint32_t>(end),
+            .length = static_cast<uint32_t>(extent_end - end),
+            .block = it->block + static_cast<blk_t>(end - it->file_block),
+        };
+        it->length = kept;
+        extents.insert(it + 1, tail);
+        break;
+      }
+      it->length = kept;
+      ++it;
+    } else if (extent_end > end) {
+      const uint32_t trimmed = static_cast<uint32_t>(end - it->file_block);
+      it->file_block += trimmed;
+      it->block += trimmed;
+      it->length -= trimmed;
+      break;
+    } else {
+      it = extents.erase(it);
+    }
+  }
+  return changed;
+}
+
+// Inserts |extent| into the sorted |extents|, which must not already map any of its file blocks,
+// merging it with its neighbours where the device blocks are contiguous.
+void InsertExtent(std::vector<Extent>& extents, const Extent& extent) {
+  auto next = ExtentAfter(extents.begin(), extents.end(), extent.file_block);
+  if (next != extents.begin()) {
+    auto prev = next - 1;
+    if (ExtentEnd(*prev) == extent.file_block && prev->block + prev->length == extent.block) {
+      prev->length += extent.length;
+      if (next != extents.end() && next->file_block == ExtentEnd(*prev) &&
+          next->block == prev->block + prev->length) {
+        prev->length += next->length;
+        extents.erase(next);
+      }
+      return;
+    }
+  }
+  if (next != extents.end() && ExtentEnd(extent) == next->file_block &&
+      extent.block + extent.length == next->block) {
+    next->file_block = extent.file_block;
+    next->block = extent.block;
+    next->length += extent.length;
+    return;
+  }
+  extents.insert(next, extent);
+}
+
+zx::status<> CorruptNode(const char* reason) {
+  FX_LOGS(ERROR) << "Invalid extent tree node: " << reason;
+  return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+}
+
+}  // namespace
+
+ExtentTree::ExtentTree(bool checksums) : checksums_(checksums), root_(std::make_unique<Node>()) {}
+
+ExtentTree::~ExtentTree() = default;
+
+std::unique_ptr<ExtentTree> ExtentTree::CreateEmpty(bool checksums) {
+  return std::unique_ptr<ExtentTree>(new ExtentTree(checksums));
+}
+
+zx::status<std::unique_ptr<ExtentTree>> ExtentTree::Load(const Inode& inode,
+                                                         const NodeReader& reader,
+                                                         bool checksums) {
+  std::unique_ptr<ExtentTree> tree(new ExtentTree(checksums));
+  const uint8_t* root = RootData(inode);
+  if (std::all_of(root, root + kMinfsExtentRootSize, [](uint8_t byte) { return byte == 0; }))
+    return zx::ok(std::move(tree));
+  if (auto status = tree->LoadNode(tree->root_.get(), root, kMinfsExtentRootSize, 0,
+                                   kMaxFileBlocks, /*depth=*/-1, reader);
+      status.is_error()) {
+    return status.take_error();
+  }
+  return zx::ok(std::move(tree));
+}
+
+zx::status<> ExtentTree::LoadNode(Node* node, const uint8_t* data, size_t size, uint64_t start,
+                                  uint64_t end, int depth, const NodeReader& reader) {
+  ExtentHeader header;
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != kMinfsExtentMagic)
+    return CorruptNode("bad magic");
+  if (header.depth > kMinfsMaxExtentDepth || (depth >= 0 && header.depth != depth))
+    return CorruptNode("bad depth");
+  node->depth = header.depth;
+  const uint8_t* records = data + sizeof(ExtentHeader);
+
+  if (header.depth == 0) {
+    if (header.count > (size - sizeof(ExtentHeader)) / sizeof(Extent))
+      return CorruptNode("too many extents");
+    node->extents.resize(header.count);
+    memcpy(node->extents.data(), records, header.count * sizeof(Extent));
+    uint64_t next = start;
+    for (const Extent& extent : node->extents) {
+      if (extent.length == 0 || extent.block == 0)
+        return CorruptNode("empty extent");
+      if (extent.file_block < next || ExtentEnd(extent) > end)
+        return CorruptNode("extent out of order");
+      next = ExtentEnd(extent);
+    }
+    return zx::ok();
+  }
+
+  if (header.count == 0 || header.count > (size - sizeof(ExtentHeader)) / sizeof(ExtentIndex))
+    return CorruptNode("bad index count");
+  std::vector<ExtentIndex> indices(header.count);
+  memcpy(indices.data(), records, header.count * sizeof(ExtentIndex));
+  auto buffer = std::make_unique<uint8_t[]>(kMinfsBlockSize);
+  node->children.reserve(indices.size());
+  for (size_t i = 0; i < indices.size(); ++i) {
+    const uint64_t child_start = i == 0 ? start : indices[i].file_block;
+    const uint64_t child_end = i + 1 < indices.size() ? indices[i + 1].file_block : end;
+    if (child_start < start || child_start >= child_end)
+      return CorruptNode("index out of order");
+    if (indices[i].block == 0)
+      return CorruptNode("bad index block");
+    if (auto status = reader(indices[i].block, buffer.get()); status.is_error())
+      return status.take_error();
+    if (checksums_ && !VerifyExtentNodeChecksum(indices[i].block, buffer.get()))
+      return CorruptNode("bad checksum");
+    auto child = std::make_unique<Node>();
+    child->block = indices[i].block;
+    child->slot = slot_count_++;
+    if (auto status = LoadNode(child.get(), buffer.get(), kMinfsBlockSize, child_start, child_end,
+                               header.depth - 1, reader);
+        status.is_error()) {
+      return status.take_error();
+    }
+    if (child->size() == 0)
+      return CorruptNode("empty node");
+    node->children.emplace_back(indices[i].file_block, std::move(child));
+  }
+  return zx::ok();
+}
+
+size_t ExtentTree::Capacity(const Node& node) const {
+  if (&node == root_.get())
+    return node.depth == 0 ? kMinfsExtentsPerRoot : kMinfsExtentIndicesPerRoot;
+  return node.depth == 0 ? kMinfsExtentsPerBlock : kMinfsExtentIndicesPerBlock;
+}
+
+ExtentTree::Node* ExtentTree::FindLeaf(uint64_t file_block, Path* path) const {
+  Node* node = root_.get();
+  while (node->depth > 0) {
+    // The first child covering a file block after |file_block|, less one.
+    auto next = std::upper_bound(
+        node->children.begin() + 1, node->children.end(), file_block,
+        [](uint64_t file_block, const auto& child) { return file_block < child.first; });
+    const size_t index = (next - node->children.begin()) - 1;
+    path->push_back({node, index});
+    node = node->children[index].second.get();
+  }
+  return node;
+}
+
+uint64_t ExtentTree::PathEnd(const Path& path) {
+  for (auto it = path.rbegin(); it != path.rend(); ++it) {
+    if (it->index + 1 < it->node->children.size())
+      return it->node->children[it->index + 1].first;
+  }
+  return kMaxFileBlocks;
+}
+
+std::pair<blk_t, uint64_t> ExtentTree::Lookup(uint64_t file_block, uint64_t max_blocks) const {
+  Path path;
+  const Node* leaf = FindLeaf(file_block, &path);
+  auto next = ExtentAfter(leaf->extents.begin(), leaf->extents.end(), file_block);
+  if (next != leaf->extents.begin()) {
+    const Extent& extent = *(next - 1);
+    if (file_block < ExtentEnd(extent)) {
+      return {extent.block + static_cast<blk_t>(file_block - extent.file_block),
+              std::min(ExtentEnd(extent) - file_block, max_blocks)};
+    }
+  }
+  const uint64_t unmapped_end = next != leaf->extents.end() ? next->file_block : PathEnd(path);
+  return {0, std::min(unmapped_end - file_block, max_blocks)};
+}
+
+bool ExtentTree::HasRoomToGrow(const Path& path, const Node& leaf) const {
+  // Removing a block from the middle of an extent and mapping it elsewhere adds two extents.
+  if (leaf.size() + 2 <= Capacity(leaf))
+    return true;
+  // Otherwise the leaf will split, adding a record to its parent, which might split in turn.
+  for (auto it = path.rbegin(); it != path.rend(); ++it) {
+    if (it->node->size() + 1 <= Capacity(*it->node))
+      return true;
+  }
+  return root_->depth < kMinfsMaxExtentDepth;
+}
+
+zx::status<> ExtentTree::Set(uint64_t file_block, blk_t block, NodeAllocator* allocator) {
+  ZX_ASSERT(file_block < kMaxFileBlocks);
+  Path path;
+  Node* leaf = FindLeaf(file_block, &path);
+  if (!HasRoomToGrow(path, *leaf))
+    return zx::error(ZX_ERR_NO_SPACE);
+  bool changed = RemoveRange(leaf->extents, file_block, file_block + 1);
+  if (block != 0) {
+    InsertExtent(leaf->extents, Extent{.file_block = static_cast<uint32_t>(file_block),
+                                       .length = 1,
+                                       .block = block});
+    changed = true;
+  }
+  if (changed) {
+    MarkDirty(leaf);
+    Rebalance(&path, leaf, allocator);
+  }
+  return zx::ok();
+}
+
+zx::status<> ExtentTree::Unmap(uint64_t file_block, uint64_t count, NodeAllocator* allocator) {
+  const uint64_t end = count < kMaxFileBlocks - file_block ? file_block + count : kMaxFileBlocks;
+  while (file_block < end) {
+    Path path;
+    Node* leaf = FindLeaf(file_block, &path);
+    const uint64_t leaf_end = std::min(PathEnd(path), end);
+    if (!HasRoomToGrow(path, *leaf))
+      return zx::error(ZX_ERR_NO_SPACE);
+    if (RemoveRange(leaf->extents, file_block, leaf_end)) {
+      MarkDirty(leaf);
+      Rebalance(&path, leaf, allocator);
+    }
+    file_block = leaf_end;
+  }
+  return zx::ok();
+}
+
+void ExtentTree::Rebalance(Path* path, Node* node, NodeAllocator* allocator) {
+  while (node != root_.get()) {
+    const PathEntry entry = path->back();
+    path->pop_back();
+    Node* parent = entry.node;
+    auto& children = parent->children;
+    if (node->size() == 0) {
+      ReleaseNode(node, allocator);
+      children.erase(children.begin() + entry.index);
+    } else if (node->size() > Capacity(*node)) {
+      // Move the upper half of the records into a new sibling.
+      auto sibling = std::make_unique<Node>();
+      sibling->depth = node->depth;
+      const size_t half = node->size() / 2;
+      uint32_t sibling_start;
+      if (node->depth == 0) {
+        sibling->extents.assign(node->extents.begin() + half, node->extents.end());
+        node->extents.erase(node->extents.begin() + half, node->extents.end());
+        sibling_start = sibling->extents.front().file_block;
+      } else {
+        std::move(node->children.begin() + half, node->children.end(),
+                  std::back_inserter(sibling->children));
+        node->children.erase(node->children.begin() + half, node->children.end());
+        sibling_start = sibling->children.front().first;
+      }
+      AttachNode(sibling.get(), allocator);
+      MarkDirty(node);
+      MarkDirty(sibling.get());
+      children.emplace(children.begin() + entry.index + 1, sibling_start, std::move(sibling));
+    } else {
+      return;
+    }
+    MarkDirty(parent);
+    node = parent;
+  }
+
+  Node* root = root_.get();
+  if (root->size() > Capacity(*root)) {
+    // The root lives in the inode, so it grows by moving its records into a new child.
+    auto child = std::make_unique<Node>();
+    child->depth = root->depth;
+    child->extents = std::move(root->extents);
+    child->children = std::move(root->children);
+    root->extents.clear();
+    root->children.clear();
+    AttachNode(child.get(), allocator);
+    MarkDirty(child.get());
+    ++root->depth;
+    root->children.emplace_back(0, std::move(child));
+    return;
+  }
+  if (root->depth > 0 && root->children.empty()) {
+    root->depth = 0;
+    return;
+  }
+  // Pull an only child up into the root for as long as it fits, so the tree shrinks again.
+  while (root->depth > 0 && root->children.size() == 1) {
+    Node* child = root->children.front().second.get();
+    const size_t capacity = child->depth == 0 ? kMinfsExtentsPerRoot : kMinfsExtentIndicesPerRoot;
+    if (child->size() > capacity)
+      break;
+    std::unique_ptr<Node> owned_child = std::move(root->children.front().second);
+    root->children.clear();
+    root->depth = child->depth;
+    root->extents = std::move(child->extents);
+    root->children = std::move(child->children);
+    ReleaseNode(child, allocator);
+  }
+}
+
+void ExtentTree::AttachNode(Node* node, NodeAllocator* allocator) {
+  ZX_ASSERT(allocator != nullptr);
+  node->block = allocator->AllocateNode();
+  ZX_ASSERT(node->block != 0);
+  if (free_slots_.empty()) {
+    node->slot = slot_count_++;
+  } else {
+    node->slot = free_slots_.back();
+    free_slots_.pop_back();
+  }
+}
+
+void ExtentTree::ReleaseNode(Node* node, NodeAllocator* allocator) {
+  ZX_ASSERT(allocator != nullptr);
+  allocator->FreeNode(node->block);
+  if (node->dirty)
+    dirty_nodes_.erase(std::find(dirty_nodes_.begin(), dirty_nodes_.end(), node));
+  free_slots_.push_back(node->slot);
+}
+
+void ExtentTree::MarkDirty(Node* node) {
+  // The root is written back to the inode by WriteRoot.
+  if (node == root_.get() || node->dirty)
+    return;
+  node->dirty = true;
+  dirty_nodes_.push_back(node);
+}
+
+void ExtentTree::Serialize(const Node& node, uint8_t* data, size_t size) const {
+  ZX_DEBUG_ASSERT(node.size() <= Capacity(node));
+  memset(data, 0, size);
+  const ExtentHeader header = {
+      .magic = kMinfsExtentMagic,
+      .depth = node.depth,
+      .count = static_cast<uint16_t>(node.size()),
+      .checksum = 0,
+  };
+  memcpy(data, &header, sizeof(header));
+  uint8_t* records = data + sizeof(header);
+  if (node.depth == 0) {
+    memcpy(records, node.extents.data(), node.extents.size() * sizeof(Extent));
+  } else {
+    for (const auto& [file_block, child] : node.children) {
+      const ExtentIndex index = {.file_block = file_block, .block = child->block};
+      memcpy(records, &index, sizeof(index));
+      records += sizeof(index);
+    }
+  }
+  if (checksums_ && &node != root_.get()) {
+    const uint16_t checksum = ExtentNodeChecksum(node.block, data);
+    memcpy(data + offsetof(ExtentHeader, checksum), &checksum, sizeof(checksum));
+  }
+}
+
+void ExtentTree::WriteRoot(Inode* inode) const {
+  uint8_t* data = RootData(inode);
+  if (root_->depth == 0 && root_->extents.empty()) {
+    memset(data, 0, kMinfsExtentRootSize);
+  } else {
+    Serialize(*root_, data, kMinfsExtentRootSize);
+  }
+}
+
+zx::status<> ExtentTree::Flush(const NodeWriter& writer) {
+  auto data = std::make_unique<uint8_t[]>(kMinfsBlockSize);
+  while (!dirty_nodes_.empty()) {
+    Node* node = dirty_nodes_.back();
+    Serialize(*node, data.get(), kMinfsBlockSize);
+    if (auto status = writer(node->slot, node->block, data.get()); status.is_error())
+      return status.take_error();
+    node->dirty = false;
+    dirty_nodes_.pop_back();
+  }
+  return zx::ok();
+}
+
+void ExtentTree::ForEachNode(
+    const fit::function<void(blk_t block, uint64_t file_block)>& callback) const {
+  std::vector<std::pair<const Node*, uint64_t>> stack = {{root_.get(), 0}};
+  while (!stack.empty()) {
+    auto [node, start] = stack.back();
+    stack.pop_back();
+    for (size_t i = 0; i < node->children.size(); ++i) {
+      const uint64_t child_start = i == 0 ? start : node->children[i].first;
+      callback(node->children[i].second->block, child_start);
+      stack.emplace_back(node->children[i].second.get(), child_start);
+    }
+  }
+}
+
+void ExtentTree::ForEachExtent(const fit::function<void(const Extent& extent)>& callback) const {
+  std::vector<const Node*> stack = {root_.get()};
+  while (!stack.empty()) {
+    const Node* node = stack.back();
+    stack.pop_back();
+    for (const Extent& extent : node->extents) {
+      callback(extent);
+    }
+    // Push in reverse so that children are visited in file block order.
+    for (auto it = node->children.rbegin(); it != node->children.rend(); ++it) {
+      stack.push_back(it->second.get());
+    }
+  }
+}
+
+uint16_t ExtentTree::depth() const { return root_->depth; }
+
+}  // namespace minfs
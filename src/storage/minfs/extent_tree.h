@@ -0,0 +1,147 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// This file describes the in-memory form of the extent tree used by extent-mapped inodes.
+
+#ifndef SRC_STORAGE_MINFS_EXTENT_TREE_H_
+#define SRC_STORAGE_MINFS_EXTENT_TREE_H_
+
+#include <lib/fit/function.h>
+#include <lib/zx/status.h>
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "src/storage/minfs/format.h"
+
+namespace minfs {
+
+// Maps the file blocks of an extent-mapped inode to device blocks. The whole tree is held in
+// memory once loaded; see format.h for the on-disk layout.
+//
+// The root of the tree lives in the inode and is copied back into it with WriteRoot. Other nodes
+// occupy blocks which are allocated and freed through a NodeAllocator as the tree grows and
+// shrinks; modified nodes are written out by Flush.
+//
+// This class is thread-compatible.
+class ExtentTree {
+ public:
+  // Reads node |block|, relative to the start of the data section, into the kMinfsBlockSize bytes
+  // at |data|.
+  using NodeReader = fit::function<zx::status<>(blk_t block, void* data)>;
+
+  // Writes the kMinfsBlockSize bytes at |data| to node |block|. |slot| is a small index which
+  // identifies the node for as long as it is part of the tree, and can be used to stage the data.
+  using NodeWriter = fit::function<zx::status<>(size_t slot, blk_t block, const void* data)>;
+
+  // Allocates and frees the blocks which hold nodes other than the root.
+  class NodeAllocator {
+   public:
+    virtual ~NodeAllocator() = default;
+
+    // Returns a newly allocated block, relative to the start of the data section.
+    virtual blk_t AllocateNode() = 0;
+
+    // Frees a block previously returned by AllocateNode or loaded as part of the tree.
+    virtual void FreeNode(blk_t block) = 0;
+  };
+
+  // The number of file blocks an extent tree can address.
+  static constexpr uint64_t kMaxFileBlocks = uint64_t{1} << 32;
+
+  // Returns a tree with no mappings. If |checksums| is true, nodes other than the root carry
+  // checksums (see ExtentHeader), which are verified when they are loaded and set when they are
+  // flushed.
+  static std::unique_ptr<ExtentTree> CreateEmpty(bool checksums);
+
+  // Loads the tree rooted in |inode|, reading its other nodes with |reader|. Returns
+  // ZX_ERR_IO_DATA_INTEGRITY if the tree is malformed. |checksums| is as for CreateEmpty.
+  static zx::status<std::unique_ptr<ExtentTree>> Load(const Inode& inode, const NodeReader& reader,
+                                                      bool checksums);
+
+  ExtentTree(const ExtentTree&) = delete;
+  ExtentTree& operator=(const ExtentTree&) = delete;
+  ~ExtentTree();
+
+  // Returns the block mapped at |file_block| (zero if it is unmapped) and the length, at most
+  // |max_blocks|, of the run starting at |file_block| which is either mapped to contiguous blocks
+  // or entirely unmapped. For simplicity the run might be shorter than it could be.
+  std::pair<blk_t, uint64_t> Lookup(uint64_t file_block, uint64_t max_blocks) const;
+
+  // Maps |file_block| to |block|, or unmaps it if |block| is zero. Returns ZX_ERR_NO_SPACE,
+  // leaving the tree unchanged, if the tree would grow deeper than kMinfsMaxExtentDepth.
+  [[nodiscard]] zx::status<> Set(uint64_t file_block, blk_t block, NodeAllocator* allocator);
+
+  // Unmaps the |count| file blocks from |file_block|. The blocks themselves are not freed.
+  [[nodiscard]] zx::status<> Unmap(uint64_t file_block, uint64_t count, NodeAllocator* allocator);
+
+  // Copies the root of the tree into the block pointer area of |inode|.
+  void WriteRoot(Inode* inode) const;
+
+  // Returns true if nodes other than the root have been modified since the last Flush.
+  bool IsDirty() const { return !dirty_nodes_.empty(); }
+
+  // Writes all the modified nodes other than the root using |writer|.
+  [[nodiscard]] zx::status<> Flush(const NodeWriter& writer);
+
+  // Calls |callback| for every node other than the root, with the node's block and the first file
+  // block it covers.
+  void ForEachNode(const fit::function<void(blk_t block, uint64_t file_block)>& callback) const;
+
+  // Calls |callback| for every extent, in file block order.
+  void ForEachExtent(const fit::function<void(const Extent& extent)>& callback) const;
+
+  // Returns the depth of the tree; zero if the root holds the extents.
+  uint16_t depth() const;
+
+ private:
+  struct Node;
+  struct PathEntry;
+  using Path = std::vector<PathEntry>;
+
+  explicit ExtentTree(bool checksums);
+
+  // Loads |node| from the serialized |data| of |size| bytes. Its extents must fall within
+  // [|start|, |end|) and, unless |depth| is negative, its depth must be |depth|.
+  zx::status<> LoadNode(Node* node, const uint8_t* data, size_t size, uint64_t start,
+                        uint64_t end, int depth, const NodeReader& reader);
+
+  // Returns the maximum number of records |node| can hold.
+  size_t Capacity(const Node& node) const;
+
+  // Returns the leaf covering |file_block|, filling |path| with the interior nodes leading to it.
+  Node* FindLeaf(uint64_t file_block, Path* path) const;
+
+  // Returns the file block at which the coverage of the leaf reached through |path| ends.
+  static uint64_t PathEnd(const Path& path);
+
+  // Returns true if the leaf at the end of |path| can take on two more extents, splitting nodes on
+  // the way to the root if necessary, without exceeding kMinfsMaxExtentDepth.
+  bool HasRoomToGrow(const Path& path, const Node& leaf) const;
+
+  // Restores the invariants of the tree after |node|, at the end of |path|, was modified: nodes
+  // which overflow are split and nodes which are empty are removed.
+  void Rebalance(Path* path, Node* node, NodeAllocator* allocator);
+
+  // Allocates a block for |node| and gives it a slot.
+  void AttachNode(Node* node, NodeAllocator* allocator);
+
+  // Frees the block and the slot used by |node|, which is no longer part of the tree.
+  void ReleaseNode(Node* node, NodeAllocator* allocator);
+
+  void MarkDirty(Node* node);
+  void Serialize(const Node& node, uint8_t* data, size_t size) const;
+
+  const bool checksums_;
+  std::unique_ptr<Node> root_;
+  std::vector<Node*> dirty_nodes_;
+  std::vector<size_t> free_slots_;
+  size_t slot_count_ = 0;
+};
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_EXTENT_TREE_H_
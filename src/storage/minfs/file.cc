@@ -37,6 +37,7 @@
 
 #include "src/storage/minfs/file.h"
 #include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/trace.h"
 #include "src/storage/minfs/unowned_vmo_buffer.h"
 #include "src/storage/minfs/vnode.h"
 
@@ -71,17 +72,17 @@ void File::AllocateAndCommitData(std::unique_ptr<Transaction> transaction) {
                   expected_blocks, max_blocks);
 
     if (expected_blocks == 0) {
-      if (GetInode()->size != allocation_state_.GetNodeSize()) {
-        GetMutableInode()->size = allocation_state_.GetNodeSize();
+      if (GetInodeSize(*GetInode()) != allocation_state_.GetNodeSize()) {
+        SetInodeSize(GetMutableInode(), allocation_state_.GetNodeSize());
       }
 
       // Since we may have pending reservations from an expected update, reset the allocation
       // state. This may happen if the same block range is allocated and de-allocated (e.g.
       // written and truncated), before the state is resolved.
-      blk_t alloc_node_size = allocation_state_.GetNodeSize();
-      ZX_ASSERT_MSG(alloc_node_size == GetInode()->size,
-                    "Allocation nodesize:%u does not match actual node size:%u", alloc_node_size,
-                    GetInode()->size);
+      uint64_t alloc_node_size = allocation_state_.GetNodeSize();
+      ZX_ASSERT_MSG(alloc_node_size == GetInodeSize(*GetInode()),
+                    "Allocation nodesize:%lu does not match actual node size:%lu", alloc_node_size,
+                    GetInodeSize(*GetInode()));
       allocation_state_.Reset(allocation_state_.GetNodeSize());
       ZX_DEBUG_ASSERT(allocation_state_.IsEmpty());
       break;
@@ -112,19 +113,19 @@ void File::AllocateAndCommitData(std::unique_ptr<Transaction> transaction) {
 
     // Since we are updating the file in "chunks", only update the on-disk inode size
     // with the portion we've written so far.
-    blk_t last_byte = static_cast<blk_t>((bno_start + bno_count) * Vfs()->BlockSize());
+    uint64_t last_byte = (uint64_t{bno_start} + bno_count) * Vfs()->BlockSize();
     ZX_ASSERT_MSG(last_byte <= fbl::round_up(allocation_state_.GetNodeSize(), Vfs()->BlockSize()),
-                  "Offset :%u to be updated is beyond the allowed nodesize :%lu", last_byte,
+                  "Offset :%lu to be updated is beyond the allowed nodesize :%lu", last_byte,
                   fbl::round_up(allocation_state_.GetNodeSize(), Vfs()->BlockSize()));
 
-    if (last_byte > GetInode()->size && last_byte < allocation_state_.GetNodeSize()) {
+    if (last_byte > GetInodeSize(*GetInode()) && last_byte < allocation_state_.GetNodeSize()) {
       // If we have written past the end of the recorded size but have not yet reached the
       // allocated size, update the recorded size to the last byte written.
-      GetMutableInode()->size = last_byte;
+      SetInodeSize(GetMutableInode(), last_byte);
     } else if (allocation_state_.GetNodeSize() <= last_byte) {
       // If we have just written to the allocated inode size, update the recorded size
       // accordingly.
-      GetMutableInode()->size = allocation_state_.GetNodeSize();
+      SetInodeSize(GetMutableInode(), allocation_state_.GetNodeSize());
     }
 
     // In the future we could resolve on a per state (i.e. reservation) basis, but since swaps
@@ -173,7 +174,10 @@ zx::status<> File::BlocksSwap(Transaction* transaction, blk_t start, blk_t count
     }
     // For copy-on-write, swap the block out if it's a data block.
     blk_t new_block = old_block;
-    Vfs()->BlockSwap(transaction, old_block, &new_block);
+    Vfs()->BlockSwap(transaction, old_block, &new_block, allocation_goal_);
+    if (allocation_goal_) {
+      allocation_goal_ = new_block + 1;
+    }
     status = iterator.SetBlk(new_block);
     if (status.is_error())
       return status.take_error();
@@ -209,14 +213,14 @@ uint64_t File::GetSize() const {
 #ifdef __Fuchsia__
   return allocation_state_.GetNodeSize();
 #endif
-  return GetInode()->size;
+  return GetInodeSize(*GetInode());
 }
 
-void File::SetSize(uint32_t new_size) {
+void File::SetSize(uint64_t new_size) {
 #ifdef __Fuchsia__
   allocation_state_.SetNodeSize(new_size);
 #else
-  GetMutableInode()->size = new_size;
+  SetInodeSize(GetMutableInode(), new_size);
 #endif
 }
 
@@ -254,6 +258,17 @@ void File::DeleteBlock(PendingWork* transaction, blk_t local_bno, blk_t old_bno,
 #endif
 }
 
+void File::DeleteBlocks(PendingWork* transaction, blk_t local_bno, blk_t old_bno, blk_t count) {
+  transaction->DeallocateBlocks(old_bno, count);
+  GetMutableInode()->block_count -= count;
+#ifdef __Fuchsia__
+  // Remove these blocks from the pending allocation map in case they are set so we do not
+  // proceed to allocate new blocks.
+  const blk_t cleared = allocation_state_.ClearPendingAllocated(local_bno, count);
+  Vfs()->InspectTree()->SubtractDirtyBytes(uint64_t{cleared} * Vfs()->BlockSize());
+#endif
+}
+
 #ifdef __Fuchsia__
 void File::IssueWriteback(Transaction* transaction, blk_t vmo_offset, blk_t dev_offset,
                           blk_t block_count) {
@@ -266,7 +281,7 @@ bool File::HasPendingAllocation(blk_t vmo_offset) {
 
 void File::CancelPendingWriteback() {
   // Drop all pending writes, revert the size of the inode to the "pre-pending-write" size.
-  allocation_state_.Reset(GetInode()->size);
+  allocation_state_.Reset(GetInodeSize(*GetInode()));
 }
 
 #endif
@@ -292,8 +307,21 @@ zx_status_t File::Read(void* data, size_t len, size_t off, size_t* out_actual) {
 }
 
 zx::status<uint32_t> File::GetRequiredBlockCount(size_t offset, size_t length) {
+  if (IsInline()) {
+    if (offset + length <= kMinfsInlineDataSize) {
+      return zx::ok(0);
+    }
+    // The write converts the file to blocks, which also needs a block for the existing data if
+    // the write doesn't cover it. None of the file's blocks can be pending yet.
+    auto data_blocks = ::minfs::GetRequiredBlockCount(Vfs()->Info(), offset, length);
+    if (data_blocks.is_error() || offset < Vfs()->BlockSize() || GetSize() == 0) {
+      return data_blocks;
+    }
+    return zx::ok(data_blocks.value() + 1);
+  }
+
   zx::status<blk_t> uncached = zx::error(ZX_ERR_INVALID_ARGS);
-  uncached = ::minfs::GetRequiredBlockCount(offset, length, Vfs()->BlockSize());
+  uncached = ::minfs::GetRequiredBlockCount(Vfs()->Info(), offset, length);
   if (!DirtyCacheEnabled()) {
     return uncached;
   }
@@ -364,10 +392,17 @@ zx_status_t File::Write(const void* data, size_t len, size_t offset, size_t* out
     }
 
     auto new_size_or = safemath::CheckAdd(offset, len);
-    if (!new_size_or.IsValid() || new_size_or.ValueOrDie() > kMinfsMaxFileSize) {
+    if (!new_size_or.IsValid() || new_size_or.ValueOrDie() > Vfs()->Info().MaxFileSize()) {
       return ZX_ERR_FILE_BIG;
     }
 
+    // The file must not regain blocks which an earlier truncation has yet to release.
+    if (new_size_or.ValueOrDie() > GetSize()) {
+      if (auto status = FinishRelease(); status.is_error()) {
+        return status.error_value();
+      }
+    }
+
     // If this file's pending blocks have crossed a limit or if there are no free blocks in the
     // filesystem, try to flush before we proceed.
     if (zx::status status = CheckAndFlush(false, len, offset); status.is_error()) {
@@ -385,9 +420,15 @@ zx_status_t File::Write(const void* data, size_t len, size_t offset, size_t* out
       return transaction_or.error_value();
     }
     std::unique_ptr<Transaction> transaction = std::move(transaction_or.value());
+    // A file which outgrows its inline data must have blocks before any of them can be pending.
+    if (IsInline() && offset + len > kMinfsInlineDataSize) {
+      if (auto status = ConvertInlineToBlocks(transaction.get()); status.is_error()) {
+        return status.error_value();
+      }
+    }
     // We mark block that has writes pending only after we have enough blocks reserved through
     // BeginTransaction or through ContinueTransaction.
-    if (DirtyCacheEnabled()) {
+    if (DirtyCacheEnabled() && !IsInline()) {
       if (auto status = MarkRequiredBlocksPending(offset, len, *transaction); status.is_error()) {
         return status.error_value();
       }
@@ -402,6 +443,7 @@ zx_status_t File::Write(const void* data, size_t len, size_t offset, size_t* out
     if (*out_actual == 0) {
       return ZX_OK;
     }
+    Vfs()->GetWriteAmplification().RecordLogicalWrite(*out_actual);
 
     // If anything was written, enqueue operations allocated within WriteInternal.
     UpdateModificationTime();
@@ -420,7 +462,7 @@ zx_status_t File::Append(const void* data, size_t len, size_t* out_end, size_t*
 zx_status_t File::Truncate(size_t len) {
   TRACE_DURATION("minfs", "File::Truncate");
   return Vfs()->GetNodeOperations()->truncate.Track([&] {
-    if (len > kMinfsMaxFileSize) {
+    if (len > Vfs()->Info().MaxFileSize()) {
       return ZX_ERR_INVALID_ARGS;
     }
 
@@ -431,6 +473,13 @@ zx_status_t File::Truncate(size_t len) {
       return status.error_value();
     }
 
+    // The file must not regain blocks which an earlier truncation has yet to release.
+    if (len > GetSize()) {
+      if (auto status = FinishRelease(); status.is_error()) {
+        return status.error_value();
+      }
+    }
+
     // Due to file copy-on-write, up to 1 new (data) block may be required.
     size_t reserve_blocks = 1;
 
@@ -450,7 +499,15 @@ zx_status_t File::Truncate(size_t len) {
     UpdateModificationTime();
     auto result = FlushTransaction(std::move(transaction_or.value()), true);
     ZX_ASSERT_MSG(result.is_ok(), "Failed to force sync inode: %u", result.status_value());
-    return ZX_OK;
+
+    // A large truncation only persists the new size, and leaves the blocks beyond it to be
+    // released in transactions of their own (see TruncateInternal).
+#ifdef __Fuchsia__
+    if (Vfs()->ShouldDeferPurge(*this)) {
+      return ZX_OK;
+    }
+#endif
+    return FinishRelease().status_value();
   });
 }
 
@@ -37,16 +37,28 @@ class File final : public VnodeMinfs, public fbl::Recyclable<File> {
   // Required for memory management, see the class comment above Vnode for more.
   void fbl_recycle() { RecycleNode(); }
 
+#ifdef __Fuchsia__
+  // Moves the data blocks of the file from |*file_block| up to |*file_block + max_blocks| to newly
+  // allocated blocks, through the same copy-on-write path as a write to them. Each new block is
+  // |*goal| if that is free, and the first free block otherwise, and |*goal| then moves to the
+  // block after it; passing zero for |*goal| allocates first fit. Advances |*file_block| past the
+  // range and returns whether any of the file remains beyond it. Fails with ZX_ERR_SHOULD_WAIT
+  // while the file has writes of its own waiting to be flushed. |max_blocks| must be no more than
+  // the number of blocks a file may hold dirty.
+  zx::status<bool> RelocateBlocks(uint64_t* file_block, uint64_t max_blocks, blk_t* goal);
+#endif
+
  private:
   zx::status<> CanUnlink() const final;
 
   // minfs::Vnode interface.
   blk_t GetBlockCount() const final;
   uint64_t GetSize() const final;
-  void SetSize(uint32_t new_size) final;
+  void SetSize(uint64_t new_size) final;
   void AcquireWritableBlock(Transaction* transaction, blk_t local_bno, blk_t old_bno,
                             blk_t* out_bno) final;
   void DeleteBlock(PendingWork* transaction, blk_t local_bno, blk_t old_bno, bool indirect) final;
+  void DeleteBlocks(PendingWork* transaction, blk_t local_bno, blk_t old_bno, blk_t count) final;
   bool IsDirectory() const final { return false; }
 #ifdef __Fuchsia__
   void IssueWriteback(Transaction* transaction, blk_t vmo_offset, blk_t dev_offset,
@@ -126,6 +138,10 @@ class File final : public VnodeMinfs, public fbl::Recyclable<File> {
   // Transaction object is held, as it may be modified asynchronously by the DataBlockAssigner
   // thread.
   PendingAllocationData allocation_state_;
+
+  // The block BlocksSwap should allocate next, or zero to allocate first fit. Only set while
+  // RelocateBlocks flushes the blocks it moves.
+  blk_t allocation_goal_ = 0;
 #endif
 
   std::unique_ptr<CachedBlockTransaction> cached_transaction_ __TA_GUARDED(mutex_);
@@ -6,6 +6,9 @@
 
 #include <lib/syslog/cpp/macros.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "src/lib/storage/vfs/cpp/trace.h"
 #include "src/storage/minfs/file.h"
 #include "src/storage/minfs/minfs_private.h"
@@ -28,8 +31,9 @@ File::~File() {
   ZX_ASSERT_MSG(allocation_state_.GetTotalPending() == 0 || Vfs()->IsJournalErrored(),
                 "File was found dirty");
   DropCachedWrites();
-  ZX_ASSERT_MSG(allocation_state_.GetNodeSize() == GetInode()->size || Vfs()->IsJournalErrored(),
-                "File being destroyed with pending updates to the inode size");
+  ZX_ASSERT_MSG(
+      allocation_state_.GetNodeSize() == GetInodeSize(*GetInode()) || Vfs()->IsJournalErrored(),
+      "File being destroyed with pending updates to the inode size");
 }
 
 bool File::DirtyCacheEnabled() const { return true; }
@@ -42,10 +46,14 @@ bool File::IsDirty() const {
 zx::status<> File::WalkFileBlocks(size_t offset, size_t length,
                                   WalkWriteBlockHandlerType& handler) {
   ZX_ASSERT(DirtyCacheEnabled());
+  if (IsInline()) {
+    // Inline data has no blocks, so none of them can be pending.
+    return zx::ok();
+  }
   blk_t start_block = static_cast<blk_t>(offset / Vfs()->BlockSize());
   blk_t end_block =
       static_cast<blk_t>((offset + length + Vfs()->BlockSize() - 1) / Vfs()->BlockSize());
-  size_t aligned_length = (end_block - start_block) * Vfs()->BlockSize();
+  size_t aligned_length = size_t{end_block - start_block} * Vfs()->BlockSize();
   while (aligned_length > 0) {
     VnodeMapper mapper(this);
     VnodeIterator iterator;
@@ -173,6 +181,65 @@ zx::status<> File::FlushCachedWrites() {
   return ForceFlushTransaction(std::move(transaction));
 }
 
+zx::status<bool> File::RelocateBlocks(uint64_t* file_block, uint64_t max_blocks, blk_t* goal) {
+  ZX_ASSERT(max_blocks <= kDirtyBlocksPerFile);
+  if (IsInline() || IsUnlinked()) {
+    return zx::error(ZX_ERR_BAD_STATE);
+  }
+  if (IsDirty() || allocation_state_.GetTotalPending() != 0) {
+    return zx::error(ZX_ERR_SHOULD_WAIT);
+  }
+  // The moved blocks are written from the VMO, so it must hold the file's data first.
+  if (auto status = InitVmo(); status.is_error()) {
+    return status.take_error();
+  }
+
+  const uint64_t block_size = Vfs()->BlockSize();
+  const uint64_t file_blocks = fbl::round_up(GetSize(), block_size) / block_size;
+  const uint64_t end = std::min(file_blocks, *file_block + max_blocks);
+  if (*file_block >= end) {
+    return zx::ok(false);
+  }
+  const size_t offset = *file_block * block_size;
+  const size_t length = (end - *file_block) * block_size;
+  auto reserve_blocks_or = GetRequiredBlockCount(offset, length);
+  if (reserve_blocks_or.is_error()) {
+    return reserve_blocks_or.take_error();
+  }
+  auto transaction_or = Vfs()->BeginTransaction(0, reserve_blocks_or.value());
+  if (transaction_or.is_error()) {
+    return transaction_or.take_error();
+  }
+
+  // Marking the mapped blocks pending is enough for AllocateAndCommitData to swap each of them for
+  // a new block and write the VMO's copy of it there. Holes are left alone.
+  std::vector<uint32_t> mapped_blocks;
+  WalkWriteBlockHandlerType find_mapped = [&mapped_blocks](uint32_t block, bool allocated,
+                                                           bool is_pending) -> zx::status<> {
+    if (allocated) {
+      mapped_blocks.push_back(block);
+    }
+    return zx::ok();
+  };
+  if (auto status = WalkFileBlocks(offset, length, find_mapped); status.is_error()) {
+    return status.take_error();
+  }
+  for (uint32_t block : mapped_blocks) {
+    allocation_state_.SetPending(block, true);
+    Vfs()->InspectTree()->AddDirtyBytes(block_size);
+  }
+
+  allocation_goal_ = *goal;
+  auto status = ForceFlushTransaction(std::move(transaction_or.value()));
+  *goal = allocation_goal_;
+  allocation_goal_ = 0;
+  if (status.is_error()) {
+    return status.take_error();
+  }
+  *file_block = end;
+  return zx::ok(end < file_blocks);
+}
+
 zx::status<bool> File::ShouldFlush(bool is_truncate, size_t length, size_t offset) {
   if (!DirtyCacheEnabled()) {
     std::lock_guard lock(mutex_);
@@ -213,12 +280,12 @@ zx::status<> File::FlushTransaction(std::unique_ptr<Transaction> transaction, bo
     // This allows us to avoid "only setting GetInode()->size" in the data task responsible for
     // calling "AllocateAndCommitData()".
     if (allocation_state_.IsEmpty()) {
-      GetMutableInode()->size = allocation_state_.GetNodeSize();
+      SetInodeSize(GetMutableInode(), allocation_state_.GetNodeSize());
     }
     return ForceFlushTransaction(std::move(transaction));
   }
 
-  GetMutableInode()->size = allocation_state_.GetNodeSize();
+  SetInodeSize(GetMutableInode(), allocation_state_.GetNodeSize());
   {
     std::lock_guard lock(mutex_);
     ZX_ASSERT(cached_transaction_ == nullptr);
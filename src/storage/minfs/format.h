@@ -9,11 +9,13 @@
 
 #include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <zircon/assert.h>
 #include <zircon/types.h>
 
 #include <limits>
+#include <string_view>
 
 #include <fbl/algorithm.h>
 
@@ -44,11 +46,37 @@ constexpr uint64_t kMinfsMagic1         = (0x385000d3d3d3d304ULL);
 //
 // See //src/storage/docs/versioning.md for more.
 constexpr uint32_t kMinfsCurrentMajorVersion = 9u;
-constexpr uint32_t kMinfsCurrentMinorVersion = 2u;
+constexpr uint32_t kMinfsCurrentMinorVersion = 3u;
+
+// The minor version at which lazy inode table initialisation (kMinfsFlagLazyInodeTable) was
+// introduced.
+constexpr uint32_t kMinfsMinorVersionLazyInodeTable = 3u;
+
+// The major version of volumes which may use format features that older drivers don't understand.
+// The features a volume uses are recorded by the kMinfsFeatureFlags bits of |Superblock::flags|,
+// and a driver must not access a volume with flags it doesn't know. Such volumes can only be
+// created by asking Mkfs for a feature, and always have at least one feature flag set; volumes of
+// kMinfsCurrentMajorVersion use none of them and remain fully supported.
+constexpr uint32_t kMinfsMajorVersionFeatures = 10u;
 
 constexpr ino_t    kMinfsRootIno        = 1;
 constexpr uint32_t kMinfsFlagClean      = 0x00000001;  // Currently unused,
 constexpr uint32_t kMinfsFlagFVM        = 0x00000002;  // Mounted on FVM.
+constexpr uint32_t kMinfsFlagLazyInodeTable = 0x00000004;  // Inode table initialised on demand.
+constexpr uint32_t kMinfsFlagExtents    = 0x00000008;  // Inodes map blocks with extent trees.
+constexpr uint32_t kMinfsFlagInlineData = 0x00000010;  // Small inodes may hold their data inline.
+constexpr uint32_t kMinfsFlagLargeFiles = 0x00000020;  // Inode sizes are 64 bits.
+constexpr uint32_t kMinfsFlagDirIndex   = 0x00000040;  // Directories are hash indexed.
+// Metadata carries CRC32C checksums: inodes, extent tree nodes and directory index blocks in their
+// own fields, and bitmaps, indirect blocks and directory blocks in the checksum table.
+constexpr uint32_t kMinfsFlagChecksums  = 0x00000080;
+// Flags describing format features, which require kMinfsMajorVersionFeatures.
+constexpr uint32_t kMinfsFeatureFlags   = kMinfsFlagExtents | kMinfsFlagInlineData |
+                                          kMinfsFlagLargeFiles | kMinfsFlagDirIndex |
+                                          kMinfsFlagChecksums;
+// All the flags this driver understands.
+constexpr uint32_t kMinfsKnownFlags     = kMinfsFlagClean | kMinfsFlagFVM |
+                                          kMinfsFlagLazyInodeTable | kMinfsFeatureFlags;
 constexpr uint32_t kMinfsBlockSize      = 8192;
 constexpr uint32_t kMinfsBlockBits      = (kMinfsBlockSize * 8);
 constexpr uint32_t kMinfsInodeSize      = 256;
@@ -61,6 +89,9 @@ constexpr uint32_t kMinfsDoublyIndirect = 1;
 constexpr uint32_t kMinfsDirectPerIndirect  = (kMinfsBlockSize / sizeof(blk_t));
 constexpr uint32_t kMinfsDirectPerDindirect = kMinfsDirectPerIndirect * kMinfsDirectPerIndirect;
 
+// The number of checksum table entries (see Superblock::csum_block) in one block.
+constexpr uint32_t kMinfsChecksumsPerBlock = (kMinfsBlockSize / sizeof(uint32_t));
+
 // It is not possible to have a block at or past this one due to the limitations of the inode and
 // indirect blocks.
 // TODO(fxbug.dev/31412): Remove this artificial cap when MinFS can safely deal with files larger than 4GB.
@@ -69,6 +100,14 @@ constexpr uint64_t kMinfsMaxFileBlock =
 
 constexpr uint64_t kMinfsMaxFileSize = kMinfsMaxFileBlock * kMinfsBlockSize;
 
+// On volumes with kMinfsFlagLargeFiles the cap above does not apply, and files may use every block
+// their inodes can address: those reached through the direct, indirect and doubly indirect block
+// pointers, or those with a 32-bit file block number in an extent tree.
+constexpr uint64_t kMinfsMaxPointerFileBlock = kMinfsDirect +
+                                               kMinfsIndirect * kMinfsDirectPerIndirect +
+                                               kMinfsDoublyIndirect * kMinfsDirectPerDindirect;
+constexpr uint64_t kMinfsMaxExtentFileBlock = std::numeric_limits<uint32_t>::max();
+
 constexpr uint32_t kMinfsTypeFile = 8;
 constexpr uint32_t kMinfsTypeDir  = 4;
 
@@ -141,8 +180,10 @@ struct Superblock {
                               // superblock).
   uint32_t dat_slices;        // Slices allocated to file data section.
 
-  uint32_t unlinked_head;  // Index to the first unlinked (but open) inode.
-  uint32_t unlinked_tail;  // Index to the last unlinked (but open) inode.
+  // Indices to the first and last unlinked (but open) inodes. The list also holds linked files
+  // whose blocks beyond their size are still being released after a truncation.
+  uint32_t unlinked_head;
+  uint32_t unlinked_tail;
 
   // Records the oldest revision of Minfs code that has touched this volume. It can be used for
   // example by fsck to determine what checks should be strict and what should be warnings. This
@@ -152,7 +193,30 @@ struct Superblock {
   // See //src/storage/docs/versioning.md
   uint32_t oldest_minor_version;
 
-  uint32_t reserved[2018];
+  // The following field is only valid with (flags & kMinfsFlagLazyInodeTable):
+  // Number of inode table blocks, starting from the first, that have been initialised. Blocks at
+  // or beyond this mark may contain stale data and have their free slots zeroed before first use.
+  // Allocated inodes may lie beyond the mark, since each block is initialised as it is first
+  // written and the mark only passes it once every block before it has been initialised too.
+  uint32_t ino_init_blocks;
+
+  // The following fields are only valid with (flags & kMinfsFlagChecksums):
+  // The checksum table holds a CRC32C for each of the first |csum_ibm_blocks| inode bitmap blocks,
+  // |csum_abm_blocks| block bitmap blocks and |csum_dat_blocks| data blocks, in that order. It
+  // occupies the |csum_blocks| data blocks starting at data block |csum_block|, which have no
+  // entries of their own. An entry of zero means that the block has no checksum, as for data blocks
+  // holding file contents; otherwise it is ChecksumTable::BlockChecksum of the block.
+  uint32_t csum_block;
+  uint32_t csum_blocks;
+  uint32_t csum_ibm_blocks;
+  uint32_t csum_abm_blocks;
+  uint32_t csum_dat_blocks;
+
+  // The following field is only valid with (flags & kMinfsFlagDirIndex):
+  // The key of DirentHash(), chosen at random when the volume is formatted.
+  uint32_t dir_hash_seed[2];
+
+  uint32_t reserved[2010];
 
   uint32_t BlockSize() const {
     // Either intentionally or unintenttionally, we do not want to change block
@@ -167,6 +231,44 @@ struct Superblock {
   // Returns true if kMinfsFlagFVM is set for superblock.
   bool GetFlagFvm() const { return (flags & kMinfsFlagFVM) == kMinfsFlagFVM; }
 
+  // Returns true if kMinfsFlagLazyInodeTable is set for superblock.
+  bool GetFlagLazyInodeTable() const {
+    return (flags & kMinfsFlagLazyInodeTable) == kMinfsFlagLazyInodeTable;
+  }
+
+  // Returns true if inodes map their blocks with extent trees.
+  bool UsesExtents() const { return (flags & kMinfsFlagExtents) != 0; }
+
+  // Returns true if newly created inodes hold their data inline until it outgrows them.
+  bool UsesInlineData() const { return (flags & kMinfsFlagInlineData) != 0; }
+
+  // Returns true if inode sizes use |Inode::size_high| as well as |Inode::size|.
+  bool UsesLargeFiles() const { return (flags & kMinfsFlagLargeFiles) != 0; }
+
+  // Returns true if newly created directories are hash indexed.
+  bool UsesDirIndex() const { return (flags & kMinfsFlagDirIndex) != 0; }
+
+  // Returns true if allocated inodes carry a checksum in |Inode::checksum|, as do extent tree nodes
+  // and directory index blocks in their headers, and other metadata blocks in the checksum table.
+  bool UsesChecksums() const { return (flags & kMinfsFlagChecksums) != 0; }
+
+  // Returns the file block at or past which no file on this volume may have a block.
+  uint64_t MaxFileBlock() const {
+    if (!UsesLargeFiles()) {
+      return kMinfsMaxFileBlock;
+    }
+    return UsesExtents() ? kMinfsMaxExtentFileBlock : kMinfsMaxPointerFileBlock;
+  }
+
+  // Returns the largest size, in bytes, of a file on this volume.
+  uint64_t MaxFileSize() const { return MaxFileBlock() * BlockSize(); }
+
+  // Returns true if the inode table block |block|, relative to the start of the inode table, has
+  // been initialised.
+  bool IsInodeTableBlockInitialized(uint64_t block) const {
+    return !GetFlagLazyInodeTable() || block < ino_init_blocks;
+  }
+
   // Returns first block number from where inode bitmap starts.
   uint64_t InodeBitmapStartBlock() const {
     if (!GetFlagFvm()) {
@@ -241,7 +343,9 @@ struct Inode {
   uint32_t dirent_count;  // for directories
   ino_t last_inode;       // index to the previous unlinked inode
   ino_t next_inode;       // index to the next unlinked inode
-  uint32_t rsvd[3];
+  uint32_t flags;         // kMinfsInodeFlag*
+  uint32_t size_high;     // upper 32 bits of the size, with kMinfsFlagLargeFiles
+  uint32_t checksum;      // CRC32C of the inode, with kMinfsFlagChecksums
   blk_t dnum[kMinfsDirect];           // direct blocks
   blk_t inum[kMinfsIndirect];         // indirect blocks
   blk_t dinum[kMinfsDoublyIndirect];  // doubly indirect blocks
@@ -249,6 +353,83 @@ struct Inode {
 
 static_assert(sizeof(Inode) == kMinfsInodeSize, "minfs inode size is wrong");
 
+// Returns the size of |inode| in bytes. |size_high| is always zero on volumes without
+// kMinfsFlagLargeFiles, so this works for any volume.
+inline uint64_t GetInodeSize(const Inode& inode) {
+  return (uint64_t{inode.size_high} << 32) | inode.size;
+}
+
+// Sets the size of |inode| to |size| bytes, which must not exceed the volume's MaxFileSize().
+inline void SetInodeSize(Inode* inode, uint64_t size) {
+  inode->size = static_cast<uint32_t>(size);
+  inode->size_high = static_cast<uint32_t>(size >> 32);
+}
+
+// Extent-mapped inodes (kMinfsFlagExtents).
+//
+// The dnum, inum and dinum fields of an extent-mapped inode are replaced by the root node of an
+// extent tree. Every node starts with an ExtentHeader. Leaf nodes (depth zero) hold Extent records
+// sorted by file block, each mapping a run of file blocks to a run of device blocks; unmapped file
+// blocks are sparse. Interior nodes hold ExtentIndex records sorted by file block, each pointing at
+// a node one level down which maps file blocks from its |file_block| up to that of the next record
+// (the first record also covers any file blocks below its own |file_block|). Nodes other than the
+// root fill a whole block in the data section and count towards the inode's |block_count|. A root
+// which is entirely zero is an empty tree.
+constexpr uint16_t kMinfsExtentMagic = 0xe87e;
+
+struct ExtentHeader {
+  uint16_t magic;
+  uint16_t depth;  // Zero for leaf nodes.
+  uint16_t count;  // Number of records following the header.
+  // For nodes other than the root, with kMinfsFlagChecksums: the low 16 bits of the CRC32C of
+  // the node's block number and contents, this field excluded. Zero otherwise.
+  uint16_t checksum;
+};
+
+struct Extent {
+  uint32_t file_block;
+  uint32_t length;
+  blk_t block;  // Relative to the start of the data section.
+};
+
+struct ExtentIndex {
+  uint32_t file_block;
+  blk_t block;  // Relative to the start of the data section.
+};
+
+static_assert(sizeof(ExtentHeader) == 8, "minfs extent header size is wrong");
+static_assert(sizeof(Extent) == 12, "minfs extent size is wrong");
+static_assert(sizeof(ExtentIndex) == 8, "minfs extent index size is wrong");
+
+constexpr uint32_t kMinfsExtentRootSize =
+    sizeof(blk_t) * (kMinfsDirect + kMinfsIndirect + kMinfsDoublyIndirect);
+static_assert(offsetof(Inode, dinum) + sizeof(Inode::dinum) - offsetof(Inode, dnum) ==
+                  kMinfsExtentRootSize,
+              "minfs block pointers are not contiguous");
+
+constexpr uint32_t kMinfsExtentsPerRoot =
+    (kMinfsExtentRootSize - sizeof(ExtentHeader)) / sizeof(Extent);
+constexpr uint32_t kMinfsExtentIndicesPerRoot =
+    (kMinfsExtentRootSize - sizeof(ExtentHeader)) / sizeof(ExtentIndex);
+constexpr uint32_t kMinfsExtentsPerBlock =
+    (kMinfsBlockSize - sizeof(ExtentHeader)) / sizeof(Extent);
+constexpr uint32_t kMinfsExtentIndicesPerBlock =
+    (kMinfsBlockSize - sizeof(ExtentHeader)) / sizeof(ExtentIndex);
+
+// The deepest extent tree a volume may contain. Even with every node half full, a tree of this
+// depth maps far more extents than a file can hold.
+constexpr uint16_t kMinfsMaxExtentDepth = 4;
+
+// Inodes with inline data (kMinfsFlagInlineData).
+//
+// An inode with kMinfsInodeFlagInlineData set has no blocks: its contents, no more than
+// kMinfsInlineDataSize bytes, occupy the space of its block pointers (or extent root) and any bytes
+// beyond |size| are zero. The inode is converted to block-mapped storage, clearing the flag, when
+// it grows any larger. On volumes with kMinfsFlagInlineData, inodes are created with the flag set.
+constexpr uint32_t kMinfsInodeFlagInlineData = 0x00000001;
+
+constexpr uint32_t kMinfsInlineDataSize = kMinfsExtentRootSize;
+
 struct Dirent {
   ino_t ino;        // Inode number.
   uint32_t reclen;  // Low 28 bits: Length of record. High 4 bits: Flags
@@ -310,6 +491,99 @@ static_assert(kMinfsMaxDirectorySize <= kMinfsReclenMask,
 //   record can be computed from the offset at which this record starts. If the MAX_DIR_SIZE is
 //   increased, this 'last' record will also increase in size.
 
+// Indexed directories (kMinfsFlagDirIndex).
+//
+// A directory with kMinfsInodeFlagDirIndex set is divided into blocks. File block 0 holds a
+// DirIndexHeader followed by |count| DirIndexEntry records sorted by |hash|, the first of which has
+// a hash of zero. Each record points at a leaf: a later file block holding the dirents whose
+// DirentHash() is at least the record's |hash| and less than that of the next record with a
+// different hash. Records may share a hash: when every name in a full leaf has the leaf's own
+// hash, so that it cannot be split, a continuation leaf with the same hash is added after it. All
+// but the last leaf of such a run hold only names with exactly the run's hash, so a name with that
+// hash is looked for in every leaf of the run, and any other name in the last one. The dirents of
+// a leaf cover its block exactly and never have kMinfsReclenLast set, so a lookup reads the index
+// and a single leaf however large the directory is, unless its name's hash is shared by more names
+// than fit in a leaf. Every file block after the first is a leaf, so an indexed directory is always
+// |count| + 1 blocks long. On volumes with kMinfsFlagDirIndex, directories are created indexed,
+// with one leaf holding "." and "..".
+//
+// The index is a single block and leaves are never merged, so a directory is limited to
+// kMinfsDirIndexMaxEntries leaves (about 8 MiB) over its lifetime, however many of its names have
+// since been removed. This is deliberate: a second level of index would cost every lookup another
+// read, and directories of that size are outside what minfs is used for.
+constexpr uint32_t kMinfsInodeFlagDirIndex = 0x00000002;
+
+constexpr uint32_t kMinfsDirIndexMagic = 0x78646968;  // "hidx"
+
+struct DirIndexHeader {
+  uint32_t magic;
+  uint32_t count;  // Number of records following the header.
+  // With kMinfsFlagChecksums: the CRC32C of the directory's inode number and the index block,
+  // this field excluded. Zero otherwise.
+  uint32_t checksum;
+  uint32_t reserved;
+};
+
+struct DirIndexEntry {
+  uint32_t hash;
+  uint32_t block;  // File block of the leaf.
+};
+
+static_assert(sizeof(DirIndexHeader) == 16, "minfs directory index header size is wrong");
+static_assert(sizeof(DirIndexEntry) == 8, "minfs directory index entry size is wrong");
+
+constexpr uint32_t kMinfsDirIndexMaxEntries =
+    (kMinfsBlockSize - sizeof(DirIndexHeader)) / sizeof(DirIndexEntry);
+
+// Indexed directories are not bound by kMinfsMaxDirectorySize; this is their limit instead.
+constexpr uint64_t kMinfsMaxIndexedDirectorySize =
+    uint64_t{kMinfsDirIndexMaxEntries + 1} * kMinfsBlockSize;
+static_assert(kMinfsMaxIndexedDirectorySize > kMinfsMaxDirectorySize,
+              "Indexed directories should hold more than linear ones");
+
+// Returns the hash which selects the leaves holding |name| in an indexed directory: HalfSipHash-2-4
+// keyed with the volume's Superblock::dir_hash_seed, so that names which share a hash cannot be
+// chosen without knowing the seed.
+constexpr uint32_t DirentHash(const uint32_t (&seed)[2], std::string_view name) {
+  auto rotl = [](uint32_t x, int b) { return (x << b) | (x >> (32 - b)); };
+  uint32_t v0 = seed[0];
+  uint32_t v1 = seed[1];
+  uint32_t v2 = seed[0] ^ 0x6c796765;
+  uint32_t v3 = seed[1] ^ 0x74656462;
+  auto rounds = [&](int count) {
+    for (int i = 0; i < count; ++i) {
+      v0 += v1;
+      v1 = rotl(v1, 5) ^ v0;
+      v0 = rotl(v0, 16);
+      v2 += v3;
+      v3 = rotl(v3, 8) ^ v2;
+      v0 += v3;
+      v3 = rotl(v3, 7) ^ v0;
+      v2 += v1;
+      v1 = rotl(v1, 13) ^ v2;
+      v2 = rotl(v2, 16);
+    }
+  };
+  // Words are read little-endian; the last one holds the remaining bytes and the length.
+  uint32_t word = 0;
+  for (size_t i = 0; i < name.size(); ++i) {
+    word |= uint32_t{static_cast<uint8_t>(name[i])} << (8 * (i % 4));
+    if (i % 4 == 3) {
+      v3 ^= word;
+      rounds(2);
+      v0 ^= word;
+      word = 0;
+    }
+  }
+  word |= static_cast<uint32_t>(name.size()) << 24;
+  v3 ^= word;
+  rounds(2);
+  v0 ^= word;
+  v2 ^= 0xff;
+  rounds(4);
+  return v1 ^ v3;
+}
+
 // blocksize   8K    16K    32K
 // 16 dir =  128K   256K   512K
 // 32 ind =  512M  1024M  2048M
@@ -11,17 +11,23 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <iomanip>
 #include <limits>
 #include <map>
 #include <memory>
 #include <optional>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 #include <safemath/checked_math.h>
 
 #include "src/lib/storage/vfs/cpp/journal/format.h"
+#include "src/storage/minfs/checksum.h"
+#include "src/storage/minfs/extent_tree.h"
 #include "src/storage/minfs/format.h"
+#include "src/storage/minfs/trace.h"
 #include "zircon/errors.h"
 
 #ifdef __Fuchsia__
@@ -63,6 +69,7 @@ struct BlockInfo {
 const std::string kBlockInfoDirectStr("direct");
 const std::string kBlockInfoIndirectStr("indirect");
 const std::string kBlockInfokDoubleIndirectStr("double indirect");
+const std::string kBlockInfoExtentNodeStr("extent node");
 
 // Given a type of block, returns human readable c-string for the block type.
 std::string BlockTypeToString(BlockType type) {
@@ -73,6 +80,8 @@ std::string BlockTypeToString(BlockType type) {
       return kBlockInfoIndirectStr;
     case BlockType::kDoubleIndirect:
       return kBlockInfokDoubleIndirectStr;
+    case BlockType::kExtentNode:
+      return kBlockInfoExtentNodeStr;
     default:
       ZX_ASSERT(false);
   }
@@ -147,9 +156,30 @@ class MinfsChecker {
   // performance reasons -- it allows fsck to avoid repeatedly checking the same
   // indirect / doubly indirect blocks with all internal bno unallocated.
   zx::status<InodeNthBnoResult> GetInodeNthBno(Inode* inode, blk_t n);
+  // A run of records within a directory: a leaf of an indexed directory, which holds the names
+  // with hashes from |min_hash| up to but not including |end_hash|, or the whole of a linear one.
+  struct DirentRange {
+    size_t start = 0;
+    size_t end = 0;  // Zero for linear directories, which end with a kMinfsReclenLast record.
+    uint32_t min_hash = 0;
+    uint64_t end_hash = uint64_t{1} << 32;
+  };
+
   zx::status<> CheckDirectory(Inode* inode, ino_t ino, ino_t parent, uint32_t flags);
+  // Used by CheckDirectory to check the index of an indexed directory and find its leaves.
+  zx::status<std::vector<DirentRange>> CheckDirIndex(VnodeMinfs* vn, Inode* inode, ino_t ino);
   std::optional<std::string> CheckDataBlock(blk_t bno, BlockInfo block_info);
   zx::status<> CheckFile(Inode* inode, ino_t ino);
+  // Returns true if |inode| is a linked file queued on the unlinked list while the blocks beyond
+  // its size are released, which it may therefore still map.
+  bool IsReleasePending(const Inode& inode, ino_t ino) const {
+    return inode.link_count > 0 && (inode.last_inode != 0 || inode.next_inode != 0 ||
+                                    fs_.Info().unlinked_head == ino);
+  }
+  // Used by CheckFile for inodes which map their blocks with extent trees.
+  zx::status<> CheckExtentFile(Inode* inode, ino_t ino);
+  // Used by CheckFile for inodes which hold their data inline.
+  zx::status<> CheckInlineFile(Inode* inode, ino_t ino);
 
   const FsckOptions fsck_options_;
 
@@ -192,6 +222,11 @@ zx::status<Inode> MinfsChecker::GetInode(ino_t ino, bool check_magic) const {
     FX_LOGS(ERROR) << "check: ino " << ino << " has bad magic 0x" << std::hex << inode.magic;
     return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
   }
+  if (fs_.Info().UsesChecksums() && !VerifyInodeChecksum(ino, inode)) {
+    FX_LOGS(ERROR) << "check: ino " << ino << " has bad checksum 0x" << std::hex << inode.checksum
+                   << ", expected 0x" << InodeChecksum(ino, inode);
+    return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
   return zx::ok(inode);
 }
 
@@ -289,104 +324,135 @@ zx::status<> MinfsChecker::CheckDirectory(Inode* inode, ino_t ino, ino_t parent,
 
   zx::status<> status;
   fbl::RefPtr<VnodeMinfs> vn;
-  VnodeMinfs::Recreate(&fs_, ino, &vn);
+  if (status = VnodeMinfs::Recreate(&fs_, ino, &vn); status.is_error()) {
+    return status;
+  }
 
-  size_t off = 0;
-  while (true) {
-    DirentBuffer dirent_buffer;
-    size_t actual;
-    status = vn->ReadInternal(nullptr, &dirent_buffer.dirent, kMinfsDirentSize, off, &actual);
-    if (status.is_ok() && actual == 0 && inode->link_count == 0 && parent == 0) {
-      // This is OK as it's an unlinked directory.
-      break;
-    }
-    if (status.is_error() || actual != kMinfsDirentSize) {
-      FX_LOGS(ERROR) << "check: ino#" << eno << ": Could not read de[" << ino << "] at " << off;
-      if (inode->dirent_count >= 2 && inode->dirent_count == eno - 1) {
-        // So we couldn't read the last direntry, for whatever reason, but our
-        // inode says that we shouldn't have been able to read it anyway.
-        FX_LOGS(ERROR) << "check: de count (" << eno << ") > inode_dirent_count ("
-                       << inode->dirent_count << ")";
-      }
-      return status.is_error() ? status.take_error() : zx::error(ZX_ERR_IO);
+  // Unlinked directories may have been truncated, in which case they have no index either.
+  std::vector<DirentRange> ranges(1);
+  if ((inode->flags & kMinfsInodeFlagDirIndex) && GetInodeSize(*inode) != 0) {
+    auto ranges_or = CheckDirIndex(vn.get(), inode, ino);
+    if (ranges_or.is_error()) {
+      return ranges_or.take_error();
     }
+    ranges = std::move(ranges_or.value());
+  }
 
-    Dirent* de = &dirent_buffer.dirent;
-    uint32_t rlen = static_cast<uint32_t>(DirentReservedSize(de, off));
-    uint32_t dlen = DirentSize(de->namelen);
-    bool is_last = de->reclen & kMinfsReclenLast;
-    if (!is_last && ((rlen < kMinfsDirentSize) || (dlen > rlen) || (dlen > kMinfsMaxDirentSize) ||
-                     (rlen & kMinfsDirentAlignmentMask))) {
-      FX_LOGS(ERROR) << "check: ino#" << ino << ": de[" << eno << "]: bad dirent reclen (" << rlen
-                     << ") dlen(" << dlen << "), maxsize(" << kMinfsMaxDirentSize << "), size("
-                     << kMinfsDirentSize << ")";
-      return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
-    }
-    if (de->ino == 0) {
-      if (flags & CD_DUMP) {
-        FX_LOGS(DEBUG) << "ino#" << ino << ": de[" << eno << "]: <empty> reclen=" << rlen;
+  for (const DirentRange& range : ranges) {
+    size_t off = range.start;
+    while (true) {
+      DirentBuffer dirent_buffer;
+      size_t actual;
+      status = vn->ReadInternal(nullptr, &dirent_buffer.dirent, kMinfsDirentSize, off, &actual);
+      if (status.is_ok() && actual == 0 && inode->link_count == 0 && parent == 0) {
+        // This is OK as it's an unlinked directory.
+        break;
       }
-    } else {
-      // Re-read the dirent to acquire the full name
-      uint32_t record_full[DirentSize(NAME_MAX)];
-      status = vn->ReadInternal(nullptr, record_full, DirentSize(de->namelen), off, &actual);
-      if (status.is_error() || actual != DirentSize(de->namelen)) {
-        FX_LOGS(ERROR) << "check: Error reading dirent of size: " << DirentSize(de->namelen);
-        return zx::error(ZX_ERR_IO);
+      if (status.is_error() || actual != kMinfsDirentSize) {
+        FX_LOGS(ERROR) << "check: ino#" << eno << ": Could not read de[" << ino << "] at " << off;
+        if (inode->dirent_count >= 2 && inode->dirent_count == eno - 1) {
+          // So we couldn't read the last direntry, for whatever reason, but our
+          // inode says that we shouldn't have been able to read it anyway.
+          FX_LOGS(ERROR) << "check: de count (" << eno << ") > inode_dirent_count ("
+                         << inode->dirent_count << ")";
+        }
+        return status.is_error() ? status.take_error() : zx::error(ZX_ERR_IO);
       }
-      de = reinterpret_cast<Dirent*>(record_full);
-      bool dot_or_dotdot = false;
 
-      if ((de->namelen == 0) || (de->namelen > (rlen - kMinfsDirentSize))) {
-        FX_LOGS(ERROR) << "check: ino#" << ino << ": de[" << eno << "]: invalid namelen "
-                       << de->namelen;
+      Dirent* de = &dirent_buffer.dirent;
+      uint32_t rlen = static_cast<uint32_t>(DirentReservedSize(de, off));
+      uint32_t dlen = DirentSize(de->namelen);
+      bool is_last = de->reclen & kMinfsReclenLast;
+      if (!is_last && ((rlen < kMinfsDirentSize) || (dlen > rlen) || (dlen > kMinfsMaxDirentSize) ||
+                       (rlen & kMinfsDirentAlignmentMask))) {
+        FX_LOGS(ERROR) << "check: ino#" << ino << ": de[" << eno << "]: bad dirent reclen (" << rlen
+                       << ") dlen(" << dlen << "), maxsize(" << kMinfsMaxDirentSize << "), size("
+                       << kMinfsDirentSize << ")";
+        return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+      }
+      if (range.end != 0 && (is_last || off + rlen > range.end)) {
+        FX_LOGS(ERROR) << "check: ino#" << ino << ": de[" << eno << "]: record at " << off
+                       << " crosses the end of its leaf at " << range.end;
         return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
       }
-      if ((de->namelen == 1) && (de->name[0] == '.')) {
-        if (dot) {
-          FX_LOGS(ERROR) << "check: ino#" << ino << ": multiple '.' entries";
-          conforming_ = false;
+      if (de->ino == 0) {
+        if (flags & CD_DUMP) {
+          FX_LOGS(DEBUG) << "ino#" << ino << ": de[" << eno << "]: <empty> reclen=" << rlen;
+        }
+      } else {
+        // Re-read the dirent to acquire the full name
+        uint32_t record_full[DirentSize(NAME_MAX)];
+        status = vn->ReadInternal(nullptr, record_full, DirentSize(de->namelen), off, &actual);
+        if (status.is_error() || actual != DirentSize(de->namelen)) {
+          FX_LOGS(ERROR) << "check: Error reading dirent of size: " << DirentSize(de->namelen);
+          return zx::error(ZX_ERR_IO);
         }
-        dot_or_dotdot = true;
-        dot = true;
-        if (de->ino != ino) {
-          FX_LOGS(ERROR) << "check: ino#" << ino << ": de[" << eno << "]: '.' ino=" << de->ino
-                         << " (not self!)";
-          conforming_ = false;
+        de = reinterpret_cast<Dirent*>(record_full);
+        bool dot_or_dotdot = false;
+
+
+        if ((de->namelen == 0) || (de->namelen > (rlen - kMinfsDirentSize))) {
+          FX_LOGS(ERROR) << "check: ino#" << ino << ": de[" << eno << "]: invalid namelen "
+                         << de->namelen;
+          return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
         }
-      }
-      if ((de->namelen == 2) && (de->name[0] == '.') && (de->name[1] == '.')) {
-        if (dotdot) {
-          FX_LOGS(ERROR) << "check: ino#" << ino << ": multiple '..' entries";
-          conforming_ = false;
+        if (range.end != 0) {
+          uint32_t hash = fs_.HashDirentName(std::string_view(de->name, de->namelen));
+          if (hash < range.min_hash || hash >= range.end_hash) {
+            FX_LOGS(ERROR) << "check: ino#" << ino << ": de[" << eno << "]: '"
+                           << std::string_view(de->name, de->namelen) << "' in the wrong leaf";
+            conforming_ = false;
+          }
         }
-        dot_or_dotdot = true;
-        dotdot = true;
-        if (de->ino != parent) {
-          FX_LOGS(ERROR) << "check: ino#" << ino << ": de[" << eno << "]: '..' ino=" << de->ino
-                         << " (not parent (ino#" << parent << ")!)";
-          conforming_ = false;
+        if ((de->namelen == 1) && (de->name[0] == '.')) {
+          if (dot) {
+            FX_LOGS(ERROR) << "check: ino#" << ino << ": multiple '.' entries";
+            conforming_ = false;
+          }
+          dot_or_dotdot = true;
+          dot = true;
+          if (de->ino != ino) {
+            FX_LOGS(ERROR) << "check: ino#" << ino << ": de[" << eno << "]: '.' ino=" << de->ino
+                           << " (not self!)";
+            conforming_ = false;
+          }
+        }
+        if ((de->namelen == 2) && (de->name[0] == '.') && (de->name[1] == '.')) {
+          if (dotdot) {
+            FX_LOGS(ERROR) << "check: ino#" << ino << ": multiple '..' entries";
+            conforming_ = false;
+          }
+          dot_or_dotdot = true;
+          dotdot = true;
+          if (de->ino != parent) {
+            FX_LOGS(ERROR) << "check: ino#" << ino << ": de[" << eno << "]: '..' ino=" << de->ino
+                           << " (not parent (ino#" << parent << ")!)";
+            conforming_ = false;
+          }
+        }
+        if (flags & CD_DUMP) {
+          FX_LOGS(DEBUG) << "ino#" << ino << ": de[" << eno << "]: ino=" << de->ino
+                         << " type=" << de->type << " '" << std::string_view(de->name, de->namelen)
+                         << "' " << (is_last ? "[last]" : "");
         }
-      }
-      if (flags & CD_DUMP) {
-        FX_LOGS(DEBUG) << "ino#" << ino << ": de[" << eno << "]: ino=" << de->ino
-                       << " type=" << de->type << " '" << std::string_view(de->name, de->namelen)
-                       << "' " << (is_last ? "[last]" : "");
-      }
 
-      if (flags & CD_RECURSE) {
-        if (auto status = CheckInode(de->ino, ino, dot_or_dotdot); status.is_error()) {
-          return status.take_error();
+        if (flags & CD_RECURSE) {
+          if (auto status = CheckInode(de->ino, ino, dot_or_dotdot); status.is_error()) {
+            return status.take_error();
+          }
         }
+        dirent_count++;
+      }
+      if (is_last) {
+        break;
+      } else {
+        off += rlen;
+      }
+      eno++;
+      if (off == range.end) {
+        break;
       }
-      dirent_count++;
-    }
-    if (is_last) {
-      break;
-    } else {
-      off += rlen;
     }
-    eno++;
   }
   if (inode->link_count == 0 && inode->dirent_count != 0) {
     FX_LOGS(ERROR) << "check: dirent_count (" << inode->dirent_count
@@ -409,6 +475,71 @@ zx::status<> MinfsChecker::CheckDirectory(Inode* inode, ino_t ino, ino_t parent,
   return zx::ok();
 }
 
+zx::status<std::vector<MinfsChecker::DirentRange>> MinfsChecker::CheckDirIndex(VnodeMinfs* vn,
+                                                                               Inode* inode,
+                                                                               ino_t ino) {
+  if (!fs_.Info().UsesDirIndex()) {
+    FX_LOGS(WARNING) << "check: ino#" << ino << ": indexed directory on a volume without them";
+    conforming_ = false;
+  }
+  const uint32_t block_size = fs_.Info().BlockSize();
+  const uint64_t size = GetInodeSize(*inode);
+  if (size % block_size != 0 || size < 2 * block_size || size > kMinfsMaxIndexedDirectorySize) {
+    FX_LOGS(ERROR) << "check: ino#" << ino << ": bad indexed directory size " << size;
+    return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
+
+  uint8_t block[kMinfsBlockSize];
+  size_t actual;
+  if (auto status = vn->ReadInternal(nullptr, block, block_size, 0, &actual);
+      status.is_error() || actual != block_size) {
+    FX_LOGS(ERROR) << "check: ino#" << ino << ": Could not read directory index";
+    return status.is_error() ? status.take_error() : zx::error(ZX_ERR_IO);
+  }
+  DirIndexHeader header;
+  memcpy(&header, block, sizeof(header));
+  const uint64_t leaf_count = size / block_size - 1;
+  if (header.magic != kMinfsDirIndexMagic || header.count != leaf_count) {
+    FX_LOGS(ERROR) << "check: ino#" << ino << ": bad directory index (magic " << header.magic
+                   << ", " << header.count << " records for " << leaf_count << " leaves)";
+    return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
+  if (fs_.Info().UsesChecksums() && !VerifyDirIndexChecksum(ino, block, block_size)) {
+    FX_LOGS(ERROR) << "check: ino#" << ino << ": directory index has a bad checksum";
+    return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
+
+  std::vector<DirIndexEntry> entries(header.count);
+  memcpy(entries.data(), block + sizeof(header), entries.size() * sizeof(DirIndexEntry));
+  std::vector<bool> leaf_seen(leaf_count + 1, false);
+  std::vector<DirentRange> ranges;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const DirIndexEntry& entry = entries[i];
+    if ((i == 0 && entry.hash != 0) || (i > 0 && entry.hash < entries[i - 1].hash)) {
+      FX_LOGS(ERROR) << "check: ino#" << ino << ": directory index record " << i << " has hash "
+                     << entry.hash << " out of order";
+      return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+    }
+    if (entry.block == 0 || entry.block > leaf_count || leaf_seen[entry.block]) {
+      FX_LOGS(ERROR) << "check: ino#" << ino << ": directory index record " << i
+                     << " has bad leaf " << entry.block;
+      return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+    }
+    leaf_seen[entry.block] = true;
+    DirentRange range;
+    range.start = size_t{entry.block} * block_size;
+    range.end = range.start + block_size;
+    range.min_hash = entry.hash;
+    if (i + 1 < entries.size()) {
+      // A leaf followed by a continuation leaf holds only names with its own hash.
+      range.end_hash = entries[i + 1].hash == entry.hash ? uint64_t{entry.hash} + 1
+                                                         : entries[i + 1].hash;
+    }
+    ranges.push_back(range);
+  }
+  return zx::ok(std::move(ranges));
+}
+
 std::optional<std::string> MinfsChecker::CheckDataBlock(blk_t bno, BlockInfo block_info) {
   if (bno == 0) {
     return std::string("reserved bno");
@@ -445,6 +576,19 @@ std::optional<std::string> MinfsChecker::CheckDataBlock(blk_t bno, BlockInfo blo
 }
 
 zx::status<> MinfsChecker::CheckFile(Inode* inode, ino_t ino) {
+  // Without kMinfsFlagLargeFiles this also catches a nonzero |size_high|.
+  if (GetInodeSize(*inode) > fs_.Info().MaxFileSize()) {
+    FX_LOGS(ERROR) << "check: ino#" << ino << ": size " << GetInodeSize(*inode)
+                   << " exceeds the maximum file size " << fs_.Info().MaxFileSize();
+    return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
+  if (inode->flags & kMinfsInodeFlagInlineData) {
+    return CheckInlineFile(inode, ino);
+  }
+  if (fs_.Info().UsesExtents()) {
+    return CheckExtentFile(inode, ino);
+  }
+
   FX_LOGS(DEBUG) << "Direct blocks: ";
   for (unsigned n = 0; n < kMinfsDirect; n++) {
     FX_LOGS(DEBUG) << " " << inode->dnum[n] << ",";
@@ -534,8 +678,72 @@ zx::status<> MinfsChecker::CheckFile(Inode* inode, ino_t ino) {
     n = nth_bno_or->next_n;
   }
   if (next_blk) {
-    unsigned max_blocks = fbl::round_up(inode->size, kMinfsBlockSize) / kMinfsBlockSize;
-    if (next_blk > max_blocks) {
+    uint64_t max_blocks =
+        fbl::round_up(GetInodeSize(*inode), uint64_t{kMinfsBlockSize}) / kMinfsBlockSize;
+    if (next_blk > max_blocks && !IsReleasePending(*inode, ino)) {
+      FX_LOGS(WARNING) << "check: ino#" << ino << ": filesize too small";
+      conforming_ = false;
+    }
+  }
+  if (block_count != inode->block_count) {
+    FX_LOGS(WARNING) << "check: ino#" << ino << ": block count " << inode->block_count
+                     << ", actual blocks " << block_count;
+    conforming_ = false;
+  }
+  return zx::ok();
+}
+
+zx::status<> MinfsChecker::CheckExtentFile(Inode* inode, ino_t ino) {
+  auto tree_or = ExtentTree::Load(
+      *inode,
+      [this](blk_t bno, void* data) -> zx::status<> {
+        if (bno >= fs_.Info().block_count) {
+          return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+        }
+        return fs_.ReadDat(bno, data);
+      },
+      fs_.Info().UsesChecksums());
+  if (tree_or.is_error()) {
+    FX_LOGS(ERROR) << "check: ino#" << ino << ": bad extent tree: " << tree_or.status_string();
+    return tree_or.take_error();
+  }
+  const ExtentTree& tree = *tree_or.value();
+  FX_LOGS(DEBUG) << "Extent tree depth: " << tree.depth();
+
+  uint32_t block_count = 0;
+
+  // count and sanity-check extent tree nodes
+  tree.ForEachNode([&](blk_t bno, uint64_t file_block) {
+    BlockInfo block_info = {ino, static_cast<blk_t>(file_block), BlockType::kExtentNode};
+    if (auto msg = CheckDataBlock(bno, block_info); msg) {
+      FX_LOGS(WARNING) << "check: ino#" << ino << ": extent node (@" << bno
+                       << "): " << msg.value();
+      conforming_ = false;
+    }
+    block_count++;
+  });
+
+  // count and sanity-check data blocks
+  uint64_t next_blk = 0;
+  tree.ForEachExtent([&](const Extent& extent) {
+    FX_LOGS(DEBUG) << "Extent: " << extent.file_block << "+" << extent.length << " @"
+                   << extent.block;
+    for (uint32_t i = 0; i < extent.length; ++i) {
+      const blk_t n = extent.file_block + i;
+      BlockInfo block_info = {ino, n, BlockType::kDirect};
+      if (auto msg = CheckDataBlock(extent.block + i, block_info); msg) {
+        FX_LOGS(WARNING) << "check: ino#" << ino << ": block " << n << "(@" << extent.block + i
+                         << "): " << msg.value();
+        conforming_ = false;
+      }
+      block_count++;
+    }
+    next_blk = uint64_t{extent.file_block} + extent.length;
+  });
+  if (next_blk) {
+    uint64_t max_blocks =
+        fbl::round_up(GetInodeSize(*inode), uint64_t{kMinfsBlockSize}) / kMinfsBlockSize;
+    if (next_blk > max_blocks && !IsReleasePending(*inode, ino)) {
       FX_LOGS(WARNING) << "check: ino#" << ino << ": filesize too small";
       conforming_ = false;
     }
@@ -548,6 +756,30 @@ zx::status<> MinfsChecker::CheckFile(Inode* inode, ino_t ino) {
   return zx::ok();
 }
 
+zx::status<> MinfsChecker::CheckInlineFile(Inode* inode, ino_t ino) {
+  if (!fs_.Info().UsesInlineData()) {
+    FX_LOGS(WARNING) << "check: ino#" << ino << ": inline data on a volume without inline data";
+    conforming_ = false;
+  }
+  if (inode->size > kMinfsInlineDataSize) {
+    FX_LOGS(ERROR) << "check: ino#" << ino << ": inline data size " << inode->size
+                   << " exceeds " << kMinfsInlineDataSize;
+    return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
+  if (inode->block_count != 0) {
+    FX_LOGS(WARNING) << "check: ino#" << ino << ": block count " << inode->block_count
+                     << ", actual blocks 0";
+    conforming_ = false;
+  }
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(inode->dnum);
+  if (std::any_of(data + inode->size, data + kMinfsInlineDataSize,
+                  [](uint8_t byte) { return byte != 0; })) {
+    FX_LOGS(WARNING) << "check: ino#" << ino << ": inline data beyond end of file";
+    conforming_ = false;
+  }
+  return zx::ok();
+}
+
 void MinfsChecker::CheckReserved() {
   // Check reserved inode '0'.
   if (fs_.GetInodeManager()->GetInodeAllocator()->CheckAllocated(0)) {
@@ -567,6 +799,21 @@ void MinfsChecker::CheckReserved() {
     FX_LOGS(WARNING) << "check: reserved block#0: not marked in-use";
     conforming_ = false;
   }
+
+  // Check the blocks of the checksum table.
+  if (fs_.Info().UsesChecksums()) {
+    const blk_t start = fs_.Info().csum_block;
+    const blk_t end = start + fs_.Info().csum_blocks;
+    for (blk_t bno = start; bno < end; ++bno) {
+      if (fs_.GetBlockAllocator().CheckAllocated(bno)) {
+        checked_blocks_.Set(bno, bno + 1);
+        alloc_blocks_++;
+      } else {
+        FX_LOGS(WARNING) << "check: checksum table block#" << bno << ": not marked in-use";
+        conforming_ = false;
+      }
+    }
+  }
 }
 
 zx::status<> MinfsChecker::CheckInode(ino_t ino, ino_t parent, bool dot_or_dotdot) {
@@ -628,7 +875,7 @@ zx::status<> MinfsChecker::CheckInode(ino_t ino, ino_t parent, bool dot_or_dotdo
       return zx::error(ZX_ERR_BAD_STATE);
     }
     FX_LOGS(DEBUG) << "ino#" << ino << ": FILE blks=" << inode.block_count
-                   << " links=" << inode.link_count << " size=" << inode.size;
+                   << " links=" << inode.link_count << " size=" << GetInodeSize(inode);
     if (auto status = CheckFile(&inode, ino); status.is_error()) {
       return status.take_error();
     }
@@ -642,8 +889,6 @@ zx::status<> MinfsChecker::CheckUnlinkedInodes() {
   ino_t unlinked_count = 0;
 
   while (next_ino != 0) {
-    unlinked_count++;
-
     auto inode_or = GetInode(next_ino);
     if (inode_or.is_error()) {
       FX_LOGS(ERROR) << "check: ino#" << next_ino << ": not readable: " << inode_or.error_value();
@@ -652,7 +897,7 @@ zx::status<> MinfsChecker::CheckUnlinkedInodes() {
 
     Inode inode = std::move(inode_or.value());
 
-    if (inode.link_count > 0) {
+    if (inode.link_count > 0 && inode.magic != kMinfsMagicFile) {
       FX_LOGS(ERROR) << "check: ino#" << next_ino << ": should have 0 links";
       return zx::error(ZX_ERR_BAD_STATE);
     }
@@ -662,11 +907,16 @@ zx::status<> MinfsChecker::CheckUnlinkedInodes() {
       return zx::error(ZX_ERR_BAD_STATE);
     }
 
-    links_[next_ino - 1] = -1;
+    // A linked file is queued while the blocks beyond its size are released, and is checked
+    // through its directory entries.
+    if (inode.link_count == 0) {
+      unlinked_count++;
+      links_[next_ino - 1] = -1;
 
-    if (auto status = CheckInode(next_ino, 0, 0); status.is_error()) {
-      FX_LOGS(ERROR) << "minfs_check: CheckInode failure: " << status.error_value();
-      return status.take_error();
+      if (auto status = CheckInode(next_ino, 0, 0); status.is_error()) {
+        FX_LOGS(ERROR) << "minfs_check: CheckInode failure: " << status.error_value();
+        return status.take_error();
+      }
     }
 
     last_ino = next_ino;
@@ -822,6 +1072,7 @@ zx::status<std::unique_ptr<MinfsChecker>> MinfsChecker::Create(FuchsiaDispatcher
                                                 : minfs::Writability::Writable,
           .repair_filesystem = fsck_options.repair,
           .fsck_after_every_transaction = false,  // Explicit in case the default is overridden.
+          .dir_hash_for_testing = fsck_options.dir_hash_for_testing,
           .quiet = fsck_options.quiet,
       });
   if (fs.is_error()) {
@@ -1128,6 +1379,7 @@ zx::status<std::unique_ptr<Bcache>> Fsck(std::unique_ptr<Bcache> bc, const FsckO
   }
 #endif
 
+  TRACE_DURATION("minfs", "Fsck");
   auto chk_or = MinfsChecker::Create(dispatcher, std::move(bc), options);
   if (chk_or.is_error()) {
     FX_LOGS(ERROR) << "Fsck: Init failure: " << chk_or.error_value();
@@ -1136,27 +1388,42 @@ zx::status<std::unique_ptr<Bcache>> Fsck(std::unique_ptr<Bcache> bc, const FsckO
 
   chk_or->CheckReserved();
 
-  if (auto status = chk_or->CheckInode(kMinfsRootIno, kMinfsRootIno, 0); status.is_error()) {
-    FX_LOGS(ERROR) << "Fsck: CheckInode failure: " << status.error_value();
-    return status.take_error();
+  {
+    TRACE_DURATION("minfs", "Fsck::CheckInodes");
+    if (auto status = chk_or->CheckInode(kMinfsRootIno, kMinfsRootIno, 0); status.is_error()) {
+      FX_LOGS(ERROR) << "Fsck: CheckInode failure: " << status.error_value();
+      return status.take_error();
+    }
   }
 
   zx::status<> r;
   zx_status_t status = ZX_OK;
 
   // Save an error if it occurs, but check for subsequent errors anyway.
-  r = chk_or->CheckUnlinkedInodes();
+  {
+    TRACE_DURATION("minfs", "Fsck::CheckUnlinkedInodes");
+    r = chk_or->CheckUnlinkedInodes();
+  }
   status |= (status != ZX_OK) ? 0 : r.status_value();
-  r = chk_or->CheckForUnusedBlocks();
+  {
+    TRACE_DURATION("minfs", "Fsck::CheckForUnusedBlocks");
+    r = chk_or->CheckForUnusedBlocks();
+  }
   status |= (status != ZX_OK) ? 0 : r.status_value();
-  r = chk_or->CheckForUnusedInodes();
+  {
+    TRACE_DURATION("minfs", "Fsck::CheckForUnusedInodes");
+    r = chk_or->CheckForUnusedInodes();
+  }
   status |= (status != ZX_OK) ? 0 : r.status_value();
   r = chk_or->CheckLinkCounts();
   status |= (status != ZX_OK) ? 0 : r.status_value();
   r = chk_or->CheckAllocatedCounts();
   status |= (status != ZX_OK) ? 0 : r.status_value();
 
-  r = chk_or->CheckSuperblockIntegrity();
+  {
+    TRACE_DURATION("minfs", "Fsck::CheckSuperblockIntegrity");
+    r = chk_or->CheckSuperblockIntegrity();
+  }
   status |= (status != ZX_OK) ? 0 : r.status_value();
 
   status |= (status != ZX_OK) ? 0 : (chk_or->conforming() ? ZX_OK : ZX_ERR_BAD_STATE);
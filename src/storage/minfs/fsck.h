@@ -12,6 +12,7 @@
 #include <lib/zx/status.h>
 
 #include <memory>
+#include <string_view>
 
 #include <fbl/array.h>
 #include <fbl/vector.h>
@@ -28,7 +29,8 @@ namespace minfs {
 enum class BlockType {
   kDirect = 0,     // Direct block contains user data.
   kIndirect,       // Contains an array of block numbers pointing to direct blocks.
-  kDoubleIndirect  // Contains an array of block numbers of pointing to indirect blocks.
+  kDoubleIndirect,  // Contains an array of block numbers of pointing to indirect blocks.
+  kExtentNode       // Contains extents or pointers to other extent tree nodes.
 };
 
 #ifdef __Fuchsia__
@@ -56,6 +58,9 @@ struct FsckOptions {
 
   // If true, be sparing with messages.
   bool quiet = false;
+
+  // For testing only: the MountOptions::dir_hash_for_testing the volume was used with.
+  uint32_t (*dir_hash_for_testing)(std::string_view name) = nullptr;
 };
 
 // Updates generation_count and checksum of the superblock.
@@ -83,6 +83,10 @@ int status_to_errno(zx_status_t status) {
       return ENOSPC;
     case ZX_ERR_ALREADY_EXISTS:
       return EEXIST;
+    case ZX_ERR_NOT_FOUND:
+      return ENOENT;
+    case ZX_ERR_NOT_EMPTY:
+      return ENOTEMPTY;
     default:
       return EIO;
   }
@@ -102,6 +106,38 @@ struct FakeFs {
   fbl::RefPtr<minfs::VnodeMinfs> fake_root = nullptr;  // Must be destroyed before fake_vfs.
 } fake_fs;
 
+minfs::Minfs& mounted_minfs() {
+  return static_cast<minfs::Runner*>(fake_fs.fake_vfs.get())->minfs();
+}
+
+// Looks up the directory holding the last component of |path|, which is returned in |out_name|.
+zx_status_t lookup_parent(const char* path, fbl::RefPtr<fs::Vnode>* out_dir,
+                          std::string_view* out_name) {
+  std::string_view remaining(path + PREFIX_SIZE);
+  fbl::RefPtr<fs::Vnode> dir = fake_fs.fake_root;
+  for (;;) {
+    while (!remaining.empty() && remaining.front() == '/') {
+      remaining.remove_prefix(1);
+    }
+    size_t end = remaining.find('/');
+    if (end == std::string_view::npos) {
+      break;
+    }
+    fbl::RefPtr<fs::Vnode> next;
+    if (zx_status_t status = dir->Lookup(remaining.substr(0, end), &next); status != ZX_OK) {
+      return status;
+    }
+    dir = std::move(next);
+    remaining.remove_prefix(end);
+  }
+  if (remaining.empty()) {
+    return ZX_ERR_INVALID_ARGS;
+  }
+  *out_dir = std::move(dir);
+  *out_name = remaining;
+  return ZX_OK;
+}
+
 }  // namespace
 
 int emu_mkfs(const char* path) {
@@ -204,8 +240,57 @@ int emu_get_used_resources(const char* path, uint64_t* out_data_size, uint64_t*
   return 0;
 }
 
+int emu_unmount() {
+  if (!emu_is_mounted()) {
+    return -1;
+  }
+  fake_fs.fake_root = nullptr;
+  minfs::Runner::Destroy(
+      std::unique_ptr<minfs::Runner>(static_cast<minfs::Runner*>(fake_fs.fake_vfs.release())));
+  return 0;
+}
+
 bool emu_is_mounted() { return fake_fs.fake_root != nullptr; }
 
+int emu_get_io_stats(minfs::Bcache::IoStats* out_stats) {
+  if (!emu_is_mounted()) {
+    return -1;
+  }
+  *out_stats = mounted_minfs().GetMutableBcache()->GetIoStats();
+  return 0;
+}
+
+int emu_get_stats_json(std::string* out_json) {
+  if (!emu_is_mounted()) {
+    return -1;
+  }
+  *out_json = "{\"latency\": " + mounted_minfs().Latencies().ToJson() +
+              ", \"io\": " + mounted_minfs().GetIoAccounting()->ToJson() +
+              ", \"write_amplification\": " + mounted_minfs().GetWriteAmplification().ToJson() +
+              ", \"locks\": " + mounted_minfs().GetLockProfile()->ToJson() +
+              ", \"object_pools\": " + GetObjectPoolStats().ToJson() + "}";
+  return 0;
+}
+
+int emu_reset_stats() {
+  if (!emu_is_mounted()) {
+    return -1;
+  }
+  mounted_minfs().Latencies().Reset();
+  mounted_minfs().GetIoAccounting()->Reset();
+  mounted_minfs().GetWriteAmplification().Reset();
+  mounted_minfs().GetLockProfile()->Reset();
+  return 0;
+}
+
+int emu_set_lock_profiling(bool enabled) {
+  if (!emu_is_mounted()) {
+    return -1;
+  }
+  mounted_minfs().GetLockProfile()->SetEnabled(enabled);
+  return 0;
+}
+
 // Converts POSIX open() flags to |VnodeConnectionOptions|.
 fs::VnodeConnectionOptions fdio_flags_to_connection_options(uint32_t flags) {
   fs::VnodeConnectionOptions options;
@@ -445,6 +530,32 @@ int emu_stat(const char* fn, struct stat* s) {
   STATUS(status);
 }
 
+int emu_unlink(const char* path) {
+  ZX_DEBUG_ASSERT_MSG(!host_path(path), "'emu_' functions can only operate on target paths");
+  fbl::RefPtr<fs::Vnode> dir;
+  std::string_view name;
+  if (zx_status_t status = lookup_parent(path, &dir, &name); status != ZX_OK) {
+    STATUS(status);
+  }
+  STATUS(dir->Unlink(name, false));
+}
+
+int emu_rename(const char* oldpath, const char* newpath) {
+  ZX_DEBUG_ASSERT_MSG(!host_path(oldpath) && !host_path(newpath),
+                      "'emu_' functions can only operate on target paths");
+  fbl::RefPtr<fs::Vnode> olddir;
+  std::string_view oldname;
+  if (zx_status_t status = lookup_parent(oldpath, &olddir, &oldname); status != ZX_OK) {
+    STATUS(status);
+  }
+  fbl::RefPtr<fs::Vnode> newdir;
+  std::string_view newname;
+  if (zx_status_t status = lookup_parent(newpath, &newdir, &newname); status != ZX_OK) {
+    STATUS(status);
+  }
+  STATUS(olddir->Rename(std::move(newdir), oldname, newname, false, false));
+}
+
 constexpr size_t kDirBufSize = 2048;
 
 struct MinDir {
@@ -18,6 +18,7 @@
 #include <unistd.h>
 
 #include <memory>
+#include <string>
 
 #include <fbl/macros.h>
 
@@ -38,7 +39,20 @@ static inline bool host_path(const char* path) {
 int emu_mkfs(const char* path);
 int emu_mount(const char* path);
 int emu_mount_bcache(std::unique_ptr<minfs::Bcache> bc);
+// Unmounts the filesystem mounted by emu_mount. Every file and directory must have been closed.
+int emu_unmount();
 bool emu_is_mounted();
+// Returns the I/O made on the backing file of the mounted filesystem (see Bcache::GetIoStats).
+int emu_get_io_stats(minfs::Bcache::IoStats* out_stats);
+// Returns the internal statistics of the mounted filesystem as a JSON object: the latency of each
+// LatencyPhase, the I/O of each IoSource, the write amplification, the contention of each
+// LockSite and the ObjectPoolStats. emu_reset_stats clears them, except for the ObjectPoolStats,
+// which are process-wide.
+int emu_get_stats_json(std::string* out_json);
+int emu_reset_stats();
+// Starts or stops recording the contention of the mounted filesystem's locks. Only the allocator
+// locks exist on host.
+int emu_set_lock_profiling(bool enabled);
 int emu_get_used_resources(const char* path, uint64_t* out_data_size, uint64_t* out_inodes,
                            uint64_t* out_used_size);
 
@@ -55,6 +69,9 @@ off_t emu_lseek(int fd, off_t offset, int whence);
 int emu_fstat(int fd, struct stat* s);
 int emu_stat(const char* fn, struct stat* s);
 
+int emu_unlink(const char* path);
+int emu_rename(const char* oldpath, const char* newpath);
+
 int emu_mkdir(const char* path, mode_t mode);
 DIR* emu_opendir(const char* name);
 struct dirent* emu_readdir(DIR* dirp);
@@ -0,0 +1,218 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/host_trace.h"
+
+#include <inttypes.h>
+#include <lib/syslog/cpp/macros.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace minfs {
+namespace internal {
+std::atomic<bool> host_trace_enabled = false;
+}  // namespace internal
+
+namespace {
+
+struct Event {
+  const char* category;
+  const char* name;
+  uint64_t start_ns;
+  uint64_t duration_ns;
+  size_t args_length;
+  char args[HostTraceDuration::kMaxArgsLength];
+};
+
+// The spans recorded by one thread. Only that thread writes to it.
+struct ThreadBuffer {
+  ThreadBuffer(uint32_t tid, size_t capacity) : tid(tid), events(capacity) {}
+
+  const uint32_t tid;
+  std::vector<Event> events;
+  // The number of spans ever recorded; the latest are at |next| - 1 modulo the capacity.
+  std::atomic<uint64_t> next = 0;
+};
+
+// Owns every thread's buffer, which outlives its thread so that its spans can still be written.
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+  std::atomic<size_t> events_per_thread = kDefaultHostTraceEventsPerThread;
+};
+
+Registry& GetRegistry() {
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+ThreadBuffer* CurrentThreadBuffer() {
+  thread_local ThreadBuffer* buffer = nullptr;
+  if (buffer == nullptr) {
+    Registry& registry = GetRegistry();
+    std::lock_guard lock(registry.mutex);
+    registry.buffers.push_back(std::make_unique<ThreadBuffer>(
+        static_cast<uint32_t>(registry.buffers.size() + 1),
+        registry.events_per_thread.load(std::memory_order_relaxed)));
+    buffer = registry.buffers.back().get();
+  }
+  return buffer;
+}
+
+void AppendJsonString(std::string& json, std::string_view value) {
+  json += '"';
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      json += '\\';
+      json += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      json += escaped;
+    } else {
+      json += c;
+    }
+  }
+  json += '"';
+}
+
+}  // namespace
+
+void StartHostTrace(size_t events_per_thread) {
+  GetRegistry().events_per_thread.store(std::max<size_t>(events_per_thread, 1),
+                                        std::memory_order_relaxed);
+  internal::host_trace_enabled.store(true, std::memory_order_relaxed);
+}
+
+void StopHostTrace() { internal::host_trace_enabled.store(false, std::memory_order_relaxed); }
+
+void ClearHostTrace() {
+  Registry& registry = GetRegistry();
+  std::lock_guard lock(registry.mutex);
+  for (auto& buffer : registry.buffers) {
+    buffer->next.store(0, std::memory_order_relaxed);
+  }
+}
+
+std::string HostTraceToJson() {
+  Registry& registry = GetRegistry();
+  std::lock_guard lock(registry.mutex);
+
+  // Timestamps are relative to the earliest span, in microseconds.
+  uint64_t epoch_ns = UINT64_MAX;
+  for (const auto& buffer : registry.buffers) {
+    const uint64_t next = buffer->next.load(std::memory_order_acquire);
+    const uint64_t size = buffer->events.size();
+    for (uint64_t i = next > size ? next - size : 0; i < next; ++i) {
+      epoch_ns = std::min(epoch_ns, buffer->events[i % size].start_ns);
+    }
+  }
+
+  std::string json = "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+  uint64_t dropped = 0;
+  bool first = true;
+  for (const auto& buffer : registry.buffers) {
+    const uint64_t next = buffer->next.load(std::memory_order_acquire);
+    const uint64_t size = buffer->events.size();
+    const uint64_t oldest = next > size ? next - size : 0;
+    dropped += oldest;
+    for (uint64_t i = oldest; i < next; ++i) {
+      const Event& event = buffer->events[i % size];
+      json += first ? "\n" : ",\n";
+      first = false;
+      json += "{\"name\": ";
+      AppendJsonString(json, event.name);
+      json += ", \"cat\": ";
+      AppendJsonString(json, event.category);
+      char fields[128];
+      snprintf(fields, sizeof(fields),
+               ", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u",
+               static_cast<double>(event.start_ns - epoch_ns) / 1000.0,
+               static_cast<double>(event.duration_ns) / 1000.0, buffer->tid);
+      json += fields;
+      json += ", \"args\": {";
+      json.append(event.args, event.args_length);
+      json += "}}";
+    }
+  }
+  json += "\n], \"otherData\": {\"dropped_events\": " + std::to_string(dropped) + "}}\n";
+  return json;
+}
+
+zx::status<> WriteHostTrace(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    FX_LOGS(ERROR) << "Cannot create " << path;
+    return zx::error(ZX_ERR_IO);
+  }
+  const std::string json = HostTraceToJson();
+  const bool written = fwrite(json.data(), 1, json.size(), file) == json.size();
+  if (fclose(file) != 0 || !written) {
+    FX_LOGS(ERROR) << "Cannot write " << path;
+    return zx::error(ZX_ERR_IO);
+  }
+  return zx::ok();
+}
+
+uint64_t HostTraceDuration::NowNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void HostTraceDuration::AppendRaw(const char* key, std::string_view json) {
+  // The whole argument is dropped if it does not fit.
+  const int length =
+      snprintf(args_ + args_length_, kMaxArgsLength - args_length_, "%s\"%s\": %.*s",
+               args_length_ ? ", " : "", key, static_cast<int>(json.size()), json.data());
+  if (length > 0 && static_cast<size_t>(length) < kMaxArgsLength - args_length_) {
+    args_length_ += length;
+  }
+}
+
+void HostTraceDuration::AppendSigned(const char* key, int64_t value) {
+  char json[24];
+  snprintf(json, sizeof(json), "%" PRId64, value);
+  AppendRaw(key, json);
+}
+
+void HostTraceDuration::AppendUnsigned(const char* key, uint64_t value) {
+  char json[24];
+  snprintf(json, sizeof(json), "%" PRIu64, value);
+  AppendRaw(key, json);
+}
+
+void HostTraceDuration::AppendDouble(const char* key, double value) {
+  char json[32];
+  snprintf(json, sizeof(json), "%g", value);
+  AppendRaw(key, json);
+}
+
+void HostTraceDuration::AppendString(const char* key, std::string_view value) {
+  std::string json;
+  AppendJsonString(json, value.substr(0, kMaxArgsLength));
+  AppendRaw(key, json);
+}
+
+void HostTraceDuration::Record() {
+  const uint64_t end_ns = NowNanoseconds();
+  ThreadBuffer* buffer = CurrentThreadBuffer();
+  const uint64_t next = buffer->next.load(std::memory_order_relaxed);
+  Event& event = buffer->events[next % buffer->events.size()];
+  event.category = category_;
+  event.name = name_;
+  event.start_ns = start_ns_;
+  event.duration_ns = end_ns - start_ns_;
+  event.args_length = args_length_;
+  memcpy(event.args, args_, args_length_);
+  buffer->next.store(next + 1, std::memory_order_release);
+}
+
+}  // namespace minfs
@@ -0,0 +1,118 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Records the spans of TRACE_DURATION on host, where the Fuchsia trace engine is not available,
+// so that host tools can be profiled with the same instrumentation as the filesystem on Fuchsia.
+
+#ifndef SRC_STORAGE_MINFS_HOST_TRACE_H_
+#define SRC_STORAGE_MINFS_HOST_TRACE_H_
+
+#ifdef __Fuchsia__
+#error Host-only Header
+#endif
+
+#include <lib/zx/status.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace minfs {
+
+constexpr size_t kDefaultHostTraceEventsPerThread = 1 << 16;
+
+namespace internal {
+extern std::atomic<bool> host_trace_enabled;
+}  // namespace internal
+
+// Starts recording spans. Each thread keeps its last |events_per_thread| spans in a ring buffer
+// of its own, so recording takes no locks. The size of a thread's buffer is fixed by the first
+// span it records.
+void StartHostTrace(size_t events_per_thread = kDefaultHostTraceEventsPerThread);
+
+// Stops recording spans. Spans which are open when tracing stops are still recorded.
+void StopHostTrace();
+
+inline bool HostTraceEnabled() {
+  return internal::host_trace_enabled.load(std::memory_order_relaxed);
+}
+
+// Discards the recorded spans. Must not be called while any thread may be recording.
+void ClearHostTrace();
+
+// Returns the recorded spans in the Chrome trace event JSON format, which chrome://tracing and
+// Perfetto both load. Should only be called once tracing has stopped and open spans have closed,
+// otherwise spans being recorded may be torn.
+std::string HostTraceToJson();
+
+// Writes HostTraceToJson to |path|.
+zx::status<> WriteHostTrace(const std::string& path);
+
+// Records the time from its construction to its destruction as a span, with the arguments of
+// TRACE_DURATION: pairs of a key, which must be a string literal, and an integer, floating point,
+// boolean or string value. Does nothing unless tracing is enabled when it is constructed.
+class HostTraceDuration {
+ public:
+  template <typename... Args>
+  HostTraceDuration(const char* category, const char* name, const Args&... args) {
+    if (!HostTraceEnabled()) {
+      return;
+    }
+    category_ = category;
+    name_ = name;
+    AppendArgs(args...);
+    start_ns_ = NowNanoseconds();
+  }
+  ~HostTraceDuration() {
+    if (name_) {
+      Record();
+    }
+  }
+
+  HostTraceDuration(const HostTraceDuration&) = delete;
+  HostTraceDuration& operator=(const HostTraceDuration&) = delete;
+
+  // Arguments which do not fit in this many bytes of JSON are dropped.
+  static constexpr size_t kMaxArgsLength = 120;
+
+ private:
+  static uint64_t NowNanoseconds();
+
+  void AppendArgs() {}
+  template <typename Value, typename... Rest>
+  void AppendArgs(const char* key, const Value& value, const Rest&... rest) {
+    if constexpr (std::is_same_v<Value, bool>) {
+      AppendRaw(key, value ? "true" : "false");
+    } else if constexpr (std::is_integral_v<Value> && std::is_signed_v<Value>) {
+      AppendSigned(key, value);
+    } else if constexpr (std::is_integral_v<Value> || std::is_enum_v<Value>) {
+      AppendUnsigned(key, static_cast<uint64_t>(value));
+    } else if constexpr (std::is_floating_point_v<Value>) {
+      AppendDouble(key, value);
+    } else {
+      AppendString(key, std::string_view(value));
+    }
+    AppendArgs(rest...);
+  }
+
+  void AppendRaw(const char* key, std::string_view json);
+  void AppendSigned(const char* key, int64_t value);
+  void AppendUnsigned(const char* key, uint64_t value);
+  void AppendDouble(const char* key, double value);
+  void AppendString(const char* key, std::string_view value);
+
+  void Record();
+
+  const char* category_ = nullptr;
+  const char* name_ = nullptr;
+  uint64_t start_ns_ = 0;
+  size_t args_length_ = 0;
+  char args_[kMaxArgsLength];
+};
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_HOST_TRACE_H_
@@ -0,0 +1,594 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/image_builder.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <lib/syslog/cpp/macros.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include <fbl/algorithm.h>
+#include <fbl/unique_fd.h>
+
+#include "src/storage/minfs/compact.h"
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/minfs.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/runner.h"
+#include "src/storage/minfs/trace.h"
+
+namespace minfs {
+namespace {
+
+// File contents are read and written in pieces of at most this size.
+constexpr uint64_t kChunkSize = 8ull << 20;
+
+uint64_t DivideRoundUp(uint64_t value, uint64_t divisor) { return (value + divisor - 1) / divisor; }
+
+// Returns the data blocks and the most indirect blocks a file of |blocks| blocks can need.
+uint64_t BlocksWithIndirection(uint64_t blocks) {
+  uint64_t total = blocks;
+  if (blocks <= kMinfsDirect) {
+    return total;
+  }
+  uint64_t remaining = blocks - kMinfsDirect;
+  const uint64_t indirect_blocks = std::min<uint64_t>(
+      DivideRoundUp(remaining, kMinfsDirectPerIndirect), kMinfsIndirect);
+  total += indirect_blocks;
+  remaining -= std::min<uint64_t>(remaining, indirect_blocks * kMinfsDirectPerIndirect);
+  if (remaining > 0) {
+    total += 1 + DivideRoundUp(remaining, kMinfsDirectPerIndirect);
+  }
+  return total;
+}
+
+uint64_t FileBlocks(uint64_t size, const MountOptions& format) {
+  if (format.inline_data && size <= kMinfsInlineDataSize) {
+    return 0;
+  }
+  return BlocksWithIndirection(DivideRoundUp(size, kMinfsBlockSize));
+}
+
+uint64_t DirectoryBlocks(const std::set<std::string>& names, const MountOptions& format) {
+  uint64_t bytes = DirentSize(1) + DirentSize(2);
+  for (const std::string& name : names) {
+    bytes += DirentSize(static_cast<uint8_t>(name.size()));
+  }
+  if (format.dir_index) {
+    // The index block, and leaves which may be only half full after splitting.
+    return 1 + BlocksWithIndirection(2 * DivideRoundUp(bytes, kMinfsBlockSize));
+  }
+  if (format.inline_data && bytes <= kMinfsInlineDataSize) {
+    return 0;
+  }
+  // Dirents do not cross blocks, so each block may waste the space of the largest dirent.
+  return BlocksWithIndirection(DivideRoundUp(bytes, kMinfsBlockSize - kMinfsMaxDirentSize));
+}
+
+std::string_view Parent(std::string_view path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string_view::npos ? std::string_view() : path.substr(0, slash);
+}
+
+std::string_view Name(std::string_view path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+std::string Join(std::string_view directory, std::string_view name) {
+  if (directory.empty()) {
+    return std::string(name);
+  }
+  std::string path(directory);
+  path += '/';
+  path += name;
+  return path;
+}
+
+// A piece of a file, read by the reader threads and then written to the image in order.
+struct Chunk {
+  const std::string* source;
+  size_t file;
+  uint64_t offset;
+  uint64_t length;
+  std::vector<uint8_t> data;
+  bool ready = false;
+  zx_status_t status = ZX_OK;
+};
+
+zx_status_t ReadChunk(Chunk& chunk) {
+  TRACE_DURATION("minfs", "ImageBuilder::ReadChunk", "source", *chunk.source, "offset",
+                 chunk.offset, "length", chunk.length);
+  fbl::unique_fd fd(open(chunk.source->c_str(), O_RDONLY));
+  if (!fd) {
+    FX_LOGS(ERROR) << "Cannot open " << *chunk.source;
+    return ZX_ERR_IO;
+  }
+  chunk.data.resize(chunk.length);
+  uint64_t done = 0;
+  while (done < chunk.length) {
+    ssize_t r = pread(fd.get(), chunk.data.data() + done, chunk.length - done,
+                      static_cast<off_t>(chunk.offset + done));
+    if (r < 0) {
+      FX_LOGS(ERROR) << "Cannot read " << *chunk.source;
+      return ZX_ERR_IO;
+    }
+    if (r == 0) {
+      FX_LOGS(ERROR) << *chunk.source << " shrank while the image was being built";
+      return ZX_ERR_IO;
+    }
+    done += r;
+  }
+  return ZX_OK;
+}
+
+// Reads chunks on a pool of threads, in order, keeping no more than a given number of bytes read
+// ahead of the consumer.
+class ChunkReader {
+ public:
+  ChunkReader(std::vector<Chunk>& chunks, uint32_t thread_count, uint64_t max_buffered_bytes)
+      : chunks_(chunks), max_buffered_bytes_(max_buffered_bytes) {
+    for (uint32_t i = 0; i < std::max(thread_count, 1u); ++i) {
+      threads_.emplace_back([this] { ReadLoop(); });
+    }
+  }
+
+  ~ChunkReader() {
+    {
+      std::lock_guard lock(mutex_);
+      stopped_ = true;
+    }
+    condition_.notify_all();
+    for (std::thread& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Waits for chunk |index| to be read and returns the result.
+  zx_status_t Wait(size_t index) {
+    std::unique_lock lock(mutex_);
+    condition_.wait(lock, [&] { return chunks_[index].ready; });
+    return chunks_[index].status;
+  }
+
+  // Frees the data of chunk |index|, making room for more to be read.
+  void Release(size_t index) {
+    {
+      std::lock_guard lock(mutex_);
+      buffered_bytes_ -= chunks_[index].length;
+      chunks_[index].data = std::vector<uint8_t>();
+    }
+    condition_.notify_all();
+  }
+
+ private:
+  void ReadLoop() {
+    std::unique_lock lock(mutex_);
+    while (true) {
+      // Always allow one chunk to be read, however large, so that the consumer makes progress.
+      condition_.wait(lock, [this] {
+        return stopped_ || next_ == chunks_.size() || buffered_bytes_ == 0 ||
+               buffered_bytes_ + chunks_[next_].length <= max_buffered_bytes_;
+      });
+      if (stopped_ || next_ == chunks_.size()) {
+        return;
+      }
+      Chunk& chunk = chunks_[next_++];
+      buffered_bytes_ += chunk.length;
+
+      lock.unlock();
+      zx_status_t status = ReadChunk(chunk);
+      lock.lock();
+
+      chunk.status = status;
+      chunk.ready = true;
+      condition_.notify_all();
+    }
+  }
+
+  std::vector<Chunk>& chunks_;
+  const uint64_t max_buffered_bytes_;
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  size_t next_ = 0;
+  uint64_t buffered_bytes_ = 0;
+  bool stopped_ = false;
+
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace
+
+zx::status<std::string> ImageBuilder::NormalizePath(std::string_view path) {
+  std::string normalized;
+  while (!path.empty()) {
+    size_t slash = path.find('/');
+    std::string_view component = path.substr(0, slash);
+    path = slash == std::string_view::npos ? std::string_view() : path.substr(slash + 1);
+    if (component.empty() || component == ".") {
+      continue;
+    }
+    if (component == ".." || component.size() > kMinfsMaxNameSize) {
+      return zx::error(ZX_ERR_INVALID_ARGS);
+    }
+    normalized = Join(normalized, component);
+  }
+  return zx::ok(std::move(normalized));
+}
+
+zx::status<> ImageBuilder::AddDirectories(const std::string& path) {
+  if (path.empty()) {
+    return zx::ok();
+  }
+  auto iter = nodes_.find(path);
+  if (iter != nodes_.end()) {
+    if (!iter->second.is_directory) {
+      return zx::error(ZX_ERR_NOT_DIR);
+    }
+    return zx::ok();
+  }
+  if (auto status = AddDirectories(std::string(Parent(path))); status.is_error()) {
+    return status;
+  }
+  nodes_[path].is_directory = true;
+  children_[std::string(Parent(path))].emplace(Name(path));
+  return zx::ok();
+}
+
+zx::status<> ImageBuilder::AddFile(std::string_view destination, const std::string& source) {
+  auto path_or = NormalizePath(destination);
+  if (path_or.is_error() || path_or->empty()) {
+    FX_LOGS(ERROR) << "Invalid destination path: " << destination;
+    return zx::error(ZX_ERR_INVALID_ARGS);
+  }
+  const std::string& path = path_or.value();
+
+  struct stat s;
+  if (stat(source.c_str(), &s) != 0) {
+    FX_LOGS(ERROR) << "Cannot stat " << source;
+    return zx::error(ZX_ERR_NOT_FOUND);
+  }
+  if (!S_ISREG(s.st_mode)) {
+    FX_LOGS(ERROR) << source << " is not a regular file";
+    return zx::error(ZX_ERR_NOT_FILE);
+  }
+  if (nodes_.find(path) != nodes_.end()) {
+    FX_LOGS(ERROR) << path << " is added more than once";
+    return zx::error(ZX_ERR_ALREADY_EXISTS);
+  }
+  if (auto status = AddDirectories(std::string(Parent(path))); status.is_error()) {
+    FX_LOGS(ERROR) << "A parent of " << path << " is a file";
+    return status;
+  }
+
+  nodes_[path] = Node{.source = source, .size = static_cast<uint64_t>(s.st_size)};
+  children_[std::string(Parent(path))].emplace(Name(path));
+  return zx::ok();
+}
+
+zx::status<> ImageBuilder::AddDirectory(std::string_view destination) {
+  auto path_or = NormalizePath(destination);
+  if (path_or.is_error()) {
+    FX_LOGS(ERROR) << "Invalid destination path: " << destination;
+    return path_or.take_error();
+  }
+  if (auto status = AddDirectories(path_or.value()); status.is_error()) {
+    FX_LOGS(ERROR) << destination << " is a file";
+    return status;
+  }
+  return zx::ok();
+}
+
+zx::status<> ImageBuilder::AddManifest(const std::string& path) {
+  std::ifstream manifest(path);
+  if (!manifest) {
+    FX_LOGS(ERROR) << "Cannot open manifest " << path;
+    return zx::error(ZX_ERR_NOT_FOUND);
+  }
+  const std::string_view manifest_directory = Parent(path);
+
+  std::string line;
+  for (int line_number = 1; std::getline(manifest, line); ++line_number) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    size_t equals = line.find('=');
+    if (equals == std::string::npos) {
+      FX_LOGS(ERROR) << path << ":" << line_number << ": expected destination=source";
+      return zx::error(ZX_ERR_INVALID_ARGS);
+    }
+    std::string source = line.substr(equals + 1);
+    if (source.empty() || source[0] != '/') {
+      source = Join(manifest_directory, source);
+    }
+    if (auto status = AddFile(std::string_view(line).substr(0, equals), source);
+        status.is_error()) {
+      FX_LOGS(ERROR) << path << ":" << line_number << ": cannot add entry";
+      return status;
+    }
+  }
+  return zx::ok();
+}
+
+zx::status<> ImageBuilder::AddTree(const std::string& source, std::string_view destination) {
+  DIR* dir = opendir(source.c_str());
+  if (dir == nullptr) {
+    FX_LOGS(ERROR) << "Cannot open directory " << source;
+    return zx::error(ZX_ERR_NOT_FOUND);
+  }
+  if (auto status = AddDirectory(destination); status.is_error()) {
+    closedir(dir);
+    return status;
+  }
+
+  std::vector<std::string> names;
+  while (struct dirent* entry = readdir(dir)) {
+    std::string_view name(entry->d_name);
+    if (name != "." && name != "..") {
+      names.emplace_back(name);
+    }
+  }
+  closedir(dir);
+
+  for (const std::string& name : names) {
+    const std::string child_source = source + "/" + name;
+    const std::string child_destination = Join(destination, name);
+    struct stat s;
+    if (stat(child_source.c_str(), &s) != 0) {
+      FX_LOGS(ERROR) << "Cannot stat " << child_source;
+      return zx::error(ZX_ERR_NOT_FOUND);
+    }
+    zx::status<> status = zx::ok();
+    if (S_ISDIR(s.st_mode)) {
+      status = AddTree(child_source, child_destination);
+    } else if (S_ISREG(s.st_mode)) {
+      status = AddFile(child_destination, child_source);
+    } else {
+      FX_LOGS(WARNING) << "Skipping " << child_source << ", which is not a file or directory";
+    }
+    if (status.is_error()) {
+      return status;
+    }
+  }
+  return zx::ok();
+}
+
+std::vector<std::string> ImageBuilder::CreationOrder() const {
+  std::vector<std::string> order;
+  std::deque<std::string> directories = {""};
+  while (!directories.empty()) {
+    std::string directory = std::move(directories.front());
+    directories.pop_front();
+    auto children = children_.find(directory);
+    if (children == children_.end()) {
+      continue;
+    }
+    for (const std::string& name : children->second) {
+      std::string path = Join(directory, name);
+      if (nodes_.at(path).is_directory) {
+        directories.push_back(path);
+      }
+      order.push_back(std::move(path));
+    }
+  }
+  return order;
+}
+
+zx::status<ImageBuilder::Plan> ImageBuilder::GetPlan() const {
+  Plan plan;
+  // Every directory, including the root, has its own blocks.
+  const std::set<std::string> no_children;
+  auto root_children = children_.find("");
+  uint64_t data_blocks = DirectoryBlocks(
+      root_children == children_.end() ? no_children : root_children->second, options_.format);
+  for (const auto& [path, node] : nodes_) {
+    if (node.is_directory) {
+      ++plan.directory_count;
+      auto children = children_.find(path);
+      data_blocks += DirectoryBlocks(children == children_.end() ? no_children : children->second,
+                                     options_.format);
+    } else {
+      ++plan.file_count;
+      plan.file_bytes += node.size;
+      data_blocks += FileBlocks(node.size, options_.format);
+    }
+  }
+  // Writes reserve blocks for the worst case before allocating, so leave room for one more chunk.
+  data_blocks += BlocksWithIndirection(kChunkSize / kMinfsBlockSize);
+  plan.data_blocks = data_blocks + options_.reserve_data_blocks;
+
+  // Inode zero is never used, and inode one is the root directory.
+  const uint64_t inode_count =
+      2 + plan.file_count + plan.directory_count + options_.reserve_inodes;
+  if (inode_count > std::numeric_limits<uint32_t>::max() - kMinfsInodesPerBlock) {
+    return zx::error(ZX_ERR_OUT_OF_RANGE);
+  }
+  plan.inode_count = static_cast<uint32_t>(
+      fbl::round_up(inode_count, static_cast<uint64_t>(kMinfsInodesPerBlock)));
+
+  MountOptions format = options_.format;
+  format.inode_count = plan.inode_count;
+  auto device_blocks_or = NonFvmDeviceBlocksRequired(format, plan.data_blocks);
+  if (device_blocks_or.is_error()) {
+    FX_LOGS(ERROR) << "The image would be too large";
+    return device_blocks_or.take_error();
+  }
+  plan.device_blocks = device_blocks_or.value();
+  return zx::ok(plan);
+}
+
+zx::status<uint64_t> ImageBuilder::Build(const std::string& path) const {
+  auto plan_or = GetPlan();
+  if (plan_or.is_error()) {
+    return plan_or.take_error();
+  }
+  fbl::unique_fd fd(open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644));
+  if (!fd) {
+    FX_LOGS(ERROR) << "Cannot create " << path;
+    return zx::error(ZX_ERR_IO);
+  }
+  if (ftruncate(fd.get(), static_cast<off_t>(plan_or->device_blocks) * kMinfsBlockSize) != 0) {
+    FX_LOGS(ERROR) << "Cannot size " << path;
+    return zx::error(ZX_ERR_IO);
+  }
+  auto bcache_or = Bcache::Create(std::move(fd), plan_or->device_blocks);
+  if (bcache_or.is_error()) {
+    return bcache_or.take_error();
+  }
+  bcache_or->SetPunchHoles(options_.sparse);
+  auto result = Build(std::move(bcache_or.value()));
+  if (result.is_error()) {
+    return result.take_error();
+  }
+  if (auto status = result.value()->Sync(); status.is_error()) {
+    return status.take_error();
+  }
+  return result.value()->AllocatedBytes();
+}
+
+zx::status<std::unique_ptr<Bcache>> ImageBuilder::Build(std::unique_ptr<Bcache> bcache) const {
+  TRACE_DURATION("minfs", "ImageBuilder::Build");
+  auto plan_or = GetPlan();
+  if (plan_or.is_error()) {
+    return plan_or.take_error();
+  }
+  if (bcache->Maxblk() < plan_or->device_blocks) {
+    FX_LOGS(ERROR) << "The image needs " << plan_or->device_blocks << " blocks but the device has "
+                   << bcache->Maxblk();
+    return zx::error(ZX_ERR_NO_SPACE);
+  }
+
+  MountOptions format = options_.format;
+  format.inode_count = plan_or->inode_count;
+  format.quiet = true;
+  if (auto status = Mkfs(format, bcache.get()); status.is_error()) {
+    return status.take_error();
+  }
+  auto runner_or = Runner::Create(nullptr, std::move(bcache), MountOptions{.quiet = true});
+  if (runner_or.is_error()) {
+    return runner_or.take_error();
+  }
+  std::unique_ptr<Runner> runner = std::move(runner_or.value());
+  Minfs& filesystem = runner->minfs();
+
+  // Create every directory and file before writing any data, so that the directories are packed
+  // together at the start of the volume and the files' data follows in inode order.
+  std::vector<std::pair<ino_t, const Node*>> files;
+  {
+    TRACE_DURATION("minfs", "ImageBuilder::CreateNodes", "nodes", nodes_.size());
+    std::map<std::string, fbl::RefPtr<fs::Vnode>> directories;
+    auto root_or = filesystem.VnodeGet(kMinfsRootIno);
+    if (root_or.is_error()) {
+      return root_or.take_error();
+    }
+    directories[""] = std::move(root_or.value());
+
+    zx_status_t status = ZX_OK;
+    for (const std::string& path : CreationOrder()) {
+      const Node& node = nodes_.at(path);
+      fbl::RefPtr<fs::Vnode> vnode;
+      status = directories.at(std::string(Parent(path)))
+                   ->Create(Name(path), node.is_directory ? S_IFDIR : 0, &vnode);
+      if (status != ZX_OK) {
+        FX_LOGS(ERROR) << "Cannot create " << path << ": " << status;
+        break;
+      }
+      if (node.is_directory) {
+        directories[path] = std::move(vnode);
+      } else {
+        if (node.size > 0) {
+          files.emplace_back(fbl::RefPtr<VnodeMinfs>::Downcast(vnode)->GetIno(), &node);
+        }
+        vnode->Close();
+      }
+    }
+    directories.erase("");
+    for (auto& [path, directory] : directories) {
+      directory->Close();
+    }
+    if (status != ZX_OK) {
+      Runner::Destroy(std::move(runner));
+      return zx::error(status);
+    }
+  }
+
+  std::vector<Chunk> chunks;
+  for (size_t i = 0; i < files.size(); ++i) {
+    const Node& node = *files[i].second;
+    for (uint64_t offset = 0; offset < node.size; offset += kChunkSize) {
+      chunks.push_back(Chunk{.source = &node.source,
+                             .file = i,
+                             .offset = offset,
+                             .length = std::min(kChunkSize, node.size - offset)});
+    }
+  }
+
+  zx_status_t status = ZX_OK;
+  {
+    TRACE_DURATION("minfs", "ImageBuilder::WriteData", "chunks", chunks.size());
+    ChunkReader reader(chunks, options_.reader_threads, options_.max_buffered_bytes);
+    fbl::RefPtr<VnodeMinfs> vnode;
+    for (size_t i = 0; i < chunks.size() && status == ZX_OK; ++i) {
+      const Chunk& chunk = chunks[i];
+      if ((status = reader.Wait(i)) != ZX_OK) {
+        break;
+      }
+      if (chunk.offset == 0) {
+        auto vnode_or = filesystem.VnodeGet(files[chunk.file].first);
+        if (vnode_or.is_error()) {
+          status = vnode_or.status_value();
+          break;
+        }
+        vnode = std::move(vnode_or.value());
+      }
+      for (uint64_t done = 0; done < chunk.length;) {
+        size_t actual = 0;
+        status = vnode->Write(chunk.data.data() + done, chunk.length - done, chunk.offset + done,
+                              &actual);
+        if (status == ZX_OK && actual == 0) {
+          status = ZX_ERR_NO_SPACE;
+        }
+        if (status != ZX_OK) {
+          FX_LOGS(ERROR) << "Cannot write " << *chunk.source << ": " << status;
+          break;
+        }
+        done += actual;
+      }
+      reader.Release(i);
+    }
+  }
+
+  if (status == ZX_OK && options_.compact) {
+    auto stats_or = CompactImage(filesystem);
+    if (stats_or.is_ok()) {
+      FX_LOGS(INFO) << "Moved " << stats_or->blocks_moved << " blocks; data now ends at block "
+                    << stats_or->high_water_after << " rather than "
+                    << stats_or->high_water_before;
+    }
+    status = stats_or.status_value();
+  }
+  if (status == ZX_OK && options_.sparse) {
+    status = DiscardFreeBlocks(filesystem).status_value();
+  }
+
+  bcache = Runner::Destroy(std::move(runner));
+  if (status != ZX_OK) {
+    return zx::error(status);
+  }
+  return zx::ok(std::move(bcache));
+}
+
+}  // namespace minfs
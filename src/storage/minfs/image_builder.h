@@ -0,0 +1,125 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_STORAGE_MINFS_IMAGE_BUILDER_H_
+#define SRC_STORAGE_MINFS_IMAGE_BUILDER_H_
+
+#ifdef __Fuchsia__
+#error Host-only Header
+#endif
+
+#include <lib/zx/status.h>
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/mount.h"
+
+namespace minfs {
+
+// Builds a minfs image from a set of host files in one pass.
+//
+// Unlike copying files in one at a time through the emu_* functions in host.h, the builder sees
+// the whole image before writing any of it. It sizes the device and the inode table to fit, creates
+// every directory and file first, parent directories before their children and the entries of each
+// directory together, so that inodes are numbered and directories packed in that order. It then
+// writes file contents in inode order with large writes, so that each file lands in one run of
+// blocks, while a pool of threads reads the source files ahead of the writer.
+class ImageBuilder {
+ public:
+  struct Options {
+    // The features to format the image with. |inode_count| is chosen by the builder.
+    MountOptions format;
+
+    // Space to leave free in the image beyond what its contents need.
+    uint32_t reserve_inodes = 0;
+    uint64_t reserve_data_blocks = 0;
+
+    // The number of threads reading source files, and the number of bytes they may have read ahead
+    // of the writer.
+    uint32_t reader_threads = 4;
+    uint64_t max_buffered_bytes = 64ull << 20;
+
+    // Punch all-zero and free blocks out of the image file rather than writing them, so that it
+    // only takes up as much space on the host as its contents (see Bcache::SetPunchHoles).
+    bool sparse = false;
+
+    // Once the contents are written, move data down into any free blocks below it (see
+    // CompactImage).
+    bool compact = false;
+  };
+
+  // The size of the image, as decided before it is written.
+  struct Plan {
+    uint64_t file_count = 0;
+    uint64_t directory_count = 0;
+    uint64_t file_bytes = 0;
+    uint32_t inode_count = 0;
+    uint64_t data_blocks = 0;
+    uint32_t device_blocks = 0;
+  };
+
+  explicit ImageBuilder(Options options) : options_(std::move(options)) {}
+
+  // Adds the host file |source| at |destination|, a path relative to the root of the image. Parent
+  // directories are created as needed.
+  zx::status<> AddFile(std::string_view destination, const std::string& source);
+
+  // Adds the directory |destination| to the image, even if it holds no files.
+  zx::status<> AddDirectory(std::string_view destination);
+
+  // Adds each "destination=source" line of the manifest at |path|. Relative sources are taken
+  // relative to the directory holding the manifest. Blank lines and lines starting with '#' are
+  // ignored.
+  zx::status<> AddManifest(const std::string& path);
+
+  // Adds the tree rooted at the host directory |source| under |destination|, which may be empty
+  // for the root of the image.
+  zx::status<> AddTree(const std::string& source, std::string_view destination);
+
+  // Returns the size of the image needed for what has been added.
+  zx::status<Plan> GetPlan() const;
+
+  // Writes the image to |path|, which is created or truncated to Plan::device_blocks blocks, and
+  // returns the number of bytes the host allocated for it. This is less than the size of the image
+  // if Options::sparse is set.
+  zx::status<uint64_t> Build(const std::string& path) const;
+
+  // Writes the image to |bcache|, which must hold at least Plan::device_blocks blocks, and returns
+  // it. Options::sparse only discards free blocks; punching out zero blocks is left to the caller
+  // through Bcache::SetPunchHoles.
+  zx::status<std::unique_ptr<Bcache>> Build(std::unique_ptr<Bcache> bcache) const;
+
+ private:
+  struct Node {
+    bool is_directory = false;
+    std::string source;
+    uint64_t size = 0;
+  };
+
+  // Returns |path| without empty or "." components, or an error if it is not a valid path within
+  // the image.
+  static zx::status<std::string> NormalizePath(std::string_view path);
+
+  // Adds |path| and any missing parents as directories.
+  zx::status<> AddDirectories(const std::string& path);
+
+  // Returns the entries in the order they are created: a breadth first walk of the tree with the
+  // entries of each directory in name order.
+  std::vector<std::string> CreationOrder() const;
+
+  Options options_;
+  // All files and directories by normalized path, and the names in each directory.
+  std::map<std::string, Node> nodes_;
+  std::map<std::string, std::set<std::string>> children_;
+};
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_IMAGE_BUILDER_H_
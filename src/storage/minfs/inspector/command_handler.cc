@@ -4,8 +4,10 @@
 
 #include "src/storage/minfs/inspector/command_handler.h"
 
+#include <string.h>
 #include <zircon/errors.h>
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <sstream>
@@ -15,6 +17,7 @@
 
 #include "src/lib/storage/vfs/cpp/journal/disk_struct.h"
 #include "src/storage/minfs/inspector/disk_struct.h"
+#include "src/storage/minfs/inspector/json_lines.h"
 
 namespace minfs {
 
@@ -123,6 +126,27 @@ void CommandHandler::InitializeCommands() {
          return PrintJournalCommit(args.uint64_fields["index"]);
        }},
 
+      {"PrintLayoutStats",
+       {
+           {"max", ArgType::kUint64, "Maximum number of fragmented files to list."},
+       },
+       "Prints free space fragmentation, file extent counts, directory sizes and inode table "
+       "density.",
+       [this](ParsedCommand args) -> zx_status_t {
+         return PrintLayoutStats(args.uint64_fields["max"]);
+       }},
+
+      {"DumpJsonLines",
+       {
+           {"what", ArgType::kString,
+            "One of inodes, allocated_inodes, inode_bitmap, block_bitmap, journal or all."},
+           {"threads", ArgType::kUint64, "Number of threads scanning the inode table."},
+       },
+       "Dumps metadata as one JSON object per line.",
+       [this](ParsedCommand args) -> zx_status_t {
+         return DumpJsonLines(args.string_fields["what"], args.uint64_fields["threads"]);
+       }},
+
       {"PrintBackupSuperblock",
        {},
        "Prints the backup superblock.",
@@ -179,9 +203,65 @@ zx_status_t CommandHandler::PrintInode(uint64_t index) {
   Inode inode = result.take_value()[0];
   std::unique_ptr<disk_inspector::DiskStruct> object = GetInodeStruct(index);
   *output_ << object->ToString(&inode, options_);
+  if (inode.flags & kMinfsInodeFlagInlineData) {
+    *output_ << "Inline data: " << std::min<uint32_t>(inode.size, kMinfsInlineDataSize)
+             << " bytes\n";
+  } else if (inspector_->InspectSuperblock().UsesExtents()) {
+    PrintExtentRoot(inode);
+  }
+  if (inode.flags & kMinfsInodeFlagDirIndex) {
+    PrintDirIndex(inode);
+  }
   return ZX_OK;
 }
 
+void CommandHandler::PrintDirIndex(const Inode& inode) {
+  auto result = inspector_->InspectDirIndex(inode);
+  if (result.is_error()) {
+    *output_ << "Directory index: unreadable (" << result.error() << ")\n";
+    return;
+  }
+  const std::vector<DirIndexEntry>& entries = result.value();
+  *output_ << "Directory index: " << entries.size() << " leaves\n";
+  for (size_t i = 0; i < entries.size(); ++i) {
+    uint64_t end_hash = i + 1 < entries.size() ? entries[i + 1].hash : uint64_t{1} << 32;
+    if (end_hash == entries[i].hash) {
+      // Continued by the next leaf, so it holds only names with exactly this hash.
+      end_hash = uint64_t{entries[i].hash} + 1;
+    }
+    *output_ << "  hashes " << entries[i].hash << "-" << end_hash - 1 << " -> file block "
+             << entries[i].block << "\n";
+  }
+}
+
+void CommandHandler::PrintExtentRoot(const Inode& inode) {
+  const uint8_t* root = reinterpret_cast<const uint8_t*>(&inode) + offsetof(Inode, dnum);
+  ExtentHeader header;
+  memcpy(&header, root, sizeof(header));
+  if (header.magic != kMinfsExtentMagic) {
+    *output_ << "Extent root: " << (header.magic == 0 ? "empty" : "bad magic") << "\n";
+    return;
+  }
+  *output_ << "Extent root: depth " << header.depth << ", " << header.count << " records\n";
+  const uint8_t* records = root + sizeof(header);
+  if (header.depth == 0) {
+    for (uint16_t i = 0; i < std::min<uint32_t>(header.count, kMinfsExtentsPerRoot); ++i) {
+      Extent extent;
+      memcpy(&extent, records + i * sizeof(Extent), sizeof(extent));
+      *output_ << "  file blocks " << extent.file_block << "-"
+               << uint64_t{extent.file_block} + extent.length - 1 << " -> blocks " << extent.block
+               << "-" << uint64_t{extent.block} + extent.length - 1 << "\n";
+    }
+  } else {
+    for (uint16_t i = 0; i < std::min<uint32_t>(header.count, kMinfsExtentIndicesPerRoot); ++i) {
+      ExtentIndex index;
+      memcpy(&index, records + i * sizeof(ExtentIndex), sizeof(index));
+      *output_ << "  file blocks from " << index.file_block << " -> node block " << index.block
+               << "\n";
+    }
+  }
+}
+
 zx_status_t CommandHandler::PrintInodes(uint64_t max) {
   uint64_t count = std::min(max, inspector_->GetInodeCount());
   if (count == 0) {
@@ -283,6 +363,104 @@ zx_status_t CommandHandler::PrintJournalCommit(uint64_t index) {
   return ZX_OK;
 }
 
+namespace {
+
+// Prints the non-empty buckets of |histogram|.
+void PrintHistogram(std::ostream& output, const char* title,
+                    const LayoutStats::Histogram& histogram) {
+  output << title << ":\n";
+  for (size_t bucket = 0; bucket < histogram.size(); ++bucket) {
+    if (histogram[bucket] != 0) {
+      output << "  " << LayoutStats::HistogramBucketName(bucket) << ": " << histogram[bucket]
+             << "\n";
+    }
+  }
+}
+
+}  // namespace
+
+zx_status_t CommandHandler::PrintLayoutStats(uint64_t max) {
+  auto result = inspector_->InspectLayout(max);
+  if (result.is_error()) {
+    return result.take_error();
+  }
+  const LayoutStats stats = result.take_value();
+
+  *output_ << "Free space: " << stats.free_blocks << " of " << stats.data_blocks
+           << " data blocks in " << stats.free_extents << " extents, the largest "
+           << stats.largest_free_extent << " blocks\n";
+  PrintHistogram(*output_, "Free extents by length in blocks", stats.free_extents_by_length);
+
+  *output_ << "Files: " << stats.mapped_files << " with " << stats.mapped_blocks << " blocks in "
+           << stats.file_extents << " extents, " << stats.fragmented_files
+           << " with more than one\n";
+  PrintHistogram(*output_, "Files by extents", stats.files_by_extents);
+  if (!stats.most_fragmented.empty()) {
+    *output_ << "Most fragmented:\n";
+    for (const LayoutStats::FragmentedFile& file : stats.most_fragmented) {
+      *output_ << "  inode " << file.ino << (file.directory ? " (directory)" : "") << ": "
+               << file.extents << " extents, " << file.blocks << " blocks\n";
+    }
+  }
+
+  *output_ << "Directories: " << stats.directories << " with " << stats.directory_entries
+           << " entries in " << stats.directory_blocks << " blocks\n";
+  PrintHistogram(*output_, "Directories by blocks", stats.directories_by_blocks);
+  PrintHistogram(*output_, "Directories by entries per block",
+                 stats.directories_by_entries_per_block);
+
+  *output_ << "Inode table: " << stats.allocated_inodes << " of " << stats.inode_capacity
+           << " inodes allocated in " << stats.inode_table_blocks << " blocks\n";
+  *output_ << "Inode table blocks by allocated inodes:\n";
+  for (size_t bucket = 0; bucket < LayoutStats::kDensityBuckets; ++bucket) {
+    *output_ << "  " << LayoutStats::DensityBucketName(bucket) << ": "
+             << stats.inode_table_blocks_by_density[bucket] << "\n";
+  }
+  return ZX_OK;
+}
+
+zx_status_t CommandHandler::DumpJsonLines(const std::string& what, uint64_t threads) {
+  const bool all = what == "all";
+  bool known = all;
+  const uint32_t thread_count = static_cast<uint32_t>(std::clamp<uint64_t>(threads, 1, 64));
+  if (all || what == "inodes" || what == "allocated_inodes") {
+    known = true;
+    zx_status_t status = DumpInodesAsJsonLines(inspector_.get(), output_, thread_count,
+                                               what == "allocated_inodes");
+    if (status != ZX_OK) {
+      return status;
+    }
+  }
+  if (all || what == "inode_bitmap") {
+    known = true;
+    zx_status_t status =
+        DumpBitmapAsJsonLines(inspector_.get(), MinfsInspector::BitmapKind::kInode, output_);
+    if (status != ZX_OK) {
+      return status;
+    }
+  }
+  if (all || what == "block_bitmap") {
+    known = true;
+    zx_status_t status =
+        DumpBitmapAsJsonLines(inspector_.get(), MinfsInspector::BitmapKind::kBlock, output_);
+    if (status != ZX_OK) {
+      return status;
+    }
+  }
+  if (all || what == "journal") {
+    known = true;
+    zx_status_t status = DumpJournalAsJsonLines(inspector_.get(), output_);
+    if (status != ZX_OK) {
+      return status;
+    }
+  }
+  if (!known) {
+    std::cerr << "Unknown metadata to dump: " << what << "\n";
+    return ZX_ERR_INVALID_ARGS;
+  }
+  return ZX_OK;
+}
+
 zx_status_t CommandHandler::PrintBackupSuperblock() {
   auto result = inspector_->InspectBackupSuperblock();
   if (result.is_error()) {
@@ -57,9 +57,16 @@ class CommandHandler : public disk_inspector::CommandHandler {
   // Prints the minfs superblock to |output_|.
   zx_status_t PrintSuperblock();
 
-  // Prints the inode at |index| to |output_|.
+  // Prints the inode at |index| to |output_|. On volumes which use extents this includes the root
+  // of the inode's extent tree, and for indexed directories it includes the directory index.
   zx_status_t PrintInode(uint64_t index);
 
+  // Prints the extent tree root held in the block pointer area of |inode| to |output_|.
+  void PrintExtentRoot(const Inode& inode);
+
+  // Prints the leaves of the indexed directory |inode| to |output_|.
+  void PrintDirIndex(const Inode& inode);
+
   // Prints every inode in the inode table in order to |output_|. |max| represents
   // the number of entries to print if |max| is less the the total number of
   // entries.
@@ -86,6 +93,14 @@ class CommandHandler : public disk_inspector::CommandHandler {
   // Prints the jouranl entry at |index| as a JournalCommit struct to |output_|.
   zx_status_t PrintJournalCommit(uint64_t index);
 
+  // Prints the free space fragmentation, file extent counts, directory sizes and inode table
+  // density of the volume to |output_|, listing up to |max| of the most fragmented files.
+  zx_status_t PrintLayoutStats(uint64_t max);
+
+  // Writes |what| to |output_| as JSON lines: "inodes", "allocated_inodes", "inode_bitmap",
+  // "block_bitmap", "journal" or "all" of them, scanning inodes on |threads| threads.
+  zx_status_t DumpJsonLines(const std::string& what, uint64_t threads);
+
   // Prints the minfs backup superblock to |output_|.
   zx_status_t PrintBackupSuperblock();
 
@@ -14,7 +14,7 @@
 namespace minfs {
 
 std::unique_ptr<disk_inspector::DiskStruct> GetSuperblockStruct() {
-  static_assert(offsetof(Superblock, reserved) == 120);
+  static_assert(offsetof(Superblock, reserved) == 132);
   std::unique_ptr<disk_inspector::DiskStruct> object =
       disk_inspector::DiskStruct::Create("Superblock", sizeof(Superblock));
   ADD_FIELD(object, Superblock, magic0);
@@ -43,7 +43,14 @@ std::unique_ptr<disk_inspector::DiskStruct> GetSuperblockStruct() {
   ADD_FIELD(object, Superblock, unlinked_head);
   ADD_FIELD(object, Superblock, unlinked_tail);
   ADD_FIELD(object, Superblock, oldest_minor_version);
-  ADD_ARRAY_FIELD(object, Superblock, reserved, 2018);
+  ADD_FIELD(object, Superblock, ino_init_blocks);
+  ADD_FIELD(object, Superblock, csum_block);
+  ADD_FIELD(object, Superblock, csum_blocks);
+  ADD_FIELD(object, Superblock, csum_ibm_blocks);
+  ADD_FIELD(object, Superblock, csum_abm_blocks);
+  ADD_FIELD(object, Superblock, csum_dat_blocks);
+  ADD_ARRAY_FIELD(object, Superblock, dir_hash_seed, 2);
+  ADD_ARRAY_FIELD(object, Superblock, reserved, 2010);
   return object;
 }
 
@@ -62,7 +69,9 @@ std::unique_ptr<disk_inspector::DiskStruct> GetInodeStruct(uint64_t index) {
   ADD_FIELD(object, Inode, dirent_count);
   ADD_FIELD(object, Inode, last_inode);
   ADD_FIELD(object, Inode, next_inode);
-  ADD_ARRAY_FIELD(object, Inode, rsvd, 3);
+  ADD_FIELD(object, Inode, flags);
+  ADD_FIELD(object, Inode, size_high);
+  ADD_FIELD(object, Inode, checksum);
   ADD_ARRAY_FIELD(object, Inode, dnum, kMinfsDirect);
   ADD_ARRAY_FIELD(object, Inode, inum, kMinfsIndirect);
   ADD_ARRAY_FIELD(object, Inode, dinum, kMinfsDoublyIndirect);
@@ -15,7 +15,7 @@
 namespace minfs {
 
 // Total number of fields in the on-disk inode structure.
-constexpr uint32_t kInodeNumElements = 16;
+constexpr uint32_t kInodeNumElements = 17;
 
 class InodeObject : public disk_inspector::DiskObject {
  public:
@@ -121,6 +121,34 @@ std::unique_ptr<disk_inspector::DiskObject> SuperBlockObject::GetElementAt(uint3
       return CreateUint32DiskObj("generation_count", &(sb_.generation_count));
     }
     case 26: {
+      // uint32_t ino_init_blocks.
+      return CreateUint32DiskObj("ino_init_blocks", &(sb_.ino_init_blocks));
+    }
+    case 27: {
+      // uint32_t csum_block.
+      return CreateUint32DiskObj("csum_block", &(sb_.csum_block));
+    }
+    case 28: {
+      // uint32_t csum_blocks.
+      return CreateUint32DiskObj("csum_blocks", &(sb_.csum_blocks));
+    }
+    case 29: {
+      // uint32_t csum_ibm_blocks.
+      return CreateUint32DiskObj("csum_ibm_blocks", &(sb_.csum_ibm_blocks));
+    }
+    case 30: {
+      // uint32_t csum_abm_blocks.
+      return CreateUint32DiskObj("csum_abm_blocks", &(sb_.csum_abm_blocks));
+    }
+    case 31: {
+      // uint32_t csum_dat_blocks.
+      return CreateUint32DiskObj("csum_dat_blocks", &(sb_.csum_dat_blocks));
+    }
+    case 32: {
+      // uint32_t dir_hash_seed[2].
+      return CreateUint32ArrayDiskObj("dir_hash_seed", sb_.dir_hash_seed, 2);
+    }
+    case 33: {
       // uint32_t reserved[].
       return CreateUint32ArrayDiskObj("reserved", sb_.reserved, 1);
     }
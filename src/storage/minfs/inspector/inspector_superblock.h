@@ -15,7 +15,7 @@
 namespace minfs {
 
 // Total number of fields in the on-disk superblock structure.
-constexpr uint32_t kSuperblockNumElements = 28;
+constexpr uint32_t kSuperblockNumElements = 35;
 constexpr char kSuperBlockName[] = "superblock";
 constexpr char kBackupSuperBlockName[] = "backup superblock";
 
@@ -0,0 +1,152 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/inspector/json_lines.h"
+
+#include <mutex>
+
+#include "src/lib/storage/vfs/cpp/journal/format.h"
+
+namespace minfs {
+namespace {
+
+void AppendField(std::string& json, const char* key, uint64_t value) {
+  json += ", \"";
+  json += key;
+  json += "\": ";
+  json += std::to_string(value);
+}
+
+template <size_t N>
+void AppendArray(std::string& json, const char* key, const blk_t (&values)[N]) {
+  json += ", \"";
+  json += key;
+  json += "\": [";
+  for (size_t i = 0; i < N; ++i) {
+    if (i > 0) {
+      json += ", ";
+    }
+    json += std::to_string(values[i]);
+  }
+  json += "]";
+}
+
+}  // namespace
+
+std::string InodeToJson(uint64_t index, const Inode& inode, bool allocated) {
+  std::string json = "{\"type\": \"inode\"";
+  AppendField(json, "index", index);
+  json += allocated ? ", \"allocated\": true" : ", \"allocated\": false";
+  AppendField(json, "magic", inode.magic);
+  AppendField(json, "size", GetInodeSize(inode));
+  AppendField(json, "block_count", inode.block_count);
+  AppendField(json, "link_count", inode.link_count);
+  AppendField(json, "create_time", inode.create_time);
+  AppendField(json, "modify_time", inode.modify_time);
+  AppendField(json, "seq_num", inode.seq_num);
+  AppendField(json, "gen_num", inode.gen_num);
+  AppendField(json, "dirent_count", inode.dirent_count);
+  AppendField(json, "last_inode", inode.last_inode);
+  AppendField(json, "next_inode", inode.next_inode);
+  AppendField(json, "flags", inode.flags);
+  AppendField(json, "checksum", inode.checksum);
+  // On volumes with extents or inodes with inline data these hold the extent root or the data.
+  AppendArray(json, "dnum", inode.dnum);
+  AppendArray(json, "inum", inode.inum);
+  AppendArray(json, "dinum", inode.dinum);
+  return json + "}";
+}
+
+zx_status_t DumpInodesAsJsonLines(MinfsInspector* inspector, std::ostream* output,
+                                  uint32_t threads, bool allocated_only) {
+  std::mutex mutex;
+  return inspector->ScanInodes(
+      0, inspector->GetInodeCount(), {.threads = threads, .allocated_only = allocated_only},
+      [&](uint64_t index, const Inode& inode, bool allocated) {
+        std::string line = InodeToJson(index, inode, allocated) + "\n";
+        std::lock_guard lock(mutex);
+        *output << line;
+        return ZX_OK;
+      });
+}
+
+zx_status_t DumpBitmapAsJsonLines(MinfsInspector* inspector, MinfsInspector::BitmapKind kind,
+                                  std::ostream* output) {
+  const char* type = kind == MinfsInspector::BitmapKind::kInode ? "inode_bitmap" : "block_bitmap";
+  uint64_t run_start = 0;
+  uint64_t run_length = 0;
+  bool run_allocated = false;
+  auto end_run = [&] {
+    if (run_length > 0) {
+      *output << "{\"type\": \"" << type << "\", \"start\": " << run_start
+              << ", \"length\": " << run_length
+              << ", \"allocated\": " << (run_allocated ? "true" : "false") << "}\n";
+    }
+  };
+  zx_status_t status = inspector->ScanBitmap(
+      kind, 64, [&](uint64_t first, const uint64_t* words, uint64_t count) {
+        for (uint64_t bit = 0; bit < count; ++bit) {
+          const bool allocated = (words[bit / 64] >> (bit % 64)) & 1;
+          if (run_length == 0 || allocated != run_allocated) {
+            end_run();
+            run_start = first + bit;
+            run_length = 0;
+            run_allocated = allocated;
+          }
+          ++run_length;
+        }
+        return ZX_OK;
+      });
+  if (status != ZX_OK) {
+    return status;
+  }
+  end_run();
+  return ZX_OK;
+}
+
+zx_status_t DumpJournalAsJsonLines(MinfsInspector* inspector, std::ostream* output) {
+  auto info_or = inspector->InspectJournalSuperblock();
+  if (info_or.is_error()) {
+    return info_or.take_error();
+  }
+  const fs::JournalInfo& info = info_or.value();
+  *output << "{\"type\": \"journal_info\", \"magic\": " << info.magic
+          << ", \"start_block\": " << info.start_block << ", \"timestamp\": " << info.timestamp
+          << "}\n";
+
+  for (uint64_t i = 0; i < inspector->GetJournalEntryCount(); ++i) {
+    auto prefix_or = inspector->InspectJournalEntryAs<fs::JournalPrefix>(i);
+    if (prefix_or.is_error()) {
+      return prefix_or.take_error();
+    }
+    const fs::JournalPrefix& prefix = prefix_or.value();
+    *output << "{\"type\": \"journal_entry\", \"index\": " << i;
+    switch (prefix.ObjectType()) {
+      case fs::JournalObjectType::kHeader: {
+        auto header_or = inspector->InspectJournalEntryAs<fs::JournalHeaderBlock>(i);
+        if (header_or.is_error()) {
+          *output << "}\n";
+          return header_or.take_error();
+        }
+        *output << ", \"kind\": \"header\", \"sequence_number\": " << prefix.sequence_number
+                << ", \"payload_blocks\": " << header_or.value().payload_blocks;
+        break;
+      }
+      case fs::JournalObjectType::kCommit:
+        *output << ", \"kind\": \"commit\", \"sequence_number\": " << prefix.sequence_number;
+        break;
+      case fs::JournalObjectType::kRevocation:
+        *output << ", \"kind\": \"revocation\", \"sequence_number\": " << prefix.sequence_number;
+        break;
+      default:
+        // Payload blocks, and blocks never written.
+        *output << ", \"kind\": \"unknown\"";
+        break;
+    }
+    *output << "}\n";
+  }
+  return ZX_OK;
+}
+
+}  // namespace minfs
@@ -0,0 +1,40 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Writers of a volume's metadata as JSON lines: a JSON object per line, each with a "type" field
+// naming what it describes. Everything is read through the chunked scans of MinfsInspector, so
+// dumping a volume of any size for offline analysis takes bounded memory.
+
+#ifndef SRC_STORAGE_MINFS_INSPECTOR_JSON_LINES_H_
+#define SRC_STORAGE_MINFS_INSPECTOR_JSON_LINES_H_
+
+#include <stdint.h>
+#include <zircon/types.h>
+
+#include <ostream>
+#include <string>
+
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/inspector/minfs_inspector.h"
+
+namespace minfs {
+
+// Returns the JSON object describing the inode at |index|, without a trailing newline.
+std::string InodeToJson(uint64_t index, const Inode& inode, bool allocated);
+
+// Writes a line for each inode, or for only the allocated ones, scanning the inode table on
+// |threads| threads. With more than one thread the lines are not in order of index.
+zx_status_t DumpInodesAsJsonLines(MinfsInspector* inspector, std::ostream* output,
+                                  uint32_t threads, bool allocated_only);
+
+// Writes a line for each run of allocated or free bits in the inode or block bitmap.
+zx_status_t DumpBitmapAsJsonLines(MinfsInspector* inspector, MinfsInspector::BitmapKind kind,
+                                  std::ostream* output);
+
+// Writes a line for the journal superblock and one for each block of journal entries.
+zx_status_t DumpJournalAsJsonLines(MinfsInspector* inspector, std::ostream* output);
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_INSPECTOR_JSON_LINES_H_
@@ -0,0 +1,155 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/inspector/layout_stats.h"
+
+#include <algorithm>
+
+namespace minfs {
+namespace {
+
+// Orders the most fragmented files, most extents first.
+bool MoreFragmented(const LayoutStats::FragmentedFile& a, const LayoutStats::FragmentedFile& b) {
+  return a.extents != b.extents ? a.extents > b.extents : a.ino < b.ino;
+}
+
+}  // namespace
+
+size_t LayoutStats::HistogramBucket(uint64_t value) {
+  if (value <= 1) {
+    return 0;
+  }
+  const size_t bucket = 63 - __builtin_clzll(value);
+  return std::min(bucket, kHistogramBuckets - 1);
+}
+
+std::string LayoutStats::HistogramBucketName(size_t bucket) {
+  if (bucket == 0) {
+    return "0-1";
+  }
+  const uint64_t low = uint64_t{1} << bucket;
+  if (bucket == kHistogramBuckets - 1) {
+    return std::to_string(low) + "+";
+  }
+  return std::to_string(low) + "-" + std::to_string(2 * low - 1);
+}
+
+size_t LayoutStats::DensityBucket(uint64_t allocated, uint64_t capacity) {
+  if (allocated == 0) {
+    return 0;
+  }
+  if (allocated >= capacity) {
+    return kDensityBuckets - 1;
+  }
+  // Rounds up so that 1-25% is the first bucket after the empty one.
+  return 1 + (allocated * 4 - 1) / capacity;
+}
+
+const char* LayoutStats::DensityBucketName(size_t bucket) {
+  static constexpr const char* kNames[kDensityBuckets] = {"0%",     "1-25%",  "26-50%",
+                                                          "51-75%", "76-99%", "100%"};
+  return bucket < kDensityBuckets ? kNames[bucket] : "unknown";
+}
+
+void LayoutStatsBuilder::AddBlockBitmap(const uint64_t* words, uint64_t count) {
+  for (uint64_t bit = 0; bit < count;) {
+    const uint64_t word = words[bit / 64];
+    // Whole words which are all allocated or all free are added at once.
+    if (bit % 64 == 0 && count - bit >= 64 && (word == 0 || word == ~uint64_t{0})) {
+      AddBlockRun(word != 0, 64);
+      bit += 64;
+      continue;
+    }
+    AddBlockRun((word >> (bit % 64)) & 1, 1);
+    ++bit;
+  }
+}
+
+void LayoutStatsBuilder::AddBlockRun(bool allocated, uint64_t length) {
+  stats_.data_blocks += length;
+  if (allocated) {
+    EndFreeExtent();
+  } else {
+    stats_.free_blocks += length;
+    free_run_ += length;
+  }
+}
+
+void LayoutStatsBuilder::EndFreeExtent() {
+  if (free_run_ == 0) {
+    return;
+  }
+  ++stats_.free_extents;
+  ++stats_.free_extents_by_length[LayoutStats::HistogramBucket(free_run_)];
+  stats_.largest_free_extent = std::max(stats_.largest_free_extent, free_run_);
+  free_run_ = 0;
+}
+
+void LayoutStatsBuilder::AddInodeTableBlock(uint64_t allocated, uint64_t capacity) {
+  ++stats_.inode_table_blocks;
+  stats_.inode_capacity += capacity;
+  stats_.allocated_inodes += allocated;
+  ++stats_.inode_table_blocks_by_density[LayoutStats::DensityBucket(allocated, capacity)];
+}
+
+void LayoutStatsBuilder::BeginFile(uint64_t ino, const Inode& inode) {
+  file_ = {.ino = ino, .directory = inode.magic == kMinfsMagicDir};
+  file_entries_ = inode.dirent_count;
+  next_file_block_ = 0;
+  next_block_ = 0;
+}
+
+void LayoutStatsBuilder::AddFileRun(uint64_t file_block, uint64_t block, uint64_t length) {
+  if (length == 0) {
+    return;
+  }
+  if (file_.extents == 0 || file_block != next_file_block_ || block != next_block_) {
+    ++file_.extents;
+  }
+  file_.blocks += length;
+  next_file_block_ = file_block + length;
+  next_block_ = block + length;
+}
+
+void LayoutStatsBuilder::EndFile() {
+  if (file_.directory) {
+    ++stats_.directories;
+    stats_.directory_entries += file_entries_;
+    if (file_.blocks > 0) {
+      stats_.directory_blocks += file_.blocks;
+      ++stats_.directories_by_blocks[LayoutStats::HistogramBucket(file_.blocks)];
+      const uint64_t entries_per_block = file_entries_ / file_.blocks;
+      ++stats_.directories_by_entries_per_block[LayoutStats::HistogramBucket(entries_per_block)];
+    }
+  }
+  if (file_.extents == 0) {
+    return;
+  }
+  ++stats_.mapped_files;
+  stats_.mapped_blocks += file_.blocks;
+  stats_.file_extents += file_.extents;
+  if (file_.extents > 1) {
+    ++stats_.fragmented_files;
+  }
+  ++stats_.files_by_extents[LayoutStats::HistogramBucket(file_.extents)];
+
+  // |most_fragmented| is kept as a heap whose front is the least fragmented file in it.
+  std::vector<LayoutStats::FragmentedFile>& worst = stats_.most_fragmented;
+  if (worst.size() < max_fragmented_files_) {
+    worst.push_back(file_);
+    std::push_heap(worst.begin(), worst.end(), MoreFragmented);
+  } else if (!worst.empty() && MoreFragmented(file_, worst.front())) {
+    std::pop_heap(worst.begin(), worst.end(), MoreFragmented);
+    worst.back() = file_;
+    std::push_heap(worst.begin(), worst.end(), MoreFragmented);
+  }
+}
+
+LayoutStats LayoutStatsBuilder::Finish() {
+  EndFreeExtent();
+  std::sort_heap(stats_.most_fragmented.begin(), stats_.most_fragmented.end(), MoreFragmented);
+  return std::move(stats_);
+}
+
+}  // namespace minfs
@@ -0,0 +1,119 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_STORAGE_MINFS_INSPECTOR_LAYOUT_STATS_H_
+#define SRC_STORAGE_MINFS_INSPECTOR_LAYOUT_STATS_H_
+
+#include <stdint.h>
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "src/storage/minfs/format.h"
+
+namespace minfs {
+
+// Statistics describing how well laid out a volume is, used to decide when it is worth
+// defragmenting or reformatting.
+struct LayoutStats {
+  // Histograms of positive values with a bucket per power of two: bucket n counts the values from
+  // 2^n to 2^(n+1) - 1, except that bucket zero also counts zero.
+  static constexpr size_t kHistogramBuckets = 33;
+  using Histogram = std::array<uint64_t, kHistogramBuckets>;
+
+  // Inode table blocks with no inodes allocated, 1-25%, 26-50%, 51-75%, 76-99% and all of them.
+  static constexpr size_t kDensityBuckets = 6;
+
+  struct FragmentedFile {
+    uint64_t ino = 0;
+    bool directory = false;
+    uint64_t blocks = 0;
+    uint64_t extents = 0;
+  };
+
+  static size_t HistogramBucket(uint64_t value);
+  // Returns the range of values counted by |bucket|, such as "4-7".
+  static std::string HistogramBucketName(size_t bucket);
+
+  static size_t DensityBucket(uint64_t allocated, uint64_t capacity);
+  static const char* DensityBucketName(size_t bucket);
+
+  // Free space, from the block bitmap. A free extent is a maximal run of free data blocks.
+  uint64_t data_blocks = 0;
+  uint64_t free_blocks = 0;
+  uint64_t free_extents = 0;
+  uint64_t largest_free_extent = 0;
+  Histogram free_extents_by_length = {};
+
+  // Files and directories with at least one data block. An extent is a maximal run of file blocks
+  // which are contiguous on the device; holes end extents.
+  uint64_t mapped_files = 0;
+  uint64_t mapped_blocks = 0;
+  uint64_t file_extents = 0;
+  uint64_t fragmented_files = 0;
+  Histogram files_by_extents = {};
+  // The files with the most extents, most first.
+  std::vector<FragmentedFile> most_fragmented;
+
+  // Directories. The fill of a directory is the number of entries per block it holds, which is
+  // known from the inode alone; directories with inline data have no blocks and are not counted
+  // in the histograms.
+  uint64_t directories = 0;
+  uint64_t directory_blocks = 0;
+  uint64_t directory_entries = 0;
+  Histogram directories_by_blocks = {};
+  Histogram directories_by_entries_per_block = {};
+
+  // Inode table density, from the inode bitmap.
+  uint64_t inode_table_blocks = 0;
+  uint64_t inode_capacity = 0;
+  uint64_t allocated_inodes = 0;
+  std::array<uint64_t, kDensityBuckets> inode_table_blocks_by_density = {};
+};
+
+// Accumulates LayoutStats in a single pass over the block bitmap and the inode table, keeping no
+// more state than the free extent and file being scanned and the most fragmented files.
+class LayoutStatsBuilder {
+ public:
+  // Keeps the |max_fragmented_files| files with the most extents.
+  explicit LayoutStatsBuilder(size_t max_fragmented_files)
+      : max_fragmented_files_(max_fragmented_files) {}
+
+  // Adds the next |count| bits of the block bitmap, held least significant bit first in |words|.
+  void AddBlockBitmap(const uint64_t* words, uint64_t count);
+
+  // Adds the next |length| data blocks, all of which are either allocated or free.
+  void AddBlockRun(bool allocated, uint64_t length);
+
+  // Adds the next block of the inode table, of which |allocated| of |capacity| inodes are
+  // allocated.
+  void AddInodeTableBlock(uint64_t allocated, uint64_t capacity);
+
+  // Adds the allocated file or directory |inode|, whose blocks are then added in file block order
+  // with AddFileRun until EndFile.
+  void BeginFile(uint64_t ino, const Inode& inode);
+  void AddFileRun(uint64_t file_block, uint64_t block, uint64_t length);
+  void EndFile();
+
+  // Returns the statistics; the builder must not be used afterwards.
+  LayoutStats Finish();
+
+ private:
+  void EndFreeExtent();
+
+  const size_t max_fragmented_files_;
+  LayoutStats stats_;
+  uint64_t free_run_ = 0;
+
+  // The file being added.
+  LayoutStats::FragmentedFile file_;
+  uint64_t file_entries_ = 0;
+  uint64_t next_file_block_ = 0;
+  uint64_t next_block_ = 0;
+};
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_INSPECTOR_LAYOUT_STATS_H_
@@ -26,7 +26,8 @@ class Loader {
   // Loads the inode bitmap at the location specified by the superblock to the start of the buffer.
   zx_status_t LoadInodeBitmap(const Superblock& superblock, storage::BlockBuffer* buffer) const;
 
-  // Loads the inode table at the location specified by the superblock to the start of the buffer.
+  // Loads the inode table at the location specified by the superblock to the start of the buffer,
+  // which must hold the whole table. MinfsInspector::ScanInodes reads it a chunk at a time instead.
   zx_status_t LoadInodeTable(const Superblock& superblock, storage::BlockBuffer* buffer) const;
 
   // Loads the journal at the location specified by the superblock to the start of the buffer.
@@ -5,8 +5,12 @@
 #include "src/storage/minfs/inspector/minfs_inspector.h"
 
 #include <lib/syslog/cpp/macros.h>
+#include <string.h>
 
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #include <disk_inspector/inspector_transaction_handler.h>
 #include <disk_inspector/vmo_buffer_factory.h>
@@ -67,39 +71,161 @@ uint64_t MinfsInspector::GetJournalEntryCount() {
 fpromise::result<std::vector<Inode>, zx_status_t> MinfsInspector::InspectInodeRange(
     uint64_t start_index, uint64_t end_index) {
   ZX_ASSERT(end_index > start_index);
-  Loader loader(handler_.get());
+  std::vector<Inode> inodes;
+  inodes.reserve(end_index - start_index);
+  // Small ranges are read in a single chunk no larger than they need.
+  const uint64_t blocks =
+      (end_index - 1) / kMinfsInodesPerBlock - start_index / kMinfsInodesPerBlock + 1;
+  zx_status_t status =
+      ScanInodes(start_index, end_index, {.chunk_blocks = blocks},
+                 [&inodes](uint64_t index, const Inode& inode, bool allocated) -> zx_status_t {
+                   inodes.push_back(inode);
+                   return ZX_OK;
+                 });
+  if (status != ZX_OK) {
+    return fpromise::error(status);
+  }
+  return fpromise::ok(std::move(inodes));
+}
 
-  // Since there are multiple inodes in a block, we first perform calculations
-  // to find the block range of only the desired inode range to load.
-  uint64_t start_block_offset = start_index / kMinfsInodesPerBlock;
-  uint64_t start_block = superblock_.ino_block + start_block_offset;
-  // Because the end index is exclusive, we calculate the length based on
-  // end index - 1 to get the last inclusive value, and add 1 to the length
-  // to prevent off-by-one.
-  uint64_t block_length = (end_index - 1) / kMinfsInodesPerBlock - start_block_offset + 1;
+zx_status_t MinfsInspector::ScanInodes(uint64_t start_index, uint64_t end_index,
+                                       const ScanOptions& options, const InodeVisitor& visitor) {
+  if (start_index >= end_index) {
+    return ZX_OK;
+  }
+  const uint64_t chunk_blocks = std::clamp<uint64_t>(options.chunk_blocks, 1, kMaxScanChunkBlocks);
+  const uint64_t first_block = start_index / kMinfsInodesPerBlock;
+  const uint64_t end_block = (end_index - 1) / kMinfsInodesPerBlock + 1;
+  const uint64_t chunk_count = (end_block - first_block + chunk_blocks - 1) / chunk_blocks;
+  const uint64_t thread_count = std::clamp<uint64_t>(options.threads, 1, chunk_count);
 
-  auto result = buffer_factory_->CreateBuffer(block_length);
-  if (result.is_error()) {
-    return result.take_error_result();
+  // Each thread loads its chunks into buffers of its own.
+  struct Worker {
+    std::unique_ptr<storage::BlockBuffer> table;
+    std::unique_ptr<storage::BlockBuffer> bitmap;
+  };
+  std::vector<Worker> workers(thread_count);
+  for (Worker& worker : workers) {
+    auto result = buffer_factory_->CreateBuffer(chunk_blocks);
+    if (result.is_error()) {
+      return result.take_error();
+    }
+    worker.table = result.take_value();
+    result = buffer_factory_->CreateBuffer(2);
+    if (result.is_error()) {
+      return result.take_error();
+    }
+    worker.bitmap = result.take_value();
   }
-  std::unique_ptr<storage::BlockBuffer> inode_buffer = result.take_value();
 
-  zx_status_t status = loader.RunReadOperation(inode_buffer.get(), 0, start_block, block_length);
+  std::atomic<uint64_t> next_chunk = 0;
+  std::atomic<bool> stopped = false;
+  std::mutex mutex;
+  zx_status_t scan_status = ZX_OK;
+  auto scan = [&](Worker* worker) {
+    while (!stopped.load(std::memory_order_relaxed)) {
+      const uint64_t chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+      if (chunk >= chunk_count) {
+        return;
+      }
+      const uint64_t block = first_block + chunk * chunk_blocks;
+      zx_status_t status = ScanInodeChunk(block, std::min(chunk_blocks, end_block - block),
+                                          start_index, end_index, options.allocated_only,
+                                          worker->table.get(), worker->bitmap.get(), visitor);
+      if (status != ZX_OK) {
+        std::lock_guard lock(mutex);
+        if (scan_status == ZX_OK) {
+          scan_status = status;
+        }
+        stopped.store(true, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  // The calling thread scans too, so a single-threaded scan visits every chunk in order on it.
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < workers.size(); ++i) {
+    threads.emplace_back(scan, &workers[i]);
+  }
+  scan(&workers[0]);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  return scan_status;
+}
+
+zx_status_t MinfsInspector::ScanInodeChunk(uint64_t block, uint64_t block_count,
+                                           uint64_t start_index, uint64_t end_index,
+                                           bool allocated_only, storage::BlockBuffer* table,
+                                           storage::BlockBuffer* bitmap,
+                                           const InodeVisitor& visitor) {
+  Loader loader(handler_.get());
+  zx_status_t status =
+      loader.RunReadOperation(table, 0, superblock_.ino_block + block, block_count);
   if (status != ZX_OK) {
     FX_LOGS(ERROR) << "Cannot load inode. err: " << status;
-    return fpromise::error(status);
+    return status;
   }
 
-  // Once loaded, we treat the buffer as the entire inode table and find the
-  // new start index relative to it being in the first block. The element count
-  // can be calculated normally.
-  uint64_t buffer_offset = start_index % kMinfsInodesPerBlock;
-  uint64_t count = end_index - start_index;
-  std::vector<Inode> inodes;
-  for (uint64_t i = 0; i < count; ++i) {
-    inodes.emplace_back(GetInodeElement(inode_buffer.get(), buffer_offset + i));
+  const uint64_t first = std::max(start_index, block * kMinfsInodesPerBlock);
+  const uint64_t end = std::min(end_index, (block + block_count) * kMinfsInodesPerBlock);
+  const uint64_t bitmap_block = first / kMinfsBlockBits;
+  status = loader.RunReadOperation(bitmap, 0, superblock_.ibm_block + bitmap_block,
+                                   (end - 1) / kMinfsBlockBits - bitmap_block + 1);
+  if (status != ZX_OK) {
+    FX_LOGS(ERROR) << "Cannot load allocation bits. err: " << status;
+    return status;
+  }
+
+  for (uint64_t index = first; index < end; ++index) {
+    const bool allocated = GetBitmapElement(bitmap, index - bitmap_block * kMinfsBlockBits);
+    if (allocated_only && !allocated) {
+      continue;
+    }
+    // Free inodes in uninitialised blocks of a lazily initialised inode table may hold stale
+    // data; report them as zeroed, as the filesystem would.
+    Inode inode = {};
+    if (allocated || superblock_.IsInodeTableBlockInitialized(index / kMinfsInodesPerBlock)) {
+      inode = GetInodeElement(table, index - block * kMinfsInodesPerBlock);
+    }
+    status = visitor(index, inode, allocated);
+    if (status != ZX_OK) {
+      return status;
+    }
   }
-  return fpromise::ok(inodes);
+  return ZX_OK;
+}
+
+zx_status_t MinfsInspector::ScanBitmap(BitmapKind kind, uint64_t chunk_blocks,
+                                       const BitmapVisitor& visitor) {
+  const uint64_t bits =
+      kind == BitmapKind::kInode ? superblock_.inode_count : superblock_.block_count;
+  const uint64_t start_block =
+      kind == BitmapKind::kInode ? superblock_.ibm_block : superblock_.abm_block;
+  chunk_blocks = std::max<uint64_t>(chunk_blocks, 1);
+  auto result = buffer_factory_->CreateBuffer(chunk_blocks);
+  if (result.is_error()) {
+    return result.take_error();
+  }
+  std::unique_ptr<storage::BlockBuffer> buffer = result.take_value();
+
+  Loader loader(handler_.get());
+  const uint64_t chunk_bits = chunk_blocks * kMinfsBlockBits;
+  for (uint64_t bit = 0; bit < bits; bit += chunk_bits) {
+    const uint64_t count = std::min(bits - bit, chunk_bits);
+    zx_status_t status =
+        loader.RunReadOperation(buffer.get(), 0, start_block + bit / kMinfsBlockBits,
+                                (count + kMinfsBlockBits - 1) / kMinfsBlockBits);
+    if (status != ZX_OK) {
+      FX_LOGS(ERROR) << "Cannot load allocation bits. err: " << status;
+      return status;
+    }
+    status = visitor(bit, static_cast<const uint64_t*>(buffer->Data(0)), count);
+    if (status != ZX_OK) {
+      return status;
+    }
+  }
+  return ZX_OK;
 }
 
 fpromise::result<std::vector<uint64_t>, zx_status_t> MinfsInspector::InspectInodeAllocatedInRange(
@@ -186,6 +312,236 @@ fpromise::result<fs::JournalCommitBlock, zx_status_t> MinfsInspector::InspectJou
   return fpromise::ok(*reinterpret_cast<fs::JournalCommitBlock*>(buffer_->Data(0)));
 }
 
+fpromise::result<std::vector<DirIndexEntry>, zx_status_t> MinfsInspector::InspectDirIndex(
+    const Inode& inode) {
+  Loader loader(handler_.get());
+  auto result = buffer_factory_->CreateBuffer(1);
+  if (result.is_error()) {
+    return result.take_error_result();
+  }
+  std::unique_ptr<storage::BlockBuffer> block_buffer = result.take_value();
+
+  // Find the block holding file block 0, which is the index.
+  blk_t index_block = inode.dnum[0];
+  if (superblock_.UsesExtents()) {
+    const uint8_t* node = reinterpret_cast<const uint8_t*>(inode.dnum);
+    for (uint16_t level = 0;; ++level) {
+      ExtentHeader header;
+      memcpy(&header, node, sizeof(header));
+      if (header.magic != kMinfsExtentMagic || header.count == 0 || level > kMinfsMaxExtentDepth) {
+        FX_LOGS(ERROR) << "Cannot find directory index in extent tree.";
+        return fpromise::error(ZX_ERR_IO_DATA_INTEGRITY);
+      }
+      if (header.depth == 0) {
+        Extent extent;
+        memcpy(&extent, node + sizeof(header), sizeof(extent));
+        index_block = extent.file_block == 0 ? extent.block : 0;
+        break;
+      }
+      // The first record covers file block 0.
+      ExtentIndex index;
+      memcpy(&index, node + sizeof(header), sizeof(index));
+      zx_status_t status = loader.RunReadOperation(block_buffer.get(), 0,
+                                                   superblock_.dat_block + index.block, 1);
+      if (status != ZX_OK) {
+        FX_LOGS(ERROR) << "Cannot load extent node. err: " << status;
+        return fpromise::error(status);
+      }
+      node = static_cast<const uint8_t*>(block_buffer->Data(0));
+    }
+  }
+  if (index_block == 0) {
+    FX_LOGS(ERROR) << "Directory has no index block.";
+    return fpromise::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
+
+  zx_status_t status =
+      loader.RunReadOperation(block_buffer.get(), 0, superblock_.dat_block + index_block, 1);
+  if (status != ZX_OK) {
+    FX_LOGS(ERROR) << "Cannot load directory index. err: " << status;
+    return fpromise::error(status);
+  }
+  const uint8_t* data = static_cast<const uint8_t*>(block_buffer->Data(0));
+  DirIndexHeader header;
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != kMinfsDirIndexMagic || header.count > kMinfsDirIndexMaxEntries) {
+    FX_LOGS(ERROR) << "Bad directory index header.";
+    return fpromise::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
+  std::vector<DirIndexEntry> entries(header.count);
+  memcpy(entries.data(), data + sizeof(header), entries.size() * sizeof(DirIndexEntry));
+  return fpromise::ok(std::move(entries));
+}
+
+// The number of blocks of the block bitmap or the inode table loaded at a time by InspectLayout.
+constexpr uint64_t kLayoutChunkBlocks = 64;
+
+fpromise::result<LayoutStats, zx_status_t> MinfsInspector::InspectLayout(
+    size_t max_fragmented_files) {
+  LayoutStatsBuilder builder(max_fragmented_files);
+  std::vector<std::unique_ptr<storage::BlockBuffer>> scratch;
+  for (uint16_t level = 0; level < kMinfsMaxExtentDepth; ++level) {
+    auto result = buffer_factory_->CreateBuffer(1);
+    if (result.is_error()) {
+      return result.take_error_result();
+    }
+    scratch.push_back(result.take_value());
+  }
+
+  // Free space, from the block bitmap.
+  zx_status_t status =
+      ScanBitmap(BitmapKind::kBlock, kLayoutChunkBlocks,
+                 [&builder](uint64_t first, const uint64_t* words, uint64_t count) {
+                   builder.AddBlockBitmap(words, count);
+                   return ZX_OK;
+                 });
+  if (status != ZX_OK) {
+    return fpromise::error(status);
+  }
+
+  // Inode table density and the files, from the inode bitmap and the inode table.
+  const uint64_t inode_count = superblock_.inode_count;
+  uint64_t block_allocated = 0;
+  status = ScanInodes(
+      0, inode_count, {.chunk_blocks = kLayoutChunkBlocks},
+      [&](uint64_t index, const Inode& inode, bool allocated) -> zx_status_t {
+        if (allocated) {
+          ++block_allocated;
+          if (inode.magic == kMinfsMagicFile || inode.magic == kMinfsMagicDir) {
+            builder.BeginFile(index, inode);
+            zx_status_t file_status = AddFileLayout(inode, &builder, scratch);
+            if (file_status != ZX_OK) {
+              return file_status;
+            }
+            builder.EndFile();
+          }
+        }
+        // The last inode of each block of the table, or of the table itself, completes a block.
+        if ((index + 1) % kMinfsInodesPerBlock == 0 || index + 1 == inode_count) {
+          builder.AddInodeTableBlock(block_allocated, index % kMinfsInodesPerBlock + 1);
+          block_allocated = 0;
+        }
+        return ZX_OK;
+      });
+  if (status != ZX_OK) {
+    return fpromise::error(status);
+  }
+  return fpromise::ok(builder.Finish());
+}
+
+zx_status_t MinfsInspector::AddFileLayout(
+    const Inode& inode, LayoutStatsBuilder* builder,
+    std::vector<std::unique_ptr<storage::BlockBuffer>>& scratch) {
+  if (inode.flags & kMinfsInodeFlagInlineData) {
+    return ZX_OK;
+  }
+  if (superblock_.UsesExtents()) {
+    return AddExtentNodeLayout(reinterpret_cast<const uint8_t*>(inode.dnum), kMinfsExtentRootSize,
+                               kMinfsMaxExtentDepth, builder, scratch);
+  }
+
+  // Block pointers past the end of the data section are corrupt and skipped.
+  auto add_block = [&](uint64_t file_block, blk_t block) {
+    if (block != 0 && block < superblock_.block_count) {
+      builder->AddFileRun(file_block, block, 1);
+    }
+  };
+  Loader loader(handler_.get());
+  auto add_indirect = [&](uint64_t first_file_block, blk_t indirect) -> zx_status_t {
+    if (indirect == 0 || indirect >= superblock_.block_count) {
+      return ZX_OK;
+    }
+    zx_status_t status =
+        loader.RunReadOperation(scratch[0].get(), 0, superblock_.dat_block + indirect, 1);
+    if (status != ZX_OK) {
+      FX_LOGS(ERROR) << "Cannot load indirect block. err: " << status;
+      return status;
+    }
+    const blk_t* entries = static_cast<const blk_t*>(scratch[0]->Data(0));
+    for (uint32_t i = 0; i < kMinfsDirectPerIndirect; ++i) {
+      add_block(first_file_block + i, entries[i]);
+    }
+    return ZX_OK;
+  };
+
+  uint64_t file_block = 0;
+  for (uint32_t i = 0; i < kMinfsDirect; ++i, ++file_block) {
+    add_block(file_block, inode.dnum[i]);
+  }
+  for (uint32_t i = 0; i < kMinfsIndirect; ++i, file_block += kMinfsDirectPerIndirect) {
+    if (zx_status_t status = add_indirect(file_block, inode.inum[i]); status != ZX_OK) {
+      return status;
+    }
+  }
+  for (uint32_t i = 0; i < kMinfsDoublyIndirect; ++i, file_block += kMinfsDirectPerDindirect) {
+    const blk_t dindirect = inode.dinum[i];
+    if (dindirect == 0 || dindirect >= superblock_.block_count) {
+      continue;
+    }
+    zx_status_t status =
+        loader.RunReadOperation(scratch[1].get(), 0, superblock_.dat_block + dindirect, 1);
+    if (status != ZX_OK) {
+      FX_LOGS(ERROR) << "Cannot load doubly indirect block. err: " << status;
+      return status;
+    }
+    const blk_t* entries = static_cast<const blk_t*>(scratch[1]->Data(0));
+    for (uint32_t j = 0; j < kMinfsDirectPerIndirect; ++j) {
+      status = add_indirect(file_block + j * kMinfsDirectPerIndirect, entries[j]);
+      if (status != ZX_OK) {
+        return status;
+      }
+    }
+  }
+  return ZX_OK;
+}
+
+zx_status_t MinfsInspector::AddExtentNodeLayout(
+    const uint8_t* node, size_t node_size, uint16_t max_depth, LayoutStatsBuilder* builder,
+    std::vector<std::unique_ptr<storage::BlockBuffer>>& scratch) {
+  // An empty root has no magic; other nodes without it, or deeper than their parent allows, are
+  // corrupt.
+  ExtentHeader header;
+  memcpy(&header, node, sizeof(header));
+  if (header.magic != kMinfsExtentMagic || header.depth > max_depth) {
+    return ZX_OK;
+  }
+  const uint8_t* records = node + sizeof(header);
+  if (header.depth == 0) {
+    const size_t count =
+        std::min<size_t>(header.count, (node_size - sizeof(header)) / sizeof(Extent));
+    for (size_t i = 0; i < count; ++i) {
+      Extent extent;
+      memcpy(&extent, records + i * sizeof(Extent), sizeof(extent));
+      builder->AddFileRun(extent.file_block, extent.block, extent.length);
+    }
+    return ZX_OK;
+  }
+
+  // Each child is read into the scratch buffer for its depth, which none of its ancestors use.
+  Loader loader(handler_.get());
+  storage::BlockBuffer* buffer = scratch[header.depth - 1].get();
+  const size_t count =
+      std::min<size_t>(header.count, (node_size - sizeof(header)) / sizeof(ExtentIndex));
+  for (size_t i = 0; i < count; ++i) {
+    ExtentIndex index;
+    memcpy(&index, records + i * sizeof(ExtentIndex), sizeof(index));
+    if (index.block >= superblock_.block_count) {
+      continue;
+    }
+    zx_status_t status = loader.RunReadOperation(buffer, 0, superblock_.dat_block + index.block, 1);
+    if (status != ZX_OK) {
+      FX_LOGS(ERROR) << "Cannot load extent node. err: " << status;
+      return status;
+    }
+    status = AddExtentNodeLayout(static_cast<const uint8_t*>(buffer->Data(0)), kMinfsBlockSize,
+                                 header.depth - 1, builder, scratch);
+    if (status != ZX_OK) {
+      return status;
+    }
+  }
+  return ZX_OK;
+}
+
 fpromise::result<Superblock, zx_status_t> MinfsInspector::InspectBackupSuperblock() {
   Loader loader(handler_.get());
   uint32_t backup_location =
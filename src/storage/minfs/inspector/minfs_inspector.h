@@ -5,6 +5,9 @@
 #ifndef SRC_STORAGE_MINFS_INSPECTOR_MINFS_INSPECTOR_H_
 #define SRC_STORAGE_MINFS_INSPECTOR_MINFS_INSPECTOR_H_
 
+#include <lib/fit/function.h>
+
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -15,6 +18,7 @@
 #include "src/lib/storage/block_client/cpp/block_device.h"
 #include "src/lib/storage/vfs/cpp/journal/format.h"
 #include "src/storage/minfs/format.h"
+#include "src/storage/minfs/inspector/layout_stats.h"
 
 namespace minfs {
 
@@ -72,12 +76,59 @@ class MinfsInspector {
   fpromise::result<std::vector<Inode>, zx_status_t> InspectInodeRange(uint64_t start_index,
                                                                       uint64_t end_index);
 
+  struct ScanOptions {
+    // The number of inode table blocks each thread reads at a time, which bounds the memory a scan
+    // uses. Clamped to between one and kMaxScanChunkBlocks.
+    uint64_t chunk_blocks = 64;
+    // The number of threads reading and visiting chunks. With more than one, chunks are visited
+    // concurrently and in no particular order, though the inodes of each are visited in order.
+    uint32_t threads = 1;
+    // Skips the inodes which the inode bitmap has free.
+    bool allocated_only = false;
+  };
+
+  // The largest chunk of the inode table a scan reads at once, chosen so that the allocation bits
+  // of its inodes lie in no more than two blocks of the inode bitmap.
+  static constexpr uint64_t kMaxScanChunkBlocks = kMinfsBlockBits / kMinfsInodesPerBlock;
+
+  // Called with each inode of a scan, its index and whether the inode bitmap has it allocated.
+  // Returning anything but ZX_OK stops the scan, which then returns that status.
+  using InodeVisitor =
+      fit::function<zx_status_t(uint64_t index, const Inode& inode, bool allocated)>;
+
+  // Visits the inodes from |start_index| inclusive to |end_index| exclusive, reading the inode
+  // table and the inode bitmap a chunk at a time, so that memory use does not grow with the size
+  // of the volume. Free inodes beyond the initialised part of a lazily initialised inode table are
+  // visited as zeroed. With more than one thread, |visitor| is called from several threads at once.
+  zx_status_t ScanInodes(uint64_t start_index, uint64_t end_index, const ScanOptions& options,
+                         const InodeVisitor& visitor);
+
+  enum class BitmapKind { kInode, kBlock };
+
+  // Called with consecutive chunks of a bitmap: |count| bits starting at bit |first|, held least
+  // significant bit first in |words|. Returning anything but ZX_OK stops the scan.
+  using BitmapVisitor =
+      fit::function<zx_status_t(uint64_t first, const uint64_t* words, uint64_t count)>;
+
+  // Visits the whole inode or block bitmap in order, reading |chunk_blocks| blocks at a time.
+  zx_status_t ScanBitmap(BitmapKind kind, uint64_t chunk_blocks, const BitmapVisitor& visitor);
+
   // Loads the inode bitmap blocks for which the inode allocation bits for inodes
   // from |start_index| inclusive to |end_index| exclusive from disk and returns
   // the inode indices for which the corresponding bits are allocated.
   fpromise::result<std::vector<uint64_t>, zx_status_t> InspectInodeAllocatedInRange(
       uint64_t start_index, uint64_t end_index);
 
+  // Loads the index block of the indexed directory |inode| (see kMinfsInodeFlagDirIndex) and
+  // returns its records.
+  fpromise::result<std::vector<DirIndexEntry>, zx_status_t> InspectDirIndex(const Inode& inode);
+
+  // Computes the layout statistics of the volume in a single pass over the block bitmap, the inode
+  // bitmap and the inode table, keeping the |max_fragmented_files| files with the most extents.
+  // The extents of files mapped by indirect blocks or extent tree nodes are found by reading those
+  // blocks as each file is reached; no other data blocks are read.
+  fpromise::result<LayoutStats, zx_status_t> InspectLayout(size_t max_fragmented_files);
+
   // Loads the first journal block
   fpromise::result<fs::JournalInfo, zx_status_t> InspectJournalSuperblock();
 
@@ -100,6 +151,21 @@ class MinfsInspector {
 
   zx_status_t LoadJournalEntry(storage::BlockBuffer* buffer, uint64_t index);
 
+  // Visits the inodes from |start_index| to |end_index| which lie in the |block_count| inode table
+  // blocks from |block|, using |table| and |bitmap| to load them and their allocation bits.
+  zx_status_t ScanInodeChunk(uint64_t block, uint64_t block_count, uint64_t start_index,
+                             uint64_t end_index, bool allocated_only, storage::BlockBuffer* table,
+                             storage::BlockBuffer* bitmap, const InodeVisitor& visitor);
+
+  // Adds the data block runs of the allocated |inode| to |builder|, reading its indirect blocks or
+  // extent tree nodes into |scratch|, which holds a single-block buffer per level of mapping below
+  // the inode. Mappings which are corrupt are followed no further.
+  zx_status_t AddFileLayout(const Inode& inode, LayoutStatsBuilder* builder,
+                            std::vector<std::unique_ptr<storage::BlockBuffer>>& scratch);
+  zx_status_t AddExtentNodeLayout(const uint8_t* node, size_t node_size, uint16_t max_depth,
+                                  LayoutStatsBuilder* builder,
+                                  std::vector<std::unique_ptr<storage::BlockBuffer>>& scratch);
+
   std::unique_ptr<fs::TransactionHandler> handler_;
   std::unique_ptr<disk_inspector::BufferFactory> buffer_factory_;
   Superblock superblock_;
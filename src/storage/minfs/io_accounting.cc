@@ -0,0 +1,172 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/io_accounting.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+namespace minfs {
+
+const char* IoSourceName(IoSource source) {
+  switch (source) {
+    case IoSource::kSuperblock:
+      return "superblock";
+    case IoSource::kInodeBitmap:
+      return "inode_bitmap";
+    case IoSource::kBlockBitmap:
+      return "block_bitmap";
+    case IoSource::kInodeTable:
+      return "inode_table";
+    case IoSource::kJournal:
+      return "journal";
+    case IoSource::kIndirect:
+      return "indirect";
+    case IoSource::kDirectory:
+      return "directory";
+    case IoSource::kFileData:
+      return "file_data";
+    case IoSource::kData:
+      return "data";
+    case IoSource::kCount:
+      break;
+  }
+  return "unknown";
+}
+
+void IoAccounting::SetLayout(const Superblock& info) {
+  inode_bitmap_start_ = info.InodeBitmapStartBlock();
+  block_bitmap_start_ = info.DataBitmapStartBlock();
+  inode_table_start_ = info.InodeTableStartBlock();
+  integrity_start_ = info.integrity_start_block;
+  journal_start_ = JournalStartBlock(info);
+  data_start_ = info.DataStartBlock();
+}
+
+IoSource IoAccounting::Classify(uint64_t block, IoSource data_source) const {
+  if (block >= data_start_) {
+    return data_source;
+  }
+  if (block >= journal_start_) {
+    return IoSource::kJournal;
+  }
+  if (block >= integrity_start_) {
+    return IoSource::kSuperblock;
+  }
+  if (block >= inode_table_start_) {
+    return IoSource::kInodeTable;
+  }
+  if (block >= block_bitmap_start_) {
+    return IoSource::kBlockBitmap;
+  }
+  if (block >= inode_bitmap_start_) {
+    return IoSource::kInodeBitmap;
+  }
+  return IoSource::kSuperblock;
+}
+
+void IoAccounting::Record(View view, const storage::Operation& operation, IoSource data_source) {
+  if (operation.type != storage::OperationType::kRead &&
+      operation.type != storage::OperationType::kWrite) {
+    return;
+  }
+  // Operations never cross regions, so the first block says which one an operation is in.
+  const IoSource source = Classify(operation.dev_offset, data_source);
+  AtomicCounts& counts = At(view, operation.type == storage::OperationType::kWrite, source);
+  counts.ops.fetch_add(1, std::memory_order_relaxed);
+  counts.blocks.fetch_add(operation.length, std::memory_order_relaxed);
+  counts.ops_by_size[SizeBucket(operation.length)].fetch_add(1, std::memory_order_relaxed);
+}
+
+IoAccounting::Counts IoAccounting::Get(View view, bool write, IoSource source) const {
+  const AtomicCounts& counts = At(view, write, source);
+  Counts result;
+  result.ops = counts.ops.load(std::memory_order_relaxed);
+  result.blocks = counts.blocks.load(std::memory_order_relaxed);
+  result.bytes = result.blocks * kMinfsBlockSize;
+  for (size_t i = 0; i < kSizeBucketCount; ++i) {
+    result.ops_by_size[i] = counts.ops_by_size[i].load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+void IoAccounting::Reset() {
+  for (auto& view : counts_) {
+    for (auto& direction : view) {
+      for (AtomicCounts& counts : direction) {
+        counts.ops.store(0, std::memory_order_relaxed);
+        counts.blocks.store(0, std::memory_order_relaxed);
+        for (auto& bucket : counts.ops_by_size) {
+          bucket.store(0, std::memory_order_relaxed);
+        }
+      }
+    }
+  }
+}
+
+std::string IoAccounting::ToJson() const {
+  std::string json = "{";
+  for (size_t view = 0; view < kViewCount; ++view) {
+    json += view ? ", \"" : "\"";
+    json += ViewName(static_cast<View>(view));
+    json += "\": {";
+    for (bool write : {false, true}) {
+      json += write ? ", \"write\": {" : "\"read\": {";
+      bool first = true;
+      for (size_t source = 0; source < kSourceCount; ++source) {
+        const Counts counts = Get(static_cast<View>(view), write, static_cast<IoSource>(source));
+        if (counts.ops == 0) {
+          continue;
+        }
+        char entry[256];
+        snprintf(entry, sizeof(entry),
+                 "%s\"%s\": {\"ops\": %" PRIu64 ", \"blocks\": %" PRIu64 ", \"bytes\": %" PRIu64
+                 ", \"ops_by_size\": {",
+                 first ? "" : ", ", IoSourceName(static_cast<IoSource>(source)), counts.ops,
+                 counts.blocks, counts.bytes);
+        json += entry;
+        for (size_t bucket = 0; bucket < kSizeBucketCount; ++bucket) {
+          snprintf(entry, sizeof(entry), "%s\"%s\": %" PRIu64, bucket ? ", " : "",
+                   SizeBucketName(bucket), counts.ops_by_size[bucket]);
+          json += entry;
+        }
+        json += "}}";
+        first = false;
+      }
+      json += "}";
+    }
+    json += "}";
+  }
+  return json + "}";
+}
+
+size_t IoAccounting::SizeBucket(uint64_t blocks) {
+  if (blocks <= 1) {
+    return 0;
+  }
+  // Buckets after the second each cover a power of four.
+  const int exponent = 63 - __builtin_clzll(blocks);
+  const size_t bucket = 1 + static_cast<size_t>(exponent) / 2;
+  return bucket < kSizeBucketCount ? bucket : kSizeBucketCount - 1;
+}
+
+const char* IoAccounting::SizeBucketName(size_t bucket) {
+  static constexpr const char* kNames[kSizeBucketCount] = {"1",     "2-3",     "4-15",
+                                                           "16-63", "64-255", "256+"};
+  return bucket < kSizeBucketCount ? kNames[bucket] : "unknown";
+}
+
+const char* IoAccounting::ViewName(View view) {
+  switch (view) {
+    case View::kTransaction:
+      return "transaction";
+    case View::kDevice:
+      return "device";
+    case View::kCount:
+      break;
+  }
+  return "unknown";
+}
+
+}  // namespace minfs
@@ -0,0 +1,132 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_STORAGE_MINFS_IO_ACCOUNTING_H_
+#define SRC_STORAGE_MINFS_IO_ACCOUNTING_H_
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <string>
+
+#include <storage/operation/operation.h>
+
+#include "src/storage/minfs/format.h"
+
+namespace minfs {
+
+// The part of the filesystem an I/O operation is for.
+enum class IoSource {
+  // The superblock and its backup.
+  kSuperblock,
+  kInodeBitmap,
+  kBlockBitmap,
+  kInodeTable,
+  kJournal,
+  // Indirect blocks and extent tree nodes.
+  kIndirect,
+  kDirectory,
+  kFileData,
+  // Blocks in the data region issued by something which cannot say what they hold, such as the
+  // writes of the journal's writeback to their final location.
+  kData,
+  kCount,
+};
+
+const char* IoSourceName(IoSource source);
+
+// Counts the operations, blocks and bytes read and written by each IoSource, and buckets the
+// operations by their length. Counting takes a few relaxed atomic operations and no locks.
+//
+// There are two views of the I/O:
+//  - The transaction view counts the operations enqueued in each Transaction, attributed by the
+//    code which enqueued them, before the journal has written any of them.
+//  - The device view counts the operations issued to the device through Bcache, including the
+//    journal and the reads, attributed by the region of the device they fall in. Blocks in the data
+//    region cannot be told apart there, so they are all counted as IoSource::kData.
+// Comparing the two shows how much device traffic the journal adds for each transaction write.
+class IoAccounting {
+ public:
+  enum class View { kTransaction, kDevice, kCount };
+
+  // Operations of 1, 2-3, 4-15, 16-63, 64-255 and 256 or more blocks.
+  static constexpr size_t kSizeBucketCount = 6;
+
+  struct Counts {
+    uint64_t ops = 0;
+    uint64_t blocks = 0;
+    uint64_t bytes = 0;
+    std::array<uint64_t, kSizeBucketCount> ops_by_size = {};
+  };
+
+  IoAccounting() = default;
+  IoAccounting(const IoAccounting&) = delete;
+  IoAccounting& operator=(const IoAccounting&) = delete;
+
+  // Sets the regions of the device used to attribute operations. Must be called before any are
+  // recorded; until it is, every operation is treated as being in the data region.
+  void SetLayout(const Superblock& info);
+
+  // Returns the source of an operation starting at |block|, or |data_source| if it is in the data
+  // region.
+  IoSource Classify(uint64_t block, IoSource data_source) const;
+
+  // Records |operation| in the transaction view. Operations in the data region are counted as
+  // |data_source|.
+  void RecordTransaction(const storage::Operation& operation, IoSource data_source) {
+    Record(View::kTransaction, operation, data_source);
+  }
+
+  // Records |operation| in the device view.
+  void RecordDevice(const storage::Operation& operation) {
+    Record(View::kDevice, operation, IoSource::kData);
+  }
+
+  // Returns the counts of reads (|write| false) or writes for |source| in |view|.
+  Counts Get(View view, bool write, IoSource source) const;
+
+  void Reset();
+
+  // Returns the counts of each view as a JSON object, omitting sources without any operations.
+  std::string ToJson() const;
+
+  static size_t SizeBucket(uint64_t blocks);
+  static const char* SizeBucketName(size_t bucket);
+  static const char* ViewName(View view);
+
+ private:
+  struct AtomicCounts {
+    std::atomic<uint64_t> ops = 0;
+    std::atomic<uint64_t> blocks = 0;
+    std::array<std::atomic<uint64_t>, kSizeBucketCount> ops_by_size = {};
+  };
+
+  static constexpr size_t kViewCount = static_cast<size_t>(View::kCount);
+  static constexpr size_t kSourceCount = static_cast<size_t>(IoSource::kCount);
+
+  void Record(View view, const storage::Operation& operation, IoSource data_source);
+
+  const AtomicCounts& At(View view, bool write, IoSource source) const {
+    return counts_[static_cast<size_t>(view)][write][static_cast<size_t>(source)];
+  }
+  AtomicCounts& At(View view, bool write, IoSource source) {
+    return counts_[static_cast<size_t>(view)][write][static_cast<size_t>(source)];
+  }
+
+  // The first block of each region. Blocks ahead of the inode bitmap hold the superblock and,
+  // without FVM, its backup; with FVM the backup is at the start of the integrity region.
+  uint64_t inode_bitmap_start_ = 0;
+  uint64_t block_bitmap_start_ = 0;
+  uint64_t inode_table_start_ = 0;
+  uint64_t integrity_start_ = 0;
+  uint64_t journal_start_ = 0;
+  uint64_t data_start_ = 0;
+
+  std::array<std::array<std::array<AtomicCounts, kSourceCount>, 2>, kViewCount> counts_;
+};
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_IO_ACCOUNTING_H_
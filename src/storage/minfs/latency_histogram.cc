@@ -0,0 +1,127 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/latency_histogram.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+namespace minfs {
+
+size_t LatencyHistogram::BucketIndex(uint64_t ns) {
+  if (ns < kSubBuckets) {
+    return ns;
+  }
+  const int exponent = 63 - __builtin_clzll(ns);
+  if (exponent >= kMaxExponent) {
+    return kBucketCount - 1;
+  }
+  const uint64_t sub_bucket = (ns >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+  return kSubBuckets * (exponent - kSubBucketBits + 1) + sub_bucket;
+}
+
+uint64_t LatencyHistogram::BucketLowerBound(size_t bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  const int exponent = static_cast<int>(bucket / kSubBuckets) + kSubBucketBits - 1;
+  const uint64_t sub_bucket = bucket % kSubBuckets;
+  return (kSubBuckets + sub_bucket) << (exponent - kSubBucketBits);
+}
+
+void LatencyHistogram::Record(std::chrono::nanoseconds latency) {
+  const uint64_t ns = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0));
+  buckets_[BucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+  total_ns_.fetch_add(ns, std::memory_order_relaxed);
+  uint64_t max = max_ns_.load(std::memory_order_relaxed);
+  while (ns > max && !max_ns_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+  }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::GetSnapshot() const {
+  Snapshot snapshot;
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    snapshot.count += snapshot.buckets[i];
+  }
+  snapshot.total_ns = total_ns_.load(std::memory_order_relaxed);
+  snapshot.max_ns = max_ns_.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+void LatencyHistogram::Reset() {
+  for (auto& bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  total_ns_.store(0, std::memory_order_relaxed);
+  max_ns_.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::Snapshot::Percentile(double fraction) const {
+  if (count == 0) {
+    return 0;
+  }
+  // The rank of the latency wanted, counting from one.
+  const uint64_t rank =
+      std::clamp<uint64_t>(static_cast<uint64_t>(fraction * static_cast<double>(count)) + 1, 1,
+                           count);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return std::min(BucketLowerBound(i), max_ns);
+    }
+  }
+  return max_ns;
+}
+
+const char* LatencyPhaseName(LatencyPhase phase) {
+  switch (phase) {
+    case LatencyPhase::kBeginTransaction:
+      return "begin_transaction";
+    case LatencyPhase::kCommitTransaction:
+      return "commit_transaction";
+    case LatencyPhase::kJournalWrite:
+      return "journal_write";
+    case LatencyPhase::kDataWriteback:
+      return "data_writeback";
+    case LatencyPhase::kInitVmo:
+      return "init_vmo";
+    case LatencyPhase::kDirectoryLookup:
+      return "directory_lookup";
+    case LatencyPhase::kVnodeGetMiss:
+      return "vnode_get_miss";
+    case LatencyPhase::kBlockingJournalSync:
+      return "blocking_journal_sync";
+    case LatencyPhase::kCount:
+      break;
+  }
+  return "unknown";
+}
+
+void LatencyMetrics::Reset() {
+  for (auto& histogram : histograms_) {
+    histogram.Reset();
+  }
+}
+
+std::string LatencyMetrics::ToJson() const {
+  std::string json = "{";
+  for (size_t i = 0; i < histograms_.size(); ++i) {
+    const LatencyHistogram::Snapshot snapshot = histograms_[i].GetSnapshot();
+    char phase[256];
+    snprintf(phase, sizeof(phase),
+             "%s\"%s\": {\"count\": %" PRIu64 ", \"mean_ns\": %" PRIu64 ", \"p50_ns\": %" PRIu64
+             ", \"p99_ns\": %" PRIu64 ", \"p999_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 "}",
+             i ? ", " : "", LatencyPhaseName(static_cast<LatencyPhase>(i)), snapshot.count,
+             snapshot.count ? snapshot.total_ns / snapshot.count : 0, snapshot.Percentile(0.5),
+             snapshot.Percentile(0.99), snapshot.Percentile(0.999), snapshot.max_ns);
+    json += phase;
+  }
+  return json + "}";
+}
+
+}  // namespace minfs
@@ -0,0 +1,119 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_STORAGE_MINFS_LATENCY_HISTOGRAM_H_
+#define SRC_STORAGE_MINFS_LATENCY_HISTOGRAM_H_
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace minfs {
+
+// A histogram of latencies with log-linear buckets: below kSubBuckets nanoseconds there is a bucket
+// per nanosecond, and above that each power of two is split into kSubBuckets equal buckets, so that
+// every bucket is within 25% of the latencies in it. Recording takes a few relaxed atomic
+// operations and no locks, so histograms can be left on in production.
+class LatencyHistogram {
+ public:
+  static constexpr int kSubBucketBits = 2;
+  static constexpr uint64_t kSubBuckets = 1 << kSubBucketBits;
+  // Latencies of 2^kMaxExponent nanoseconds (about 18 minutes) or more share the last bucket.
+  static constexpr int kMaxExponent = 40;
+  static constexpr size_t kBucketCount = kSubBuckets * (kMaxExponent - kSubBucketBits + 1) + 1;
+
+  struct Snapshot {
+    std::array<uint64_t, kBucketCount> buckets = {};
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+
+    // Returns the lower bound of the bucket holding the latency below which |fraction| of those
+    // recorded fall, or zero if there are none.
+    uint64_t Percentile(double fraction) const;
+  };
+
+  LatencyHistogram() = default;
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  void Record(std::chrono::nanoseconds latency);
+
+  Snapshot GetSnapshot() const;
+
+  void Reset();
+
+  // Returns the bucket holding latencies of |ns| nanoseconds, and the smallest latency in |bucket|.
+  static size_t BucketIndex(uint64_t ns);
+  static uint64_t BucketLowerBound(size_t bucket);
+
+ private:
+  std::array<std::atomic<uint64_t>, kBucketCount> buckets_ = {};
+  std::atomic<uint64_t> total_ns_ = 0;
+  std::atomic<uint64_t> max_ns_ = 0;
+};
+
+// The internal phases of filesystem operations whose latencies Minfs records.
+enum class LatencyPhase {
+  // Minfs::BeginTransaction, which reserves inodes and blocks.
+  kBeginTransaction,
+  // Minfs::CommitTransaction. On Fuchsia this only hands the transaction to the journal.
+  kCommitTransaction,
+  // From committing a transaction to its metadata being written to the journal (Fuchsia only).
+  kJournalWrite,
+  // From committing a transaction to its data being written (Fuchsia only).
+  kDataWriteback,
+  // Reading a vnode's blocks into its VMO in VnodeMinfs::InitVmo (Fuchsia only).
+  kInitVmo,
+  kDirectoryLookup,
+  // Minfs::VnodeGet for vnodes which are not in the vnode cache.
+  kVnodeGetMiss,
+  kBlockingJournalSync,
+  kCount,
+};
+
+const char* LatencyPhaseName(LatencyPhase phase);
+
+// A LatencyHistogram for each LatencyPhase.
+class LatencyMetrics {
+ public:
+  LatencyHistogram& Get(LatencyPhase phase) { return histograms_[static_cast<size_t>(phase)]; }
+  const LatencyHistogram& Get(LatencyPhase phase) const {
+    return histograms_[static_cast<size_t>(phase)];
+  }
+
+  void Record(LatencyPhase phase, std::chrono::nanoseconds latency) { Get(phase).Record(latency); }
+
+  void Reset();
+
+  // Returns the count, mean, maximum and percentiles of each phase as a JSON object.
+  std::string ToJson() const;
+
+ private:
+  std::array<LatencyHistogram, static_cast<size_t>(LatencyPhase::kCount)> histograms_;
+};
+
+// Records the time from its construction to its destruction in a LatencyHistogram.
+class ScopedLatency {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  ScopedLatency(LatencyMetrics& metrics, LatencyPhase phase)
+      : histogram_(metrics.Get(phase)), start_(Clock::now()) {}
+  ~ScopedLatency() { histogram_.Record(Clock::now() - start_); }
+
+  ScopedLatency(const ScopedLatency&) = delete;
+  ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+ private:
+  LatencyHistogram& histogram_;
+  const Clock::time_point start_;
+};
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_LATENCY_HISTOGRAM_H_
@@ -23,7 +23,20 @@ class LazyBuffer {
   class Reader : public MappedFileReader {
    public:
     Reader(Bcache* bcache, MapperInterface* mapper, LazyBuffer* buffer)
-        : MappedFileReader(bcache, mapper, &buffer->buffer()) {}
+        : MappedFileReader(bcache, mapper, &buffer->buffer()), bcache_(*bcache) {}
+
+#ifdef __Fuchsia__
+   protected:
+    // On host, Bcache verifies the blocks it reads itself.
+    zx::status<> VerifyRead(const storage::Operation& operation) override {
+      return bcache_.VerifyChecksums(static_cast<blk_t>(operation.dev_offset),
+                                     static_cast<blk_t>(operation.length),
+                                     buffer().Data(operation.vmo_offset));
+    }
+#endif
+
+   private:
+    [[maybe_unused]] Bcache& bcache_;
   };
 
   // Create an instance of LazyBuffer.
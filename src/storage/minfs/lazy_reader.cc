@@ -68,4 +68,17 @@ zx::status<uint64_t> MappedFileReader::Enqueue(BlockRange range) {
   return zx::ok(device_range.count());
 }
 
+zx::status<> MappedFileReader::RunRequests() {
+  std::vector<storage::BufferedOperation> operations = builder_.TakeOperations();
+  if (zx_status_t status = handler_.RunRequests(operations); status != ZX_OK) {
+    return zx::error(status);
+  }
+  for (const storage::BufferedOperation& operation : operations) {
+    if (auto status = VerifyRead(operation.op); status.is_error()) {
+      return status;
+    }
+  }
+  return zx::ok();
+}
+
 }  // namespace minfs
@@ -95,12 +95,19 @@ class MappedFileReader : public LazyReader::ReaderInterface {
 
   zx::status<uint64_t> Enqueue(BlockRange range) override;
 
-  [[nodiscard]] zx::status<> RunRequests() override {
-    return zx::make_status(handler_.RunRequests(builder_.TakeOperations()));
-  }
+  // Issues the queued reads, then passes each of them to VerifyRead.
+  [[nodiscard]] zx::status<> RunRequests() override;
 
   MapperInterface& mapper() { return mapper_; }
 
+ protected:
+  // Called for each read once RunRequests has issued it. An error fails the read.
+  [[nodiscard]] virtual zx::status<> VerifyRead(const storage::Operation& operation) {
+    return zx::ok();
+  }
+
+  storage::BlockBuffer& buffer() { return buffer_; }
+
  private:
   fs::TransactionHandler& handler_;
   MapperInterface& mapper_;
@@ -0,0 +1,83 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/lock_profile.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+namespace minfs {
+
+const char* LockSiteName(LockSite site) {
+  switch (site) {
+    case LockSite::kTransaction:
+      return "transaction";
+    case LockSite::kVnodeHash:
+      return "vnode_hash";
+    case LockSite::kInodeAllocator:
+      return "inode_allocator";
+    case LockSite::kBlockAllocator:
+      return "block_allocator";
+    case LockSite::kBcache:
+      return "bcache";
+    case LockSite::kCount:
+      break;
+  }
+  return "unknown";
+}
+
+void LockProfile::RecordAcquisition(LockSite site, bool contended, Clock::duration wait) {
+  SiteCounters& counters = sites_[static_cast<size_t>(site)];
+  counters.acquisitions.fetch_add(1, std::memory_order_relaxed);
+  if (contended) {
+    counters.contended.fetch_add(1, std::memory_order_relaxed);
+    counters.wait.Record(wait);
+  }
+}
+
+void LockProfile::RecordHold(LockSite site, Clock::duration hold) {
+  sites_[static_cast<size_t>(site)].hold.Record(hold);
+}
+
+LockProfile::Stats LockProfile::Get(LockSite site) const {
+  const SiteCounters& counters = sites_[static_cast<size_t>(site)];
+  return {
+      .acquisitions = counters.acquisitions.load(std::memory_order_relaxed),
+      .contended = counters.contended.load(std::memory_order_relaxed),
+      .wait = counters.wait.GetSnapshot(),
+      .hold = counters.hold.GetSnapshot(),
+  };
+}
+
+void LockProfile::Reset() {
+  for (SiteCounters& counters : sites_) {
+    counters.acquisitions.store(0, std::memory_order_relaxed);
+    counters.contended.store(0, std::memory_order_relaxed);
+    counters.wait.Reset();
+    counters.hold.Reset();
+  }
+}
+
+std::string LockProfile::ToJson() const {
+  std::string json = std::string("{\"enabled\": ") + (enabled() ? "true" : "false");
+  for (size_t i = 0; i < sites_.size(); ++i) {
+    const LockSite site = static_cast<LockSite>(i);
+    const Stats stats = Get(site);
+    char site_json[512];
+    snprintf(site_json, sizeof(site_json),
+             ", \"%s\": {\"acquisitions\": %" PRIu64 ", \"contended\": %" PRIu64
+             ", \"wait_total_ns\": %" PRIu64 ", \"wait_p50_ns\": %" PRIu64
+             ", \"wait_p99_ns\": %" PRIu64 ", \"wait_max_ns\": %" PRIu64
+             ", \"hold_total_ns\": %" PRIu64 ", \"hold_p50_ns\": %" PRIu64
+             ", \"hold_p99_ns\": %" PRIu64 ", \"hold_max_ns\": %" PRIu64 "}",
+             LockSiteName(site), stats.acquisitions, stats.contended, stats.wait.total_ns,
+             stats.wait.Percentile(0.5), stats.wait.Percentile(0.99), stats.wait.max_ns,
+             stats.hold.total_ns, stats.hold.Percentile(0.5), stats.hold.Percentile(0.99),
+             stats.hold.max_ns);
+    json += site_json;
+  }
+  return json + "}";
+}
+
+}  // namespace minfs
@@ -0,0 +1,187 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_STORAGE_MINFS_LOCK_PROFILE_H_
+#define SRC_STORAGE_MINFS_LOCK_PROFILE_H_
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <shared_mutex>
+#include <string>
+#include <type_traits>
+
+#include <fbl/mutex.h>
+
+#include "src/storage/minfs/latency_histogram.h"
+
+namespace minfs {
+
+// The locks whose contention Minfs can profile.
+enum class LockSite {
+  // Minfs::txn_lock_, held by every Transaction for its whole life (Fuchsia only).
+  kTransaction,
+  // Minfs::hash_lock_, which guards the vnode cache (Fuchsia only).
+  kVnodeHash,
+  // Allocator::lock_ of the inode and block allocators.
+  kInodeAllocator,
+  kBlockAllocator,
+  // Bcache's device lock, shared by every request and held exclusively while the device is paused
+  // (Fuchsia only).
+  kBcache,
+  kCount,
+};
+
+const char* LockSiteName(LockSite site);
+
+// Counts the acquisitions of each LockSite and records how long they waited for and held the
+// lock. Profiling is off until enabled, and while it is off the locks only pay for a relaxed load.
+class LockProfile {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Stats {
+    uint64_t acquisitions = 0;
+    // Acquisitions which found the lock held and had to wait for it.
+    uint64_t contended = 0;
+    // The waits of the contended acquisitions.
+    LatencyHistogram::Snapshot wait;
+    LatencyHistogram::Snapshot hold;
+  };
+
+  LockProfile() = default;
+  LockProfile(const LockProfile&) = delete;
+  LockProfile& operator=(const LockProfile&) = delete;
+
+  // Acquisitions started while profiling is disabled are not recorded, even if they are released
+  // after it is enabled.
+  void SetEnabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  // Records an acquisition of |site| which waited |wait| for the lock if it was |contended|.
+  void RecordAcquisition(LockSite site, bool contended, Clock::duration wait);
+  void RecordHold(LockSite site, Clock::duration hold);
+
+  Stats Get(LockSite site) const;
+
+  void Reset();
+
+  // Returns whether profiling is enabled and the acquisitions, contention and wait and hold times
+  // of each site as a JSON object.
+  std::string ToJson() const;
+
+ private:
+  struct SiteCounters {
+    std::atomic<uint64_t> acquisitions = 0;
+    std::atomic<uint64_t> contended = 0;
+    LatencyHistogram wait;
+    LatencyHistogram hold;
+  };
+
+  std::atomic<bool> enabled_ = false;
+  std::array<SiteCounters, static_cast<size_t>(LockSite::kCount)> sites_;
+};
+
+namespace internal {
+
+// Times one acquisition and release of a lock for a LockProfile, or only takes and releases the
+// lock if there is no profile or it is disabled. A lock which is free is taken with a try-lock, so
+// that only acquisitions which have to wait read the clock before taking it.
+class LockTimer {
+ public:
+  LockTimer(LockProfile* profile, LockSite site)
+      : profile_(profile != nullptr && profile->enabled() ? profile : nullptr), site_(site) {}
+
+  template <typename TryLock, typename Lock>
+  void Acquire(TryLock try_lock, Lock lock) {
+    if (profile_ == nullptr) {
+      lock();
+      return;
+    }
+    if (try_lock()) {
+      acquired_ = LockProfile::Clock::now();
+      profile_->RecordAcquisition(site_, false, {});
+      return;
+    }
+    const LockProfile::Clock::time_point start = LockProfile::Clock::now();
+    lock();
+    acquired_ = LockProfile::Clock::now();
+    profile_->RecordAcquisition(site_, true, acquired_ - start);
+  }
+
+  // The hold is recorded after |unlock| so that recording it does not lengthen it.
+  template <typename Unlock>
+  void Release(Unlock unlock) {
+    if (profile_ == nullptr) {
+      unlock();
+      return;
+    }
+    const LockProfile::Clock::duration hold = LockProfile::Clock::now() - acquired_;
+    unlock();
+    profile_->RecordHold(site_, hold);
+  }
+
+ private:
+  LockProfile* const profile_;
+  const LockSite site_;
+  LockProfile::Clock::time_point acquired_;
+};
+
+}  // namespace internal
+
+// Holds |mutex|, an fbl::Mutex or a standard mutex, for its lifetime like std::scoped_lock, and
+// records the acquisition in |profile| as |site|. |profile| may be null, in which case nothing is
+// recorded.
+template <typename Mutex>
+class __TA_SCOPED_CAPABILITY ProfiledLock {
+ public:
+  ProfiledLock(Mutex* mutex, LockProfile* profile, LockSite site) __TA_ACQUIRE(mutex)
+      : mutex_(mutex), timer_(profile, site) {
+    if constexpr (std::is_same_v<Mutex, fbl::Mutex>) {
+      timer_.Acquire([this] { return mutex_->TryAcquire(); }, [this] { mutex_->Acquire(); });
+    } else {
+      timer_.Acquire([this] { return mutex_->try_lock(); }, [this] { mutex_->lock(); });
+    }
+  }
+  ~ProfiledLock() __TA_RELEASE() {
+    if constexpr (std::is_same_v<Mutex, fbl::Mutex>) {
+      timer_.Release([this] { mutex_->Release(); });
+    } else {
+      timer_.Release([this] { mutex_->unlock(); });
+    }
+  }
+
+  ProfiledLock(const ProfiledLock&) = delete;
+  ProfiledLock& operator=(const ProfiledLock&) = delete;
+
+ private:
+  Mutex* const mutex_;
+  internal::LockTimer timer_;
+};
+
+// Like ProfiledLock, but holds a shared lock on |mutex|.
+class __TA_SCOPED_CAPABILITY ProfiledSharedLock {
+ public:
+  ProfiledSharedLock(std::shared_mutex* mutex, LockProfile* profile, LockSite site)
+      __TA_ACQUIRE_SHARED(mutex)
+      : mutex_(mutex), timer_(profile, site) {
+    timer_.Acquire([this] { return mutex_->try_lock_shared(); }, [this] { mutex_->lock_shared(); });
+  }
+  ~ProfiledSharedLock() __TA_RELEASE() {
+    timer_.Release([this] { mutex_->unlock_shared(); });
+  }
+
+  ProfiledSharedLock(const ProfiledSharedLock&) = delete;
+  ProfiledSharedLock& operator=(const ProfiledSharedLock&) = delete;
+
+ private:
+  std::shared_mutex* const mutex_;
+  internal::LockTimer timer_;
+};
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_LOCK_PROFILE_H_
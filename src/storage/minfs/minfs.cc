@@ -17,10 +17,13 @@
 #include <unistd.h>
 #include <zircon/assert.h>
 
+#include <algorithm>
 #include <iomanip>
 #include <limits>
 #include <memory>
+#include <random>
 #include <utility>
+#include <vector>
 
 #include <bitmap/raw-bitmap.h>
 #include <fbl/algorithm.h>
@@ -29,11 +32,12 @@
 
 #include "src/lib/storage/vfs/cpp/journal/format.h"
 #include "src/lib/storage/vfs/cpp/journal/initializer.h"
-#include "src/lib/storage/vfs/cpp/trace.h"
 #include "src/storage/minfs/allocator/allocator_reservation.h"
+#include "src/storage/minfs/checksum.h"
 #include "src/storage/minfs/file.h"
 #include "src/storage/minfs/fsck.h"
 #include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/trace.h"
 #include "src/storage/minfs/writeback.h"
 
 #ifdef __Fuchsia__
@@ -43,20 +47,28 @@
 #include <lib/inspect/service/cpp/service.h>
 #include <lib/zx/clock.h>
 #include <lib/zx/event.h>
+#include <zircon/syscalls.h>
 
 #include <fbl/auto_lock.h>
 #include <storage/buffer/owned_vmoid.h>
+#include <storage/buffer/vmo_buffer.h>
 
 #include "sdk/lib/sys/cpp/service_directory.h"
 #include "src/lib/storage/vfs/cpp/journal/header_view.h"
 #include "src/lib/storage/vfs/cpp/journal/journal.h"
 #include "src/lib/storage/vfs/cpp/journal/replay.h"
 #include "src/storage/fvm/client.h"
+#else
+#include <storage/buffer/array_buffer.h>
 #endif
 
 namespace minfs {
 namespace {
 
+// The largest number of zeroed blocks Mkfs issues in a single request when clearing the inode
+// table.
+constexpr uint32_t kMkfsMaxZeroBlocks = 256;
+
 #ifdef __Fuchsia__
 // Deletes all known slices from a MinFS Partition.
 void FreeSlices(const Superblock* info, block_client::BlockDevice* device) {
@@ -384,6 +396,9 @@ void DumpInfo(const Superblock& info) {
   FX_LOGS(DEBUG) << "integrity start block  @ " << std::setw(10) << info.integrity_start_block;
   FX_LOGS(DEBUG) << "data blocks  @ " << std::setw(10) << info.dat_block;
   FX_LOGS(DEBUG) << "FVM-aware: " << ((info.flags & kMinfsFlagFVM) ? "YES" : "NO");
+  if (info.GetFlagLazyInodeTable()) {
+    FX_LOGS(DEBUG) << "inode table initialised blocks: " << std::setw(10) << info.ino_init_blocks;
+  }
   FX_LOGS(DEBUG) << "checksum:  " << std::setw(10) << info.checksum;
   FX_LOGS(DEBUG) << "generation count:  " << std::setw(10) << info.generation_count;
   FX_LOGS(DEBUG) << "oldest_minor_version:  " << std::setw(10) << info.oldest_minor_version;
@@ -397,7 +412,7 @@ void DumpInfo(const Superblock& info) {
 
 void DumpInode(const Inode* inode, ino_t ino) {
   FX_LOGS(DEBUG) << "inode[" << ino << "]: magic:  " << std::setw(10) << inode->magic;
-  FX_LOGS(DEBUG) << "inode[" << ino << "]: size:   " << std::setw(10) << inode->size;
+  FX_LOGS(DEBUG) << "inode[" << ino << "]: size:   " << std::setw(10) << GetInodeSize(*inode);
   FX_LOGS(DEBUG) << "inode[" << ino << "]: blocks: " << std::setw(10) << inode->block_count;
   FX_LOGS(DEBUG) << "inode[" << ino << "]: links:  " << std::setw(10) << inode->link_count;
 }
@@ -447,7 +462,8 @@ zx::status<> CheckSuperblock(const Superblock& info, uint32_t max_blocks) {
     return zx::error(ZX_ERR_WRONG_TYPE);
   }
 
-  if (info.major_version != kMinfsCurrentMajorVersion) {
+  if (info.major_version != kMinfsCurrentMajorVersion &&
+      info.major_version != kMinfsMajorVersionFeatures) {
     FX_LOGS(ERROR) << "FS major version: " << std::setfill('0') << std::setw(8) << std::hex
                    << info.major_version << ". Driver major version: " << std::setw(8)
                    << kMinfsCurrentMajorVersion;
@@ -459,6 +475,26 @@ zx::status<> CheckSuperblock(const Superblock& info, uint32_t max_blocks) {
     return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
   }
 
+  if (info.major_version == kMinfsMajorVersionFeatures) {
+    if ((info.flags & ~kMinfsKnownFlags) != 0) {
+      FX_LOGS(ERROR) << "FS has unsupported feature flags: " << std::hex
+                     << (info.flags & ~kMinfsKnownFlags);
+      return zx::error(ZX_ERR_NOT_SUPPORTED);
+    }
+    // Mkfs only writes kMinfsMajorVersionFeatures for volumes which use a feature, so a volume of
+    // that version without any feature flags didn't come from this format; reading it as one would
+    // misinterpret its inodes.
+    if ((info.flags & kMinfsFeatureFlags) == 0) {
+      FX_LOGS(ERROR) << "FS major version " << kMinfsMajorVersionFeatures
+                     << " has no feature flags";
+      return zx::error(ZX_ERR_NOT_SUPPORTED);
+    }
+  } else if ((info.flags & kMinfsFeatureFlags) != 0) {
+    FX_LOGS(ERROR) << "FS feature flags " << std::hex << (info.flags & kMinfsFeatureFlags)
+                   << " require major version " << std::dec << kMinfsMajorVersionFeatures;
+    return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
+
   if ((info.block_size != kMinfsBlockSize) || (info.inode_size != kMinfsInodeSize)) {
     FX_LOGS(ERROR) << "bsz/isz " << info.block_size << "/" << info.inode_size << " unsupported";
     return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
@@ -476,6 +512,38 @@ zx::status<> CheckSuperblock(const Superblock& info, uint32_t max_blocks) {
     return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
   }
 
+  if (info.GetFlagLazyInodeTable() &&
+      (info.ino_init_blocks == 0 ||
+       info.ino_init_blocks > BlocksRequiredForInode(info.inode_count))) {
+    FX_LOGS(ERROR) << "Initialised inode table blocks (" << info.ino_init_blocks
+                   << ") out of range for " << info.inode_count << " inodes";
+    return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
+
+  if (info.UsesChecksums()) {
+    // The table must lie within the data blocks, and cover no more of each region than it has.
+    uint64_t ibm_blocks = 0;
+    uint64_t abm_blocks = 0;
+    if (info.flags & kMinfsFlagFVM) {
+      const uint64_t blocks_per_slice = info.slice_size / info.BlockSize();
+      ibm_blocks = info.ibm_slices * blocks_per_slice;
+      abm_blocks = info.abm_slices * blocks_per_slice;
+    } else {
+      ibm_blocks = info.abm_block > info.ibm_block ? info.abm_block - info.ibm_block : 0;
+      abm_blocks = info.ino_block > info.abm_block ? info.ino_block - info.abm_block : 0;
+    }
+    if (info.csum_ibm_blocks > ibm_blocks || info.csum_abm_blocks > abm_blocks ||
+        info.csum_dat_blocks > info.block_count || info.csum_block == 0 ||
+        info.csum_blocks != ChecksumTable::BlocksNeeded(info.csum_ibm_blocks,
+                                                        info.csum_abm_blocks,
+                                                        info.csum_dat_blocks) ||
+        uint64_t{info.csum_block} + info.csum_blocks > info.block_count) {
+      FX_LOGS(ERROR) << "Checksum table (" << info.csum_blocks << " blocks at data block "
+                     << info.csum_block << ") out of range";
+      return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+    }
+  }
+
   TransactionLimits limits(info);
   if ((info.flags & kMinfsFlagFVM) == 0) {
     if (info.dat_block + info.block_count != max_blocks) {
@@ -538,12 +606,21 @@ BlockOffsets::BlockOffsets(const Bcache& bc, const SuperblockManager& sb) {
 std::unique_ptr<Bcache> Minfs::Destroy(std::unique_ptr<Minfs> minfs) {
 #ifdef __Fuchsia__
   minfs->StopWriteback();
+#endif
+  if (minfs->checksums_) {
+    minfs->bc_->SetChecksumTable(nullptr);
+    minfs->checksums_.reset();
+  }
+  minfs->bc_->SetIoAccounting(nullptr);
+#ifdef __Fuchsia__
+  minfs->bc_->SetLockProfile(nullptr);
 #endif
   return std::move(minfs->bc_);
 }
 
 zx::status<std::unique_ptr<Transaction>> Minfs::BeginTransaction(size_t reserve_inodes,
                                                                  size_t reserve_blocks) {
+  ScopedLatency latency(latencies_, LatencyPhase::kBeginTransaction);
   ZX_DEBUG_ASSERT(reserve_inodes <= TransactionLimits::kMaxInodeBitmapBlocks);
 #ifdef __Fuchsia__
   if (journal_ == nullptr) {
@@ -629,6 +706,7 @@ class ReleaseObject {
 };
 
 void Minfs::CommitTransaction(std::unique_ptr<Transaction> transaction) {
+  ScopedLatency latency(latencies_, LatencyPhase::kCommitTransaction);
   transaction->inode_reservation().Commit(transaction.get());
   transaction->block_reservation().Commit(transaction.get());
   if (sb_->is_dirty()) {
@@ -640,6 +718,11 @@ void Minfs::CommitTransaction(std::unique_ptr<Transaction> transaction) {
 
   auto data_operations = transaction->RemoveDataOperations();
   auto metadata_operations = transaction->RemoveMetadataOperations();
+  if (checksums_) {
+    if (auto status = checksums_->Commit(&metadata_operations); status.is_error()) {
+      FX_LOGS(ERROR) << "Failed to update checksum table: " << status.status_string();
+    }
+  }
   ZX_DEBUG_ASSERT(BlockCount(metadata_operations) <= limits_.GetMaximumEntryDataBlocks());
 
   TRACE_DURATION("minfs", "CommitTransaction", "data_ops", data_operations.size(), "metadata_ops",
@@ -659,17 +742,32 @@ void Minfs::CommitTransaction(std::unique_ptr<Transaction> transaction) {
   //  * The allocator will currently reserve inodes that are freed in the same transaction i.e. it
   //    won't be possible to use free inodes until the next transaction. This probably can't
   //    happen anyway.
+  const auto start = ScopedLatency::Clock::now();
+  fs::Journal::Promise data_promise;
+  if (!data_operations.empty()) {
+    data_promise = journal_->WriteData(std::move(data_operations))
+                       .then([this, start](fpromise::result<void, zx_status_t>& result) {
+                         latencies_.Record(LatencyPhase::kDataWriteback,
+                                           ScopedLatency::Clock::now() - start);
+                         return result;
+                       });
+  }
   zx_status_t status = journal_->CommitTransaction(
       {.metadata_operations = metadata_operations,
-       .data_promise = data_operations.empty() ? fs::Journal::Promise()
-                                               : journal_->WriteData(std::move(data_operations)),
+       .data_promise = std::move(data_promise),
        // Keep blocks reserved until committed.
-       .commit_callback = [pending_deallocations =
-                               transaction->block_reservation().TakePendingDeallocations()] {},
+       .commit_callback =
+           [this, start,
+            pending_deallocations = transaction->block_reservation().TakePendingDeallocations()] {
+             latencies_.Record(LatencyPhase::kJournalWrite, ScopedLatency::Clock::now() - start);
+           },
        // Keep vnodes alive until complete because we cache data and it's not safe to read new
        // data until the transaction is complete (and we could end up doing that if the vnode
        // gets destroyed and then quickly recreated).
-       .complete_callback = [pinned_vnodes = transaction->RemovePinnedVnodes()] {}});
+       .complete_callback =
+           [pinned_vnodes = transaction->RemovePinnedVnodes()]() mutable {
+             Transaction::ReleasePinnedVnodes(std::move(pinned_vnodes));
+           }});
   if (status != ZX_OK) {
     FX_LOGS(ERROR) << "CommitTransaction failed: " << zx_status_get_string(status);
   }
@@ -686,7 +784,12 @@ void Minfs::CommitTransaction(std::unique_ptr<Transaction> transaction) {
     }
   }
 #else
-  bc_->RunRequests(transaction->TakeOperations());
+  std::vector<storage::BufferedOperation> operations = transaction->TakeOperations();
+  TRACE_DURATION("minfs", "CommitTransaction", "ops", operations.size());
+  if (checksums_) {
+    checksums_->Commit(&operations);
+  }
+  bc_->RunRequests(operations);
 #endif
 }
 
@@ -725,29 +828,46 @@ Minfs::Minfs(async_dispatcher_t* dispatcher, std::unique_ptr<Bcache> bc,
              std::unique_ptr<InodeManager> inodes, const MountOptions& mount_options,
              fs::ManagedVfs* vfs)
     : bc_(std::move(bc)),
+      write_amplification_(&io_accounting_),
       sb_(std::move(sb)),
       block_allocator_(std::move(block_allocator)),
       inodes_(std::move(inodes)),
       journal_sync_task_([this]() { Sync(); }),
-      inspect_tree_(bc_->device()),
+      purge_unlinked_task_([this]() { PurgeUnlinkedInBackground(); }),
+      defrag_task_([this]() { DefragmentInBackground(); }),
+      inspect_tree_(bc_->device(), &latencies_, &io_accounting_, &write_amplification_,
+                    &lock_profile_),
       limits_(sb_->Info()),
       mount_options_(mount_options),
       dispatcher_(dispatcher),
       vfs_(vfs) {
   zx::event::create(0, &fs_id_);
+  io_accounting_.SetLayout(sb_->Info());
+  bc_->SetIoAccounting(&io_accounting_);
+  lock_profile_.SetEnabled(mount_options.profile_locks);
+  block_allocator_->SetLockProfile(&lock_profile_, LockSite::kBlockAllocator);
+  inodes_->inode_allocator().SetLockProfile(&lock_profile_, LockSite::kInodeAllocator);
+  bc_->SetLockProfile(&lock_profile_);
 }
 #else
 Minfs::Minfs(std::unique_ptr<Bcache> bc, std::unique_ptr<SuperblockManager> sb,
              std::unique_ptr<Allocator> block_allocator, std::unique_ptr<InodeManager> inodes,
              BlockOffsets offsets, const MountOptions& mount_options, fs::Vfs* vfs)
     : bc_(std::move(bc)),
+      write_amplification_(&io_accounting_),
       sb_(std::move(sb)),
       block_allocator_(std::move(block_allocator)),
       inodes_(std::move(inodes)),
       offsets_(offsets),
       limits_(sb_->Info()),
       mount_options_(mount_options),
-      vfs_(vfs) {}
+      vfs_(vfs) {
+  io_accounting_.SetLayout(sb_->Info());
+  bc_->SetIoAccounting(&io_accounting_);
+  lock_profile_.SetEnabled(mount_options.profile_locks);
+  block_allocator_->SetLockProfile(&lock_profile_, LockSite::kBlockAllocator);
+  inodes_->inode_allocator().SetLockProfile(&lock_profile_, LockSite::kInodeAllocator);
+}
 #endif
 
 Minfs::~Minfs() { vnode_hash_.clear(); }
@@ -772,7 +892,25 @@ zx::status<> Minfs::InoFree(Transaction* transaction, VnodeMinfs* vn) {
   return zx::ok();
 }
 
-void Minfs::AddUnlinked(PendingWork* transaction, VnodeMinfs* vn) {
+zx::status<fbl::RefPtr<VnodeMinfs>> Minfs::LookupUnlinkedVnode(ino_t ino) {
+  // Vnodes unlinked by this instance of the filesystem are necessarily open and so exist in the
+  // vnode lookup. Those left over from a previous mount, and files whose truncated blocks are being
+  // released while they are closed, are only recreated while that work is still pending.
+  fbl::RefPtr<VnodeMinfs> vn = VnodeLookupInternal(ino);
+  if (vn == nullptr) {
+    if (auto status = VnodeMinfs::Recreate(this, ino, &vn); status.is_error()) {
+      return status.take_error();
+    }
+    if (!vn->IsUnlinked()) {
+      // A linked vnode is looked up, and must be released, like any other.
+      VnodeInsert(vn.get());
+    }
+  }
+  ZX_DEBUG_ASSERT(vn->IsUnlinked() || vn->IsReleasePending());
+  return zx::ok(std::move(vn));
+}
+
+zx::status<> Minfs::AddUnlinked(PendingWork* transaction, VnodeMinfs* vn) {
   ZX_DEBUG_ASSERT(vn->GetInode()->link_count == 0);
 
   Superblock* info = sb_->MutableInfo();
@@ -783,10 +921,11 @@ void Minfs::AddUnlinked(PendingWork* transaction, VnodeMinfs* vn) {
     info->unlinked_head = vn->GetIno();
     info->unlinked_tail = vn->GetIno();
   } else {
-    // Since all vnodes in the unlinked list are necessarily open, the last vnode
-    // must currently exist in the vnode lookup.
-    fbl::RefPtr<VnodeMinfs> last_vn = VnodeLookupInternal(info->unlinked_tail);
-    ZX_DEBUG_ASSERT(last_vn != nullptr);
+    auto last_vn_or = LookupUnlinkedVnode(info->unlinked_tail);
+    if (last_vn_or.is_error()) {
+      return last_vn_or.take_error();
+    }
+    fbl::RefPtr<VnodeMinfs>& last_vn = last_vn_or.value();
 
     // Add |vn| to the end of the unlinked list.
     last_vn->SetNextInode(vn->GetIno());
@@ -796,9 +935,10 @@ void Minfs::AddUnlinked(PendingWork* transaction, VnodeMinfs* vn) {
     last_vn->InodeSync(transaction, kMxFsSyncDefault);
     vn->InodeSync(transaction, kMxFsSyncDefault);
   }
+  return zx::ok();
 }
 
-void Minfs::RemoveUnlinked(PendingWork* transaction, VnodeMinfs* vn) {
+zx::status<> Minfs::RemoveUnlinked(PendingWork* transaction, VnodeMinfs* vn) {
   if (vn->GetInode()->last_inode == 0) {
     // If |vn| is the first unlinked inode, we just need to update the list head
     // to the next inode (which may not exist).
@@ -808,10 +948,12 @@ void Minfs::RemoveUnlinked(PendingWork* transaction, VnodeMinfs* vn) {
     sb_->MutableInfo()->unlinked_head = vn->GetInode()->next_inode;
   } else {
     // Set the previous vnode's next to |vn|'s next.
-    fbl::RefPtr<VnodeMinfs> last_vn = VnodeLookupInternal(vn->GetInode()->last_inode);
-    ZX_DEBUG_ASSERT(last_vn != nullptr);
-    last_vn->SetNextInode(vn->GetInode()->next_inode);
-    last_vn->InodeSync(transaction, kMxFsSyncDefault);
+    auto last_vn_or = LookupUnlinkedVnode(vn->GetInode()->last_inode);
+    if (last_vn_or.is_error()) {
+      return last_vn_or.take_error();
+    }
+    last_vn_or->SetNextInode(vn->GetInode()->next_inode);
+    last_vn_or->InodeSync(transaction, kMxFsSyncDefault);
   }
 
   if (vn->GetInode()->next_inode == 0) {
@@ -823,69 +965,359 @@ void Minfs::RemoveUnlinked(PendingWork* transaction, VnodeMinfs* vn) {
     sb_->MutableInfo()->unlinked_tail = vn->GetInode()->last_inode;
   } else {
     // Set the next vnode's previous to |vn|'s previous.
-    fbl::RefPtr<VnodeMinfs> next_vn = VnodeLookupInternal(vn->GetInode()->next_inode);
-    ZX_DEBUG_ASSERT(next_vn != nullptr);
-    next_vn->SetLastInode(vn->GetInode()->last_inode);
-    next_vn->InodeSync(transaction, kMxFsSyncDefault);
+    auto next_vn_or = LookupUnlinkedVnode(vn->GetInode()->next_inode);
+    if (next_vn_or.is_error()) {
+      return next_vn_or.take_error();
+    }
+    next_vn_or->SetLastInode(vn->GetInode()->last_inode);
+    next_vn_or->InodeSync(transaction, kMxFsSyncDefault);
   }
+  return zx::ok();
 }
 
-zx::status<> Minfs::PurgeUnlinked() {
+zx::status<> Minfs::AddUnlinkedHead(PendingWork* transaction, VnodeMinfs* vn) {
+  Superblock* info = sb_->MutableInfo();
+  vn->SetLastInode(0);
+  vn->SetNextInode(info->unlinked_head);
+  if (info->unlinked_head == 0) {
+    ZX_DEBUG_ASSERT(info->unlinked_tail == 0);
+    info->unlinked_tail = vn->GetIno();
+  } else {
+    auto next_vn_or = LookupUnlinkedVnode(info->unlinked_head);
+    if (next_vn_or.is_error()) {
+      return next_vn_or.take_error();
+    }
+    next_vn_or->SetLastInode(vn->GetIno());
+    next_vn_or->InodeSync(transaction, kMxFsSyncDefault);
+  }
+  info->unlinked_head = vn->GetIno();
+  vn->InodeSync(transaction, kMxFsSyncDefault);
+  return zx::ok();
+}
+
+zx::status<> Minfs::AddPendingRelease(PendingWork* transaction, VnodeMinfs* vn) {
+  ZX_DEBUG_ASSERT(!vn->IsUnlinked());
+  ZX_DEBUG_ASSERT(!vn->IsReleasePending());
+  if (auto status = AddUnlinkedHead(transaction, vn); status.is_error()) {
+    return status;
+  }
+#ifdef __Fuchsia__
+  if (ShouldDeferPurge(*vn) && !purge_unlinked_task_.is_pending()) {
+    purge_unlinked_task_.Post(dispatcher_);
+  }
+#endif
+  return zx::ok();
+}
+
+zx::status<bool> Minfs::ReleaseStep(PendingWork* transaction, VnodeMinfs* vn) {
+  ZX_DEBUG_ASSERT(vn->IsReleasePending());
+  // Released blocks are unmapped in the same transaction, so the mapping itself records how far
+  // the release has got.
+  const blk_t start = safemath::checked_cast<blk_t>(
+      fbl::round_up(vn->GetSize(), uint64_t{BlockSize()}) / BlockSize());
+  auto released_or =
+      vn->BlocksRelease(transaction, start, TransactionLimits::kMaxReleaseBlocks);
+  if (released_or.is_error()) {
+    return released_or.take_error();
+  }
+  if (released_or.value()) {
+    if (auto status = RemoveUnlinked(transaction, vn); status.is_error()) {
+      return status.take_error();
+    }
+    vn->SetLastInode(0);
+    vn->SetNextInode(0);
+  }
+  vn->InodeSync(transaction, kMxFsSyncDefault);
+  return zx::ok(!released_or.value());
+}
+
+zx::status<bool> Minfs::PurgeUnlinkedBatch(size_t* out_purged) {
+  *out_purged = 0;
+  auto transaction_or = BeginTransaction(0, 0);
+  if (transaction_or.is_error()) {
+    return transaction_or.take_error();
+  }
+  Transaction* transaction = transaction_or.value().get();
+
+  // Each purged inode dirties its inode table and inode bitmap blocks, and at most one block bitmap
+  // block per block it frees. Leave room for the superblock, for relinking the new list head and
+  // for the checksums of the bitmap blocks.
+  const blk_t budget = limits_.GetMaximumEntryDataBlocks() -
+                       TransactionLimits::kMaxSuperblockBlocks -
+                       TransactionLimits::kMaxInodeTableBlocks -
+                       limits_.GetMaximumChecksumTableBlocks();
+  const blk_t bitmap_blocks = GetBlockBitmapBlocks(Info());
+  blk_t budget_used = 0;
+  size_t purged_count = 0;
+
   ino_t last_ino = 0;
   ino_t next_ino = Info().unlinked_head;
-  ino_t unlinked_count = 0;
 
-  if (next_ino == 0) {
-    ZX_DEBUG_ASSERT(Info().unlinked_tail == 0);
-    return zx::ok();
-  }
+  // Vnodes that are unlinked but still open were unlinked by this instance of the filesystem and
+  // will be purged when they are closed. Those left over from a previous mount, those whose purge
+  // has been deferred, and files queued by AddPendingRelease always precede them in the list.
+  while (next_ino != 0) {
+    fbl::RefPtr<VnodeMinfs> vn = VnodeLookupInternal(next_ino);
+    if (vn == nullptr) {
+      // The blocks of a corrupt inode must not be freed, so the purge stops at one.
+      if (auto status = VnodeMinfs::Recreate(this, next_ino, &vn); status.is_error()) {
+        return status.take_error();
+      }
+      if (!vn->IsUnlinked()) {
+        VnodeInsert(vn.get());
+      }
+    } else if (vn->IsUnlinked()) {
+      break;
+    }
+    ZX_DEBUG_ASSERT(vn->GetInode()->last_inode == last_ino);
 
-  // Loop through the unlinked list and free all allocated resources.
-  fbl::RefPtr<VnodeMinfs> vn;
-  VnodeMinfs::Recreate(this, next_ino, &vn);
-  ZX_DEBUG_ASSERT(vn->GetInode()->last_inode == 0);
+    if (!vn->IsUnlinked()) {
+      if (purged_count > 0) {
+        break;
+      }
+      if (auto status = ReleaseStep(transaction, vn.get()); status.is_error()) {
+        return status.take_error();
+      }
+      CommitTransaction(std::move(transaction_or.value()));
+      return zx::ok(true);
+    }
 
-  do {
-    auto transaction_or = BeginTransaction(0, 0);
-    if (transaction_or.is_error()) {
-      return transaction_or.take_error();
+    if (vn->GetInode()->block_count > TransactionLimits::kMaxReleaseBlocks) {
+      if (purged_count > 0) {
+        break;
+      }
+      // Release the lowest of the file's blocks in a transaction of their own. They are unmapped
+      // along with being freed, so a later batch, possibly after a remount, resumes where this one
+      // left off. Once no mapped blocks remain, the inode is freed below.
+      auto released_or = vn->BlocksRelease(transaction, 0, TransactionLimits::kMaxReleaseBlocks);
+      if (released_or.is_error()) {
+        return released_or.take_error();
+      }
+      if (!released_or.value()) {
+        InodeUpdate(transaction, next_ino, vn->GetInode());
+        CommitTransaction(std::move(transaction_or.value()));
+        return zx::ok(true);
+      }
     }
 
-    ZX_DEBUG_ASSERT(vn->GetInode()->link_count == 0);
+    const blk_t cost = 1 + TransactionLimits::kMaxInodeBitmapBlocks +
+                       std::min(vn->GetInode()->block_count, bitmap_blocks);
+    if (purged_count > 0 && budget_used + cost > budget) {
+      break;
+    }
 
-    if (auto status = InoFree(transaction_or.value().get(), vn.get()); status.is_error()) {
-      return status;
+    if (auto status = InoFree(transaction, vn.get()); status.is_error()) {
+      return status.take_error();
     }
+    budget_used += cost;
+    purged_count++;
 
     last_ino = next_ino;
     next_ino = vn->GetInode()->next_inode;
+  }
 
-    sb_->MutableInfo()->unlinked_head = next_ino;
+  if (purged_count == 0) {
+    return zx::ok(false);
+  }
 
-    if (next_ino == 0) {
-      ZX_DEBUG_ASSERT(Info().unlinked_tail == last_ino);
-      sb_->MutableInfo()->unlinked_tail = 0;
-    } else {
-      // Fix the last_inode pointer in the next inode.
-      VnodeMinfs::Recreate(this, next_ino, &vn);
-      ZX_DEBUG_ASSERT(vn->GetInode()->last_inode == last_ino);
-      vn->GetMutableInode()->last_inode = 0;
-      InodeUpdate(transaction_or.value().get(), next_ino, vn->GetInode());
+  sb_->MutableInfo()->unlinked_head = next_ino;
+  if (next_ino == 0) {
+    ZX_DEBUG_ASSERT(Info().unlinked_tail == last_ino);
+    sb_->MutableInfo()->unlinked_tail = 0;
+  } else {
+    // Fix the last_inode pointer in the new head of the list.
+    auto next_vn_or = LookupUnlinkedVnode(next_ino);
+    if (next_vn_or.is_error()) {
+      return next_vn_or.take_error();
     }
-    CommitTransaction(std::move(transaction_or.value()));
-    unlinked_count++;
-  } while (next_ino != 0);
+    ZX_DEBUG_ASSERT(next_vn_or->GetInode()->last_inode == last_ino);
+    next_vn_or->SetLastInode(0);
+    next_vn_or->InodeSync(transaction, kMxFsSyncDefault);
+  }
+  CommitTransaction(std::move(transaction_or.value()));
+  *out_purged = purged_count;
+  return zx::ok(true);
+}
 
-  ZX_DEBUG_ASSERT(Info().unlinked_head == 0);
-  ZX_DEBUG_ASSERT(Info().unlinked_tail == 0);
+zx::status<> Minfs::PurgeUnlinked() {
+  size_t unlinked_count = 0;
+  while (Info().unlinked_head != 0) {
+    size_t purged_count;
+    auto progress_or = PurgeUnlinkedBatch(&purged_count);
+    if (progress_or.is_error()) {
+      return progress_or.take_error();
+    }
+    if (!progress_or.value()) {
+      break;
+    }
+    unlinked_count += purged_count;
+  }
 
-  if (!mount_options_.quiet) {
+  if (unlinked_count > 0 && !mount_options_.quiet) {
     FX_LOGS(WARNING) << "Found and purged " << unlinked_count << " unlinked vnode(s) on mount";
   }
 
   return zx::ok();
 }
 
+#ifdef __Fuchsia__
+void Minfs::PurgeUnlinkedInBackground() {
+  // Purge one transaction's worth at a time so that other requests on the dispatcher can make
+  // progress in between.
+  size_t purged_count;
+  auto progress_or = PurgeUnlinkedBatch(&purged_count);
+  if (progress_or.is_error()) {
+    FX_LOGS(ERROR) << "Failed to purge unlinked vnodes: " << progress_or.status_string();
+    return;
+  }
+  if (progress_or.value()) {
+    purge_unlinked_task_.Post(dispatcher_);
+  }
+}
+
+bool Minfs::ShouldDeferPurge(const VnodeMinfs& vn) const {
+  return mount_options_.purge_unlinked_in_background && dispatcher_ &&
+         vn.GetInode()->block_count > TransactionLimits::kMaxReleaseBlocks;
+}
+
+zx::status<> Minfs::DeferPurge(PendingWork* transaction, VnodeMinfs* vn) {
+  ZX_DEBUG_ASSERT(vn->GetInode()->link_count == 0);
+
+  // The purge stops at the first vnode which is still open, so queue |vn| ahead of them all.
+  if (auto status = AddUnlinkedHead(transaction, vn); status.is_error()) {
+    return status;
+  }
+  vn->CancelPendingWriteback();
+
+  if (!purge_unlinked_task_.is_pending()) {
+    purge_unlinked_task_.Post(dispatcher_);
+  }
+  return zx::ok();
+}
+
+void Minfs::NoteFragmentation(ino_t ino, uint64_t blocks, uint64_t extents) {
+  if (!mount_options_.defragment_in_background || !dispatcher_ ||
+      mount_options_.writability != Writability::Writable) {
+    return;
+  }
+  {
+    fbl::AutoLock lock(&defrag_lock_);
+    if (extents <= 1 || blocks >= extents * kDefragMinExtentBlocks) {
+      defrag_candidates_.erase(ino);
+      return;
+    }
+    if (defrag_candidates_.size() >= kMaxDefragCandidates && defrag_candidates_.count(ino) == 0) {
+      return;
+    }
+    defrag_candidates_[ino] = DefragCandidate{.blocks = blocks, .extents = extents};
+  }
+  if (!defrag_task_.is_pending()) {
+    defrag_task_.Post(dispatcher_);
+  }
+}
+
+zx::status<uint64_t> Minfs::DefragmentStep() {
+  if (!defrag_cursor_.file) {
+    ino_t ino;
+    DefragCandidate candidate;
+    {
+      fbl::AutoLock lock(&defrag_lock_);
+      auto most_fragmented = std::max_element(
+          defrag_candidates_.begin(), defrag_candidates_.end(),
+          [](const auto& a, const auto& b) { return a.second.extents < b.second.extents; });
+      if (most_fragmented == defrag_candidates_.end()) {
+        return zx::ok(0);
+      }
+      ino = most_fragmented->first;
+      candidate = most_fragmented->second;
+      defrag_candidates_.erase(most_fragmented);
+    }
+    // Without a free run which holds the whole file, moving it would not leave it in fewer extents.
+    auto run_or = block_allocator_->FindFreeRun(candidate.blocks);
+    if (run_or.is_error()) {
+      return zx::ok(0);
+    }
+    // The file may have been removed, or its inode reused for a directory, since it was noted.
+    auto vnode_or = VnodeGet(ino);
+    if (vnode_or.is_error() || vnode_or->IsDirectory()) {
+      return zx::ok(0);
+    }
+    const blk_t goal = static_cast<blk_t>(run_or.value());
+    defrag_cursor_ = DefragCursor{.file = fbl::RefPtr<File>::Downcast(std::move(vnode_or.value())),
+                                  .candidate = candidate,
+                                  .goal = goal,
+                                  .goal_end = static_cast<blk_t>(goal + candidate.blocks)};
+  } else if (defrag_cursor_.goal < defrag_cursor_.goal_end &&
+             !block_allocator_->IsFreeRun(defrag_cursor_.goal,
+                                          defrag_cursor_.goal_end - defrag_cursor_.goal)) {
+    // Blocks of the run have been allocated since it was found, so the rest of the file would not
+    // follow the blocks already moved. A |goal| outside the run, left by blocks which could not be
+    // placed in it, covers blocks already moved and fails the same way. Queue the file again to be
+    // moved whole to a new run.
+    fbl::AutoLock lock(&defrag_lock_);
+    defrag_candidates_.try_emplace(defrag_cursor_.file->GetIno(), defrag_cursor_.candidate);
+    defrag_cursor_ = {};
+    return zx::ok(0);
+  }
+
+  const uint64_t file_block = defrag_cursor_.file_block;
+  auto more_or = defrag_cursor_.file->RelocateBlocks(&defrag_cursor_.file_block,
+                                                     kDefragBlocksPerStep, &defrag_cursor_.goal);
+  if (more_or.is_error()) {
+    if (more_or.error_value() != ZX_ERR_SHOULD_WAIT) {
+      defrag_cursor_ = {};
+    }
+    return more_or.take_error();
+  }
+  const uint64_t blocks = defrag_cursor_.file_block - file_block;
+  if (!more_or.value()) {
+    // Reading the file to move it may have noted it again.
+    fbl::AutoLock lock(&defrag_lock_);
+    defrag_candidates_.erase(defrag_cursor_.file->GetIno());
+    defrag_cursor_ = {};
+  }
+  return zx::ok(blocks);
+}
+
+void Minfs::DefragmentInBackground() {
+  const zx::time start = zx::clock::get_monotonic();
+  auto blocks_or = DefragmentStep();
+  const zx::duration busy = zx::clock::get_monotonic() - start;
+
+  zx::duration delay;
+  if (blocks_or.is_error()) {
+    if (blocks_or.error_value() != ZX_ERR_SHOULD_WAIT) {
+      FX_LOGS(ERROR) << "Failed to defragment a file: " << blocks_or.status_string();
+    }
+    delay = kDefragRetryDelay;
+  } else {
+    // Stay idle for long enough that the step took no more than |defrag_time_percent| of the time,
+    // and copied no more than |defrag_bytes_per_second| on average.
+    const uint32_t percent = std::clamp(mount_options_.defrag_time_percent, 1u, 100u);
+    delay = busy * (100 - percent) / percent;
+    if (mount_options_.defrag_bytes_per_second > 0) {
+      const uint64_t bytes = blocks_or.value() * BlockSize();
+      delay = std::max(delay, zx::sec(1) * static_cast<int64_t>(bytes) /
+                                  static_cast<int64_t>(mount_options_.defrag_bytes_per_second));
+    }
+  }
+
+  {
+    fbl::AutoLock lock(&defrag_lock_);
+    if (!defrag_cursor_.file && defrag_candidates_.empty()) {
+      return;
+    }
+  }
+  // Noting a file while this step read it may have posted the task already, without the delay.
+  defrag_task_.Cancel();
+  if (delay > zx::duration(0)) {
+    defrag_task_.PostDelayed(dispatcher_, delay);
+  } else {
+    defrag_task_.Post(dispatcher_);
+  }
+}
+#endif
+
 #ifdef __Fuchsia__
 zx::status<> Minfs::UpdateCleanBitAndOldestRevision(bool is_clean) {
   auto transaction_or = BeginTransaction(0, 0);
@@ -913,6 +1345,13 @@ void Minfs::StopWriteback() {
     return;
   }
 
+  // Any unlinked vnodes that have not been purged yet will be purged on the next mount.
+  purge_unlinked_task_.Cancel();
+
+  // Files which have not been defragmented yet are noted again when they are next read.
+  defrag_task_.Cancel();
+  defrag_cursor_ = {};
+
   if (mount_options_.writability == Writability::Writable) {
     // Ignore errors here since there is nothing we can do.
     [[maybe_unused]] auto _ = UpdateCleanBitAndOldestRevision(/*is_clean=*/true);
@@ -928,7 +1367,7 @@ fbl::RefPtr<VnodeMinfs> Minfs::VnodeLookupInternal(uint32_t ino) {
   fbl::RefPtr<VnodeMinfs> vn;
   {
     // Avoid releasing a reference to |vn| while holding |hash_lock_|.
-    fbl::AutoLock lock(&hash_lock_);
+    ProfiledLock lock(&hash_lock_, &lock_profile_, LockSite::kVnodeHash);
     auto rawVn = vnode_hash_.find(ino);
     if (!rawVn.IsValid()) {
       // Nothing exists in the lookup table
@@ -981,7 +1420,7 @@ zx::status<fbl::RefPtr<VnodeMinfs>> Minfs::VnodeNew(Transaction* transaction, ui
 
 void Minfs::VnodeInsert(VnodeMinfs* vn) {
 #ifdef __Fuchsia__
-  fbl::AutoLock lock(&hash_lock_);
+  ProfiledLock lock(&hash_lock_, &lock_profile_, LockSite::kVnodeHash);
 #endif
 
   ZX_DEBUG_ASSERT_MSG(!vnode_hash_.find(vn->GetKey()).IsValid(), "ino %u already in map\n",
@@ -1001,7 +1440,7 @@ fbl::RefPtr<VnodeMinfs> Minfs::VnodeLookup(uint32_t ino) {
 
 void Minfs::VnodeRelease(VnodeMinfs* vn) {
 #ifdef __Fuchsia__
-  fbl::AutoLock lock(&hash_lock_);
+  ProfiledLock lock(&hash_lock_, &lock_profile_, LockSite::kVnodeHash);
 #endif
   vnode_hash_.erase(*vn);
 }
@@ -1017,7 +1456,10 @@ zx::status<fbl::RefPtr<VnodeMinfs>> Minfs::VnodeGet(ino_t ino) {
     return zx::ok(std::move(vn));
   }
 
-  VnodeMinfs::Recreate(this, ino, &vn);
+  ScopedLatency latency(latencies_, LatencyPhase::kVnodeGetMiss);
+  if (auto status = VnodeMinfs::Recreate(this, ino, &vn); status.is_error()) {
+    return status.take_error();
+  }
 
   if (vn->IsUnlinked()) {
     // If a vnode we have recreated from disk is unlinked, something has gone wrong during the
@@ -1036,6 +1478,9 @@ void Minfs::BlockNew(PendingWork* transaction, blk_t* out_bno) const {
   size_t allocated_bno = transaction->AllocateBlock();
   *out_bno = static_cast<blk_t>(allocated_bno);
   ValidateBno(*out_bno);
+  if (checksums_) {
+    checksums_->Clear(Info().dat_block + *out_bno);
+  }
 }
 
 void Minfs::UpdateFlags(PendingWork* transaction, uint32_t flags, bool set) {
@@ -1048,14 +1493,31 @@ void Minfs::UpdateFlags(PendingWork* transaction, uint32_t flags, bool set) {
 }
 
 #ifdef __Fuchsia__
-void Minfs::BlockSwap(Transaction* transaction, blk_t in_bno, blk_t* out_bno) {
+void Minfs::BlockSwap(Transaction* transaction, blk_t in_bno, blk_t* out_bno, blk_t goal) {
   if (in_bno > 0) {
     ValidateBno(in_bno);
   }
 
-  size_t allocated_bno = transaction->SwapBlock(in_bno);
+  size_t allocated_bno = transaction->SwapBlock(in_bno, goal);
   *out_bno = static_cast<blk_t>(allocated_bno);
   ValidateBno(*out_bno);
+  if (checksums_) {
+    checksums_->Clear(Info().dat_block + *out_bno);
+  }
+}
+#else
+zx::status<> Minfs::WriteMetadataBlock(blk_t bno, const void* data) {
+  if (auto status = bc_->Writeblk(bno, data); status.is_error()) {
+    return status;
+  }
+  if (!checksums_) {
+    return zx::ok();
+  }
+  // There is no journal on host, so the table is brought up to date straight away too.
+  checksums_->Update(bno, 1, data);
+  std::vector<storage::BufferedOperation> operations;
+  checksums_->Commit(&operations);
+  return zx::make_status(bc_->RunRequests(operations));
 }
 #endif
 
@@ -1084,6 +1546,28 @@ void InitializeDirectory(void* bdata, ino_t ino_self, ino_t ino_parent) {
   memcpy(&static_cast<uint8_t*>(bdata)[kSelfSize], parent.raw, kParentSize);
 }
 
+void InitializeIndexedDirectory(void* bdata, uint32_t block_size, ino_t ino_self,
+                                ino_t ino_parent, bool checksum) {
+  uint8_t* data = static_cast<uint8_t*>(bdata);
+
+  // The index has a single record, covering every hash, for the leaf in file block 1.
+  DirIndexHeader header = {};
+  header.magic = kMinfsDirIndexMagic;
+  header.count = 1;
+  DirIndexEntry entry = {.hash = 0, .block = 1};
+  memcpy(data, &header, sizeof(header));
+  memcpy(data + sizeof(header), &entry, sizeof(entry));
+  if (checksum) {
+    UpdateDirIndexChecksum(ino_self, data, block_size);
+  }
+
+  // The leaf holds "." and "..", the latter taking up the rest of the block.
+  uint8_t* leaf = data + block_size;
+  InitializeDirectory(leaf, ino_self, ino_parent);
+  Dirent* parent = reinterpret_cast<Dirent*>(leaf + DirentSize(1));
+  parent->reclen = block_size - DirentSize(1);
+}
+
 zx::status<std::pair<std::unique_ptr<Allocator>, std::unique_ptr<InodeManager>>>
 Minfs::ReadInitialBlocks(const Superblock& info, Bcache& bc, SuperblockManager& superblock,
                          const MountOptions& mount_options) {
@@ -1149,6 +1633,24 @@ Minfs::ReadInitialBlocks(const Superblock& info, Bcache& bc, SuperblockManager&
     return zx::error(status);
   }
 
+#ifdef __Fuchsia__
+  // On host, Bcache verifies the bitmaps as it reads them.
+  Allocator& block_allocator = *block_allocator_or.value();
+  Allocator& inode_allocator = inodes_or.value()->inode_allocator();
+  if (auto status = bc.VerifyChecksums(abm_start_block, block_allocator.GetMapBlocks(),
+                                       block_allocator.GetMapData());
+      status.is_error()) {
+    FX_LOGS(ERROR) << "Create failed to verify the block bitmap";
+    return status.take_error();
+  }
+  if (auto status = bc.VerifyChecksums(ibm_start_block, inode_allocator.GetMapBlocks(),
+                                       inode_allocator.GetMapData());
+      status.is_error()) {
+    FX_LOGS(ERROR) << "Create failed to verify the inode bitmap";
+    return status.take_error();
+  }
+#endif
+
   return zx::ok(
       std::make_pair(std::move(block_allocator_or.value()), std::move(inodes_or.value())));
 }
@@ -1204,6 +1706,23 @@ zx::status<std::unique_ptr<Minfs>> Minfs::Create(FuchsiaDispatcher dispatcher,
 
   std::unique_ptr<SuperblockManager> sb = std::move(sb_or.value());
 
+  // The checksum table is loaded first so that the other metadata is verified as it is read. On
+  // host, it is not used with sparse images, whose regions are not where the superblock says.
+  std::unique_ptr<ChecksumTable> checksums;
+#ifdef __Fuchsia__
+  const bool load_checksums = info.UsesChecksums();
+#else
+  const bool load_checksums = info.UsesChecksums() && bc->extent_lengths_.empty();
+#endif
+  if (load_checksums) {
+    auto checksums_or = ChecksumTable::Load(bc.get(), info);
+    if (checksums_or.is_error()) {
+      return checksums_or.take_error();
+    }
+    checksums = std::move(checksums_or).value();
+    bc->SetChecksumTable(checksums.get());
+  }
+
   auto result = Minfs::ReadInitialBlocks(info, *bc, *sb, options);
   if (result.is_error())
     return result.take_error();
@@ -1215,6 +1734,7 @@ zx::status<std::unique_ptr<Minfs>> Minfs::Create(FuchsiaDispatcher dispatcher,
   out_fs = std::unique_ptr<Minfs>(new Minfs(dispatcher, std::move(bc), std::move(sb),
                                             std::move(block_allocator), std::move(inodes), options,
                                             vfs));
+  out_fs->checksums_ = std::move(checksums);
   if (options.writability != Writability::ReadOnlyDisk) {
     auto status = out_fs->InitializeJournal(std::move(journal_superblock_or.value()));
     if (status.is_error()) {
@@ -1249,10 +1769,16 @@ zx::status<std::unique_ptr<Minfs>> Minfs::Create(FuchsiaDispatcher dispatcher,
     }
 
     // After loading the rest of the filesystem, purge any remaining nodes in the unlinked list.
-    status = out_fs->PurgeUnlinked();
-    if (status.is_error()) {
-      FX_LOGS(ERROR) << "Cannot purge unlinked list";
-      return status.take_error();
+    // When requested, this is deferred so that the filesystem is available immediately.
+    if (options.purge_unlinked_in_background && options.writability == Writability::Writable &&
+        dispatcher) {
+      out_fs->purge_unlinked_task_.Post(dispatcher);
+    } else {
+      status = out_fs->PurgeUnlinked();
+      if (status.is_error()) {
+        FX_LOGS(ERROR) << "Cannot purge unlinked list";
+        return status.take_error();
+      }
     }
 
     if (options.writability == Writability::ReadOnlyFilesystem) {
@@ -1268,6 +1794,7 @@ zx::status<std::unique_ptr<Minfs>> Minfs::Create(FuchsiaDispatcher dispatcher,
   out_fs =
       std::unique_ptr<Minfs>(new Minfs(std::move(bc), std::move(sb), std::move(block_allocator),
                                        std::move(inodes), offsets, options, vfs));
+  out_fs->checksums_ = std::move(checksums);
 #endif  // !defined(__Fuchsia__)
 
   return zx::ok(std::move(out_fs));
@@ -1386,13 +1913,139 @@ uint32_t BlocksRequiredForBits(uint64_t bit_count) {
   return safemath::checked_cast<uint32_t>((bit_count + kMinfsBlockBits - 1) / kMinfsBlockBits);
 }
 
+namespace {
+
+// Lays out the metadata of a non-FVM volume of |blocks| device blocks holding |info->inode_count|
+// inodes, setting the region locations and the data block count in |info|.
+zx::status<> LayoutNonFvmVolume(uint32_t blocks, Superblock* info) {
+  const uint32_t inoblks = (info->inode_count + kMinfsInodesPerBlock - 1) /
+                           kMinfsInodesPerBlock;
+  const uint32_t ibmblks = (info->inode_count + kMinfsBlockBits - 1) / kMinfsBlockBits;
+  if (blocks <= 8) {
+    return zx::error(ZX_ERR_INVALID_ARGS);
+  }
+  blk_t non_dat_blocks;
+  blk_t journal_blocks = 0;
+
+  info->ibm_block = 8;
+  info->abm_block = info->ibm_block + fbl::round_up(ibmblks, 8u);
+
+  for (uint32_t alloc_bitmap_rounded = 8; alloc_bitmap_rounded < blocks;
+       alloc_bitmap_rounded += 8) {
+    // Increment bitmap blocks by 8, since we will always round this value up to 8.
+    ZX_ASSERT(alloc_bitmap_rounded % 8 == 0);
+
+    info->ino_block = info->abm_block + alloc_bitmap_rounded;
+
+    // Calculate the journal size based on other metadata structures.
+    TransactionLimits limits(*info);
+    journal_blocks = limits.GetRecommendedIntegrityBlocks();
+
+    non_dat_blocks = 8 + fbl::round_up(ibmblks, 8u) + alloc_bitmap_rounded + inoblks;
+
+    // If the recommended journal count is too high, try using the minimum instead.
+    if (non_dat_blocks + journal_blocks >= blocks) {
+      journal_blocks = limits.GetMinimumIntegrityBlocks();
+    }
+
+    non_dat_blocks += journal_blocks;
+    if (non_dat_blocks >= blocks) {
+      return zx::error(ZX_ERR_INVALID_ARGS);
+    }
+
+    info->block_count = blocks - non_dat_blocks;
+    // Calculate the exact number of bitmap blocks needed to track this many data blocks.
+    const uint32_t abmblks = (info->block_count + kMinfsBlockBits - 1) / kMinfsBlockBits;
+
+    if (alloc_bitmap_rounded >= abmblks) {
+      // It is possible that the abmblks value will actually bring us back to the next
+      // lowest tier of 8-rounded values. This means we may have 8 blocks allocated for
+      // the block bitmap which will never actually be used. This is not ideal, but is
+      // expected, and should only happen for very particular block counts.
+      break;
+    }
+  }
+
+  info->integrity_start_block = info->ino_block + inoblks;
+  info->dat_block = info->integrity_start_block + journal_blocks;
+  return zx::ok();
+}
+
+uint32_t NonFvmInodeCount(const MountOptions& options) {
+  if (options.inode_count == 0) {
+    return kMinfsDefaultInodeCount;
+  }
+  return fbl::round_up(options.inode_count, kMinfsInodesPerBlock);
+}
+
+}  // namespace
+
+zx::status<uint32_t> NonFvmDeviceBlocksRequired(const MountOptions& options,
+                                                uint64_t data_blocks) {
+  Superblock info = {};
+  info.block_size = kMinfsBlockSize;
+  info.inode_size = kMinfsInodeSize;
+  info.inode_count = NonFvmInodeCount(options);
+  if (options.metadata_checksums) {
+    info.flags |= kMinfsFlagChecksums;
+  }
+
+  // The metadata grows with the device, so grow the device by each shortfall until it fits.
+  uint64_t blocks = data_blocks + 64;
+  while (true) {
+    if (blocks > std::numeric_limits<uint32_t>::max()) {
+      return zx::error(ZX_ERR_OUT_OF_RANGE);
+    }
+    if (LayoutNonFvmVolume(static_cast<uint32_t>(blocks), &info).is_error()) {
+      blocks *= 2;
+      continue;
+    }
+    // The checksum table takes its blocks from the data region.
+    uint64_t usable_blocks = info.block_count;
+    if (info.UsesChecksums()) {
+      usable_blocks -= std::min<uint64_t>(
+          usable_blocks, ChecksumTable::BlocksNeeded(info.abm_block - info.ibm_block,
+                                                     info.ino_block - info.abm_block,
+                                                     info.block_count));
+    }
+    if (usable_blocks >= data_blocks) {
+      return zx::ok(static_cast<uint32_t>(blocks));
+    }
+    blocks += data_blocks - usable_blocks;
+  }
+}
+
 zx::status<> Mkfs(const MountOptions& options, Bcache* bc) {
   Superblock info;
   memset(&info, 0x00, sizeof(info));
   info.magic0 = kMinfsMagic0;
   info.magic1 = kMinfsMagic1;
-  info.major_version = kMinfsCurrentMajorVersion;
   info.flags = kMinfsFlagClean;
+  if (options.extent_inodes) {
+    info.flags |= kMinfsFlagExtents;
+  }
+  if (options.inline_data) {
+    info.flags |= kMinfsFlagInlineData;
+  }
+  if (options.large_files) {
+    info.flags |= kMinfsFlagLargeFiles;
+  }
+  if (options.dir_index) {
+    info.flags |= kMinfsFlagDirIndex;
+#ifdef __Fuchsia__
+    zx_cprng_draw(info.dir_hash_seed, sizeof(info.dir_hash_seed));
+#else
+    std::random_device random;
+    for (uint32_t& word : info.dir_hash_seed) {
+      word = random();
+    }
+#endif
+  }
+  if (options.metadata_checksums) {
+    info.flags |= kMinfsFlagChecksums;
+  }
+  info.major_version = (info.flags & kMinfsFeatureFlags) ? kMinfsMajorVersionFeatures
+                                                         : kMinfsCurrentMajorVersion;
   info.block_size = kMinfsBlockSize;
   info.inode_size = kMinfsInodeSize;
 
@@ -1409,7 +2062,7 @@ zx::status<> Mkfs(const MountOptions& options, Bcache* bc) {
   blocks = static_cast<uint32_t>(info.dat_slices * info.slice_size / info.BlockSize());
 #endif
   if ((info.flags & kMinfsFlagFVM) == 0) {
-    inodes = kMinfsDefaultInodeCount;
+    inodes = NonFvmInodeCount(options);
     blocks = bc->Maxblk();
   }
 
@@ -1417,70 +2070,31 @@ zx::status<> Mkfs(const MountOptions& options, Bcache* bc) {
   // and inode bitmaps there are
   uint32_t inoblks = (inodes + kMinfsInodesPerBlock - 1) / kMinfsInodesPerBlock;
   uint32_t ibmblks = (inodes + kMinfsBlockBits - 1) / kMinfsBlockBits;
-  uint32_t abmblks = 0;
 
   info.inode_count = inodes;
   info.alloc_block_count = 0;
   info.alloc_inode_count = 0;
 
   if ((info.flags & kMinfsFlagFVM) == 0) {
-    blk_t non_dat_blocks;
-    blk_t journal_blocks = 0;
-
-    info.ibm_block = 8;
-    info.abm_block = info.ibm_block + fbl::round_up(ibmblks, 8u);
-
-    for (uint32_t alloc_bitmap_rounded = 8; alloc_bitmap_rounded < blocks;
-         alloc_bitmap_rounded += 8) {
-      // Increment bitmap blocks by 8, since we will always round this value up to 8.
-      ZX_ASSERT(alloc_bitmap_rounded % 8 == 0);
-
-      info.ino_block = info.abm_block + alloc_bitmap_rounded;
-
-      // Calculate the journal size based on other metadata structures.
-      TransactionLimits limits(info);
-      journal_blocks = limits.GetRecommendedIntegrityBlocks();
-
-      non_dat_blocks = 8 + fbl::round_up(ibmblks, 8u) + alloc_bitmap_rounded + inoblks;
-
-      // If the recommended journal count is too high, try using the minimum instead.
-      if (non_dat_blocks + journal_blocks >= blocks) {
-        journal_blocks = limits.GetMinimumIntegrityBlocks();
-      }
-
-      non_dat_blocks += journal_blocks;
-      if (non_dat_blocks >= blocks) {
-        FX_LOGS(ERROR) << "mkfs: Partition size ("
-                       << static_cast<uint64_t>(blocks) * info.BlockSize()
-                       << " bytes) is too small";
-        return zx::error(ZX_ERR_INVALID_ARGS);
-      }
-
-      info.block_count = blocks - non_dat_blocks;
-      // Calculate the exact number of bitmap blocks needed to track this many data blocks.
-      abmblks = (info.block_count + kMinfsBlockBits - 1) / kMinfsBlockBits;
-
-      if (alloc_bitmap_rounded >= abmblks) {
-        // It is possible that the abmblks value will actually bring us back to the next
-        // lowest tier of 8-rounded values. This means we may have 8 blocks allocated for
-        // the block bitmap which will never actually be used. This is not ideal, but is
-        // expected, and should only happen for very particular block counts.
-        break;
-      }
+    if (auto status = LayoutNonFvmVolume(blocks, &info); status.is_error()) {
+      FX_LOGS(ERROR) << "mkfs: Partition size (" << static_cast<uint64_t>(blocks) * info.BlockSize()
+                     << " bytes) is too small";
+      return status.take_error();
     }
-
-    info.integrity_start_block = info.ino_block + inoblks;
-    info.dat_block = info.integrity_start_block + journal_blocks;
   } else {
     info.block_count = blocks;
-    abmblks = (info.block_count + kMinfsBlockBits - 1) / kMinfsBlockBits;
     info.ibm_block = kFVMBlockInodeBmStart;
     info.abm_block = kFVMBlockDataBmStart;
     info.ino_block = kFVMBlockInodeStart;
     info.integrity_start_block = kFvmSuperblockBackup;
     info.dat_block = kFVMBlockDataStart;
   }
+  const uint32_t abmblks = (info.block_count + kMinfsBlockBits - 1) / kMinfsBlockBits;
   info.oldest_minor_version = kMinfsCurrentMinorVersion;
+  if (options.lazy_inode_table_init) {
+    info.flags |= kMinfsFlagLazyInodeTable;
+    info.ino_init_blocks = 1;
+  }
   DumpInfo(info);
 
   RawBitmap abm;
@@ -1509,12 +2123,20 @@ zx::status<> Mkfs(const MountOptions& options, Bcache* bc) {
   }
 
   // Write rootdir
-  uint8_t blk[info.BlockSize()];
-  memset(blk, 0, sizeof(blk));
-  InitializeDirectory(blk, kMinfsRootIno, kMinfsRootIno);
-  if (auto status = bc->Writeblk(info.dat_block + 1, blk); status.is_error()) {
-    FX_LOGS(ERROR) << "mkfs: Failed to write root directory: " << status.error_value();
-    return status.take_error();
+  const blk_t root_blocks = info.UsesDirIndex() ? 2 : 1;
+  std::vector<uint8_t> root_data(root_blocks * info.BlockSize(), 0);
+  if (info.UsesDirIndex()) {
+    InitializeIndexedDirectory(root_data.data(), info.BlockSize(), kMinfsRootIno, kMinfsRootIno,
+                               info.UsesChecksums());
+  } else {
+    InitializeDirectory(root_data.data(), kMinfsRootIno, kMinfsRootIno);
+  }
+  for (blk_t i = 0; i < root_blocks; ++i) {
+    if (auto status = bc->Writeblk(info.dat_block + 1 + i, &root_data[i * info.BlockSize()]);
+        status.is_error()) {
+      FX_LOGS(ERROR) << "mkfs: Failed to write root directory: " << status.error_value();
+      return status.take_error();
+    }
   }
 
   // Update inode bitmap
@@ -1524,45 +2146,148 @@ zx::status<> Mkfs(const MountOptions& options, Bcache* bc) {
 
   // update block bitmap:
   // Reserve the 0th data block (as a 'null' value)
-  // Reserve the 1st data block (for root directory)
-  abm.Set(0, 2);
-  info.alloc_block_count += 2;
-
-  // Write allocation bitmap
-  for (uint32_t n = 0; n < abmblks; n++) {
-    void* bmdata = fs::GetBlock(info.BlockSize(), abm.StorageUnsafe()->GetData(), n);
-    memcpy(blk, bmdata, info.BlockSize());
-    if (auto status = bc->Writeblk(info.abm_block + n, blk); status.is_error()) {
-      return status.take_error();
+  // Reserve the following data blocks (for root directory)
+  abm.Set(0, 1 + root_blocks);
+  info.alloc_block_count += 1 + root_blocks;
+
+  // The checksum table follows the root directory. It covers the regions as they are now; see
+  // ChecksumTable.
+  std::unique_ptr<ChecksumTable> checksums;
+  if (info.UsesChecksums()) {
+    if (info.flags & kMinfsFlagFVM) {
+      const uint32_t blocks_per_slice = static_cast<uint32_t>(info.slice_size / info.BlockSize());
+      info.csum_ibm_blocks = info.ibm_slices * blocks_per_slice;
+      info.csum_abm_blocks = info.abm_slices * blocks_per_slice;
+    } else {
+      info.csum_ibm_blocks = info.abm_block - info.ibm_block;
+      info.csum_abm_blocks = info.ino_block - info.abm_block;
     }
+    info.csum_dat_blocks = info.block_count;
+    info.csum_block = 1 + root_blocks;
+    info.csum_blocks = ChecksumTable::BlocksNeeded(info.csum_ibm_blocks, info.csum_abm_blocks,
+                                                   info.csum_dat_blocks);
+    if (uint64_t{info.csum_block} + info.csum_blocks > info.block_count) {
+      FX_LOGS(ERROR) << "mkfs: No room for a checksum table of " << info.csum_blocks << " blocks";
+      return zx::error(ZX_ERR_NO_SPACE);
+    }
+    abm.Set(info.csum_block, info.csum_block + info.csum_blocks);
+    info.alloc_block_count += info.csum_blocks;
+
+    auto checksums_or = ChecksumTable::CreateEmpty(bc, info);
+    if (checksums_or.is_error()) {
+      return checksums_or.take_error();
+    }
+    checksums = std::move(checksums_or).value();
+    checksums->Update(info.dat_block + 1, root_blocks, root_data.data());
+    checksums->Update(info.abm_block, abmblks, abm.StorageUnsafe()->GetData());
+    checksums->Update(info.ibm_block, ibmblks, ibm.StorageUnsafe()->GetData());
   }
 
-  // Write inode bitmap
-  for (uint32_t n = 0; n < ibmblks; n++) {
-    void* bmdata = fs::GetBlock(info.BlockSize(), ibm.StorageUnsafe()->GetData(), n);
-    memcpy(blk, bmdata, info.BlockSize());
-    if (auto status = bc->Writeblk(info.ibm_block + n, blk); status.is_error()) {
-      return status.take_error();
+  // Write both bitmaps and zero the inode table as a single batch of large sequential requests
+  // rather than one block at a time. The first inode table block holds the root inode and is
+  // written separately below.
+  fs::BufferedOperationsBuilder builder;
+#ifdef __Fuchsia__
+  storage::OwnedVmoid abm_vmoid;
+  if (zx_status_t status =
+          bc->BlockAttachVmo(abm.StorageUnsafe()->GetVmo(), &abm_vmoid.GetReference(bc));
+      status != ZX_OK) {
+    return zx::error(status);
+  }
+  storage::OwnedVmoid ibm_vmoid;
+  if (zx_status_t status =
+          bc->BlockAttachVmo(ibm.StorageUnsafe()->GetVmo(), &ibm_vmoid.GetReference(bc));
+      status != ZX_OK) {
+    return zx::error(status);
+  }
+  fs::internal::BorrowedBuffer abm_buffer(abm_vmoid.get());
+  fs::internal::BorrowedBuffer ibm_buffer(ibm_vmoid.get());
+#else
+  fs::internal::BorrowedBuffer abm_buffer(abm.StorageUnsafe()->GetData());
+  fs::internal::BorrowedBuffer ibm_buffer(ibm.StorageUnsafe()->GetData());
+#endif
+  builder.Add(storage::Operation{.type = storage::OperationType::kWrite,
+                                 .vmo_offset = 0,
+                                 .dev_offset = info.abm_block,
+                                 .length = abmblks},
+              &abm_buffer);
+  builder.Add(storage::Operation{.type = storage::OperationType::kWrite,
+                                 .vmo_offset = 0,
+                                 .dev_offset = info.ibm_block,
+                                 .length = ibmblks},
+              &ibm_buffer);
+
+  // The same zeroed buffer is reused for every chunk of the inode table. With lazy initialisation
+  // only the first block (which holds the root inode) is written; the remainder is initialised on
+  // demand by the InodeManager.
+  const uint32_t zero_blocks = std::min(inoblks - 1, kMkfsMaxZeroBlocks);
+#ifdef __Fuchsia__
+  storage::VmoBuffer zero_buffer;
+  if (!options.lazy_inode_table_init && zero_blocks > 0) {
+    if (zx_status_t status =
+            zero_buffer.Initialize(bc, zero_blocks, info.BlockSize(), "minfs-mkfs-zero");
+        status != ZX_OK) {
+      FX_LOGS(ERROR) << "mkfs: Failed to allocate zero buffer: " << status;
+      return zx::error(status);
+    }
+  }
+#else
+  storage::ArrayBuffer zero_buffer(options.lazy_inode_table_init ? 0 : zero_blocks,
+                                   info.BlockSize());
+  if (zero_buffer.capacity() > 0) {
+    memset(zero_buffer.Data(0), 0, zero_buffer.capacity() * info.BlockSize());
+  }
+#endif
+  if (!options.lazy_inode_table_init) {
+    for (uint32_t n = 1; n < inoblks; n += zero_blocks) {
+      builder.Add(storage::Operation{.type = storage::OperationType::kWrite,
+                                     .vmo_offset = 0,
+                                     .dev_offset = info.ino_block + n,
+                                     .length = std::min(inoblks - n, zero_blocks)},
+                  &zero_buffer);
     }
   }
 
-  // Write inodes
-  memset(blk, 0, sizeof(blk));
-  for (uint32_t n = 0; n < inoblks; n++) {
-    if (auto status = bc->Writeblk(info.ino_block + n, blk); status.is_error()) {
+  if (zx_status_t status = bc->RunRequests(builder.TakeOperations()); status != ZX_OK) {
+    FX_LOGS(ERROR) << "mkfs: Failed to write metadata: " << status;
+    return zx::error(status);
+  }
+  if (checksums) {
+    if (auto status = checksums->Write(bc); status.is_error()) {
+      FX_LOGS(ERROR) << "mkfs: Failed to write checksum table: " << status.error_value();
       return status.take_error();
     }
   }
 
-  // Setup root inode
+  // Setup root inode in the first inode table block.
+  uint8_t blk[info.BlockSize()];
+  memset(blk, 0, sizeof(blk));
   Inode* ino = reinterpret_cast<Inode*>(blk);
   ino[kMinfsRootIno].magic = kMinfsMagicDir;
-  ino[kMinfsRootIno].size = info.BlockSize();
-  ino[kMinfsRootIno].block_count = 1;
+  ino[kMinfsRootIno].size = root_blocks * info.BlockSize();
+  ino[kMinfsRootIno].block_count = root_blocks;
   ino[kMinfsRootIno].link_count = 2;
   ino[kMinfsRootIno].dirent_count = 2;
-  ino[kMinfsRootIno].dnum[0] = 1;
+  if (info.UsesDirIndex()) {
+    ino[kMinfsRootIno].flags = kMinfsInodeFlagDirIndex;
+  }
+  if (info.UsesExtents()) {
+    // The root directory's only extent fits in the inode, so no node blocks are needed.
+    std::unique_ptr<ExtentTree> tree = ExtentTree::CreateEmpty(info.UsesChecksums());
+    for (blk_t i = 0; i < root_blocks; ++i) {
+      [[maybe_unused]] auto status = tree->Set(i, 1 + i, /*allocator=*/nullptr);
+      ZX_DEBUG_ASSERT(status.is_ok());
+    }
+    tree->WriteRoot(&ino[kMinfsRootIno]);
+  } else {
+    for (blk_t i = 0; i < root_blocks; ++i) {
+      ino[kMinfsRootIno].dnum[i] = 1 + i;
+    }
+  }
   ino[kMinfsRootIno].create_time = GetTimeUTC();
+  if (info.UsesChecksums()) {
+    UpdateInodeChecksum(kMinfsRootIno, &ino[kMinfsRootIno]);
+  }
   (void)bc->Writeblk(info.ino_block, blk);
 
   info.generation_count = 0;
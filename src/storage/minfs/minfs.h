@@ -47,6 +47,11 @@ zx::status<> Mkfs(const MountOptions& options, Bcache* bc);
 // Format the partition backed by |bc| as MinFS.
 inline zx::status<> Mkfs(Bcache* bc) { return Mkfs({}, bc); }
 
+// Returns the smallest number of blocks which a device without FVM needs for Mkfs with |options| to
+// leave at least |data_blocks| data blocks.
+zx::status<uint32_t> NonFvmDeviceBlocksRequired(const MountOptions& options,
+                                                uint64_t data_blocks);
+
 }  // namespace minfs
 
 #endif  // SRC_STORAGE_MINFS_MINFS_H_
@@ -20,12 +20,30 @@ fs_inspect::UsageData CalculateSpaceUsage(const Superblock& superblock, uint64_t
   };
 }
 
-MinfsInspectTree::MinfsInspectTree(const block_client::BlockDevice* device)
+MinfsInspectTree::MinfsInspectTree(const block_client::BlockDevice* device,
+                                   const LatencyMetrics* latencies,
+                                   const IoAccounting* io_accounting,
+                                   const WriteAmplification* write_amplification,
+                                   const LockProfile* lock_profile)
     : device_(device),
+      latencies_(latencies),
+      io_accounting_(io_accounting),
+      write_amplification_(write_amplification),
+      lock_profile_(lock_profile),
       tree_root_(inspector_.GetRoot().CreateChild("minfs")),
       opstats_node_(tree_root_.CreateChild("fs.opstats")),
-      node_operations_(opstats_node_) {
+      node_operations_(opstats_node_),
+      latency_node_(tree_root_.CreateLazyNode("fs.latency", CreateLatencyNode())),
+      io_node_(tree_root_.CreateLazyNode("fs.io", CreateIoNode())),
+      write_amplification_node_(tree_root_.CreateLazyNode("fs.write_amplification",
+                                                          CreateWriteAmplificationNode())),
+      locks_node_(tree_root_.CreateLazyNode("fs.locks", CreateLocksNode())),
+      object_pools_node_(tree_root_.CreateLazyNode("fs.object_pools", CreateObjectPoolsNode())) {
   ZX_ASSERT(device_);
+  ZX_ASSERT(latencies_);
+  ZX_ASSERT(io_accounting_);
+  ZX_ASSERT(write_amplification_);
+  ZX_ASSERT(lock_profile_);
   inspector_.CreateStatsNode();
 }
 
@@ -38,7 +56,7 @@ void MinfsInspectTree::Initialize(const fs::FilesystemInfo& fs_info, const Super
         .id = fs_info.fs_id,
         .type = fs_info.fs_type,
         .name = fs_info.name,
-        .version_major = kMinfsCurrentMajorVersion,
+        .version_major = superblock.major_version,
         .version_minor = kMinfsCurrentMinorVersion,
         .block_size = fs_info.block_size,
         .max_filename_length = fs_info.max_filename_size,
@@ -116,6 +134,122 @@ inspect::LazyNodeCallbackFn MinfsInspectTree::CreateDetailNode() const {
   };
 }
 
+inspect::LazyNodeCallbackFn MinfsInspectTree::CreateLatencyNode() const {
+  return [this]() {
+    inspect::Inspector insp;
+    for (size_t i = 0; i < static_cast<size_t>(LatencyPhase::kCount); ++i) {
+      const LatencyPhase phase = static_cast<LatencyPhase>(i);
+      const LatencyHistogram::Snapshot snapshot = latencies_->Get(phase).GetSnapshot();
+      inspect::Node node = insp.GetRoot().CreateChild(LatencyPhaseName(phase));
+      node.CreateUint("count", snapshot.count, &insp);
+      node.CreateUint("total_ns", snapshot.total_ns, &insp);
+      node.CreateUint("max_ns", snapshot.max_ns, &insp);
+      node.CreateUint("p50_ns", snapshot.Percentile(0.5), &insp);
+      node.CreateUint("p99_ns", snapshot.Percentile(0.99), &insp);
+      node.CreateUint("p999_ns", snapshot.Percentile(0.999), &insp);
+      inspect::UintArray buckets = node.CreateUintArray("buckets", snapshot.buckets.size());
+      for (size_t bucket = 0; bucket < snapshot.buckets.size(); ++bucket) {
+        buckets.Set(bucket, snapshot.buckets[bucket]);
+      }
+      insp.emplace(std::move(buckets));
+      insp.emplace(std::move(node));
+    }
+    return fpromise::make_ok_promise(insp);
+  };
+}
+
+inspect::LazyNodeCallbackFn MinfsInspectTree::CreateIoNode() const {
+  return [this]() {
+    inspect::Inspector insp;
+    for (size_t i = 0; i < static_cast<size_t>(IoAccounting::View::kCount); ++i) {
+      const IoAccounting::View view = static_cast<IoAccounting::View>(i);
+      inspect::Node view_node = insp.GetRoot().CreateChild(IoAccounting::ViewName(view));
+      for (bool write : {false, true}) {
+        inspect::Node direction_node = view_node.CreateChild(write ? "write" : "read");
+        for (size_t j = 0; j < static_cast<size_t>(IoSource::kCount); ++j) {
+          const IoSource source = static_cast<IoSource>(j);
+          const IoAccounting::Counts counts = io_accounting_->Get(view, write, source);
+          inspect::Node node = direction_node.CreateChild(IoSourceName(source));
+          node.CreateUint("ops", counts.ops, &insp);
+          node.CreateUint("blocks", counts.blocks, &insp);
+          node.CreateUint("bytes", counts.bytes, &insp);
+          inspect::Node sizes = node.CreateChild("ops_by_size");
+          for (size_t bucket = 0; bucket < IoAccounting::kSizeBucketCount; ++bucket) {
+            sizes.CreateUint(IoAccounting::SizeBucketName(bucket), counts.ops_by_size[bucket],
+                             &insp);
+          }
+          insp.emplace(std::move(sizes));
+          insp.emplace(std::move(node));
+        }
+        insp.emplace(std::move(direction_node));
+      }
+      insp.emplace(std::move(view_node));
+    }
+    return fpromise::make_ok_promise(insp);
+  };
+}
+
+inspect::LazyNodeCallbackFn MinfsInspectTree::CreateWriteAmplificationNode() const {
+  return [this]() {
+    inspect::Inspector insp;
+    auto add = [&insp](const char* name, const WriteAmplification::Totals& totals) {
+      inspect::Node node = insp.GetRoot().CreateChild(name);
+      node.CreateDouble("ratio", totals.Ratio(), &insp);
+      node.CreateUint("logical_bytes", totals.logical_bytes, &insp);
+      node.CreateUint("device_bytes", totals.DeviceBytes(), &insp);
+      for (size_t i = 0; i < WriteAmplification::kCategoryCount; ++i) {
+        const auto category = static_cast<WriteAmplification::Category>(i);
+        inspect::Node category_node =
+            node.CreateChild(WriteAmplification::CategoryName(category));
+        category_node.CreateUint("bytes", totals.device_bytes[i], &insp);
+        category_node.CreateDouble("ratio", totals.Ratio(category), &insp);
+        insp.emplace(std::move(category_node));
+      }
+      insp.emplace(std::move(node));
+    };
+    add("cumulative", write_amplification_->Cumulative());
+    add("window", write_amplification_->Window());
+    return fpromise::make_ok_promise(insp);
+  };
+}
+
+inspect::LazyNodeCallbackFn MinfsInspectTree::CreateLocksNode() const {
+  return [this]() {
+    inspect::Inspector insp;
+    auto add_times = [&insp](inspect::Node& parent, const char* name,
+                             const LatencyHistogram::Snapshot& snapshot) {
+      inspect::Node node = parent.CreateChild(name);
+      node.CreateUint("total_ns", snapshot.total_ns, &insp);
+      node.CreateUint("p50_ns", snapshot.Percentile(0.5), &insp);
+      node.CreateUint("p99_ns", snapshot.Percentile(0.99), &insp);
+      node.CreateUint("max_ns", snapshot.max_ns, &insp);
+      insp.emplace(std::move(node));
+    };
+    insp.GetRoot().CreateBool("enabled", lock_profile_->enabled(), &insp);
+    for (size_t i = 0; i < static_cast<size_t>(LockSite::kCount); ++i) {
+      const LockSite site = static_cast<LockSite>(i);
+      const LockProfile::Stats stats = lock_profile_->Get(site);
+      inspect::Node node = insp.GetRoot().CreateChild(LockSiteName(site));
+      node.CreateUint("acquisitions", stats.acquisitions, &insp);
+      node.CreateUint("contended", stats.contended, &insp);
+      add_times(node, "wait", stats.wait);
+      add_times(node, "hold", stats.hold);
+      insp.emplace(std::move(node));
+    }
+    return fpromise::make_ok_promise(insp);
+  };
+}
+
+inspect::LazyNodeCallbackFn MinfsInspectTree::CreateObjectPoolsNode() {
+  return []() {
+    inspect::Inspector insp;
+    const ObjectPoolStats stats = GetObjectPoolStats();
+    insp.GetRoot().CreateUint("recycled_allocations", stats.recycled_allocations, &insp);
+    insp.GetRoot().CreateUint("pool_misses", stats.pool_misses, &insp);
+    return fpromise::make_ok_promise(insp);
+  };
+}
+
 fs_inspect::NodeCallbacks MinfsInspectTree::CreateCallbacks() {
   return {
       .info_callback =
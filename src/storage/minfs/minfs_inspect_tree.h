@@ -14,6 +14,11 @@
 #include "src/lib/storage/vfs/cpp/inspect/inspect_tree.h"
 #include "src/lib/storage/vfs/cpp/inspect/node_operations.h"
 #include "src/storage/minfs/format.h"
+#include "src/storage/minfs/io_accounting.h"
+#include "src/storage/minfs/latency_histogram.h"
+#include "src/storage/minfs/lock_profile.h"
+#include "src/storage/minfs/object_pool.h"
+#include "src/storage/minfs/write_amplification.h"
 
 namespace minfs {
 
@@ -22,7 +27,13 @@ fs_inspect::UsageData CalculateSpaceUsage(const Superblock& superblock, uint64_t
 // Encapsulates the state required to make a filesystem inspect tree for Minfs.
 class MinfsInspectTree final {
  public:
-  explicit MinfsInspectTree(const block_client::BlockDevice* device);
+  // |latencies| are exported under fs.latency, |io_accounting| under fs.io,
+  // |write_amplification| under fs.write_amplification and |lock_profile| under fs.locks. All must
+  // outlive this object.
+  MinfsInspectTree(const block_client::BlockDevice* device, const LatencyMetrics* latencies,
+                   const IoAccounting* io_accounting,
+                   const WriteAmplification* write_amplification,
+                   const LockProfile* lock_profile);
   ~MinfsInspectTree() = default;
 
   // Initialize the Minfs inspect tree, creating all required nodes. Once called, the inspect
@@ -104,6 +115,30 @@ class MinfsInspectTree final {
 
   inspect::LazyNodeCallbackFn CreateDetailNode() const;
 
+  // Creates a node for each LatencyPhase holding the count, total, maximum and percentiles of its
+  // latencies in nanoseconds, and the counts in each bucket of its LatencyHistogram.
+  inspect::LazyNodeCallbackFn CreateLatencyNode() const;
+
+  // Creates a node for each IoAccounting view, holding a node for reads and writes with the ops,
+  // blocks, bytes and ops by size bucket of each IoSource.
+  inspect::LazyNodeCallbackFn CreateIoNode() const;
+
+  // Creates a "cumulative" and a "window" node, each holding the ratio, the logical and device
+  // bytes, and the bytes and ratio of each WriteAmplification category.
+  inspect::LazyNodeCallbackFn CreateWriteAmplificationNode() const;
+
+  // Creates a node for each LockSite holding its acquisitions, contended acquisitions, and the
+  // total, percentiles and maximum of its wait and hold times.
+  inspect::LazyNodeCallbackFn CreateLocksNode() const;
+
+  // Creates a node holding the process-wide ObjectPoolStats.
+  static inspect::LazyNodeCallbackFn CreateObjectPoolsNode();
+
+  const LatencyMetrics* const latencies_;
+  const IoAccounting* const io_accounting_;
+  const WriteAmplification* const write_amplification_;
+  const LockProfile* const lock_profile_;
+
   // The Inspector to which the tree is attached.
   inspect::Inspector inspector_;
 
@@ -119,6 +154,21 @@ class MinfsInspectTree final {
   // All common filesystem node operation trackers.
   fs_inspect::NodeOperations node_operations_;
 
+  // Node which exports |latencies_|.
+  inspect::LazyNode latency_node_;
+
+  // Node which exports |io_accounting_|.
+  inspect::LazyNode io_node_;
+
+  // Node which exports |write_amplification_|.
+  inspect::LazyNode write_amplification_node_;
+
+  // Node which exports |lock_profile_|.
+  inspect::LazyNode locks_node_;
+
+  // Node which exports GetObjectPoolStats().
+  inspect::LazyNode object_pools_node_;
+
   // Filesystem inspect tree nodes.
   // **MUST be declared last**, as the callbacks passed to this object use the above properties.
   // This ensures that the callbacks are destroyed before any properties that they may reference.
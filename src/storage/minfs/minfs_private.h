@@ -10,6 +10,7 @@
 
 #include <inttypes.h>
 
+#include <map>
 #include <memory>
 #include <utility>
 
@@ -45,9 +46,13 @@
 #include "src/lib/storage/vfs/cpp/vfs.h"
 #include "src/lib/storage/vfs/cpp/vnode.h"
 #include "src/storage/minfs/format.h"
+#include "src/storage/minfs/io_accounting.h"
+#include "src/storage/minfs/latency_histogram.h"
+#include "src/storage/minfs/lock_profile.h"
 #include "src/storage/minfs/minfs.h"
 #include "src/storage/minfs/superblock.h"
 #include "src/storage/minfs/transaction_limits.h"
+#include "src/storage/minfs/write_amplification.h"
 #include "src/storage/minfs/writeback.h"
 
 #ifdef __Fuchsia__
@@ -57,6 +62,7 @@
 #include "src/storage/minfs/allocator/allocator.h"
 #include "src/storage/minfs/allocator/inode_manager.h"
 #include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/checksum_table.h"
 #include "src/storage/minfs/vnode.h"
 
 constexpr uint32_t kExtentCount = 6;
@@ -67,6 +73,20 @@ namespace minfs {
 // How frequently we synchronize the journal. Without this, the journal will only get flushed when
 // there is no room for a new transaction, or it is explicitly asked to by some other mechanism.
 constexpr zx::duration kJournalBackgroundSyncTime = zx::sec(30);
+
+// The background defragmenter takes a file whose extents average fewer blocks than this.
+constexpr uint64_t kDefragMinExtentBlocks = 64;
+
+// The most files which wait for the background defragmenter at once. Others are noted again when
+// they are next read.
+constexpr size_t kMaxDefragCandidates = 64;
+
+// The number of blocks the background defragmenter moves in each step. This may be no more than a
+// file may hold dirty, since the blocks are moved as if they had been written.
+constexpr uint64_t kDefragBlocksPerStep = 256;
+
+// How long the background defragmenter waits for a file with writes of its own pending.
+constexpr zx::duration kDefragRetryDelay = zx::sec(1);
 #endif  // __Fuchsia__
 
 // A async_dispatcher_t* is needed for some functions on Fuchsia only. In order to avoid ifdefs on
@@ -100,6 +120,7 @@ constexpr uint32_t kMinfsBlockCacheSize = 64;
 
 // Used by fsck
 class VnodeMinfs;
+class File;
 
 using SyncCallback = fs::Vnode::SyncCallback;
 
@@ -167,6 +188,13 @@ class TransactionalFs {
 
   virtual Allocator& GetBlockAllocator() = 0;
   virtual Allocator& GetInodeAllocator() = 0;
+
+  // Returns where transactions account for the I/O they enqueue, or null if they do not.
+  virtual IoAccounting* GetIoAccounting() { return nullptr; }
+
+  // Returns where transactions record their acquisitions of the transaction lock, or null if they
+  // do not.
+  virtual LockProfile* GetLockProfile() { return nullptr; }
 };
 
 class Minfs : public fbl::RefCounted<Minfs>, public TransactionalFs {
@@ -220,21 +248,67 @@ class Minfs : public fbl::RefCounted<Minfs>, public TransactionalFs {
   void UpdateFlags(PendingWork* transaction, uint32_t flags, bool set);
 
   // Mark |in_bno| for de-allocation (if it is > 0), and return a new block |*out_bno|.
-  // The swap will not be persisted until the transaction is commited.
-  void BlockSwap(Transaction* transaction, blk_t in_bno, blk_t* out_bno);
+  // The swap will not be persisted until the transaction is commited. A non-zero |goal| is
+  // allocated if it is free.
+  void BlockSwap(Transaction* transaction, blk_t in_bno, blk_t* out_bno, blk_t goal = 0);
 
   // Free ino in inode bitmap, release all blocks held by inode.
   [[nodiscard]] zx::status<> InoFree(Transaction* transaction, VnodeMinfs* vn);
 
   // Mark |vn| to be unlinked.
-  void AddUnlinked(PendingWork* transaction, VnodeMinfs* vn);
+  [[nodiscard]] zx::status<> AddUnlinked(PendingWork* transaction, VnodeMinfs* vn);
 
   // Remove |vn| from the list of unlinked vnodes.
-  void RemoveUnlinked(PendingWork* transaction, VnodeMinfs* vn);
+  [[nodiscard]] zx::status<> RemoveUnlinked(PendingWork* transaction, VnodeMinfs* vn);
+
+  // Queues |vn|, a linked file whose size is being reduced, at the head of the unlinked list so
+  // that the blocks beyond its new size are released by later transactions (see ReleaseStep), or
+  // by the purge on the next mount if the filesystem goes away first. The new size must be
+  // persisted in |transaction|.
+  [[nodiscard]] zx::status<> AddPendingRelease(PendingWork* transaction, VnodeMinfs* vn);
+
+  // Releases up to |TransactionLimits::kMaxReleaseBlocks| of the blocks beyond the size of |vn|,
+  // which must have been queued by AddPendingRelease, and removes it from the unlinked list once
+  // none remain. Returns whether blocks remain to be released.
+  [[nodiscard]] zx::status<bool> ReleaseStep(PendingWork* transaction, VnodeMinfs* vn);
 
   // Free resources of all vnodes marked unlinked.
   [[nodiscard]] zx::status<> PurgeUnlinked();
 
+  // Frees as many vnodes from the head of the unlinked list as fit within a single transaction,
+  // stopping at the first one which is unlinked but still open. A vnode with more than
+  // |TransactionLimits::kMaxReleaseBlocks| blocks instead has that many of its blocks released,
+  // and is freed by a later batch; a linked file queued by AddPendingRelease has a ReleaseStep.
+  // Sets |out_purged| to the number of vnodes freed, and returns whether any progress was made.
+  [[nodiscard]] zx::status<bool> PurgeUnlinkedBatch(size_t* out_purged);
+
+#ifdef __Fuchsia__
+  // Purges the unlinked list one batch at a time, reposting itself until the list is exhausted.
+  void PurgeUnlinkedInBackground();
+
+  // Returns true if the blocks of |vn| should be released in the background once it is purged or
+  // truncated, rather than by the caller.
+  bool ShouldDeferPurge(const VnodeMinfs& vn) const;
+
+  // Queues |vn|, which is unlinked, not on the unlinked list and no longer in the vnode lookup, at
+  // the head of the unlinked list. Its resources are freed by the background purge.
+  [[nodiscard]] zx::status<> DeferPurge(PendingWork* transaction, VnodeMinfs* vn);
+
+  // Records that the file |ino| maps |blocks| data blocks in |extents| runs, as found by
+  // VnodeMinfs::InitVmo, and queues it for the background defragmenter if its extents are short.
+  void NoteFragmentation(ino_t ino, uint64_t blocks, uint64_t extents);
+
+  // Moves up to kDefragBlocksPerStep blocks of the most fragmented queued file towards a free run
+  // which holds the whole file, and reposts itself while there is more to do, delayed so that it
+  // keeps within the defrag_bytes_per_second and defrag_time_percent mount options.
+  void DefragmentInBackground();
+#endif
+
+  // Returns the vnode for |ino|, which must be on the unlinked list, either because it is unlinked
+  // or because it is queued by AddPendingRelease. Fails if the vnode has to be loaded and its inode
+  // is corrupt.
+  zx::status<fbl::RefPtr<VnodeMinfs>> LookupUnlinkedVnode(ino_t ino);
+
   // Writes back an inode into the inode table on persistent storage.
   // Does not modify inode bitmap.
   void InodeUpdate(PendingWork* transaction, ino_t ino, const Inode* inode) {
@@ -328,6 +402,14 @@ class Minfs : public fbl::RefCounted<Minfs>, public TransactionalFs {
     return Info().BlockSize();
   }
 
+  // Returns the DirentHash() of |name| in the indexed directories of this volume.
+  uint32_t HashDirentName(std::string_view name) const {
+    if (mount_options_.dir_hash_for_testing != nullptr) {
+      return mount_options_.dir_hash_for_testing(name);
+    }
+    return DirentHash(Info().dir_hash_seed, name);
+  }
+
   // Gets an immutable reference to the InodeManager.
   const InspectableInodeManager* GetInodeManager() const { return inodes_.get(); }
 
@@ -365,6 +447,15 @@ class Minfs : public fbl::RefCounted<Minfs>, public TransactionalFs {
 
   Bcache* GetMutableBcache() final { return bc_.get(); }
 
+  // Returns the checksum table, or null if the volume does not use checksums.
+  ChecksumTable* checksums() { return checksums_.get(); }
+
+#ifndef __Fuchsia__
+  // Writes |data| to device block |bno| immediately, as host code does for the indirect blocks,
+  // extent tree nodes and directory blocks of vnodes, and records its checksum.
+  [[nodiscard]] zx::status<> WriteMetadataBlock(blk_t bno, const void* data);
+#endif
+
   // TODO(rvargas): Make private.
   std::unique_ptr<Bcache> bc_;
 
@@ -375,6 +466,19 @@ class Minfs : public fbl::RefCounted<Minfs>, public TransactionalFs {
 
   PlatformVfs* vfs() { return vfs_; }
 
+  // Latencies of the internal phases of filesystem operations, see LatencyPhase.
+  LatencyMetrics& Latencies() { return latencies_; }
+
+  IoAccounting* GetIoAccounting() final { return &io_accounting_; }
+
+  // Device bytes written for each byte written to files, derived from |io_accounting_|. Must be
+  // reset along with it.
+  WriteAmplification& GetWriteAmplification() { return write_amplification_; }
+
+  // Contention and hold times of the filesystem's locks, see LockSite. Disabled unless
+  // MountOptions::profile_locks is set or it is enabled with LockProfile::SetEnabled.
+  LockProfile* GetLockProfile() final { return &lock_profile_; }
+
  private:
   using HashTable = fbl::HashTable<ino_t, VnodeMinfs*>;
 
@@ -392,6 +496,10 @@ class Minfs : public fbl::RefCounted<Minfs>, public TransactionalFs {
   // Internal version of VnodeLookup which may also return unlinked vnodes.
   fbl::RefPtr<VnodeMinfs> VnodeLookupInternal(uint32_t ino) __TA_EXCLUDES(hash_lock_);
 
+  // Inserts |vn|, which is not on the unlinked list, at its head, ahead of any vnodes which are
+  // unlinked but still open.
+  [[nodiscard]] zx::status<> AddUnlinkedHead(PendingWork* transaction, VnodeMinfs* vn);
+
   // Returns a vector of vnodes having one or more blocks that needs to be
   // flushed.
   std::vector<fbl::RefPtr<VnodeMinfs>> GetDirtyVnodes();
@@ -410,11 +518,22 @@ class Minfs : public fbl::RefCounted<Minfs>, public TransactionalFs {
   // Updates the clean bit and oldest revision in the super block.
   [[nodiscard]] zx::status<> UpdateCleanBitAndOldestRevision(bool is_clean);
 
-#ifndef __Fuchsia__
+#ifdef __Fuchsia__
+  // One step of DefragmentInBackground. Returns the number of file blocks it covered.
+  zx::status<uint64_t> DefragmentStep();
+#else
   [[nodiscard]] zx::status<> ReadBlk(blk_t bno, blk_t start, blk_t soft_max, blk_t hard_max,
                                      void* data) const;
 #endif
 
+  // Declared before the journal, which records journal write and data writeback latencies.
+  LatencyMetrics latencies_;
+  // The I/O enqueued by transactions and run on |bc_|, which records into it while attached.
+  IoAccounting io_accounting_;
+  WriteAmplification write_amplification_;
+  // Declared before the allocators and the journal, which record into it until they are destroyed.
+  LockProfile lock_profile_;
+
   // Global information about the filesystem.
   // While Allocator is thread-safe, it is recommended that a valid Transaction object be held
   // while any metadata fields are modified until the time they are enqueued for writeback. This
@@ -423,6 +542,8 @@ class Minfs : public fbl::RefCounted<Minfs>, public TransactionalFs {
   std::unique_ptr<SuperblockManager> sb_;
   std::unique_ptr<Allocator> block_allocator_;
   std::unique_ptr<InodeManager> inodes_;
+  // With kMinfsFlagChecksums, the checksums of the metadata blocks written by transactions.
+  std::unique_ptr<ChecksumTable> checksums_;
 
 #ifdef __Fuchsia__
   mutable fbl::Mutex txn_lock_;   // Lock required to start a new Transaction.
@@ -439,6 +560,25 @@ class Minfs : public fbl::RefCounted<Minfs>, public TransactionalFs {
   zx::event fs_id_;
 
   async::TaskClosure journal_sync_task_;
+  async::TaskClosure purge_unlinked_task_;
+
+  struct DefragCandidate {
+    uint64_t blocks = 0;
+    uint64_t extents = 0;
+  };
+  // The file being moved by the background defragmenter, as it was queued, the next block of it to
+  // move, and where to move it: the rest of the free run found for it, from |goal| to |goal_end|.
+  struct DefragCursor {
+    fbl::RefPtr<File> file;
+    DefragCandidate candidate;
+    uint64_t file_block = 0;
+    blk_t goal = 0;
+    blk_t goal_end = 0;
+  };
+  async::TaskClosure defrag_task_;
+  DefragCursor defrag_cursor_;
+  mutable fbl::Mutex defrag_lock_;
+  std::map<ino_t, DefragCandidate> defrag_candidates_ __TA_GUARDED(defrag_lock_);
 
   MinfsInspectTree inspect_tree_;
   void InitializeInspectTree();
@@ -468,6 +608,11 @@ void DumpInfo(const Superblock& info);
 void DumpInode(const Inode* inode, ino_t ino);
 zx_time_t GetTimeUTC();
 void InitializeDirectory(void* bdata, ino_t ino_self, ino_t ino_parent);
+// Initializes the index and the single leaf of an empty indexed directory (see
+// kMinfsInodeFlagDirIndex) in |bdata|, which must hold two zeroed blocks of |block_size| bytes.
+// The index is given a checksum if |checksum| is true.
+void InitializeIndexedDirectory(void* bdata, uint32_t block_size, ino_t ino_self,
+                                ino_t ino_parent, bool checksum);
 
 }  // namespace minfs
 
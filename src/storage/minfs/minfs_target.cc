@@ -26,7 +26,7 @@ std::vector<fbl::RefPtr<VnodeMinfs>> Minfs::GetDirtyVnodes() {
   std::vector<fbl::RefPtr<VnodeMinfs>> unused_clean_vnodes;
 
   // Avoid releasing a reference to |vn| while holding |hash_lock_|.
-  fbl::AutoLock lock(&hash_lock_);
+  ProfiledLock lock(&hash_lock_, &lock_profile_, LockSite::kVnodeHash);
   for (auto& raw_vnode : vnode_hash_) {
     vn = fbl::MakeRefPtrUpgradeFromRaw(&raw_vnode, hash_lock_);
     if (vn == nullptr) {
@@ -99,6 +99,7 @@ bool Minfs::AllReservationsBacked(const Transaction&) const {
 }
 
 zx::status<> Minfs::BlockingJournalSync() {
+  ScopedLatency latency(latencies_, LatencyPhase::kBlockingJournalSync);
   zx_status_t sync_status = ZX_OK;
   sync_completion_t sync_completion = {};
   journal_->schedule_task(journal_->Sync().then(
@@ -5,7 +5,10 @@
 #ifndef SRC_STORAGE_MINFS_MOUNT_H_
 #define SRC_STORAGE_MINFS_MOUNT_H_
 
+#include <stdint.h>
+
 #include <memory>
+#include <string_view>
 
 #ifdef __Fuchsia__
 #include "src/lib/storage/vfs/cpp/managed_vfs.h"
@@ -32,10 +35,60 @@ struct MountOptions {
   bool repair_filesystem = true;
   // For testing only: if true, run fsck after every transaction.
   bool fsck_after_every_transaction = false;
+  // For testing only: if set, replaces DirentHash() in indexed directories, so that tests can
+  // create names which share a hash.
+  uint32_t (*dir_hash_for_testing)(std::string_view name) = nullptr;
 
   // Number of slices to preallocate for data when the filesystem is created.
   uint32_t fvm_data_slices = 1;
 
+  // Number of inodes to create on a device without FVM, rounded up to a whole block of inodes. Zero
+  // selects kMinfsDefaultInodeCount.
+  uint32_t inode_count = 0;
+
+  // If true, Mkfs does not zero the inode table. Instead it sets kMinfsFlagLazyInodeTable and inode
+  // table blocks are initialised on demand as inodes are allocated.
+  bool lazy_inode_table_init = false;
+
+  // If true, Mkfs formats the volume with kMinfsFlagExtents, so that inodes map their blocks with
+  // extent trees rather than direct and indirect block pointers.
+  bool extent_inodes = false;
+
+  // If true, Mkfs formats the volume with kMinfsFlagInlineData, so that files and directories of
+  // no more than kMinfsInlineDataSize bytes are stored in their inodes rather than in data blocks.
+  bool inline_data = false;
+
+  // If true, Mkfs formats the volume with kMinfsFlagLargeFiles, so that inode sizes are 64 bits
+  // and files may grow to as many blocks as their inodes can address rather than just under 4 GiB.
+  bool large_files = false;
+
+  // If true, Mkfs formats the volume with kMinfsFlagDirIndex, so that directories are hash indexed
+  // and may grow to kMinfsMaxIndexedDirectorySize rather than kMinfsMaxDirectorySize.
+  bool dir_index = false;
+
+  // If true, Mkfs formats the volume with kMinfsFlagChecksums, so that inodes and other metadata
+  // blocks carry CRC32C checksums, either in their own fields or in the checksum table, which are
+  // verified as the metadata is read and by fsck.
+  bool metadata_checksums = false;
+
+  // If true, vnodes left on the unlinked list by a previous mount are purged by a background task
+  // after mount rather than before the filesystem becomes available. The same task releases the
+  // blocks of large files deleted or truncated while mounted, so that those operations return
+  // immediately.
+  bool purge_unlinked_in_background = false;
+
+  // If true, files found to be fragmented when their data is first read are moved into contiguous
+  // runs of free blocks by a background task. The task copies at most |defrag_bytes_per_second|
+  // (zero for no limit), and is busy no more than |defrag_time_percent| of the time, so that it
+  // leaves the device to foreground requests.
+  bool defragment_in_background = false;
+  uint64_t defrag_bytes_per_second = 4 * 1024 * 1024;
+  uint32_t defrag_time_percent = 5;
+
+  // If true, the filesystem records how long its locks are waited for and held, see LockProfile.
+  // The profile is exported under fs.locks in inspect.
+  bool profile_locks = false;
+
   // If true, don't log messages except for errors.
   bool quiet = false;
 };
@@ -0,0 +1,70 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/object_pool.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <atomic>
+
+namespace minfs {
+namespace {
+
+std::atomic<uint64_t> recycled_allocations = 0;
+std::atomic<uint64_t> pool_misses = 0;
+
+}  // namespace
+
+ObjectPoolStats GetObjectPoolStats() {
+  return {
+      .recycled_allocations = recycled_allocations.load(std::memory_order_relaxed),
+      .pool_misses = pool_misses.load(std::memory_order_relaxed),
+  };
+}
+
+std::string ObjectPoolStats::ToJson() const {
+  char json[128];
+  snprintf(json, sizeof(json),
+           "{\"recycled_allocations\": %" PRIu64 ", \"pool_misses\": %" PRIu64 "}",
+           recycled_allocations, pool_misses);
+  return json;
+}
+
+namespace internal {
+
+void RecordObjectPoolAllocation(bool from_heap) {
+  (from_heap ? pool_misses : recycled_allocations).fetch_add(1, std::memory_order_relaxed);
+}
+
+void FreeBlockList::Push(void* block) {
+  FreeBlock* free_block = static_cast<FreeBlock*>(block);
+  free_block->next = head_;
+  head_ = free_block;
+  ++size_;
+}
+
+void* FreeBlockList::Pop() {
+  FreeBlock* free_block = head_;
+  if (free_block != nullptr) {
+    head_ = free_block->next;
+    --size_;
+  }
+  return free_block;
+}
+
+void FreeBlockList::TakeFrom(FreeBlockList& other, size_t count) {
+  for (; count > 0 && !other.empty(); --count) {
+    Push(other.Pop());
+  }
+}
+
+void FreeBlockList::Release() {
+  while (!empty()) {
+    ::operator delete(Pop());
+  }
+}
+
+}  // namespace internal
+}  // namespace minfs
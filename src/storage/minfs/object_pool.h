@@ -0,0 +1,237 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_STORAGE_MINFS_OBJECT_POOL_H_
+#define SRC_STORAGE_MINFS_OBJECT_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace minfs {
+
+// Counts the memory handed out by object pools, over every pool in the process. Only pooled
+// objects are counted: Transaction, AllocatorReservation and PendingChange, and the RleBitmap
+// elements the allocators recycle. The pinned vnode lists are recycled by a VectorPool, which is
+// not counted. Other per-transaction allocations, such as the operation vectors and the journal's
+// closures, still come from the heap. Once the pools hold as many objects as are alive at the
+// busiest time, they stop missing, so a |pool_misses| which stops growing shows that the pooled
+// objects are recycled.
+// The counters are never reset.
+struct ObjectPoolStats {
+  // Pooled objects whose memory was recycled from a freed object.
+  uint64_t recycled_allocations = 0;
+  // Pooled objects and RleBitmap elements whose memory had to come from the heap because their
+  // pool was empty.
+  uint64_t pool_misses = 0;
+
+  std::string ToJson() const;
+};
+
+ObjectPoolStats GetObjectPoolStats();
+
+namespace internal {
+
+void RecordObjectPoolAllocation(bool from_heap);
+
+// A list of freed blocks of memory, linked through the blocks themselves. Not thread-safe.
+class FreeBlockList {
+ public:
+  bool empty() const { return head_ == nullptr; }
+  size_t size() const { return size_; }
+
+  void Push(void* block);
+  void* Pop();
+
+  // Moves up to |count| blocks from |other| to this list.
+  void TakeFrom(FreeBlockList& other, size_t count);
+
+  // Returns every block to the heap.
+  void Release();
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  FreeBlock* head_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Recycles the memory of objects of type T. Each thread keeps up to kThreadCacheSize freed blocks
+// of its own, so that a thread which creates and destroys objects takes no locks. Threads which
+// free more than they allocate, such as the journal thread which destroys the deallocations of
+// committed transactions, pass blocks in batches to a depot shared by every thread, from which
+// threads which run out refill. The depot keeps at most kDepotSize blocks and returns the rest to
+// the heap.
+template <typename T>
+class ObjectPool {
+ public:
+  static constexpr size_t kThreadCacheSize = 32;
+  static constexpr size_t kBatchSize = kThreadCacheSize / 2;
+  static constexpr size_t kDepotSize = 1024;
+
+  static void* Allocate() {
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    static_assert(sizeof(T) >= sizeof(void*));
+    FreeBlockList* blocks = ThreadBlocks();
+    void* block = nullptr;
+    if (blocks == nullptr || blocks->empty()) {
+      Depot& depot = GetDepot();
+      std::lock_guard lock(depot.mutex);
+      if (blocks == nullptr) {
+        block = depot.blocks.Pop();
+      } else {
+        blocks->TakeFrom(depot.blocks, kBatchSize);
+      }
+    }
+    if (blocks != nullptr) {
+      block = blocks->Pop();
+    }
+    RecordObjectPoolAllocation(block == nullptr);
+    return block != nullptr ? block : ::operator new(sizeof(T));
+  }
+
+  static void Free(void* block) {
+    FreeBlockList* blocks = ThreadBlocks();
+    if (blocks == nullptr) {
+      FreeBlockList list;
+      list.Push(block);
+      GiveToDepot(list, 1);
+      return;
+    }
+    blocks->Push(block);
+    if (blocks->size() > kThreadCacheSize) {
+      GiveToDepot(*blocks, kBatchSize);
+    }
+  }
+
+ private:
+  struct Depot {
+    std::mutex mutex;
+    FreeBlockList blocks;
+  };
+
+  // Gives the thread's blocks to the depot when the thread exits.
+  struct ThreadCache {
+    ~ThreadCache() {
+      GiveToDepot(blocks, blocks.size());
+      exited = true;
+    }
+
+    FreeBlockList blocks;
+    // Set once the cache has been destroyed. Trivially destructible, so that objects destroyed
+    // later in the thread's exit can still read it and go to the depot instead.
+    static thread_local bool exited;
+  };
+
+  static Depot& GetDepot() {
+    // Never destroyed, so that objects may be freed during exit.
+    static Depot* depot = new Depot();
+    return *depot;
+  }
+
+  // Returns the calling thread's blocks, or null if the thread is exiting and has destroyed them.
+  static FreeBlockList* ThreadBlocks() {
+    if (ThreadCache::exited) {
+      return nullptr;
+    }
+    thread_local ThreadCache cache;
+    return &cache.blocks;
+  }
+
+  static void GiveToDepot(FreeBlockList& blocks, size_t count) {
+    FreeBlockList overflow;
+    {
+      Depot& depot = GetDepot();
+      std::lock_guard lock(depot.mutex);
+      const size_t room = kDepotSize > depot.blocks.size() ? kDepotSize - depot.blocks.size() : 0;
+      depot.blocks.TakeFrom(blocks, std::min(count, room));
+      overflow.TakeFrom(blocks, count > room ? count - room : 0);
+    }
+    overflow.Release();
+  }
+};
+
+template <typename T>
+thread_local bool ObjectPool<T>::ThreadCache::exited = false;
+
+}  // namespace internal
+
+// Makes |new| and |delete| of T, and of classes derived from it of the same size, recycle memory
+// through an ObjectPool rather than the heap. Used for the objects created for every transaction.
+template <typename T>
+class PooledObject {
+ public:
+  static void* operator new(size_t size) {
+    return size == sizeof(T) ? internal::ObjectPool<T>::Allocate() : ::operator new(size);
+  }
+  static void operator delete(void* block, size_t size) {
+    if (size == sizeof(T)) {
+      internal::ObjectPool<T>::Free(block);
+    } else {
+      ::operator delete(block);
+    }
+  }
+};
+
+// Recycles the storage of vectors which are filled and emptied once per transaction. Keeps up to
+// kMaxVectors emptied vectors whose capacity is at most kMaxCapacity; larger ones go back to the
+// heap, so that one unusually large transaction does not hold on to its memory. Thread-safe.
+template <typename T>
+class VectorPool {
+ public:
+  static constexpr size_t kMaxVectors = 64;
+  static constexpr size_t kMaxCapacity = 64;
+
+  // Returns an empty vector, with the capacity of a recycled one if there is one.
+  static std::vector<T> Take() {
+    Depot& depot = GetDepot();
+    std::lock_guard lock(depot.mutex);
+    if (depot.vectors.empty()) {
+      return {};
+    }
+    std::vector<T> vector = std::move(depot.vectors.back());
+    depot.vectors.pop_back();
+    return vector;
+  }
+
+  // Destroys the elements of |vector| and keeps its storage for a later Take.
+  static void Give(std::vector<T> vector) {
+    // The elements are destroyed before taking the lock, since their destructors may use the pool.
+    vector.clear();
+    if (vector.capacity() == 0 || vector.capacity() > kMaxCapacity) {
+      return;
+    }
+    Depot& depot = GetDepot();
+    std::lock_guard lock(depot.mutex);
+    if (depot.vectors.size() < kMaxVectors) {
+      depot.vectors.push_back(std::move(vector));
+    }
+  }
+
+ private:
+  struct Depot {
+    Depot() { vectors.reserve(kMaxVectors); }
+
+    std::mutex mutex;
+    std::vector<std::vector<T>> vectors;
+  };
+
+  static Depot& GetDepot() {
+    // Never destroyed, so that vectors may be given back during exit.
+    static Depot* depot = new Depot();
+    return *depot;
+  }
+};
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_OBJECT_POOL_H_
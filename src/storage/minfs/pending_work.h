@@ -40,6 +40,13 @@ class PendingWork {
 
   // Deallocates a block in the data section and returns the block allocated.
   virtual void DeallocateBlock(size_t block) = 0;
+
+  // Deallocates |count| contiguous blocks in the data section, starting at |start|.
+  virtual void DeallocateBlocks(size_t start, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      DeallocateBlock(start + i);
+    }
+  }
 };
 }  // namespace minfs
 
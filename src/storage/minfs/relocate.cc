@@ -0,0 +1,183 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/relocate.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <storage/buffer/array_buffer.h>
+
+#include "src/lib/storage/vfs/cpp/transaction/buffered_operations_builder.h"
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/transaction_limits.h"
+#include "src/storage/minfs/vnode_mapper.h"
+
+namespace minfs {
+namespace {
+
+// Blocks are moved, and so buffered, at most this many at a time.
+constexpr uint64_t kMaxRelocateBlocks = 2048;
+
+zx::status<> RelocateBatch(Minfs& fs, VnodeMinfs& vnode, uint64_t file_block, blk_t block,
+                           uint64_t count, blk_t* destination) {
+  // Blocks allocated for earlier batches, such as indirect blocks, may have landed in the run.
+  if (*destination && !fs.GetBlockAllocator().IsFreeRun(*destination, count)) {
+    return zx::error(ZX_ERR_NO_SPACE);
+  }
+  auto reserve_or =
+      GetRequiredBlockCount(fs.Info(), file_block * fs.BlockSize(), count * fs.BlockSize());
+  if (reserve_or.is_error()) {
+    return reserve_or.take_error();
+  }
+  auto transaction_or = fs.BeginTransaction(0, reserve_or.value());
+  if (transaction_or.is_error()) {
+    return transaction_or.take_error();
+  }
+  std::unique_ptr<Transaction> transaction = std::move(transaction_or.value());
+
+  std::vector<blk_t> new_blocks(count);
+  for (uint64_t i = 0; i < count; ++i) {
+    new_blocks[i] = static_cast<blk_t>(
+        *destination ? transaction->block_reservation().Allocate(*destination)
+                     : transaction->AllocateBlock());
+    fs.ValidateBno(new_blocks[i]);
+    if (*destination) {
+      ZX_ASSERT(new_blocks[i] == *destination);
+      *destination = new_blocks[i] + 1;
+    }
+    if (fs.checksums()) {
+      fs.checksums()->Clear(new_blocks[i] + fs.Info().dat_block);
+    }
+  }
+
+  // Read the whole range at once, and write it back in as few pieces as the new blocks allow.
+  storage::ArrayBuffer buffer(count, static_cast<uint32_t>(fs.BlockSize()));
+  const blk_t dat_block = fs.Info().dat_block;
+  {
+    fs::BufferedOperationsBuilder builder;
+    builder.Add(storage::Operation{.type = storage::OperationType::kRead,
+                                   .vmo_offset = 0,
+                                   .dev_offset = block + dat_block,
+                                   .length = count},
+                &buffer);
+    if (zx_status_t status = fs.bc_->RunRequests(builder.TakeOperations()); status != ZX_OK) {
+      return zx::error(status);
+    }
+  }
+  {
+    fs::BufferedOperationsBuilder builder;
+    for (uint64_t start = 0; start < count;) {
+      uint64_t end = start + 1;
+      while (end < count && new_blocks[end] == new_blocks[end - 1] + 1) {
+        ++end;
+      }
+      builder.Add(storage::Operation{.type = storage::OperationType::kWrite,
+                                     .vmo_offset = start,
+                                     .dev_offset = new_blocks[start] + dat_block,
+                                     .length = end - start},
+                  &buffer);
+      start = end;
+    }
+    if (zx_status_t status = fs.bc_->RunRequests(builder.TakeOperations()); status != ZX_OK) {
+      return zx::error(status);
+    }
+  }
+  // Directory blocks keep their checksums as they move. The table is written with the transaction.
+  if (fs.checksums() && vnode.IsDirectory()) {
+    for (uint64_t i = 0; i < count; ++i) {
+      fs.checksums()->Update(new_blocks[i] + dat_block, 1, buffer.Data(i));
+    }
+  }
+
+  VnodeMapper mapper(&vnode);
+  VnodeIterator iterator;
+  if (auto status = iterator.Init(&mapper, transaction.get(), file_block); status.is_error()) {
+    return status;
+  }
+  for (uint64_t i = 0; i < count; ++i) {
+    ZX_DEBUG_ASSERT(iterator.Blk() == block + i);
+    if (auto status = iterator.SetBlk(new_blocks[i]); status.is_error()) {
+      return status;
+    }
+    if (auto status = iterator.Advance(); status.is_error()) {
+      return status;
+    }
+  }
+  if (auto status = iterator.Flush(); status.is_error()) {
+    return status;
+  }
+  transaction->DeallocateBlocks(block, count);
+  vnode.InodeSync(transaction.get(), kMxFsSyncDefault);
+  fs.CommitTransaction(std::move(transaction));
+  return zx::ok();
+}
+
+}  // namespace
+
+zx::status<std::vector<BlockRun>> ListBlockRuns(Minfs& fs) {
+  std::vector<BlockRun> runs;
+  for (ino_t ino = kMinfsRootIno; ino < fs.Info().inode_count; ++ino) {
+    if (!fs.GetInodeAllocator().CheckAllocated(ino)) {
+      continue;
+    }
+    Inode inode;
+    fs.InodeLoad(ino, &inode);
+    if (inode.magic != kMinfsMagicFile && inode.magic != kMinfsMagicDir) {
+      continue;
+    }
+    auto vnode_or = fs.VnodeGet(ino);
+    if (vnode_or.is_error()) {
+      return vnode_or.take_error();
+    }
+    VnodeMinfs& vnode = *vnode_or.value();
+    if (vnode.IsInline()) {
+      continue;
+    }
+    VnodeMapper mapper(&vnode);
+    VnodeIterator iterator;
+    if (auto status = iterator.Init(&mapper, nullptr, 0); status.is_error()) {
+      return status.take_error();
+    }
+    uint64_t remaining = (vnode.GetSize() + fs.BlockSize() - 1) / fs.BlockSize();
+    while (remaining > 0) {
+      const uint64_t count = iterator.GetContiguousBlockCount(remaining);
+      if (iterator.Blk() != 0) {
+        // GetContiguousBlockCount may stop short of the end of a run.
+        BlockRun* last = runs.empty() ? nullptr : &runs.back();
+        if (last && last->ino == ino && last->file_block + last->count == iterator.file_block() &&
+            last->block + last->count == iterator.Blk()) {
+          last->count += count;
+        } else {
+          runs.push_back(BlockRun{.ino = ino,
+                                  .file_block = iterator.file_block(),
+                                  .block = iterator.Blk(),
+                                  .count = count});
+        }
+      }
+      if (auto status = iterator.Advance(count); status.is_error()) {
+        return status.take_error();
+      }
+      remaining -= count;
+    }
+  }
+  return zx::ok(std::move(runs));
+}
+
+zx::status<> RelocateBlocks(Minfs& fs, VnodeMinfs& vnode, uint64_t file_block, blk_t block,
+                            uint64_t count, blk_t destination) {
+  for (uint64_t done = 0; done < count;) {
+    const uint64_t batch = std::min(count - done, kMaxRelocateBlocks);
+    if (auto status = RelocateBatch(fs, vnode, file_block + done,
+                                    block + static_cast<blk_t>(done), batch, &destination);
+        status.is_error()) {
+      return status;
+    }
+    done += batch;
+  }
+  return zx::ok();
+}
+
+}  // namespace minfs
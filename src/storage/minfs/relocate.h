@@ -0,0 +1,51 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_STORAGE_MINFS_RELOCATE_H_
+#define SRC_STORAGE_MINFS_RELOCATE_H_
+
+#ifdef __Fuchsia__
+#error Host-only Header
+#endif
+
+#include <lib/zx/status.h>
+
+#include <vector>
+
+#include "src/storage/minfs/format.h"
+
+namespace minfs {
+
+class Minfs;
+class VnodeMinfs;
+
+// A run of blocks of one vnode which are also contiguous on disk.
+struct BlockRun {
+  ino_t ino = 0;
+  uint64_t file_block = 0;
+  blk_t block = 0;
+  uint64_t count = 0;
+};
+
+// Returns the runs of data blocks of every file and directory in |fs|, in inode order and then file
+// block order. Adjacent runs are merged, so each run is as long as it can be. Indirect blocks and
+// extent tree nodes are not included.
+zx::status<std::vector<BlockRun>> ListBlockRuns(Minfs& fs);
+
+// Moves the |count| blocks of |vnode| from |file_block|, which must be mapped to the blocks from
+// |block| onward, to newly allocated blocks. A non-zero |destination| is the first of a free run
+// which receives the whole range, moved in batches. If a batch finds part of its share of the run
+// taken, for instance by an indirect block allocated for an earlier batch, ZX_ERR_NO_SPACE is
+// returned and the earlier batches stay moved. Passing 0 for |destination| allocates first fit.
+//
+// The data is copied with one read and a write per contiguous run of new blocks before the block
+// pointers are rewritten through VnodeIterator::SetBlk, and the old blocks freed, in one
+// transaction. This is only safe on the host, where writes go straight to the device, and with
+// nothing else using |fs|.
+zx::status<> RelocateBlocks(Minfs& fs, VnodeMinfs& vnode, uint64_t file_block, blk_t block,
+                            uint64_t count, blk_t destination);
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_RELOCATE_H_
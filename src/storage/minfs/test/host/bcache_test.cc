@@ -79,4 +79,23 @@ TEST_F(BcacheTest, RunOperation) {
   EXPECT_BYTES_EQ(buffer.Data(2), buffer.Data(0), buffer.BlockSize() * 2);
 }
 
+TEST_F(BcacheTest, IoStatsCountCallsAndBytes) {
+  DataBuffer buffer(2);
+  storage::Operation operation = {};
+  operation.type = storage::OperationType::kWrite;
+  operation.length = 2;
+  ASSERT_OK(bcache_->RunOperation(operation, &buffer));
+  ASSERT_OK(bcache_->Readblk(0, buffer.Data(0)));
+
+  const minfs::Bcache::IoStats& stats = bcache_->GetIoStats();
+  EXPECT_EQ(stats.write_calls, 1);
+  EXPECT_EQ(stats.bytes_written, 2 * kMinfsBlockSize);
+  EXPECT_EQ(stats.read_calls, 1);
+  EXPECT_EQ(stats.bytes_read, kMinfsBlockSize);
+  EXPECT_EQ(stats.other_calls, 0);
+
+  ASSERT_OK(bcache_->Discard(0, 1));
+  EXPECT_EQ(stats.other_calls, 1);
+}
+
 }  // namespace
@@ -0,0 +1,194 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/defrag.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <fbl/unique_fd.h>
+#include <zxtest/zxtest.h>
+
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/fsck.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/relocate.h"
+#include "src/storage/minfs/runner.h"
+
+namespace minfs {
+namespace {
+
+constexpr uint32_t kBlockCount = 1 << 12;
+constexpr uint64_t kFileBlocks = 12;
+
+std::vector<uint8_t> Contents(uint8_t seed) {
+  std::vector<uint8_t> data(kFileBlocks * kMinfsBlockSize);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<uint8_t>(i * 13 + seed);
+  }
+  return data;
+}
+
+class DefragTest : public zxtest::Test {
+ public:
+  void SetUp() final {
+    char path[] = "/tmp/minfs_defrag_test.XXXXXX";
+    fbl::unique_fd fd(mkstemp(path));
+    ASSERT_TRUE(fd);
+    path_ = path;
+    ASSERT_EQ(ftruncate(fd.get(), off_t{kBlockCount} * kMinfsBlockSize), 0);
+    auto bcache_or = Bcache::Create(std::move(fd), kBlockCount);
+    ASSERT_OK(bcache_or.status_value());
+    ASSERT_OK(Mkfs(MountOptions(), bcache_or.value().get()).status_value());
+    auto runner_or = Runner::Create(nullptr, std::move(bcache_or.value()), MountOptions());
+    ASSERT_OK(runner_or.status_value());
+    runner_ = std::move(runner_or.value());
+  }
+
+  void TearDown() final {
+    if (runner_) {
+      Runner::Destroy(std::move(runner_));
+    }
+    unlink(path_.c_str());
+  }
+
+  fbl::RefPtr<fs::Vnode> Root() {
+    auto root_or = runner_->minfs().VnodeGet(kMinfsRootIno);
+    EXPECT_TRUE(root_or.is_ok());
+    return root_or.value();
+  }
+
+ protected:
+  std::string path_;
+  std::unique_ptr<Runner> runner_;
+};
+
+TEST_F(DefragTest, MovesInterleavedFilesIntoSingleExtents) {
+  const std::vector<uint8_t> contents[2] = {Contents(1), Contents(2)};
+  fbl::RefPtr<fs::Vnode> files[2];
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_OK(Root()->Create(i == 0 ? "a" : "b", 0, &files[i]));
+  }
+  // Write the files a block at a time, turn about, so that their blocks alternate.
+  for (uint64_t block = 0; block < kFileBlocks; ++block) {
+    for (int i = 0; i < 2; ++i) {
+      size_t actual;
+      ASSERT_OK(files[i]->Write(contents[i].data() + block * kMinfsBlockSize, kMinfsBlockSize,
+                                block * kMinfsBlockSize, &actual));
+      ASSERT_EQ(actual, kMinfsBlockSize);
+    }
+  }
+
+  auto report_or = GetFragmentationReport(runner_->minfs());
+  ASSERT_OK(report_or.status_value());
+  EXPECT_EQ(report_or->fragmented_files, 2u);
+  ASSERT_GE(report_or->files.size(), 2u);
+  EXPECT_EQ(report_or->files[0].extents, kFileBlocks);
+  EXPECT_EQ(report_or->files[0].blocks, kFileBlocks);
+
+  auto stats_or = Defragment(runner_->minfs());
+  ASSERT_OK(stats_or.status_value());
+  EXPECT_EQ(stats_or->files_moved, 2u);
+  EXPECT_EQ(stats_or->blocks_moved, 2 * kFileBlocks);
+  EXPECT_EQ(stats_or->files_skipped, 0u);
+  EXPECT_EQ(stats_or->files_left_fragmented, 0u);
+
+  report_or = GetFragmentationReport(runner_->minfs());
+  ASSERT_OK(report_or.status_value());
+  EXPECT_EQ(report_or->fragmented_files, 0u);
+  EXPECT_EQ(report_or->extents, report_or->files.size());
+
+  for (int i = 0; i < 2; ++i) {
+    std::vector<uint8_t> data(contents[i].size());
+    size_t actual;
+    ASSERT_OK(files[i]->Read(data.data(), data.size(), 0, &actual));
+    EXPECT_EQ(actual, data.size());
+    EXPECT_EQ(data, contents[i]);
+    files[i]->Close();
+  }
+  files[0].reset();
+  files[1].reset();
+
+  auto bcache = Runner::Destroy(std::move(runner_));
+  EXPECT_TRUE(Fsck(std::move(bcache), FsckOptions()).is_ok());
+}
+
+TEST_F(DefragTest, SkipsFilesWithoutRoomToMove) {
+  // Fill the volume with two interleaved files and delete one, leaving the other fragmented with
+  // no free run large enough for it.
+  fbl::RefPtr<fs::Vnode> files[2];
+  ASSERT_OK(Root()->Create("a", 0, &files[0]));
+  ASSERT_OK(Root()->Create("b", 0, &files[1]));
+  const std::vector<uint8_t> block(kMinfsBlockSize, 0xab);
+  for (uint64_t n = 0;; ++n) {
+    size_t actual = 0;
+    if (files[n % 2]->Write(block.data(), block.size(), (n / 2) * kMinfsBlockSize, &actual) !=
+            ZX_OK ||
+        actual == 0) {
+      break;
+    }
+  }
+  files[0]->Close();
+  files[1]->Close();
+  files[0].reset();
+  files[1].reset();
+  ASSERT_OK(Root()->Unlink("b", false));
+
+  auto report_or = GetFragmentationReport(runner_->minfs());
+  ASSERT_OK(report_or.status_value());
+  EXPECT_EQ(report_or->fragmented_files, 1u);
+  ASSERT_GE(report_or->files.size(), 1u);
+  EXPECT_LT(report_or->largest_free_extent, report_or->files[0].blocks);
+
+  auto stats_or = Defragment(runner_->minfs());
+  ASSERT_OK(stats_or.status_value());
+  EXPECT_EQ(stats_or->files_moved, 0u);
+  EXPECT_EQ(stats_or->files_skipped, 1u);
+}
+
+TEST_F(DefragTest, RelocateRefusesADestinationWhichIsNoLongerFree) {
+  const std::vector<uint8_t> contents = Contents(3);
+  fbl::RefPtr<fs::Vnode> file;
+  ASSERT_OK(Root()->Create("a", 0, &file));
+  size_t actual;
+  ASSERT_OK(file->Write(contents.data(), contents.size(), 0, &actual));
+  ASSERT_EQ(actual, contents.size());
+
+  Minfs& fs = runner_->minfs();
+  auto runs_or = ListBlockRuns(fs);
+  ASSERT_OK(runs_or.status_value());
+  ASSERT_FALSE(runs_or->empty());
+  const BlockRun run = runs_or->back();
+  auto destination_or = fs.GetBlockAllocator().FindFreeRun(run.count);
+  ASSERT_OK(destination_or.status_value());
+  const blk_t destination = static_cast<blk_t>(destination_or.value());
+
+  // Take a block in the middle of the planned run, as an indirect block allocated while moving
+  // another part of the file might.
+  auto transaction_or = fs.BeginTransaction(0, 1);
+  ASSERT_OK(transaction_or.status_value());
+  ASSERT_EQ(transaction_or->block_reservation().Allocate(destination + run.count / 2),
+            destination + run.count / 2);
+  fs.CommitTransaction(std::move(transaction_or.value()));
+
+  auto vnode_or = fs.VnodeGet(run.ino);
+  ASSERT_OK(vnode_or.status_value());
+  EXPECT_STATUS(RelocateBlocks(fs, *vnode_or.value(), run.file_block, run.block, run.count,
+                               destination)
+                    .status_value(),
+                ZX_ERR_NO_SPACE);
+
+  std::vector<uint8_t> data(contents.size());
+  ASSERT_OK(file->Read(data.data(), data.size(), 0, &actual));
+  EXPECT_EQ(actual, data.size());
+  EXPECT_EQ(data, contents);
+  file->Close();
+}
+
+}  // namespace
+}  // namespace minfs
@@ -0,0 +1,111 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/host_trace.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <fbl/unique_fd.h>
+#include <zxtest/zxtest.h>
+
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/runner.h"
+#include "src/storage/minfs/trace.h"
+
+namespace minfs {
+namespace {
+
+size_t Count(const std::string& haystack, std::string_view needle) {
+  size_t count = 0;
+  for (size_t i = haystack.find(needle); i != std::string::npos;
+       i = haystack.find(needle, i + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+class HostTraceTest : public zxtest::Test {
+ public:
+  void SetUp() final { ClearHostTrace(); }
+  void TearDown() final {
+    StopHostTrace();
+    ClearHostTrace();
+  }
+};
+
+TEST_F(HostTraceTest, RecordsSpansWithArguments) {
+  StartHostTrace();
+  {
+    TRACE_DURATION("minfs", "Outer", "ino", 7u, "delta", -3, "name", std::string_view("a\"b"));
+    TRACE_DURATION("minfs", "Inner");
+  }
+  StopHostTrace();
+  { TRACE_DURATION("minfs", "Untraced"); }
+
+  const std::string json = HostTraceToJson();
+  EXPECT_EQ(Count(json, "\"ph\": \"X\""), 2u);
+  EXPECT_EQ(Count(json, "\"name\": \"Inner\""), 1u);
+  EXPECT_EQ(Count(json, "\"args\": {\"ino\": 7, \"delta\": -3, \"name\": \"a\\\"b\"}"), 1u);
+  EXPECT_EQ(Count(json, "Untraced"), 0u);
+  EXPECT_EQ(Count(json, "\"dropped_events\": 0"), 1u);
+}
+
+TEST_F(HostTraceTest, RingBufferKeepsTheLatestSpans) {
+  StartHostTrace(4);
+  // The size of a thread's buffer is fixed by its first span, so record on a new thread.
+  std::thread thread([] {
+    for (uint64_t i = 0; i < 10; ++i) {
+      TRACE_DURATION("minfs", "Span", "i", i);
+    }
+  });
+  thread.join();
+  StopHostTrace();
+
+  const std::string json = HostTraceToJson();
+  EXPECT_EQ(Count(json, "\"name\": \"Span\""), 4u);
+  EXPECT_EQ(Count(json, "\"i\": 5}"), 0u);
+  EXPECT_EQ(Count(json, "\"i\": 6}"), 1u);
+  EXPECT_EQ(Count(json, "\"i\": 9}"), 1u);
+  EXPECT_EQ(Count(json, "\"dropped_events\": 6"), 1u);
+}
+
+TEST_F(HostTraceTest, FilesystemOperationsAreTraced) {
+  char path[] = "/tmp/minfs_host_trace_test.XXXXXX";
+  fbl::unique_fd fd(mkstemp(path));
+  ASSERT_TRUE(fd);
+  unlink(path);
+  constexpr uint32_t kBlockCount = 1 << 14;
+  ASSERT_EQ(ftruncate(fd.get(), off_t{kBlockCount} * kMinfsBlockSize), 0);
+  auto bcache_or = Bcache::Create(std::move(fd), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+  ASSERT_TRUE(Mkfs(bcache_or.value().get()).is_ok());
+  auto runner_or = Runner::Create(nullptr, std::move(bcache_or.value()), MountOptions());
+  ASSERT_TRUE(runner_or.is_ok());
+
+  StartHostTrace();
+  {
+    auto root_or = runner_or->minfs().VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+    fbl::RefPtr<fs::Vnode> file;
+    ASSERT_OK(root_or.value()->Create("file", 0, &file));
+    ASSERT_OK(file->Close());
+  }
+  StopHostTrace();
+  Runner::Destroy(std::move(runner_or.value()));
+
+  const std::string json = HostTraceToJson();
+  EXPECT_EQ(Count(json, "\"name\": \"Directory::Create\""), 1u);
+  EXPECT_EQ(Count(json, "\"args\": {\"name\": \"file\"}"), 1u);
+  EXPECT_GT(Count(json, "\"name\": \"CommitTransaction\""), 0u);
+}
+
+}  // namespace
+}  // namespace minfs
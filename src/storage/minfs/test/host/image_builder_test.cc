@@ -0,0 +1,255 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/image_builder.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fbl/unique_fd.h>
+#include <zxtest/zxtest.h>
+
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/compact.h"
+#include "src/storage/minfs/fsck.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/runner.h"
+
+namespace minfs {
+namespace {
+
+std::vector<uint8_t> Contents(size_t size, uint8_t seed) {
+  std::vector<uint8_t> data(size);
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = static_cast<uint8_t>(i * 31 + seed);
+  }
+  return data;
+}
+
+class ImageBuilderTest : public zxtest::Test {
+ public:
+  void SetUp() final {
+    char dir[] = "/tmp/minfs_image_builder_test.XXXXXX";
+    ASSERT_NOT_NULL(mkdtemp(dir));
+    root_ = dir;
+  }
+
+  void TearDown() final {
+    std::string command = "rm -rf " + root_;
+    system(command.c_str());
+  }
+
+  void WriteHostFile(const std::string& path, const std::vector<uint8_t>& data) {
+    std::ofstream file(root_ + "/" + path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()),
+               static_cast<std::streamsize>(data.size()));
+    ASSERT_TRUE(file.good());
+  }
+
+  // Checks the image at |image| and returns it mounted.
+  std::unique_ptr<Runner> Mount(const std::string& image) {
+    fbl::unique_fd fd(open(image.c_str(), O_RDWR));
+    EXPECT_TRUE(fd);
+    struct stat s;
+    EXPECT_EQ(fstat(fd.get(), &s), 0);
+    auto bcache_or =
+        Bcache::Create(std::move(fd), static_cast<uint32_t>(s.st_size / kMinfsBlockSize));
+    EXPECT_TRUE(bcache_or.is_ok());
+    auto fsck_or = Fsck(std::move(bcache_or.value()), FsckOptions());
+    EXPECT_TRUE(fsck_or.is_ok());
+    auto runner_or = Runner::Create(nullptr, std::move(fsck_or.value()), MountOptions());
+    EXPECT_TRUE(runner_or.is_ok());
+    return std::move(runner_or.value());
+  }
+
+  static std::vector<uint8_t> ReadImageFile(Runner& runner, const std::string& path) {
+    auto root_or = runner.minfs().VnodeGet(kMinfsRootIno);
+    EXPECT_TRUE(root_or.is_ok());
+    fbl::RefPtr<fs::Vnode> vnode = root_or.value();
+    for (size_t start = 0; start < path.size();) {
+      size_t slash = path.find('/', start);
+      if (slash == std::string::npos) {
+        slash = path.size();
+      }
+      fbl::RefPtr<fs::Vnode> child;
+      EXPECT_OK(vnode->Lookup(path.substr(start, slash - start), &child));
+      if (!child) {
+        return {};
+      }
+      vnode = std::move(child);
+      start = slash + 1;
+    }
+    fs::VnodeAttributes attributes;
+    EXPECT_OK(vnode->GetAttributes(&attributes));
+    std::vector<uint8_t> data(attributes.content_size);
+    size_t actual = 0;
+    EXPECT_OK(vnode->Read(data.data(), data.size(), 0, &actual));
+    EXPECT_EQ(actual, data.size());
+    return data;
+  }
+
+ protected:
+  std::string root_;
+};
+
+TEST_F(ImageBuilderTest, BuildsImageFromManifestAndTree) {
+  const std::vector<uint8_t> empty;
+  const std::vector<uint8_t> small = Contents(100, 1);
+  const std::vector<uint8_t> medium = Contents(3 * kMinfsBlockSize + 17, 2);
+  // Larger than a chunk, and needing indirect blocks.
+  const std::vector<uint8_t> large = Contents((9 << 20) + 5, 3);
+  ASSERT_NO_FAILURES(WriteHostFile("empty", empty));
+  ASSERT_NO_FAILURES(WriteHostFile("small", small));
+  ASSERT_NO_FAILURES(WriteHostFile("medium", medium));
+  ASSERT_EQ(mkdir((root_ + "/tree").c_str(), 0755), 0);
+  ASSERT_EQ(mkdir((root_ + "/tree/sub").c_str(), 0755), 0);
+  ASSERT_NO_FAILURES(WriteHostFile("tree/sub/large", large));
+  {
+    std::ofstream manifest(root_ + "/manifest");
+    manifest << "# A comment\n"
+             << "\n"
+             << "data/empty=empty\n"
+             << "data/a/b/small=" << root_ << "/small\n"
+             << "/medium=medium\n";
+  }
+
+  ImageBuilder::Options options;
+  options.reader_threads = 3;
+  options.max_buffered_bytes = 1 << 20;
+  ImageBuilder builder(options);
+  ASSERT_OK(builder.AddManifest(root_ + "/manifest").status_value());
+  ASSERT_OK(builder.AddTree(root_ + "/tree", "copy").status_value());
+  ASSERT_OK(builder.AddDirectory("empty_dir").status_value());
+  EXPECT_STATUS(builder.AddFile("medium", root_ + "/small").status_value(),
+                ZX_ERR_ALREADY_EXISTS);
+  EXPECT_STATUS(builder.AddFile("medium/x", root_ + "/small").status_value(), ZX_ERR_NOT_DIR);
+  EXPECT_STATUS(builder.AddFile("../x", root_ + "/small").status_value(), ZX_ERR_INVALID_ARGS);
+
+  auto plan_or = builder.GetPlan();
+  ASSERT_OK(plan_or.status_value());
+  EXPECT_EQ(plan_or->file_count, 4u);
+  EXPECT_EQ(plan_or->directory_count, 6u);
+  EXPECT_EQ(plan_or->file_bytes, small.size() + medium.size() + large.size());
+
+  const std::string image = root_ + "/image";
+  ASSERT_OK(builder.Build(image).status_value());
+  struct stat s;
+  ASSERT_EQ(stat(image.c_str(), &s), 0);
+  EXPECT_EQ(static_cast<uint64_t>(s.st_size),
+            static_cast<uint64_t>(plan_or->device_blocks) * kMinfsBlockSize);
+
+  std::unique_ptr<Runner> runner = Mount(image);
+  ASSERT_TRUE(runner);
+  EXPECT_EQ(runner->minfs().Info().inode_count, plan_or->inode_count);
+  EXPECT_EQ(ReadImageFile(*runner, "data/empty"), empty);
+  EXPECT_EQ(ReadImageFile(*runner, "data/a/b/small"), small);
+  EXPECT_EQ(ReadImageFile(*runner, "medium"), medium);
+  EXPECT_EQ(ReadImageFile(*runner, "copy/sub/large"), large);
+  Runner::Destroy(std::move(runner));
+}
+
+TEST_F(ImageBuilderTest, SizesInodeTableForManyFiles) {
+  ASSERT_NO_FAILURES(WriteHostFile("file", Contents(10, 4)));
+  ImageBuilder::Options options;
+  options.reserve_inodes = 10;
+  ImageBuilder builder(options);
+  constexpr uint32_t kFileCount = kMinfsDefaultInodeCount + 100;
+  for (uint32_t i = 0; i < kFileCount; ++i) {
+    ASSERT_OK(builder.AddFile("dir" + std::to_string(i % 8) + "/" + std::to_string(i),
+                              root_ + "/file")
+                  .status_value());
+  }
+  auto plan_or = builder.GetPlan();
+  ASSERT_OK(plan_or.status_value());
+  EXPECT_GE(plan_or->inode_count, kFileCount + 8u + 2u + 10u);
+
+  const std::string image = root_ + "/image";
+  ASSERT_OK(builder.Build(image).status_value());
+  std::unique_ptr<Runner> runner = Mount(image);
+  ASSERT_TRUE(runner);
+  constexpr uint32_t kLastFile = kFileCount - 1;
+  EXPECT_EQ(ReadImageFile(*runner, "dir" + std::to_string(kLastFile % 8) + "/" +
+                                       std::to_string(kLastFile)),
+            Contents(10, 4));
+  Runner::Destroy(std::move(runner));
+}
+
+TEST_F(ImageBuilderTest, SparseImageOnlyAllocatesData) {
+  const std::vector<uint8_t> data = Contents(4 << 20, 5);
+  ASSERT_NO_FAILURES(WriteHostFile("file", data));
+  ImageBuilder::Options options;
+  options.sparse = true;
+  options.reserve_data_blocks = 1 << 14;
+  ImageBuilder builder(options);
+  ASSERT_OK(builder.AddFile("file", root_ + "/file").status_value());
+
+  const std::string image = root_ + "/image";
+  auto allocated_or = builder.Build(image);
+  ASSERT_OK(allocated_or.status_value());
+  struct stat s;
+  ASSERT_EQ(stat(image.c_str(), &s), 0);
+  // The empty inode table, journal and reserved blocks are all holes.
+  EXPECT_GE(allocated_or.value(), data.size());
+  EXPECT_LT(allocated_or.value(), static_cast<uint64_t>(s.st_size) / 2);
+
+  std::unique_ptr<Runner> runner = Mount(image);
+  ASSERT_TRUE(runner);
+  EXPECT_EQ(ReadImageFile(*runner, "file"), data);
+  Runner::Destroy(std::move(runner));
+}
+
+TEST_F(ImageBuilderTest, CompactMovesDataIntoFreedBlocks) {
+  // Small enough to need no indirect blocks, which are not moved.
+  const std::vector<uint8_t> data = Contents(kMinfsDirect * kMinfsBlockSize, 6);
+  ASSERT_NO_FAILURES(WriteHostFile("file", data));
+  ImageBuilder::Options options;
+  options.sparse = true;
+  ImageBuilder builder(options);
+  for (const char* name : {"a", "b", "c"}) {
+    ASSERT_OK(builder.AddFile(name, root_ + "/file").status_value());
+  }
+  const std::string image = root_ + "/image";
+  ASSERT_OK(builder.Build(image).status_value());
+
+  // Free the blocks of the first two files, below those of the last.
+  {
+    std::unique_ptr<Runner> runner = Mount(image);
+    ASSERT_TRUE(runner);
+    auto root_or = runner->minfs().VnodeGet(kMinfsRootIno);
+    ASSERT_OK(root_or.status_value());
+    EXPECT_OK(root_or->Unlink("a", false));
+    EXPECT_OK(root_or->Unlink("b", false));
+    root_or.value().reset();
+    Runner::Destroy(std::move(runner));
+  }
+
+  struct stat s;
+  ASSERT_EQ(stat(image.c_str(), &s), 0);
+  const uint64_t allocated_before = static_cast<uint64_t>(s.st_blocks) * 512;
+
+  auto stats_or = CompactImage(image);
+  ASSERT_OK(stats_or.status_value());
+  const uint64_t file_blocks = data.size() / kMinfsBlockSize;
+  EXPECT_EQ(stats_or->blocks_moved, file_blocks);
+  EXPECT_EQ(stats_or->high_water_before - stats_or->high_water_after, 2 * file_blocks);
+
+  // The blocks the deleted files and the old copy of the last one took up are punched out.
+  ASSERT_EQ(stat(image.c_str(), &s), 0);
+  EXPECT_LE(static_cast<uint64_t>(s.st_blocks) * 512, allocated_before - 2 * data.size());
+
+  std::unique_ptr<Runner> runner = Mount(image);
+  ASSERT_TRUE(runner);
+  EXPECT_EQ(DataHighWaterMark(runner->minfs()), stats_or->high_water_after);
+  EXPECT_EQ(ReadImageFile(*runner, "c"), data);
+  Runner::Destroy(std::move(runner));
+}
+
+}  // namespace
+}  // namespace minfs
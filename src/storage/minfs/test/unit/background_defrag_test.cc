@@ -0,0 +1,130 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <lib/async-loop/cpp/loop.h>
+#include <lib/async-loop/default.h>
+#include <lib/sync/completion.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "src/lib/storage/block_client/cpp/fake_block_device.h"
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/file.h"
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/fsck.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/runner.h"
+#include "src/storage/minfs/vnode_mapper.h"
+
+namespace minfs {
+namespace {
+
+using block_client::FakeBlockDevice;
+
+constexpr uint64_t kBlockCount = 1 << 17;
+constexpr uint64_t kFileBlocks = 8;
+constexpr const char* kNames[] = {"a", "b"};
+
+std::vector<uint8_t> BlockData(size_t file, uint64_t block) {
+  return std::vector<uint8_t>(kMinfsBlockSize, static_cast<uint8_t>(file * kFileBlocks + block));
+}
+
+// Returns the number of blocks from the start of |vnode| which are contiguous on disk.
+uint64_t ContiguousBlocks(VnodeMinfs* vnode) {
+  VnodeMapper mapper(vnode);
+  VnodeIterator iterator;
+  EXPECT_TRUE(iterator.Init(&mapper, nullptr, 0).is_ok());
+  return iterator.GetContiguousBlockCount(kFileBlocks);
+}
+
+TEST(BackgroundDefragTest, FragmentedFilesAreMovedIntoSingleExtents) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+
+  auto device = std::make_unique<FakeBlockDevice>(kBlockCount, kMinfsBlockSize);
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+  ASSERT_TRUE(Mkfs(bcache_or.value().get()).is_ok());
+
+  // Write two files a block at a time, flushing after each block so that their blocks interleave.
+  auto fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), MountOptions());
+  ASSERT_TRUE(fs_or.is_ok());
+  {
+    auto root_or = fs_or->minfs().VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+    fbl::RefPtr<fs::Vnode> files[2];
+    for (size_t i = 0; i < 2; ++i) {
+      ASSERT_EQ(root_or->Create(kNames[i], 0, &files[i]), ZX_OK);
+    }
+    for (uint64_t block = 0; block < kFileBlocks; ++block) {
+      for (size_t i = 0; i < 2; ++i) {
+        std::vector<uint8_t> data = BlockData(i, block);
+        size_t written;
+        ASSERT_EQ(files[i]->Write(data.data(), data.size(), block * kMinfsBlockSize, &written),
+                  ZX_OK);
+        ASSERT_EQ(written, data.size());
+        sync_completion_t completion;
+        fs_or->minfs().Sync(
+            [&completion](zx_status_t status) { sync_completion_signal(&completion); });
+        ASSERT_EQ(sync_completion_wait(&completion, zx::duration::infinite().get()), ZX_OK);
+      }
+    }
+    for (size_t i = 0; i < 2; ++i) {
+      EXPECT_EQ(ContiguousBlocks(fbl::RefPtr<File>::Downcast(files[i]).get()), 1u);
+      ASSERT_EQ(files[i]->Close(), ZX_OK);
+    }
+  }
+  auto bcache = Runner::Destroy(std::move(fs_or.value()));
+
+  // Reading the files back notes that they are fragmented, and the background task moves them.
+  MountOptions options = {};
+  options.defragment_in_background = true;
+  options.defrag_bytes_per_second = 0;
+  options.defrag_time_percent = 100;
+  fs_or = Runner::Create(loop.dispatcher(), std::move(bcache), options);
+  ASSERT_TRUE(fs_or.is_ok());
+  {
+    auto root_or = fs_or->minfs().VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+    fbl::RefPtr<fs::Vnode> files[2];
+    std::vector<uint8_t> read_back(kMinfsBlockSize);
+    for (size_t i = 0; i < 2; ++i) {
+      ASSERT_EQ(root_or->Lookup(kNames[i], &files[i]), ZX_OK);
+      size_t actual;
+      ASSERT_EQ(files[i]->Read(read_back.data(), read_back.size(), 0, &actual), ZX_OK);
+    }
+
+    loop.RunUntilIdle();
+    for (size_t i = 0; i < 2; ++i) {
+      EXPECT_EQ(ContiguousBlocks(fbl::RefPtr<File>::Downcast(files[i]).get()), kFileBlocks);
+    }
+  }
+  auto fsck_or = Fsck(Runner::Destroy(std::move(fs_or.value())), FsckOptions());
+  ASSERT_TRUE(fsck_or.is_ok());
+
+  // The moved blocks hold the data written to the old ones.
+  fs_or = Runner::Create(loop.dispatcher(), std::move(fsck_or.value()), MountOptions());
+  ASSERT_TRUE(fs_or.is_ok());
+  {
+    auto root_or = fs_or->minfs().VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+    for (size_t i = 0; i < 2; ++i) {
+      fbl::RefPtr<fs::Vnode> file;
+      ASSERT_EQ(root_or->Lookup(kNames[i], &file), ZX_OK);
+      for (uint64_t block = 0; block < kFileBlocks; ++block) {
+        std::vector<uint8_t> read_back(kMinfsBlockSize);
+        size_t actual;
+        ASSERT_EQ(file->Read(read_back.data(), read_back.size(), block * kMinfsBlockSize, &actual),
+                  ZX_OK);
+        ASSERT_EQ(actual, read_back.size());
+        EXPECT_EQ(read_back, BlockData(i, block)) << kNames[i] << " block " << block;
+      }
+    }
+  }
+  bcache = Runner::Destroy(std::move(fs_or.value()));
+}
+
+}  // namespace
+}  // namespace minfs
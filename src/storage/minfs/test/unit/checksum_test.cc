@@ -0,0 +1,288 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/checksum.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/checksum_table.h"
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/fsck.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/runner.h"
+#include "src/storage/minfs/test/unit/feature_flag_fixture.h"
+
+namespace minfs {
+namespace {
+
+TEST(Crc32cTest, KnownValue) {
+  constexpr char kData[] = "123456789";
+  EXPECT_EQ(Crc32c(0, kData, sizeof(kData) - 1), 0xe3069283u);
+  EXPECT_EQ(Crc32cSoftware(0, kData, sizeof(kData) - 1), 0xe3069283u);
+  EXPECT_EQ(Crc32c(Crc32c(0, kData, 4), kData + 4, sizeof(kData) - 5), 0xe3069283u);
+}
+
+TEST(Crc32cTest, MatchesSoftwareAtAllAlignments) {
+  std::vector<uint8_t> data(300);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<uint8_t>(i * 7 + 3);
+  }
+  for (size_t offset = 0; offset < 8; ++offset) {
+    for (size_t length = 0; offset + length <= data.size(); ++length) {
+      ASSERT_EQ(Crc32c(0, &data[offset], length), Crc32cSoftware(0, &data[offset], length))
+          << offset << ", " << length;
+    }
+  }
+}
+
+TEST(InodeChecksumTest, ChecksumExcludesItself) {
+  Inode inode = {};
+  inode.magic = kMinfsMagicFile;
+  inode.size = 1234;
+  EXPECT_FALSE(VerifyInodeChecksum(5, inode));
+  UpdateInodeChecksum(5, &inode);
+  EXPECT_TRUE(VerifyInodeChecksum(5, inode));
+  EXPECT_EQ(InodeChecksum(5, inode), inode.checksum);
+
+  inode.size++;
+  EXPECT_FALSE(VerifyInodeChecksum(5, inode));
+}
+
+TEST(InodeChecksumTest, InodeInWrongSlotFails) {
+  Inode inode = {};
+  inode.magic = kMinfsMagicFile;
+  UpdateInodeChecksum(5, &inode);
+  EXPECT_TRUE(VerifyInodeChecksum(5, inode));
+  EXPECT_FALSE(VerifyInodeChecksum(6, inode));
+}
+
+TEST(InodeChecksumTest, InodeWithoutMagicFails) {
+  // Corruption which clears an inode in use must not pass for a free inode.
+  Inode inode = {};
+  UpdateInodeChecksum(5, &inode);
+  EXPECT_FALSE(VerifyInodeChecksum(5, inode));
+}
+
+TEST(DirIndexChecksumTest, CoversInodeNumberAndContents) {
+  std::vector<uint8_t> block(kMinfsBlockSize, 0);
+  DirIndexHeader header = {.magic = kMinfsDirIndexMagic, .count = 1};
+  memcpy(block.data(), &header, sizeof(header));
+  UpdateDirIndexChecksum(5, block.data(), block.size());
+  EXPECT_TRUE(VerifyDirIndexChecksum(5, block.data(), block.size()));
+  EXPECT_FALSE(VerifyDirIndexChecksum(6, block.data(), block.size()));
+  block.back() ^= 1;
+  EXPECT_FALSE(VerifyDirIndexChecksum(5, block.data(), block.size()));
+}
+
+TEST(ChecksumTableTest, BlockChecksumCoversBlockNumberAndContents) {
+  std::vector<uint8_t> block(kMinfsBlockSize, 0);
+  const uint32_t checksum = ChecksumTable::BlockChecksum(10, block.data());
+  EXPECT_NE(checksum, 0u);
+  EXPECT_NE(ChecksumTable::BlockChecksum(11, block.data()), checksum);
+  block.back() ^= 1;
+  EXPECT_NE(ChecksumTable::BlockChecksum(10, block.data()), checksum);
+}
+
+TEST(ChecksumTableTest, BlocksNeeded) {
+  EXPECT_EQ(ChecksumTable::BlocksNeeded(0, 0, 0), 0u);
+  EXPECT_EQ(ChecksumTable::BlocksNeeded(1, 1, kMinfsChecksumsPerBlock - 2), 1u);
+  EXPECT_EQ(ChecksumTable::BlocksNeeded(1, 1, kMinfsChecksumsPerBlock - 1), 2u);
+}
+
+class ChecksumMountTest : public FeatureFlagFixture {
+ public:
+  ChecksumMountTest()
+      : FeatureFlagFixture(MountOptions{.metadata_checksums = true}, kMinfsFlagChecksums) {}
+
+  void SetUp() override {
+    ASSERT_NO_FATAL_FAILURE(FeatureFlagFixture::SetUp());
+    info_ = fs().Info();
+    ASSERT_GT(info_.csum_blocks, 0u);
+  }
+
+  // Unmounts, flips a bit of the last byte of device block |bno| without updating its checksum and
+  // returns the device.
+  std::unique_ptr<Bcache> UnmountAndCorrupt(blk_t bno) {
+    std::unique_ptr<Bcache> bcache = Unmount();
+    std::vector<uint8_t> block(kMinfsBlockSize);
+    EXPECT_TRUE(bcache->Readblk(bno, block.data()).is_ok());
+    block.back() ^= 1;
+    EXPECT_TRUE(bcache->Writeblk(bno, block.data()).is_ok());
+    return bcache;
+  }
+
+ protected:
+  Superblock info_;
+};
+
+TEST_F(ChecksumMountTest, CorruptInodeIsDetected) {
+  ino_t ino;
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_->Create("foo", 0, &child), ZX_OK);
+    fs::VnodeAttributes attributes;
+    ASSERT_EQ(child->GetAttributes(&attributes), ZX_OK);
+    ino = static_cast<ino_t>(attributes.inode);
+    ASSERT_EQ(child->Close(), ZX_OK);
+  }
+  std::unique_ptr<Bcache> bcache = UnmountAndCheck();
+  ASSERT_TRUE(bcache);
+
+  // Flip a bit in the file's inode without updating its checksum.
+  Inode inodes[kMinfsInodesPerBlock];
+  const blk_t inode_block = info_.ino_block + ino / kMinfsInodesPerBlock;
+  ASSERT_TRUE(bcache->Readblk(inode_block, &inodes).is_ok());
+  Inode& inode = inodes[ino % kMinfsInodesPerBlock];
+  ASSERT_EQ(inode.magic, kMinfsMagicFile);
+  ASSERT_TRUE(VerifyInodeChecksum(ino, inode));
+  inode.modify_time ^= 1;
+  ASSERT_TRUE(bcache->Writeblk(inode_block, &inodes).is_ok());
+
+  // Loading the inode fails, and so does fsck.
+  ASSERT_NO_FATAL_FAILURE(Mount(std::move(bcache)));
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    EXPECT_EQ(root_->Lookup("foo", &child), ZX_ERR_IO_DATA_INTEGRITY);
+    EXPECT_EQ(fs().VnodeGet(ino).status_value(), ZX_ERR_IO_DATA_INTEGRITY);
+  }
+  EXPECT_TRUE(Fsck(Unmount(), FsckOptions()).is_error());
+}
+
+TEST_F(ChecksumMountTest, CorruptUnlinkedInodeIsNotPurged) {
+  ino_t ino;
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_->Create("foo", 0, &child), ZX_OK);
+    std::vector<uint8_t> data(4 * kMinfsBlockSize, 0xab);
+    size_t actual;
+    ASSERT_EQ(child->Write(data.data(), data.size(), 0, &actual), ZX_OK);
+    fs::VnodeAttributes attributes;
+    ASSERT_EQ(child->GetAttributes(&attributes), ZX_OK);
+    ino = static_cast<ino_t>(attributes.inode);
+    ASSERT_EQ(child->Close(), ZX_OK);
+  }
+  std::unique_ptr<Bcache> bcache = Unmount();
+
+  // Put the file's inode, corrupted, on the unlinked list as if it had been unlinked while open.
+  Superblock sb;
+  ASSERT_TRUE(bcache->Readblk(kSuperblockStart, &sb).is_ok());
+  Inode inodes[kMinfsInodesPerBlock];
+  const blk_t inode_block = sb.ino_block + ino / kMinfsInodesPerBlock;
+  ASSERT_TRUE(bcache->Readblk(inode_block, &inodes).is_ok());
+  Inode& inode = inodes[ino % kMinfsInodesPerBlock];
+  ASSERT_GT(inode.block_count, 0u);
+  inode.link_count = 0;
+  UpdateInodeChecksum(ino, &inode);
+  inode.dnum[0] ^= 1;
+  ASSERT_TRUE(bcache->Writeblk(inode_block, &inodes).is_ok());
+  sb.unlinked_head = ino;
+  sb.unlinked_tail = ino;
+  UpdateChecksum(&sb);
+  ASSERT_TRUE(bcache->Writeblk(kSuperblockStart, &sb).is_ok());
+
+  // The mount purges the unlinked list, which must stop rather than free the corrupt inode's
+  // block pointers.
+  auto result = Runner::Create(loop_.dispatcher(), std::move(bcache), MountOptions());
+  ASSERT_TRUE(result.is_error());
+  EXPECT_EQ(result.status_value(), ZX_ERR_IO_DATA_INTEGRITY);
+}
+
+TEST_F(ChecksumMountTest, CorruptDirectoryBlockIsDetected) {
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_->Create("foo", 0, &child), ZX_OK);
+    ASSERT_EQ(child->Close(), ZX_OK);
+  }
+  const blk_t root_block = info_.dat_block + root_->GetInode()->dnum[0];
+
+  // The slack at the end of the block belongs to the last entry, so only the checksum notices.
+  Mount(UnmountAndCorrupt(root_block));
+  fbl::RefPtr<fs::Vnode> child;
+  EXPECT_EQ(root_->Lookup("foo", &child), ZX_ERR_IO_DATA_INTEGRITY);
+  EXPECT_TRUE(Fsck(Unmount(), FsckOptions()).is_error());
+}
+
+TEST_F(ChecksumMountTest, CorruptIndirectBlockIsDetected) {
+  std::vector<uint8_t> data((kMinfsDirect + 1) * kMinfsBlockSize, 0xab);
+  blk_t indirect_block;
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_->Create("foo", 0, &child), ZX_OK);
+    size_t actual;
+    ASSERT_EQ(child->Write(data.data(), data.size(), 0, &actual), ZX_OK);
+    ASSERT_EQ(actual, data.size());
+    ASSERT_EQ(child->Close(), ZX_OK);
+  }
+  ASSERT_NO_FATAL_FAILURE(Mount(UnmountAndCheck()));
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_->Lookup("foo", &child), ZX_OK);
+    indirect_block = fbl::RefPtr<VnodeMinfs>::Downcast(child)->GetInode()->inum[0];
+    ASSERT_NE(indirect_block, 0u);
+  }
+
+  Mount(UnmountAndCorrupt(info_.dat_block + indirect_block));
+  fbl::RefPtr<fs::Vnode> child;
+  ASSERT_EQ(root_->Lookup("foo", &child), ZX_OK);
+  auto options = child->ValidateOptions(fs::VnodeConnectionOptions());
+  ASSERT_TRUE(options.is_ok());
+  ASSERT_EQ(child->Open(options.value(), nullptr), ZX_OK);
+  size_t actual;
+  EXPECT_EQ(child->Read(data.data(), data.size(), 0, &actual), ZX_ERR_IO_DATA_INTEGRITY);
+  EXPECT_EQ(child->Close(), ZX_OK);
+  child.reset();
+  EXPECT_TRUE(Fsck(Unmount(), FsckOptions()).is_error());
+}
+
+TEST_F(ChecksumMountTest, CorruptBitmapIsDetected) {
+  // The last byte of the first block bitmap block tracks blocks which are free either way.
+  auto fs_or =
+      Runner::Create(loop_.dispatcher(), UnmountAndCorrupt(info_.abm_block), MountOptions());
+  ASSERT_TRUE(fs_or.is_error());
+  EXPECT_EQ(fs_or.status_value(), ZX_ERR_IO_DATA_INTEGRITY);
+}
+
+TEST_F(ChecksumMountTest, FreedDirectoryBlockCanHoldFileData) {
+  blk_t dir_block;
+  {
+    fbl::RefPtr<fs::Vnode> dir;
+    ASSERT_EQ(root_->Create("dir", S_IFDIR, &dir), ZX_OK);
+    dir_block = fbl::RefPtr<VnodeMinfs>::Downcast(dir)->GetInode()->dnum[0];
+    ASSERT_EQ(dir->Close(), ZX_OK);
+  }
+  ASSERT_EQ(root_->Unlink("dir", true), ZX_OK);
+  ASSERT_TRUE(fs().BlockingJournalSync().is_ok());
+
+  // The directory's block, which has a checksum, is the first free block, so the file gets it.
+  std::vector<uint8_t> data(kMinfsBlockSize, 0xab);
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_->Create("foo", 0, &child), ZX_OK);
+    size_t actual;
+    ASSERT_EQ(child->Write(data.data(), data.size(), 0, &actual), ZX_OK);
+    ASSERT_EQ(child->Close(), ZX_OK);
+  }
+
+  ASSERT_NO_FATAL_FAILURE(Mount(UnmountAndCheck()));
+  fbl::RefPtr<fs::Vnode> child;
+  ASSERT_EQ(root_->Lookup("foo", &child), ZX_OK);
+  EXPECT_EQ(fbl::RefPtr<VnodeMinfs>::Downcast(child)->GetInode()->dnum[0], dir_block);
+  auto options = child->ValidateOptions(fs::VnodeConnectionOptions());
+  ASSERT_TRUE(options.is_ok());
+  ASSERT_EQ(child->Open(options.value(), nullptr), ZX_OK);
+  std::vector<uint8_t> read(data.size());
+  size_t actual;
+  EXPECT_EQ(child->Read(read.data(), read.size(), 0, &actual), ZX_OK);
+  EXPECT_EQ(read, data);
+  EXPECT_EQ(child->Close(), ZX_OK);
+}
+
+}  // namespace
+}  // namespace minfs
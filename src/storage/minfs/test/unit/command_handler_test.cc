@@ -72,6 +72,15 @@ PrintJournalCommit [index]
 	Prints a journal entry cast as a journal commit.
 		index: Index of journal entry to cast.
 
+PrintLayoutStats [max]
+	Prints free space fragmentation, file extent counts, directory sizes and inode table density.
+		max: Maximum number of fragmented files to list.
+
+DumpJsonLines [what] [threads]
+	Dumps metadata as one JSON object per line.
+		what: One of inodes, allocated_inodes, inode_bitmap, block_bitmap, journal or all.
+		threads: Number of threads scanning the inode table.
+
 PrintBackupSuperblock
 	Prints the backup superblock.
 
@@ -97,6 +106,8 @@ const TestCommands& GetTestCommands() {
                                                         {"PrintJournalEntries", "5"},
                                                         {"PrintJournalHeader", "0"},
                                                         {"PrintJournalCommit", "0"},
+                                                        {"PrintLayoutStats", "5"},
+                                                        {"DumpJsonLines", "all", "2"},
                                                         {"PrintBackupSuperblock"},
                                                         {"WriteSuperblockField", "magic0", "0"}};
   return *test_commands;
@@ -0,0 +1,195 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <sys/stat.h>
+
+#include <set>
+#include <string>
+#include <string_view>
+
+#include <gtest/gtest.h>
+
+#include "src/lib/storage/block_client/cpp/fake_block_device.h"
+#include "src/lib/storage/vfs/cpp/vfs_types.h"
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/directory.h"
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/fsck.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/test/unit/feature_flag_fixture.h"
+
+namespace minfs {
+namespace {
+
+using block_client::FakeBlockDevice;
+
+// Long names fill leaves quickly: each takes a record of over 200 bytes.
+std::string EntryName(int i) { return std::string(190, 'n') + std::to_string(i); }
+
+// Gives every name the same hash, as someone who knew the volume's seed could.
+uint32_t CollidingHash(std::string_view) { return 0x12345678; }
+
+class DirIndexTest : public FeatureFlagFixture {
+ public:
+  DirIndexTest() : FeatureFlagFixture(MountOptions{.dir_index = true}, kMinfsFlagDirIndex) {}
+
+  // Returns the names listed by reading all of |dir|.
+  static std::set<std::string> ReadNames(fs::Vnode* dir) {
+    std::set<std::string> names;
+    fs::VdirCookie cookie;
+    uint8_t buffer[8192];
+    while (true) {
+      size_t actual = 0;
+      EXPECT_EQ(dir->Readdir(&cookie, buffer, sizeof(buffer), &actual), ZX_OK);
+      if (actual == 0) {
+        break;
+      }
+      for (size_t off = 0; off < actual;) {
+        auto entry = reinterpret_cast<vdirent_t*>(&buffer[off]);
+        names.emplace(entry->name, entry->size);
+        off += sizeof(vdirent_t) + entry->size;
+      }
+    }
+    return names;
+  }
+};
+
+TEST_F(DirIndexTest, NewDirectoryIsIndexed) {
+  {
+    fbl::RefPtr<fs::Vnode> dir;
+    ASSERT_EQ(root_->Create("dir", S_IFDIR, &dir), ZX_OK);
+    auto directory = fbl::RefPtr<VnodeMinfs>::Downcast(dir);
+    EXPECT_NE(directory->GetInode()->flags & kMinfsInodeFlagDirIndex, 0u);
+    EXPECT_FALSE(directory->IsInline());
+    EXPECT_EQ(directory->GetSize(), 2u * kMinfsBlockSize);
+
+    fbl::RefPtr<fs::Vnode> parent;
+    ASSERT_EQ(dir->Lookup("..", &parent), ZX_OK);
+    EXPECT_EQ(parent.get(), root_.get());
+    EXPECT_EQ(ReadNames(dir.get()), std::set<std::string>({"."}));
+    ASSERT_EQ(dir->Close(), ZX_OK);
+  }
+  ASSERT_EQ(root_->Unlink("dir", true), ZX_OK);
+  EXPECT_TRUE(UnmountAndCheck());
+}
+
+TEST_F(DirIndexTest, GrowsBeyondLinearDirectoryLimit) {
+  // More names than fit in kMinfsMaxDirectorySize. Hard links save on inodes.
+  constexpr int kEntryCount = 6000;
+  static_assert(kEntryCount * DirentSize(191) > kMinfsMaxDirectorySize);
+  {
+    fbl::RefPtr<fs::Vnode> dir;
+    ASSERT_EQ(root_->Create("dir", S_IFDIR, &dir), ZX_OK);
+    fbl::RefPtr<fs::Vnode> target;
+    ASSERT_EQ(dir->Create(EntryName(0), 0, &target), ZX_OK);
+    for (int i = 1; i < kEntryCount; ++i) {
+      ASSERT_EQ(dir->Link(EntryName(i), target), ZX_OK) << i;
+    }
+    ASSERT_EQ(dir->Link(EntryName(kEntryCount / 2), target), ZX_ERR_ALREADY_EXISTS);
+    auto directory = fbl::RefPtr<VnodeMinfs>::Downcast(dir);
+    EXPECT_GT(directory->GetSize(), kMinfsMaxDirectorySize);
+
+    for (int i = 0; i < kEntryCount; ++i) {
+      fbl::RefPtr<fs::Vnode> child;
+      ASSERT_EQ(dir->Lookup(EntryName(i), &child), ZX_OK) << i;
+      EXPECT_EQ(child.get(), target.get());
+    }
+
+    // Remove every other name, then rename the rest.
+    for (int i = 0; i < kEntryCount; i += 2) {
+      ASSERT_EQ(dir->Unlink(EntryName(i), false), ZX_OK) << i;
+    }
+    for (int i = 1; i < kEntryCount; i += 2) {
+      ASSERT_EQ(dir->Rename(dir, EntryName(i), "r" + EntryName(i), false, false), ZX_OK) << i;
+    }
+
+    std::set<std::string> expected = {"."};
+    for (int i = 1; i < kEntryCount; i += 2) {
+      expected.insert("r" + EntryName(i));
+      fbl::RefPtr<fs::Vnode> child;
+      EXPECT_EQ(dir->Lookup(EntryName(i), &child), ZX_ERR_NOT_FOUND);
+    }
+    EXPECT_EQ(ReadNames(dir.get()), expected);
+
+    ASSERT_EQ(target->Close(), ZX_OK);
+    ASSERT_EQ(dir->Close(), ZX_OK);
+  }
+  EXPECT_TRUE(UnmountAndCheck());
+}
+
+TEST_F(DirIndexTest, VolumesHaveTheirOwnHashSeed) {
+  const Superblock& info = fs().Info();
+  EXPECT_TRUE(info.dir_hash_seed[0] != 0 || info.dir_hash_seed[1] != 0);
+
+  constexpr uint64_t kBlockCount = 1 << 15;
+  auto device = std::make_unique<FakeBlockDevice>(kBlockCount, kMinfsBlockSize);
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+  ASSERT_TRUE(Mkfs(MountOptions{.dir_index = true}, bcache_or.value().get()).is_ok());
+  auto other_or = LoadSuperblock(bcache_or.value().get());
+  ASSERT_TRUE(other_or.is_ok());
+  EXPECT_TRUE(other_or->dir_hash_seed[0] != info.dir_hash_seed[0] ||
+              other_or->dir_hash_seed[1] != info.dir_hash_seed[1]);
+  EXPECT_NE(fs().HashDirentName(EntryName(0)),
+            DirentHash(other_or->dir_hash_seed, EntryName(0)));
+}
+
+TEST(DirentHashTest, IsHalfSipHash) {
+  // The reference test vectors, keyed with the bytes 0 to 7.
+  static constexpr uint32_t kSeed[2] = {0x03020100, 0x07060504};
+  static_assert(DirentHash(kSeed, std::string_view()) == 0x5b9f35a9);
+  EXPECT_EQ(DirentHash(kSeed, std::string_view("\0", 1)), 0xb85a4727u);
+}
+
+class DirIndexCollisionTest : public DirIndexTest {
+ public:
+  DirIndexCollisionTest() { mount_options_.dir_hash_for_testing = CollidingHash; }
+};
+
+TEST_F(DirIndexCollisionTest, NamesSharingAHashUseContinuationLeaves) {
+  // Many leaves' worth of names with the same hash.
+  constexpr int kEntryCount = 200;
+  static_assert(kEntryCount * DirentSize(191) > 4 * kMinfsBlockSize);
+  {
+    fbl::RefPtr<fs::Vnode> dir;
+    ASSERT_EQ(root_->Create("dir", S_IFDIR, &dir), ZX_OK);
+    fbl::RefPtr<fs::Vnode> target;
+    ASSERT_EQ(dir->Create(EntryName(0), 0, &target), ZX_OK);
+    for (int i = 1; i < kEntryCount; ++i) {
+      ASSERT_EQ(dir->Link(EntryName(i), target), ZX_OK) << i;
+    }
+    ASSERT_EQ(dir->Link(EntryName(kEntryCount / 2), target), ZX_ERR_ALREADY_EXISTS);
+    auto directory = fbl::RefPtr<VnodeMinfs>::Downcast(dir);
+    EXPECT_GT(directory->GetSize(), 5u * kMinfsBlockSize);
+
+    for (int i = 0; i < kEntryCount; ++i) {
+      fbl::RefPtr<fs::Vnode> child;
+      ASSERT_EQ(dir->Lookup(EntryName(i), &child), ZX_OK) << i;
+      EXPECT_EQ(child.get(), target.get());
+    }
+
+    // Remove every other name, then rename the rest.
+    for (int i = 0; i < kEntryCount; i += 2) {
+      ASSERT_EQ(dir->Unlink(EntryName(i), false), ZX_OK) << i;
+    }
+    for (int i = 1; i < kEntryCount; i += 2) {
+      ASSERT_EQ(dir->Rename(dir, EntryName(i), "r" + EntryName(i), false, false), ZX_OK) << i;
+    }
+
+    std::set<std::string> expected = {"."};
+    for (int i = 1; i < kEntryCount; i += 2) {
+      expected.insert("r" + EntryName(i));
+      fbl::RefPtr<fs::Vnode> child;
+      EXPECT_EQ(dir->Lookup(EntryName(i), &child), ZX_ERR_NOT_FOUND);
+    }
+    EXPECT_EQ(ReadNames(dir.get()), expected);
+
+    ASSERT_EQ(target->Close(), ZX_OK);
+    ASSERT_EQ(dir->Close(), ZX_OK);
+  }
+  EXPECT_TRUE(UnmountAndCheck());
+}
+
+}  // namespace
+}  // namespace minfs
@@ -50,7 +50,14 @@ TEST(InspectorDiskStruct, GetSuperblockString) {
 	unlinked_head: 0
 	unlinked_tail: 0
 	oldest_minor_version: 0
-	reserved: uint32_t[2018] = { ... }
+	ino_init_blocks: 0
+	csum_block: 0
+	csum_blocks: 0
+	csum_ibm_blocks: 0
+	csum_abm_blocks: 0
+	csum_dat_blocks: 0
+	dir_hash_seed: uint32_t[2] = { ... }
+	reserved: uint32_t[2010] = { ... }
 )""";
 
   EXPECT_EQ(disk_struct->ToString(&sb, options), output);
@@ -75,7 +82,9 @@ TEST(InspectorDiskStruct, GetInodeString) {
 	dirent_count: 0
 	last_inode: 0
 	next_inode: 0
-	rsvd: uint32_t[3] = { ... }
+	flags: 0
+	size_high: 0
+	checksum: 0
 	dnum: uint32_t[16] = { ... }
 	inum: uint32_t[31] = { ... }
 	dinum: uint32_t[1] = { ... }
@@ -0,0 +1,220 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/extent_tree.h"
+
+#include <lib/fit/defer.h>
+#include <string.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "src/storage/minfs/file.h"
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/test/unit/feature_flag_fixture.h"
+
+namespace minfs {
+namespace {
+
+// Hands out node blocks from an in-memory store which also serves as the tree's backing device.
+class FakeNodeStore : public ExtentTree::NodeAllocator {
+ public:
+  blk_t AllocateNode() final {
+    blk_t block = next_block_++;
+    allocated_.insert(block);
+    return block;
+  }
+
+  void FreeNode(blk_t block) final {
+    ASSERT_EQ(allocated_.erase(block), 1u);
+    blocks_.erase(block);
+  }
+
+  ExtentTree::NodeReader Reader() {
+    return [this](blk_t block, void* data) -> zx::status<> {
+      auto iter = blocks_.find(block);
+      if (iter == blocks_.end()) {
+        return zx::error(ZX_ERR_OUT_OF_RANGE);
+      }
+      memcpy(data, iter->second.data(), kMinfsBlockSize);
+      return zx::ok();
+    };
+  }
+
+  ExtentTree::NodeWriter Writer() {
+    return [this](size_t slot, blk_t block, const void* data) -> zx::status<> {
+      EXPECT_EQ(allocated_.count(block), 1u);
+      auto& stored = blocks_[block];
+      stored.resize(kMinfsBlockSize);
+      memcpy(stored.data(), data, kMinfsBlockSize);
+      return zx::ok();
+    };
+  }
+
+  size_t allocated() const { return allocated_.size(); }
+
+  // Returns the stored contents of |block|.
+  std::vector<uint8_t>& data(blk_t block) { return blocks_[block]; }
+
+ private:
+  blk_t next_block_ = 100;
+  std::set<blk_t> allocated_;
+  std::map<blk_t, std::vector<uint8_t>> blocks_;
+};
+
+TEST(ExtentTreeTest, EmptyTreeIsSparse) {
+  auto tree = ExtentTree::CreateEmpty(/*checksums=*/false);
+  EXPECT_EQ(tree->depth(), 0u);
+  auto [block, count] = tree->Lookup(10, 5);
+  EXPECT_EQ(block, 0u);
+  EXPECT_EQ(count, 5u);
+}
+
+TEST(ExtentTreeTest, ContiguousBlocksMergeIntoOneExtent) {
+  auto tree = ExtentTree::CreateEmpty(/*checksums=*/false);
+  for (uint64_t i = 0; i < 8; ++i) {
+    ASSERT_TRUE(tree->Set(i, static_cast<blk_t>(50 + i), nullptr).is_ok());
+  }
+
+  size_t extent_count = 0;
+  tree->ForEachExtent([&](const Extent& extent) {
+    ++extent_count;
+    EXPECT_EQ(extent.file_block, 0u);
+    EXPECT_EQ(extent.length, 8u);
+    EXPECT_EQ(extent.block, 50u);
+  });
+  EXPECT_EQ(extent_count, 1u);
+
+  auto [block, count] = tree->Lookup(3, 100);
+  EXPECT_EQ(block, 53u);
+  EXPECT_EQ(count, 5u);
+}
+
+TEST(ExtentTreeTest, UnmapSplitsExtent) {
+  auto tree = ExtentTree::CreateEmpty(/*checksums=*/false);
+  for (uint64_t i = 0; i < 8; ++i) {
+    ASSERT_TRUE(tree->Set(i, static_cast<blk_t>(50 + i), nullptr).is_ok());
+  }
+  ASSERT_TRUE(tree->Unmap(3, 2, nullptr).is_ok());
+
+  std::vector<Extent> extents;
+  tree->ForEachExtent([&](const Extent& extent) { extents.push_back(extent); });
+  ASSERT_EQ(extents.size(), 2u);
+  EXPECT_EQ(extents[0].file_block, 0u);
+  EXPECT_EQ(extents[0].length, 3u);
+  EXPECT_EQ(extents[1].file_block, 5u);
+  EXPECT_EQ(extents[1].length, 3u);
+  EXPECT_EQ(extents[1].block, 55u);
+
+  EXPECT_EQ(tree->Lookup(3, 100).first, 0u);
+  EXPECT_EQ(tree->Lookup(3, 100).second, 2u);
+}
+
+TEST(ExtentTreeTest, FragmentedFileGrowsAndShrinksTree) {
+  constexpr uint64_t kExtentCount = 5000;
+  FakeNodeStore store;
+  auto tree = ExtentTree::CreateEmpty(/*checksums=*/false);
+
+  // Mapping every other file block stops any of the extents from merging.
+  for (uint64_t i = 0; i < kExtentCount; ++i) {
+    ASSERT_TRUE(tree->Set(2 * i, static_cast<blk_t>(10000 + 3 * i), &store).is_ok());
+  }
+  EXPECT_GT(tree->depth(), 0u);
+  EXPECT_GT(store.allocated(), 0u);
+  EXPECT_TRUE(tree->IsDirty());
+  ASSERT_TRUE(tree->Flush(store.Writer()).is_ok());
+  EXPECT_FALSE(tree->IsDirty());
+
+  Inode inode = {};
+  tree->WriteRoot(&inode);
+  auto loaded_or = ExtentTree::Load(inode, store.Reader(), /*checksums=*/false);
+  ASSERT_TRUE(loaded_or.is_ok()) << loaded_or.status_string();
+  std::unique_ptr<ExtentTree> loaded = std::move(loaded_or.value());
+  EXPECT_EQ(loaded->depth(), tree->depth());
+  for (uint64_t i = 0; i < kExtentCount; ++i) {
+    ASSERT_EQ(loaded->Lookup(2 * i, 1).first, 10000 + 3 * i);
+    ASSERT_EQ(loaded->Lookup(2 * i + 1, 1).first, 0u);
+  }
+
+  size_t node_count = 0;
+  loaded->ForEachNode([&](blk_t, uint64_t) { ++node_count; });
+  EXPECT_EQ(node_count, store.allocated());
+
+  ASSERT_TRUE(loaded->Unmap(0, 2 * kExtentCount, &store).is_ok());
+  EXPECT_EQ(loaded->depth(), 0u);
+  EXPECT_EQ(store.allocated(), 0u);
+  EXPECT_EQ(loaded->Lookup(0, 100).first, 0u);
+}
+
+TEST(ExtentTreeTest, LoadRejectsBadMagic) {
+  FakeNodeStore store;
+  Inode inode = {};
+  ExtentTree::CreateEmpty(/*checksums=*/false)->WriteRoot(&inode);
+  ExtentHeader* header = reinterpret_cast<ExtentHeader*>(inode.dnum);
+  header->magic = kMinfsExtentMagic + 1;
+
+  auto tree_or = ExtentTree::Load(inode, store.Reader(), /*checksums=*/false);
+  ASSERT_TRUE(tree_or.is_error());
+  EXPECT_EQ(tree_or.status_value(), ZX_ERR_IO_DATA_INTEGRITY);
+}
+
+TEST(ExtentTreeTest, LoadRejectsNodeWithBadChecksum) {
+  FakeNodeStore store;
+  auto tree = ExtentTree::CreateEmpty(/*checksums=*/true);
+  for (uint64_t i = 0; i < 100; ++i) {
+    ASSERT_TRUE(tree->Set(2 * i, static_cast<blk_t>(10000 + 3 * i), &store).is_ok());
+  }
+  ASSERT_GT(tree->depth(), 0u);
+  ASSERT_TRUE(tree->Flush(store.Writer()).is_ok());
+  Inode inode = {};
+  tree->WriteRoot(&inode);
+  ASSERT_TRUE(ExtentTree::Load(inode, store.Reader(), /*checksums=*/true).is_ok());
+
+  blk_t node_block = 0;
+  tree->ForEachNode([&node_block](blk_t block, uint64_t) { node_block = block; });
+  ASSERT_NE(node_block, 0u);
+
+  // Corrupt a record without touching the header.
+  store.data(node_block)[sizeof(ExtentHeader)] ^= 1;
+  auto tree_or = ExtentTree::Load(inode, store.Reader(), /*checksums=*/true);
+  ASSERT_TRUE(tree_or.is_error());
+  EXPECT_EQ(tree_or.status_value(), ZX_ERR_IO_DATA_INTEGRITY);
+}
+
+class ExtentVolumeTest : public FeatureFlagFixture {
+ public:
+  ExtentVolumeTest() : FeatureFlagFixture(MountOptions{.extent_inodes = true}, kMinfsFlagExtents) {}
+};
+
+TEST_F(ExtentVolumeTest, PassesFsck) {
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_->Create("foo", 0, &child), ZX_OK);
+    auto close = fit::defer([child]() { ASSERT_EQ(child->Close(), ZX_OK); });
+
+    // Write a file with a hole in it so that it needs more than one extent.
+    std::vector<uint8_t> data(4 * kMinfsBlockSize, 0xaf);
+    size_t actual;
+    ASSERT_EQ(child->Write(data.data(), data.size(), 0, &actual), ZX_OK);
+    ASSERT_EQ(actual, data.size());
+    ASSERT_EQ(child->Write(data.data(), data.size(), 16 * kMinfsBlockSize, &actual), ZX_OK);
+    ASSERT_EQ(actual, data.size());
+
+    std::vector<uint8_t> read_back(data.size());
+    ASSERT_EQ(child->Read(read_back.data(), read_back.size(), 16 * kMinfsBlockSize, &actual),
+              ZX_OK);
+    ASSERT_EQ(actual, read_back.size());
+    EXPECT_EQ(read_back, data);
+    ASSERT_EQ(child->Read(read_back.data(), read_back.size(), 8 * kMinfsBlockSize, &actual),
+              ZX_OK);
+    EXPECT_EQ(read_back, std::vector<uint8_t>(read_back.size(), 0));
+  }
+  EXPECT_TRUE(UnmountAndCheck());
+}
+
+}  // namespace
+}  // namespace minfs
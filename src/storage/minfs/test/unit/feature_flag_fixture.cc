@@ -0,0 +1,48 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/test/unit/feature_flag_fixture.h"
+
+#include <utility>
+
+#include "src/lib/storage/block_client/cpp/fake_block_device.h"
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/fsck.h"
+
+namespace minfs {
+
+void FeatureFlagFixture::SetUp() {
+  auto device = std::make_unique<block_client::FakeBlockDevice>(kBlockCount, kMinfsBlockSize);
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+  ASSERT_TRUE(Mkfs(mkfs_options_, bcache_or.value().get()).is_ok());
+  ASSERT_NO_FATAL_FAILURE(Mount(std::move(bcache_or.value())));
+  if (flag_ != 0) {
+    ASSERT_EQ(fs().Info().flags & flag_, flag_);
+    ASSERT_EQ(fs().Info().major_version, kMinfsMajorVersionFeatures);
+  }
+}
+
+void FeatureFlagFixture::Mount(std::unique_ptr<Bcache> bcache) {
+  auto fs_or = Runner::Create(loop_.dispatcher(), std::move(bcache), mount_options_);
+  ASSERT_TRUE(fs_or.is_ok());
+  runner_ = std::move(fs_or.value());
+  auto root_or = fs().VnodeGet(kMinfsRootIno);
+  ASSERT_TRUE(root_or.is_ok());
+  root_ = std::move(root_or.value());
+}
+
+std::unique_ptr<Bcache> FeatureFlagFixture::Unmount() {
+  root_.reset();
+  return Runner::Destroy(std::move(runner_));
+}
+
+std::unique_ptr<Bcache> FeatureFlagFixture::UnmountAndCheck() {
+  auto fsck_or =
+      Fsck(Unmount(), FsckOptions{.dir_hash_for_testing = mount_options_.dir_hash_for_testing});
+  EXPECT_TRUE(fsck_or.is_ok());
+  return fsck_or.is_ok() ? std::move(fsck_or.value()) : nullptr;
+}
+
+}  // namespace minfs
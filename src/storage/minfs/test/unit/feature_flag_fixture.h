@@ -0,0 +1,62 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_STORAGE_MINFS_TEST_UNIT_FEATURE_FLAG_FIXTURE_H_
+#define SRC_STORAGE_MINFS_TEST_UNIT_FEATURE_FLAG_FIXTURE_H_
+
+#include <lib/async-loop/cpp/loop.h>
+#include <lib/async-loop/default.h>
+
+#include <cstdint>
+#include <memory>
+
+#include <fbl/ref_ptr.h>
+#include <gtest/gtest.h>
+
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/mount.h"
+#include "src/storage/minfs/runner.h"
+
+namespace minfs {
+
+// Formats a fake device with an optional feature turned on and mounts it.
+class FeatureFlagFixture : public testing::Test {
+ public:
+  static constexpr uint64_t kBlockCount = 1 << 17;
+
+  // Formats with |mkfs_options|, which must turn on the feature whose superblock flag is |flag|. A
+  // |flag| of zero formats a volume without features.
+  FeatureFlagFixture(MountOptions mkfs_options, uint32_t flag)
+      : mkfs_options_(mkfs_options), flag_(flag) {}
+
+  // Formats and mounts the volume, and checks that it uses the feature.
+  void SetUp() override;
+
+  Minfs& fs() { return runner_->minfs(); }
+
+  // Mounts |bcache| with |mount_options_| and opens the root directory as |root_|.
+  void Mount(std::unique_ptr<Bcache> bcache);
+
+  // Releases |root_|, unmounts and returns the device.
+  std::unique_ptr<Bcache> Unmount();
+
+  // Unmounts and checks the filesystem, returning the device, or null if the check fails.
+  std::unique_ptr<Bcache> UnmountAndCheck();
+
+ protected:
+  async::Loop loop_{&kAsyncLoopConfigAttachToCurrentThread};
+  // Used for every mount and check. Subclasses may change it before SetUp.
+  MountOptions mount_options_;
+  std::unique_ptr<Runner> runner_;
+  fbl::RefPtr<VnodeMinfs> root_;
+
+ private:
+  const MountOptions mkfs_options_;
+  const uint32_t flag_;
+};
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_TEST_UNIT_FEATURE_FLAG_FIXTURE_H_
@@ -0,0 +1,139 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "src/storage/minfs/directory.h"
+#include "src/storage/minfs/file.h"
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/test/unit/feature_flag_fixture.h"
+
+namespace minfs {
+namespace {
+
+class InlineDataTest : public FeatureFlagFixture {
+ public:
+  InlineDataTest() : FeatureFlagFixture(MountOptions{.inline_data = true}, kMinfsFlagInlineData) {}
+};
+
+TEST_F(InlineDataTest, SmallFileHasNoBlocks) {
+  const uint32_t initial_block_count = fs().Info().alloc_block_count;
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_->Create("foo", 0, &child), ZX_OK);
+    std::vector<uint8_t> data(100, 0x5a);
+    size_t actual;
+    ASSERT_EQ(child->Write(data.data(), data.size(), 0, &actual), ZX_OK);
+    ASSERT_EQ(actual, data.size());
+    ASSERT_EQ(child->Write(data.data(), 50, 120, &actual), ZX_OK);
+    ASSERT_EQ(actual, 50u);
+
+    auto file = fbl::RefPtr<VnodeMinfs>::Downcast(child);
+    EXPECT_TRUE(file->IsInline());
+    EXPECT_EQ(file->GetBlockCount(), 0u);
+    EXPECT_EQ(file->GetSize(), 170u);
+
+    std::vector<uint8_t> read_back(170);
+    ASSERT_EQ(child->Read(read_back.data(), read_back.size(), 0, &actual), ZX_OK);
+    ASSERT_EQ(actual, read_back.size());
+    std::vector<uint8_t> expected(170, 0x5a);
+    std::fill(expected.begin() + 100, expected.begin() + 120, 0);
+    EXPECT_EQ(read_back, expected);
+    ASSERT_EQ(child->Close(), ZX_OK);
+  }
+  EXPECT_EQ(fs().Info().alloc_block_count, initial_block_count);
+  EXPECT_TRUE(UnmountAndCheck());
+}
+
+TEST_F(InlineDataTest, GrowingFileIsConvertedToBlocks) {
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_->Create("foo", 0, &child), ZX_OK);
+    std::vector<uint8_t> data(kMinfsInlineDataSize, 0x11);
+    size_t actual;
+    ASSERT_EQ(child->Write(data.data(), data.size(), 0, &actual), ZX_OK);
+    auto file = fbl::RefPtr<VnodeMinfs>::Downcast(child);
+    EXPECT_TRUE(file->IsInline());
+
+    // Writing beyond the inline area, past the first block, moves the existing data to a block.
+    std::vector<uint8_t> more(kMinfsBlockSize, 0x22);
+    ASSERT_EQ(child->Write(more.data(), more.size(), 2 * kMinfsBlockSize, &actual), ZX_OK);
+    ASSERT_EQ(actual, more.size());
+    EXPECT_FALSE(file->IsInline());
+    EXPECT_EQ(file->GetBlockCount(), 2u);
+
+    std::vector<uint8_t> read_back(data.size());
+    ASSERT_EQ(child->Read(read_back.data(), read_back.size(), 0, &actual), ZX_OK);
+    EXPECT_EQ(read_back, data);
+    read_back.resize(more.size());
+    ASSERT_EQ(child->Read(read_back.data(), read_back.size(), 2 * kMinfsBlockSize, &actual),
+              ZX_OK);
+    EXPECT_EQ(read_back, more);
+    ASSERT_EQ(child->Close(), ZX_OK);
+  }
+  EXPECT_TRUE(UnmountAndCheck());
+}
+
+TEST_F(InlineDataTest, TruncateInlineFile) {
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_->Create("foo", 0, &child), ZX_OK);
+    std::vector<uint8_t> data(64, 0x33);
+    size_t actual;
+    ASSERT_EQ(child->Write(data.data(), data.size(), 0, &actual), ZX_OK);
+
+    // Shrinking and growing again within the inline area exposes zeroes.
+    ASSERT_EQ(child->Truncate(16), ZX_OK);
+    ASSERT_EQ(child->Truncate(64), ZX_OK);
+    auto file = fbl::RefPtr<VnodeMinfs>::Downcast(child);
+    EXPECT_TRUE(file->IsInline());
+    std::vector<uint8_t> read_back(64);
+    ASSERT_EQ(child->Read(read_back.data(), read_back.size(), 0, &actual), ZX_OK);
+    std::vector<uint8_t> expected(64, 0);
+    std::fill(expected.begin(), expected.begin() + 16, 0x33);
+    EXPECT_EQ(read_back, expected);
+
+    // Growing beyond it converts the file.
+    ASSERT_EQ(child->Truncate(3 * kMinfsBlockSize), ZX_OK);
+    EXPECT_FALSE(file->IsInline());
+    ASSERT_EQ(child->Read(read_back.data(), read_back.size(), 0, &actual), ZX_OK);
+    EXPECT_EQ(read_back, expected);
+    ASSERT_EQ(child->Close(), ZX_OK);
+  }
+  EXPECT_TRUE(UnmountAndCheck());
+}
+
+TEST_F(InlineDataTest, DirectoryOutgrowsInlineData) {
+  {
+    fbl::RefPtr<fs::Vnode> dir;
+    ASSERT_EQ(root_->Create("dir", S_IFDIR, &dir), ZX_OK);
+    auto directory = fbl::RefPtr<VnodeMinfs>::Downcast(dir);
+    EXPECT_TRUE(directory->IsInline());
+
+    constexpr int kEntryCount = 20;
+    for (int i = 0; i < kEntryCount; ++i) {
+      fbl::RefPtr<fs::Vnode> child;
+      ASSERT_EQ(dir->Create("file" + std::to_string(i), 0, &child), ZX_OK);
+      ASSERT_EQ(child->Close(), ZX_OK);
+    }
+    EXPECT_FALSE(directory->IsInline());
+
+    for (int i = 0; i < kEntryCount; ++i) {
+      fbl::RefPtr<fs::Vnode> child;
+      EXPECT_EQ(dir->Lookup("file" + std::to_string(i), &child), ZX_OK);
+    }
+    ASSERT_EQ(dir->Close(), ZX_OK);
+  }
+  EXPECT_TRUE(UnmountAndCheck());
+}
+
+}  // namespace
+}  // namespace minfs
@@ -0,0 +1,119 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/io_accounting.h"
+
+#include <lib/async-loop/cpp/loop.h>
+#include <lib/async-loop/default.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "src/lib/storage/block_client/cpp/fake_block_device.h"
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/runner.h"
+
+namespace minfs {
+namespace {
+
+using block_client::FakeBlockDevice;
+using View = IoAccounting::View;
+
+storage::Operation Write(uint64_t block, uint64_t length) {
+  return storage::Operation{
+      .type = storage::OperationType::kWrite, .dev_offset = block, .length = length};
+}
+
+TEST(IoAccountingTest, SizeBuckets) {
+  EXPECT_EQ(IoAccounting::SizeBucket(1), 0u);
+  EXPECT_EQ(IoAccounting::SizeBucket(2), 1u);
+  EXPECT_EQ(IoAccounting::SizeBucket(3), 1u);
+  EXPECT_EQ(IoAccounting::SizeBucket(4), 2u);
+  EXPECT_EQ(IoAccounting::SizeBucket(15), 2u);
+  EXPECT_EQ(IoAccounting::SizeBucket(16), 3u);
+  EXPECT_EQ(IoAccounting::SizeBucket(255), 4u);
+  EXPECT_EQ(IoAccounting::SizeBucket(256), 5u);
+  EXPECT_EQ(IoAccounting::SizeBucket(1 << 20), IoAccounting::kSizeBucketCount - 1);
+}
+
+TEST(IoAccountingTest, ClassifiesByRegion) {
+  Superblock info = {};
+  info.ibm_block = 8;
+  info.abm_block = 9;
+  info.ino_block = 10;
+  info.integrity_start_block = 20;
+  info.dat_block = 40;
+  IoAccounting accounting;
+  accounting.SetLayout(info);
+
+  EXPECT_EQ(accounting.Classify(0, IoSource::kData), IoSource::kSuperblock);
+  EXPECT_EQ(accounting.Classify(kNonFvmSuperblockBackup, IoSource::kData), IoSource::kSuperblock);
+  EXPECT_EQ(accounting.Classify(8, IoSource::kData), IoSource::kInodeBitmap);
+  EXPECT_EQ(accounting.Classify(9, IoSource::kData), IoSource::kBlockBitmap);
+  EXPECT_EQ(accounting.Classify(19, IoSource::kData), IoSource::kInodeTable);
+  EXPECT_EQ(accounting.Classify(20, IoSource::kData), IoSource::kSuperblock);
+  EXPECT_EQ(accounting.Classify(21, IoSource::kData), IoSource::kJournal);
+  EXPECT_EQ(accounting.Classify(40, IoSource::kDirectory), IoSource::kDirectory);
+
+  accounting.RecordTransaction(Write(45, 4), IoSource::kFileData);
+  accounting.RecordTransaction(Write(12, 1), IoSource::kFileData);
+  accounting.RecordDevice(Write(45, 4));
+  IoAccounting::Counts counts = accounting.Get(View::kTransaction, true, IoSource::kFileData);
+  EXPECT_EQ(counts.ops, 1u);
+  EXPECT_EQ(counts.blocks, 4u);
+  EXPECT_EQ(counts.bytes, 4 * kMinfsBlockSize);
+  EXPECT_EQ(counts.ops_by_size[2], 1u);
+  EXPECT_EQ(accounting.Get(View::kTransaction, true, IoSource::kInodeTable).ops, 1u);
+  EXPECT_EQ(accounting.Get(View::kDevice, true, IoSource::kData).blocks, 4u);
+  EXPECT_EQ(accounting.Get(View::kDevice, false, IoSource::kData).ops, 0u);
+
+  accounting.Reset();
+  EXPECT_EQ(accounting.Get(View::kTransaction, true, IoSource::kFileData).ops, 0u);
+}
+
+TEST(IoAccountingTest, MinfsAccountsForTransactionsAndDeviceIo) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+  constexpr uint64_t kBlockCount = 1 << 15;
+  auto device = std::make_unique<FakeBlockDevice>(kBlockCount, kMinfsBlockSize);
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+  ASSERT_TRUE(Mkfs(bcache_or.value().get()).is_ok());
+  auto fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), MountOptions());
+  ASSERT_TRUE(fs_or.is_ok());
+  IoAccounting& accounting = *fs_or->minfs().GetIoAccounting();
+  accounting.Reset();
+  {
+    auto root_or = fs_or->minfs().VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+    fbl::RefPtr<fs::Vnode> file;
+    ASSERT_EQ(root_or->Create("file", 0, &file), ZX_OK);
+    std::vector<uint8_t> data(kMinfsBlockSize, 'x');
+    size_t written;
+    ASSERT_EQ(file->Write(data.data(), data.size(), 0, &written), ZX_OK);
+    ASSERT_EQ(file->Close(), ZX_OK);
+  }
+  ASSERT_TRUE(fs_or->minfs().BlockingJournalSync().is_ok());
+
+  EXPECT_GT(accounting.Get(View::kTransaction, true, IoSource::kInodeTable).ops, 0u);
+  EXPECT_GT(accounting.Get(View::kTransaction, true, IoSource::kInodeBitmap).ops, 0u);
+  EXPECT_GT(accounting.Get(View::kTransaction, true, IoSource::kBlockBitmap).ops, 0u);
+  EXPECT_GT(accounting.Get(View::kTransaction, true, IoSource::kDirectory).ops, 0u);
+  EXPECT_GT(accounting.Get(View::kTransaction, true, IoSource::kFileData).ops, 0u);
+  EXPECT_EQ(accounting.Get(View::kTransaction, true, IoSource::kJournal).ops, 0u);
+
+  // The metadata goes through the journal before being written to its final location.
+  EXPECT_GT(accounting.Get(View::kDevice, true, IoSource::kJournal).ops, 0u);
+  EXPECT_GT(accounting.Get(View::kDevice, true, IoSource::kData).ops, 0u);
+
+  // Destroying the filesystem detaches its accounting from the block cache, which stays usable.
+  auto bcache = Runner::Destroy(std::move(fs_or.value()));
+  std::vector<uint8_t> block(kMinfsBlockSize);
+  ASSERT_TRUE(bcache->Readblk(0, block.data()).is_ok());
+}
+
+}  // namespace
+}  // namespace minfs
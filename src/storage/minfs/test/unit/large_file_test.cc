@@ -0,0 +1,83 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/test/unit/feature_flag_fixture.h"
+
+namespace minfs {
+namespace {
+
+// An offset which cannot be represented by a 32-bit size.
+constexpr uint64_t kLargeOffset = 5ull << 30;
+
+class LargeFileTest : public FeatureFlagFixture {
+ public:
+  LargeFileTest() : FeatureFlagFixture(MountOptions{.large_files = true}, kMinfsFlagLargeFiles) {}
+};
+
+class NoLargeFileTest : public FeatureFlagFixture {
+ public:
+  NoLargeFileTest() : FeatureFlagFixture(MountOptions(), 0) {}
+};
+
+TEST_F(LargeFileTest, WriteBeyondFourGigabytes) {
+  EXPECT_GT(fs().Info().MaxFileSize(), kLargeOffset + kMinfsBlockSize);
+
+  std::vector<uint8_t> data(kMinfsBlockSize, 0x5c);
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_->Create("foo", 0, &child), ZX_OK);
+    size_t actual;
+    ASSERT_EQ(child->Write(data.data(), data.size(), kLargeOffset, &actual), ZX_OK);
+    ASSERT_EQ(actual, data.size());
+
+    fs::VnodeAttributes attributes;
+    ASSERT_EQ(child->GetAttributes(&attributes), ZX_OK);
+    EXPECT_EQ(attributes.content_size, kLargeOffset + data.size());
+    ASSERT_EQ(child->Close(), ZX_OK);
+  }
+
+  ASSERT_NO_FATAL_FAILURE(Mount(UnmountAndCheck()));
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_->Lookup("foo", &child), ZX_OK);
+    fs::VnodeAttributes attributes;
+    ASSERT_EQ(child->GetAttributes(&attributes), ZX_OK);
+    EXPECT_EQ(attributes.content_size, kLargeOffset + data.size());
+
+    std::vector<uint8_t> read_back(data.size());
+    size_t actual;
+    ASSERT_EQ(child->Read(read_back.data(), read_back.size(), kLargeOffset, &actual), ZX_OK);
+    ASSERT_EQ(actual, read_back.size());
+    EXPECT_EQ(read_back, data);
+
+    // Truncating within the large range keeps the high bits of the size.
+    ASSERT_EQ(child->Truncate(kLargeOffset + 100), ZX_OK);
+    ASSERT_EQ(child->GetAttributes(&attributes), ZX_OK);
+    EXPECT_EQ(attributes.content_size, kLargeOffset + 100);
+  }
+  EXPECT_TRUE(UnmountAndCheck());
+}
+
+TEST_F(NoLargeFileTest, WriteBeyondFourGigabytesFails) {
+  EXPECT_EQ(fs().Info().MaxFileSize(), kMinfsMaxFileSize);
+  {
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_->Create("foo", 0, &child), ZX_OK);
+    std::vector<uint8_t> data(kMinfsBlockSize, 0x5c);
+    size_t actual;
+    EXPECT_EQ(child->Write(data.data(), data.size(), kLargeOffset, &actual), ZX_ERR_FILE_BIG);
+    EXPECT_EQ(child->Truncate(kLargeOffset), ZX_ERR_INVALID_ARGS);
+    ASSERT_EQ(child->Close(), ZX_OK);
+  }
+  EXPECT_TRUE(UnmountAndCheck());
+}
+
+}  // namespace
+}  // namespace minfs
@@ -0,0 +1,91 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/latency_histogram.h"
+
+#include <lib/async-loop/cpp/loop.h>
+#include <lib/async-loop/default.h>
+
+#include <gtest/gtest.h>
+
+#include "src/lib/storage/block_client/cpp/fake_block_device.h"
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/runner.h"
+
+namespace minfs {
+namespace {
+
+using block_client::FakeBlockDevice;
+using std::chrono::microseconds;
+
+TEST(LatencyHistogramTest, BucketsCoverEveryLatency) {
+  for (uint64_t ns : {0ul, 1ul, 3ul, 4ul, 7ul, 8ul, 1000ul, 123456789ul, 1ul << 40, ~0ul}) {
+    const size_t bucket = LatencyHistogram::BucketIndex(ns);
+    ASSERT_LT(bucket, LatencyHistogram::kBucketCount);
+    EXPECT_LE(LatencyHistogram::BucketLowerBound(bucket), ns);
+    if (bucket + 1 < LatencyHistogram::kBucketCount) {
+      EXPECT_GT(LatencyHistogram::BucketLowerBound(bucket + 1), ns);
+    }
+  }
+  for (size_t bucket = 0; bucket < LatencyHistogram::kBucketCount; ++bucket) {
+    EXPECT_EQ(LatencyHistogram::BucketIndex(LatencyHistogram::BucketLowerBound(bucket)), bucket);
+  }
+}
+
+TEST(LatencyHistogramTest, PercentilesAreWithinABucket) {
+  LatencyHistogram histogram;
+  for (int i = 1; i <= 1000; ++i) {
+    histogram.Record(microseconds(i));
+  }
+  LatencyHistogram::Snapshot snapshot = histogram.GetSnapshot();
+  EXPECT_EQ(snapshot.count, 1000u);
+  EXPECT_EQ(snapshot.max_ns, 1'000'000u);
+  EXPECT_EQ(snapshot.total_ns, 500'500'000u);
+  // Buckets are no wider than a quarter of their lower bound.
+  for (double fraction : {0.5, 0.99, 0.999}) {
+    const double expected = fraction * 1'000'000;
+    const double percentile = static_cast<double>(snapshot.Percentile(fraction));
+    EXPECT_LE(percentile, expected);
+    EXPECT_GT(percentile * 1.25, expected);
+  }
+
+  histogram.Reset();
+  snapshot = histogram.GetSnapshot();
+  EXPECT_EQ(snapshot.count, 0u);
+  EXPECT_EQ(snapshot.Percentile(0.5), 0u);
+}
+
+TEST(LatencyHistogramTest, MinfsRecordsPhases) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+  constexpr uint64_t kBlockCount = 1 << 15;
+  auto device = std::make_unique<FakeBlockDevice>(kBlockCount, kMinfsBlockSize);
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+  ASSERT_TRUE(Mkfs(bcache_or.value().get()).is_ok());
+  auto fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), MountOptions());
+  ASSERT_TRUE(fs_or.is_ok());
+  LatencyMetrics& latencies = fs_or->minfs().Latencies();
+  latencies.Reset();
+  {
+    auto root_or = fs_or->minfs().VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+    fbl::RefPtr<fs::Vnode> file;
+    ASSERT_EQ(root_or->Create("file", 0, &file), ZX_OK);
+    ASSERT_EQ(root_or->Lookup("file", &file), ZX_OK);
+    ASSERT_EQ(file->Close(), ZX_OK);
+  }
+  EXPECT_GT(latencies.Get(LatencyPhase::kBeginTransaction).GetSnapshot().count, 0u);
+  EXPECT_GT(latencies.Get(LatencyPhase::kCommitTransaction).GetSnapshot().count, 0u);
+  EXPECT_EQ(latencies.Get(LatencyPhase::kDirectoryLookup).GetSnapshot().count, 1u);
+
+  ASSERT_TRUE(fs_or->minfs().BlockingJournalSync().is_ok());
+  EXPECT_EQ(latencies.Get(LatencyPhase::kBlockingJournalSync).GetSnapshot().count, 1u);
+  EXPECT_GT(latencies.Get(LatencyPhase::kJournalWrite).GetSnapshot().count, 0u);
+  Runner::Destroy(std::move(fs_or.value()));
+}
+
+}  // namespace
+}  // namespace minfs
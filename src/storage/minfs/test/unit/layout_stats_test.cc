@@ -0,0 +1,137 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/inspector/layout_stats.h"
+
+#include <gtest/gtest.h>
+
+#include "src/storage/minfs/format.h"
+
+namespace minfs {
+namespace {
+
+Inode MakeInode(uint32_t magic, uint32_t dirent_count = 0) {
+  Inode inode = {};
+  inode.magic = magic;
+  inode.dirent_count = dirent_count;
+  return inode;
+}
+
+TEST(LayoutStatsTest, HistogramBuckets) {
+  EXPECT_EQ(LayoutStats::HistogramBucket(0), 0u);
+  EXPECT_EQ(LayoutStats::HistogramBucket(1), 0u);
+  EXPECT_EQ(LayoutStats::HistogramBucket(2), 1u);
+  EXPECT_EQ(LayoutStats::HistogramBucket(7), 2u);
+  EXPECT_EQ(LayoutStats::HistogramBucket(8), 3u);
+  EXPECT_EQ(LayoutStats::HistogramBucket(uint64_t{1} << 40), LayoutStats::kHistogramBuckets - 1);
+  EXPECT_EQ(LayoutStats::HistogramBucketName(0), "0-1");
+  EXPECT_EQ(LayoutStats::HistogramBucketName(2), "4-7");
+  EXPECT_EQ(LayoutStats::HistogramBucketName(LayoutStats::kHistogramBuckets - 1), "4294967296+");
+}
+
+TEST(LayoutStatsTest, DensityBuckets) {
+  EXPECT_EQ(LayoutStats::DensityBucket(0, 32), 0u);
+  EXPECT_EQ(LayoutStats::DensityBucket(1, 32), 1u);
+  EXPECT_EQ(LayoutStats::DensityBucket(8, 32), 1u);
+  EXPECT_EQ(LayoutStats::DensityBucket(9, 32), 2u);
+  EXPECT_EQ(LayoutStats::DensityBucket(24, 32), 3u);
+  EXPECT_EQ(LayoutStats::DensityBucket(31, 32), 4u);
+  EXPECT_EQ(LayoutStats::DensityBucket(32, 32), 5u);
+}
+
+TEST(LayoutStatsTest, FreeExtentsSpanBitmapWords) {
+  LayoutStatsBuilder builder(0);
+  // Blocks 0-3 allocated, 4-131 free, 132 allocated and 133-149 free.
+  uint64_t words[3] = {0xf, 0, 0x10};
+  builder.AddBlockBitmap(words, 150);
+  LayoutStats stats = builder.Finish();
+
+  EXPECT_EQ(stats.data_blocks, 150u);
+  EXPECT_EQ(stats.free_blocks, 145u);
+  EXPECT_EQ(stats.free_extents, 2u);
+  EXPECT_EQ(stats.largest_free_extent, 128u);
+  EXPECT_EQ(stats.free_extents_by_length[LayoutStats::HistogramBucket(128)], 1u);
+  EXPECT_EQ(stats.free_extents_by_length[LayoutStats::HistogramBucket(17)], 1u);
+}
+
+TEST(LayoutStatsTest, CountsFileExtents) {
+  LayoutStatsBuilder builder(2);
+  const Inode file = MakeInode(kMinfsMagicFile);
+
+  // Runs which continue on the device merge into one extent; a hole or a jump starts another.
+  builder.BeginFile(10, file);
+  builder.AddFileRun(0, 100, 4);
+  builder.AddFileRun(4, 104, 4);
+  builder.AddFileRun(9, 108, 1);
+  builder.AddFileRun(10, 200, 1);
+  builder.EndFile();
+
+  builder.BeginFile(11, file);
+  builder.AddFileRun(0, 300, 8);
+  builder.EndFile();
+
+  builder.BeginFile(12, file);
+  builder.AddFileRun(0, 400, 1);
+  builder.AddFileRun(1, 402, 1);
+  builder.EndFile();
+
+  // A file without blocks is not counted.
+  builder.BeginFile(13, file);
+  builder.EndFile();
+
+  LayoutStats stats = builder.Finish();
+  EXPECT_EQ(stats.mapped_files, 3u);
+  EXPECT_EQ(stats.mapped_blocks, 20u);
+  EXPECT_EQ(stats.file_extents, 6u);
+  EXPECT_EQ(stats.fragmented_files, 2u);
+  EXPECT_EQ(stats.files_by_extents[LayoutStats::HistogramBucket(1)], 1u);
+  EXPECT_EQ(stats.files_by_extents[LayoutStats::HistogramBucket(2)], 2u);
+
+  ASSERT_EQ(stats.most_fragmented.size(), 2u);
+  EXPECT_EQ(stats.most_fragmented[0].ino, 10u);
+  EXPECT_EQ(stats.most_fragmented[0].extents, 3u);
+  EXPECT_EQ(stats.most_fragmented[0].blocks, 10u);
+  EXPECT_EQ(stats.most_fragmented[1].ino, 12u);
+  EXPECT_EQ(stats.most_fragmented[1].extents, 2u);
+}
+
+TEST(LayoutStatsTest, CountsDirectoryFill) {
+  LayoutStatsBuilder builder(0);
+
+  builder.BeginFile(1, MakeInode(kMinfsMagicDir, 40));
+  builder.AddFileRun(0, 10, 2);
+  builder.EndFile();
+
+  // Directories with inline data are counted but have no blocks.
+  builder.BeginFile(2, MakeInode(kMinfsMagicDir, 2));
+  builder.EndFile();
+
+  LayoutStats stats = builder.Finish();
+  EXPECT_EQ(stats.directories, 2u);
+  EXPECT_EQ(stats.directory_entries, 42u);
+  EXPECT_EQ(stats.directory_blocks, 2u);
+  EXPECT_EQ(stats.directories_by_blocks[LayoutStats::HistogramBucket(2)], 1u);
+  EXPECT_EQ(stats.directories_by_entries_per_block[LayoutStats::HistogramBucket(20)], 1u);
+  EXPECT_EQ(stats.mapped_files, 1u);
+  EXPECT_TRUE(stats.most_fragmented.empty());
+}
+
+TEST(LayoutStatsTest, CountsInodeTableDensity) {
+  LayoutStatsBuilder builder(0);
+  builder.AddInodeTableBlock(32, 32);
+  builder.AddInodeTableBlock(3, 32);
+  builder.AddInodeTableBlock(0, 32);
+  builder.AddInodeTableBlock(0, 16);
+
+  LayoutStats stats = builder.Finish();
+  EXPECT_EQ(stats.inode_table_blocks, 4u);
+  EXPECT_EQ(stats.inode_capacity, 112u);
+  EXPECT_EQ(stats.allocated_inodes, 35u);
+  EXPECT_EQ(stats.inode_table_blocks_by_density[0], 2u);
+  EXPECT_EQ(stats.inode_table_blocks_by_density[1], 1u);
+  EXPECT_EQ(stats.inode_table_blocks_by_density[LayoutStats::kDensityBuckets - 1], 1u);
+}
+
+}  // namespace
+}  // namespace minfs
@@ -0,0 +1,133 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/lock_profile.h"
+
+#include <lib/async-loop/cpp/loop.h>
+#include <lib/async-loop/default.h>
+#include <lib/sync/completion.h>
+
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+#include <fbl/mutex.h>
+#include <gtest/gtest.h>
+
+#include "src/lib/storage/block_client/cpp/fake_block_device.h"
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/runner.h"
+
+namespace minfs {
+namespace {
+
+using block_client::FakeBlockDevice;
+
+TEST(LockProfileTest, DisabledProfileRecordsNothing) {
+  LockProfile profile;
+  std::mutex mutex;
+  { ProfiledLock lock(&mutex, &profile, LockSite::kBlockAllocator); }
+  { ProfiledLock lock(&mutex, nullptr, LockSite::kBlockAllocator); }
+  EXPECT_EQ(profile.Get(LockSite::kBlockAllocator).acquisitions, 0u);
+  EXPECT_EQ(profile.Get(LockSite::kBlockAllocator).hold.count, 0u);
+}
+
+TEST(LockProfileTest, RecordsUncontendedAcquisitions) {
+  LockProfile profile;
+  profile.SetEnabled(true);
+  fbl::Mutex mutex;
+  for (int i = 0; i < 3; ++i) {
+    ProfiledLock lock(&mutex, &profile, LockSite::kVnodeHash);
+  }
+  const LockProfile::Stats stats = profile.Get(LockSite::kVnodeHash);
+  EXPECT_EQ(stats.acquisitions, 3u);
+  EXPECT_EQ(stats.contended, 0u);
+  EXPECT_EQ(stats.wait.count, 0u);
+  EXPECT_EQ(stats.hold.count, 3u);
+  EXPECT_EQ(profile.Get(LockSite::kTransaction).acquisitions, 0u);
+
+  profile.Reset();
+  EXPECT_EQ(profile.Get(LockSite::kVnodeHash).acquisitions, 0u);
+  EXPECT_EQ(profile.Get(LockSite::kVnodeHash).hold.count, 0u);
+}
+
+TEST(LockProfileTest, RecordsContendedWaitAndHold) {
+  LockProfile profile;
+  profile.SetEnabled(true);
+  std::mutex mutex;
+  sync_completion_t locked;
+  std::thread holder([&] {
+    ProfiledLock lock(&mutex, &profile, LockSite::kInodeAllocator);
+    sync_completion_signal(&locked);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  });
+  sync_completion_wait(&locked, ZX_TIME_INFINITE);
+  { ProfiledLock lock(&mutex, &profile, LockSite::kInodeAllocator); }
+  holder.join();
+
+  const LockProfile::Stats stats = profile.Get(LockSite::kInodeAllocator);
+  EXPECT_EQ(stats.acquisitions, 2u);
+  EXPECT_EQ(stats.contended, 1u);
+  EXPECT_EQ(stats.wait.count, 1u);
+  EXPECT_GT(stats.wait.max_ns, 0u);
+  EXPECT_EQ(stats.hold.count, 2u);
+  EXPECT_GE(stats.hold.max_ns, 20'000'000u);
+}
+
+TEST(LockProfileTest, SharedLocksDoNotContendWithEachOther) {
+  LockProfile profile;
+  profile.SetEnabled(true);
+  std::shared_mutex mutex;
+  {
+    ProfiledSharedLock first(&mutex, &profile, LockSite::kBcache);
+    ProfiledSharedLock second(&mutex, &profile, LockSite::kBcache);
+  }
+  EXPECT_EQ(profile.Get(LockSite::kBcache).acquisitions, 2u);
+  EXPECT_EQ(profile.Get(LockSite::kBcache).contended, 0u);
+}
+
+TEST(LockProfileTest, ToJsonHasEverySite) {
+  LockProfile profile;
+  const std::string json = profile.ToJson();
+  EXPECT_NE(json.find("\"enabled\": false"), std::string::npos);
+  for (size_t i = 0; i < static_cast<size_t>(LockSite::kCount); ++i) {
+    EXPECT_NE(json.find(LockSiteName(static_cast<LockSite>(i))), std::string::npos);
+  }
+}
+
+TEST(LockProfileTest, MinfsProfilesLocksWhenMountedWithProfiling) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+  constexpr uint64_t kBlockCount = 1 << 15;
+  auto device = std::make_unique<FakeBlockDevice>(kBlockCount, kMinfsBlockSize);
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+  ASSERT_TRUE(Mkfs(bcache_or.value().get()).is_ok());
+  MountOptions options;
+  options.profile_locks = true;
+  auto fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), options);
+  ASSERT_TRUE(fs_or.is_ok());
+  LockProfile& profile = *fs_or->minfs().GetLockProfile();
+  EXPECT_TRUE(profile.enabled());
+  profile.Reset();
+  {
+    auto root_or = fs_or->minfs().VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+    fbl::RefPtr<fs::Vnode> file;
+    ASSERT_EQ(root_or->Create("file", 0, &file), ZX_OK);
+    ASSERT_EQ(file->Close(), ZX_OK);
+  }
+  ASSERT_TRUE(fs_or->minfs().BlockingJournalSync().is_ok());
+  for (LockSite site : {LockSite::kTransaction, LockSite::kVnodeHash, LockSite::kInodeAllocator,
+                        LockSite::kBcache}) {
+    const LockProfile::Stats stats = profile.Get(site);
+    EXPECT_GT(stats.acquisitions, 0u) << LockSiteName(site);
+    EXPECT_GT(stats.hold.count, 0u) << LockSiteName(site);
+  }
+  Runner::Destroy(std::move(fs_or.value()));
+}
+
+}  // namespace
+}  // namespace minfs
@@ -8,7 +8,11 @@
 #include <lib/async-loop/default.h>
 #include <zircon/device/block.h>
 
+#include <algorithm>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <utility>
 
 #include <disk_inspector/inspector_transaction_handler.h>
 #include <disk_inspector/vmo_buffer_factory.h>
@@ -18,6 +22,7 @@
 #include "src/lib/storage/block_client/cpp/fake_block_device.h"
 #include "src/lib/storage/vfs/cpp/journal/format.h"
 #include "src/storage/minfs/format.h"
+#include "src/storage/minfs/inspector/json_lines.h"
 #include "src/storage/minfs/runner.h"
 
 namespace minfs {
@@ -185,6 +190,158 @@ TEST_F(MinfsInspectorTest, CheckInodeAllocated) {
   }
 }
 
+TEST_F(MinfsInspectorTest, ScanInodesVisitsEveryInodeInOrder) {
+  std::unique_ptr<MinfsInspector> inspector = SetupMinfsInspector();
+  Superblock sb = inspector->InspectSuperblock();
+
+  // Chunks of one block exercise the boundaries between chunks.
+  std::vector<uint64_t> indices;
+  std::vector<uint64_t> allocated_indices;
+  ASSERT_EQ(inspector->ScanInodes(3, sb.inode_count, {.chunk_blocks = 1},
+                                  [&](uint64_t index, const Inode& inode, bool allocated) {
+                                    indices.push_back(index);
+                                    if (allocated) {
+                                      allocated_indices.push_back(index);
+                                    }
+                                    return ZX_OK;
+                                  }),
+            ZX_OK);
+  ASSERT_EQ(indices.size(), sb.inode_count - 3);
+  for (size_t i = 0; i < indices.size(); ++i) {
+    ASSERT_EQ(indices[i], i + 3);
+  }
+  EXPECT_TRUE(allocated_indices.empty());
+
+  // Only the reserved inode and the root directory are allocated.
+  std::vector<std::pair<uint64_t, uint32_t>> allocated;
+  ASSERT_EQ(inspector->ScanInodes(0, sb.inode_count, {.allocated_only = true},
+                                  [&](uint64_t index, const Inode& inode, bool is_allocated) {
+                                    EXPECT_TRUE(is_allocated);
+                                    allocated.emplace_back(index, inode.magic);
+                                    return ZX_OK;
+                                  }),
+            ZX_OK);
+  using Allocated = std::pair<uint64_t, uint32_t>;
+  EXPECT_THAT(allocated,
+              testing::ElementsAre(Allocated(0, 0), Allocated(kMinfsRootIno, kMinfsMagicDir)));
+}
+
+TEST_F(MinfsInspectorTest, ScanInodesInParallel) {
+  std::unique_ptr<MinfsInspector> inspector = SetupMinfsInspector();
+  Superblock sb = inspector->InspectSuperblock();
+
+  std::mutex mutex;
+  std::vector<uint64_t> indices;
+  ASSERT_EQ(inspector->ScanInodes(0, sb.inode_count, {.chunk_blocks = 2, .threads = 4},
+                                  [&](uint64_t index, const Inode& inode, bool allocated) {
+                                    std::lock_guard lock(mutex);
+                                    indices.push_back(index);
+                                    return ZX_OK;
+                                  }),
+            ZX_OK);
+  std::sort(indices.begin(), indices.end());
+  ASSERT_EQ(indices.size(), sb.inode_count);
+  for (size_t i = 0; i < indices.size(); ++i) {
+    ASSERT_EQ(indices[i], i);
+  }
+}
+
+TEST_F(MinfsInspectorTest, ScanInodesStopsOnError) {
+  std::unique_ptr<MinfsInspector> inspector = SetupMinfsInspector();
+  uint64_t visited = 0;
+  EXPECT_EQ(inspector->ScanInodes(0, inspector->GetInodeCount(), {},
+                                  [&](uint64_t index, const Inode& inode, bool allocated) {
+                                    ++visited;
+                                    return index == 5 ? ZX_ERR_STOP : ZX_OK;
+                                  }),
+            ZX_ERR_STOP);
+  EXPECT_EQ(visited, 6u);
+}
+
+TEST_F(MinfsInspectorTest, ScanBitmap) {
+  std::unique_ptr<MinfsInspector> inspector = SetupMinfsInspector();
+  Superblock sb = inspector->InspectSuperblock();
+
+  uint64_t bits = 0;
+  uint64_t allocated = 0;
+  ASSERT_EQ(inspector->ScanBitmap(MinfsInspector::BitmapKind::kBlock, 1,
+                                  [&](uint64_t first, const uint64_t* words, uint64_t count) {
+                                    EXPECT_EQ(first, bits);
+                                    for (uint64_t bit = 0; bit < count; ++bit) {
+                                      allocated += (words[bit / 64] >> (bit % 64)) & 1;
+                                    }
+                                    bits += count;
+                                    return ZX_OK;
+                                  }),
+            ZX_OK);
+  EXPECT_EQ(bits, sb.block_count);
+  EXPECT_EQ(allocated, sb.alloc_block_count);
+}
+
+TEST_F(MinfsInspectorTest, DumpAsJsonLines) {
+  std::unique_ptr<MinfsInspector> inspector = SetupMinfsInspector();
+  Superblock sb = inspector->InspectSuperblock();
+
+  std::ostringstream inodes;
+  ASSERT_EQ(DumpInodesAsJsonLines(inspector.get(), &inodes, 2, true), ZX_OK);
+  EXPECT_EQ(inodes.str(),
+            InodeToJson(0, Inode{}, true) + "\n" +
+                InodeToJson(kMinfsRootIno, inspector->InspectInodeRange(1, 2).value()[0], true) +
+                "\n");
+  EXPECT_THAT(inodes.str(), testing::HasSubstr("{\"type\": \"inode\", \"index\": 1, "
+                                               "\"allocated\": true"));
+
+  std::ostringstream bitmap;
+  ASSERT_EQ(DumpBitmapAsJsonLines(inspector.get(), MinfsInspector::BitmapKind::kBlock, &bitmap),
+            ZX_OK);
+  EXPECT_EQ(bitmap.str(),
+            "{\"type\": \"block_bitmap\", \"start\": 0, \"length\": 2, \"allocated\": true}\n"
+            "{\"type\": \"block_bitmap\", \"start\": 2, \"length\": " +
+                std::to_string(sb.block_count - 2) + ", \"allocated\": false}\n");
+
+  std::ostringstream journal;
+  ASSERT_EQ(DumpJournalAsJsonLines(inspector.get(), &journal), ZX_OK);
+  EXPECT_THAT(journal.str(), testing::StartsWith("{\"type\": \"journal_info\""));
+  EXPECT_THAT(journal.str(),
+              testing::HasSubstr("{\"type\": \"journal_entry\", \"index\": 0, \"kind\": "
+                                 "\"header\", \"sequence_number\": 0, \"payload_blocks\": 2}\n"));
+  EXPECT_THAT(journal.str(),
+              testing::HasSubstr("{\"type\": \"journal_entry\", \"index\": 3, \"kind\": "
+                                 "\"commit\", \"sequence_number\": 0}\n"));
+}
+
+TEST_F(MinfsInspectorTest, InspectLayout) {
+  std::unique_ptr<MinfsInspector> inspector = SetupMinfsInspector();
+  Superblock sb = inspector->InspectSuperblock();
+
+  auto result = inspector->InspectLayout(5);
+  ASSERT_TRUE(result.is_ok());
+  LayoutStats stats = result.take_value();
+
+  // The reserved block and the root directory's block are at the start of the data section, and
+  // the rest of it is a single free extent.
+  EXPECT_EQ(stats.data_blocks, sb.block_count);
+  EXPECT_EQ(stats.free_blocks, sb.block_count - sb.alloc_block_count);
+  EXPECT_EQ(stats.free_extents, 1u);
+  EXPECT_EQ(stats.largest_free_extent, stats.free_blocks);
+
+  // The root directory is the only file.
+  EXPECT_EQ(stats.mapped_files, 1u);
+  EXPECT_EQ(stats.file_extents, 1u);
+  EXPECT_EQ(stats.fragmented_files, 0u);
+  ASSERT_EQ(stats.most_fragmented.size(), 1u);
+  EXPECT_EQ(stats.most_fragmented[0].ino, kMinfsRootIno);
+  EXPECT_TRUE(stats.most_fragmented[0].directory);
+  EXPECT_EQ(stats.directories, 1u);
+  EXPECT_EQ(stats.directory_blocks, 1u);
+
+  EXPECT_EQ(stats.inode_capacity, sb.inode_count);
+  EXPECT_EQ(stats.allocated_inodes, sb.alloc_inode_count);
+  EXPECT_EQ(stats.inode_table_blocks,
+            (sb.inode_count + kMinfsInodesPerBlock - 1) / kMinfsInodesPerBlock);
+  EXPECT_EQ(stats.inode_table_blocks_by_density[0], stats.inode_table_blocks - 1);
+}
+
 TEST_F(MinfsInspectorTest, InspectJournalSuperblock) {
   std::unique_ptr<MinfsInspector> inspector = SetupMinfsInspector();
 
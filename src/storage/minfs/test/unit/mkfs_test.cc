@@ -2,12 +2,18 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <lib/async-loop/cpp/loop.h>
+#include <lib/async-loop/default.h>
+
+#include <string>
+
 #include <gtest/gtest.h>
 
 #include "src/lib/storage/block_client/cpp/fake_block_device.h"
 #include "src/storage/minfs/format.h"
 #include "src/storage/minfs/fsck.h"
 #include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/runner.h"
 
 namespace minfs {
 namespace {
@@ -68,5 +74,176 @@ TEST(FormatFilesystemTest, FilesystemFormatClearsJournal) {
   }
 }
 
+TEST(FormatFilesystemTest, FilesystemFormatClearsInodeTable) {
+  auto device = std::make_unique<FakeBlockDevice>(kBlockCount, kBlockSize);
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+  ASSERT_TRUE(Mkfs(bcache_or.value().get()).is_ok());
+
+  // Fill the inode table with sentinel pages.
+  auto superblock_or = LoadSuperblock(bcache_or.value().get());
+  ASSERT_TRUE(superblock_or.is_ok());
+  const uint32_t inode_blocks = BlocksRequiredForInode(superblock_or->inode_count);
+  storage::VmoBuffer buffer;
+  ASSERT_EQ(buffer.Initialize(bcache_or.value().get(), inode_blocks, kMinfsBlockSize,
+                              "inode-table-buffer"),
+            ZX_OK);
+  for (size_t i = 0; i < inode_blocks; i++) {
+    memset(buffer.Data(i), 'a', kMinfsBlockSize);
+  }
+  storage::Operation operation = {};
+  operation.type = storage::OperationType::kWrite;
+  operation.vmo_offset = 0;
+  operation.dev_offset = superblock_or->ino_block;
+  operation.length = inode_blocks;
+  ASSERT_EQ(bcache_or->RunOperation(operation, &buffer), ZX_OK);
+
+  // Re-format and verify every inode other than the root has been cleared.
+  ASSERT_TRUE(Mkfs(bcache_or.value().get()).is_ok());
+  operation.type = storage::OperationType::kRead;
+  ASSERT_EQ(bcache_or->RunOperation(operation, &buffer), ZX_OK);
+  for (ino_t ino = 0; ino < superblock_or->inode_count; ino++) {
+    const Inode* inode = reinterpret_cast<const Inode*>(
+        static_cast<const uint8_t*>(buffer.Data(ino / kMinfsInodesPerBlock)) +
+        (ino % kMinfsInodesPerBlock) * kMinfsInodeSize);
+    if (ino == kMinfsRootIno) {
+      EXPECT_EQ(inode->magic, kMinfsMagicDir);
+    } else {
+      EXPECT_EQ(inode->magic, 0u) << "ino " << ino;
+    }
+  }
+
+  EXPECT_TRUE(Fsck(std::move(bcache_or.value()), FsckOptions()).is_ok());
+}
+
+// Formats |bcache| with kMinfsFlagLazyInodeTable over an inode table filled with sentinel pages,
+// on which lazy initialisation must not depend, and leaves |buffer| holding the sentinel table.
+void FormatLazyOverSentinels(Bcache* bcache, storage::VmoBuffer* buffer) {
+  ASSERT_TRUE(Mkfs(bcache).is_ok());
+  auto superblock_or = LoadSuperblock(bcache);
+  ASSERT_TRUE(superblock_or.is_ok());
+  const uint32_t inode_blocks = BlocksRequiredForInode(superblock_or->inode_count);
+  ASSERT_EQ(buffer->Initialize(bcache, inode_blocks, kMinfsBlockSize, "inode-table-buffer"),
+            ZX_OK);
+  for (size_t i = 0; i < inode_blocks; i++) {
+    memset(buffer->Data(i), 'a', kMinfsBlockSize);
+  }
+  ASSERT_EQ(bcache->RunOperation(
+                storage::Operation{.type = storage::OperationType::kWrite,
+                                   .vmo_offset = 0,
+                                   .dev_offset = superblock_or->ino_block,
+                                   .length = inode_blocks},
+                buffer),
+            ZX_OK);
+  ASSERT_TRUE(Mkfs(MountOptions{.lazy_inode_table_init = true}, bcache).is_ok());
+}
+
+TEST(FormatFilesystemTest, LazyInodeTableIsInitialisedOnDemand) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+  auto device = std::make_unique<FakeBlockDevice>(kBlockCount, kBlockSize);
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+
+  storage::VmoBuffer buffer;
+  ASSERT_NO_FATAL_FAILURE(FormatLazyOverSentinels(bcache_or.value().get(), &buffer));
+  auto superblock_or = LoadSuperblock(bcache_or.value().get());
+  ASSERT_TRUE(superblock_or.is_ok());
+  EXPECT_TRUE(superblock_or->GetFlagLazyInodeTable());
+  EXPECT_EQ(superblock_or->ino_init_blocks, 1u);
+
+  // Allocate enough inodes to spill into the second inode table block.
+  auto fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), MountOptions());
+  ASSERT_TRUE(fs_or.is_ok());
+  {
+    auto root_or = fs_or->minfs().VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+    for (uint32_t i = 0; i < kMinfsInodesPerBlock; i++) {
+      fbl::RefPtr<fs::Vnode> child;
+      ASSERT_EQ(root_or->Create(std::to_string(i), 0, &child), ZX_OK);
+      EXPECT_EQ(child->Close(), ZX_OK);
+    }
+  }
+  EXPECT_EQ(fs_or->minfs().Info().ino_init_blocks, 2u);
+  auto bcache = Runner::Destroy(std::move(fs_or.value()));
+
+  // Free inodes in the newly initialised block must have been cleared.
+  ASSERT_EQ(bcache->RunOperation(
+                storage::Operation{.type = storage::OperationType::kRead,
+                                   .vmo_offset = 0,
+                                   .dev_offset = superblock_or->ino_block,
+                                   .length = 2},
+                &buffer),
+            ZX_OK);
+  const Inode* inodes = static_cast<const Inode*>(buffer.Data(1));
+  EXPECT_EQ(inodes[kMinfsInodesPerBlock - 1].magic, 0u);
+
+  EXPECT_TRUE(Fsck(std::move(bcache), FsckOptions()).is_ok());
+}
+
+TEST(FormatFilesystemTest, LazyInodeTableInitialisesOnlyTheBlocksWritten) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+  auto device = std::make_unique<FakeBlockDevice>(kBlockCount, kBlockSize);
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+
+  storage::VmoBuffer buffer;
+  ASSERT_NO_FATAL_FAILURE(FormatLazyOverSentinels(bcache_or.value().get(), &buffer));
+  auto superblock_or = LoadSuperblock(bcache_or.value().get());
+  ASSERT_TRUE(superblock_or.is_ok());
+  ASSERT_EQ(superblock_or->ino_init_blocks, 1u);
+
+  auto fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), MountOptions());
+  ASSERT_TRUE(fs_or.is_ok());
+  Minfs& fs = fs_or->minfs();
+  auto update_inode_in_block = [&fs](blk_t block) {
+    auto transaction_or = fs.BeginTransaction(0, 0);
+    ASSERT_TRUE(transaction_or.is_ok());
+    const Inode inode = {};
+    fs.InodeUpdate(transaction_or.value().get(), block * kMinfsInodesPerBlock, &inode);
+    fs.CommitTransaction(std::move(transaction_or.value()));
+  };
+
+  // Writing far beyond the high-water mark initialises only the block written, and leaves the mark.
+  ASSERT_NO_FATAL_FAILURE(update_inode_in_block(3));
+  EXPECT_EQ(fs.Info().ino_init_blocks, 1u);
+
+  // The mark passes the block once those before it have been initialised.
+  ASSERT_NO_FATAL_FAILURE(update_inode_in_block(1));
+  EXPECT_EQ(fs.Info().ino_init_blocks, 2u);
+  auto bcache = Runner::Destroy(std::move(fs_or.value()));
+
+  ASSERT_EQ(bcache->RunOperation(
+                storage::Operation{.type = storage::OperationType::kRead,
+                                   .vmo_offset = 0,
+                                   .dev_offset = superblock_or->ino_block,
+                                   .length = 4},
+                &buffer),
+            ZX_OK);
+  for (blk_t block : {1, 3}) {
+    const Inode* inodes = static_cast<const Inode*>(buffer.Data(block));
+    EXPECT_EQ(inodes[1].magic, 0u) << "block " << block;
+  }
+  const uint8_t* untouched = static_cast<const uint8_t*>(buffer.Data(2));
+  EXPECT_EQ(untouched[0], 'a');
+
+  fs_or = Runner::Create(loop.dispatcher(), std::move(bcache), MountOptions());
+  ASSERT_TRUE(fs_or.is_ok());
+  Minfs& remounted = fs_or->minfs();
+  EXPECT_EQ(remounted.Info().ino_init_blocks, 2u);
+  {
+    auto transaction_or = remounted.BeginTransaction(0, 0);
+    ASSERT_TRUE(transaction_or.is_ok());
+    const Inode inode = {};
+    remounted.InodeUpdate(transaction_or.value().get(), 2 * kMinfsInodesPerBlock, &inode);
+    remounted.CommitTransaction(std::move(transaction_or.value()));
+  }
+  // Block 3 was initialised before the remount, but that is no longer known, so the mark stops
+  // short of it. This is safe, since initialising a block again only zeroes free inodes.
+  EXPECT_EQ(remounted.Info().ino_init_blocks, 3u);
+  bcache = Runner::Destroy(std::move(fs_or.value()));
+
+  EXPECT_TRUE(Fsck(std::move(bcache), FsckOptions()).is_ok());
+}
+
 }  // namespace
 }  // namespace minfs
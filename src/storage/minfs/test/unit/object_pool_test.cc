@@ -0,0 +1,149 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/object_pool.h"
+
+#include <lib/async-loop/cpp/loop.h>
+#include <lib/async-loop/default.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "src/lib/storage/block_client/cpp/fake_block_device.h"
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/runner.h"
+#include "src/storage/minfs/vnode.h"
+#include "src/storage/minfs/writeback.h"
+
+namespace {
+
+// Counts the heap allocations made through the global operator new by every thread, so that the
+// tests can check that the pools, rather than the heap, supply memory.
+std::atomic<uint64_t> heap_allocations = 0;
+
+}  // namespace
+
+void* operator new(size_t size) {
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* block = malloc(size == 0 ? 1 : size);
+  if (block == nullptr) {
+    abort();
+  }
+  return block;
+}
+
+void operator delete(void* block) noexcept { free(block); }
+void operator delete(void* block, size_t) noexcept { free(block); }
+
+namespace minfs {
+namespace {
+
+using block_client::FakeBlockDevice;
+
+struct Pooled : public PooledObject<Pooled> {
+  uint64_t values[4] = {};
+};
+
+TEST(ObjectPoolTest, RecyclesFreedObjects) {
+  auto first = std::make_unique<Pooled>();
+  Pooled* address = first.get();
+  first.reset();
+
+  const ObjectPoolStats before = GetObjectPoolStats();
+  const uint64_t allocations = heap_allocations.load();
+  auto second = std::make_unique<Pooled>();
+  EXPECT_EQ(heap_allocations.load(), allocations);
+  EXPECT_EQ(second.get(), address);
+  const ObjectPoolStats after = GetObjectPoolStats();
+  EXPECT_EQ(after.pool_misses, before.pool_misses);
+  EXPECT_EQ(after.recycled_allocations, before.recycled_allocations + 1);
+}
+
+TEST(ObjectPoolTest, ObjectsFreedByOtherThreadsAreRecycled) {
+  constexpr size_t kCount = 100;
+  std::vector<std::unique_ptr<Pooled>> objects;
+  for (size_t i = 0; i < kCount; ++i) {
+    objects.push_back(std::make_unique<Pooled>());
+  }
+  // The thread's cache is given to the depot when it exits.
+  std::thread([&objects] { objects.clear(); }).join();
+
+  const ObjectPoolStats before = GetObjectPoolStats();
+  objects.reserve(kCount);
+  for (size_t i = 0; i < kCount; ++i) {
+    objects.push_back(std::make_unique<Pooled>());
+  }
+  EXPECT_EQ(GetObjectPoolStats().pool_misses, before.pool_misses);
+}
+
+TEST(ObjectPoolTest, VectorPoolRecyclesStorage) {
+  std::vector<int> vector = VectorPool<int>::Take();
+  vector.resize(VectorPool<int>::kMaxCapacity);
+  const int* storage = vector.data();
+  VectorPool<int>::Give(std::move(vector));
+
+  const uint64_t allocations = heap_allocations.load();
+  vector = VectorPool<int>::Take();
+  EXPECT_TRUE(vector.empty());
+  vector.resize(VectorPool<int>::kMaxCapacity);
+  EXPECT_EQ(vector.data(), storage);
+  EXPECT_EQ(heap_allocations.load(), allocations);
+}
+
+TEST(ObjectPoolTest, SteadyStateTransactionsRecyclePooledObjects) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+  constexpr uint64_t kBlockCount = 1 << 15;
+  auto device = std::make_unique<FakeBlockDevice>(kBlockCount, kMinfsBlockSize);
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+  ASSERT_TRUE(Mkfs(bcache_or.value().get()).is_ok());
+  auto fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), MountOptions());
+  ASSERT_TRUE(fs_or.is_ok());
+  Minfs& minfs = fs_or->minfs();
+
+  auto root_or = minfs.VnodeGet(kMinfsRootIno);
+  ASSERT_TRUE(root_or.is_ok());
+  fbl::RefPtr<VnodeMinfs> root = std::move(root_or.value());
+
+  // Each round allocates a block in one transaction and frees it in another, whose deallocations
+  // are destroyed by the journal once written. Building a transaction must not touch the heap once
+  // the pools are warm. Committing it still does, for the operation vectors and the journal's
+  // closures, so only the pooled objects are checked across the commit.
+  constexpr int kWarmUpRounds = 100;
+  constexpr int kMeasuredRounds = 100;
+  uint64_t pool_misses = 0;
+  for (int round = 0; round < kWarmUpRounds + kMeasuredRounds; ++round) {
+    if (round == kWarmUpRounds) {
+      pool_misses = GetObjectPoolStats().pool_misses;
+    }
+    const uint64_t allocations = heap_allocations.load();
+    auto transaction_or = minfs.BeginTransaction(0, 1);
+    ASSERT_TRUE(transaction_or.is_ok());
+    const size_t block = transaction_or->AllocateBlock();
+    transaction_or->PinVnode(root);
+    if (round >= kWarmUpRounds) {
+      EXPECT_EQ(heap_allocations.load(), allocations) << "round " << round;
+    }
+    minfs.CommitTransaction(std::move(transaction_or.value()));
+
+    transaction_or = minfs.BeginTransaction(0, 0);
+    ASSERT_TRUE(transaction_or.is_ok());
+    transaction_or->DeallocateBlock(block);
+    minfs.CommitTransaction(std::move(transaction_or.value()));
+    ASSERT_TRUE(minfs.BlockingJournalSync().is_ok());
+  }
+  EXPECT_EQ(GetObjectPoolStats().pool_misses, pool_misses);
+  root.reset();
+  Runner::Destroy(std::move(fs_or.value()));
+}
+
+}  // namespace
+}  // namespace minfs
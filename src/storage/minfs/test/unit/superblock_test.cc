@@ -330,6 +330,21 @@ TEST(SuperblockTest, SupportedBlockSize) {
   info.BlockSize();
 }
 
+TEST(SuperblockTest, FeatureVersionRequiresFeatureFlags) {
+  Superblock info = {};
+  FillSuperblockFields(&info);
+  info.major_version = kMinfsMajorVersionFeatures;
+  minfs::UpdateChecksum(&info);
+  EXPECT_EQ(CheckSuperblock(info, info.dat_block + info.block_count).status_value(),
+            ZX_ERR_NOT_SUPPORTED);
+
+  info.major_version = kMinfsCurrentMajorVersion;
+  info.flags |= kMinfsFlagExtents;
+  minfs::UpdateChecksum(&info);
+  EXPECT_EQ(CheckSuperblock(info, info.dat_block + info.block_count).status_value(),
+            ZX_ERR_IO_DATA_INTEGRITY);
+}
+
 TEST(SuperblockTest, GetFvmFlag) {
   Superblock info;
   FillSuperblockFields(&info);
@@ -6,7 +6,13 @@
 #include <lib/async-loop/default.h>
 #include <lib/fit/defer.h>
 
+#include <vector>
+
+#include "src/lib/storage/block_client/cpp/fake_block_device.h"
+#include "src/storage/minfs/file.h"
+#include "src/storage/minfs/fsck.h"
 #include "src/storage/minfs/test/unit/journal_integration_fixture.h"
+#include "src/storage/minfs/transaction_limits.h"
 
 namespace minfs {
 namespace {
@@ -65,5 +71,153 @@ TEST_F(TruncateTest, EnsureOldDataWhenTransactionFails) {
   }
 }
 
+// A file with more blocks than one transaction releases, followed by a hole of several gigabytes
+// and one more block.
+constexpr size_t kDenseBlocks = TransactionLimits::kMaxReleaseBlocks * 3 / 2;
+constexpr size_t kFarOffset = size_t{3} << 30;
+
+void WriteSparseFile(fs::Vnode* file) {
+  std::vector<uint8_t> data(TransactionLimits::kMaxWriteBytes, kFill);
+  size_t written;
+  for (size_t offset = 0; offset < kDenseBlocks * kMinfsBlockSize; offset += data.size()) {
+    ASSERT_EQ(file->Write(data.data(), data.size(), offset, &written), ZX_OK);
+    ASSERT_EQ(written, data.size());
+  }
+  ASSERT_EQ(file->Write(data.data(), kMinfsBlockSize, kFarOffset, &written), ZX_OK);
+  ASSERT_EQ(written, kMinfsBlockSize);
+}
+
+std::unique_ptr<Bcache> CreateMinfsDevice() {
+  constexpr uint64_t kDeviceBlocks = 1 << 20;
+  auto device =
+      std::make_unique<block_client::FakeBlockDevice>(kDeviceBlocks, kMinfsBlockSize);
+  auto bcache_or = Bcache::Create(std::move(device), kDeviceBlocks);
+  EXPECT_TRUE(bcache_or.is_ok());
+  EXPECT_TRUE(Mkfs(bcache_or.value().get()).is_ok());
+  return std::move(bcache_or.value());
+}
+
+TEST(LargeTruncateTest, ReleaseSkipsHoles) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+  auto fs_or = Runner::Create(loop.dispatcher(), CreateMinfsDevice(), MountOptions());
+  ASSERT_TRUE(fs_or.is_ok());
+  Minfs& fs = fs_or->minfs();
+  const uint32_t initial_block_count = fs.Info().alloc_block_count;
+  {
+    auto root_or = fs.VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+    fbl::RefPtr<fs::Vnode> fs_file;
+    ASSERT_EQ(root_or->Create("foo", 0, &fs_file), ZX_OK);
+    auto file = fbl::RefPtr<File>::Downcast(std::move(fs_file));
+    ASSERT_NO_FATAL_FAILURE(WriteSparseFile(file.get()));
+    ASSERT_TRUE(file->FlushCachedWrites().is_ok());
+    const LatencyHistogram& commits = fs.Latencies().Get(LatencyPhase::kCommitTransaction);
+    const uint64_t commits_before = commits.GetSnapshot().count;
+
+    // One transaction sets the size, and the rest each release up to kMaxReleaseBlocks blocks,
+    // however large the hole between them.
+    ASSERT_EQ(file->Truncate(0), ZX_OK);
+    EXPECT_LE(commits.GetSnapshot().count - commits_before, 3u);
+
+    EXPECT_EQ(fs.Info().unlinked_head, 0u);
+    EXPECT_EQ(file->GetInode()->block_count, 0u);
+    EXPECT_EQ(fs.Info().alloc_block_count, initial_block_count);
+    ASSERT_EQ(file->Close(), ZX_OK);
+  }
+  EXPECT_TRUE(Fsck(Runner::Destroy(std::move(fs_or.value())), FsckOptions()).is_ok());
+}
+
+TEST(LargeTruncateTest, ReleaseIsDeferredToBackground) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+  MountOptions options;
+  options.purge_unlinked_in_background = true;
+  auto fs_or = Runner::Create(loop.dispatcher(), CreateMinfsDevice(), options);
+  ASSERT_TRUE(fs_or.is_ok());
+  Minfs& fs = fs_or->minfs();
+  const uint32_t initial_block_count = fs.Info().alloc_block_count;
+  {
+    auto root_or = fs.VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+    fbl::RefPtr<fs::Vnode> file;
+    ASSERT_EQ(root_or->Create("foo", 0, &file), ZX_OK);
+    ASSERT_NO_FATAL_FAILURE(WriteSparseFile(file.get()));
+    const ino_t ino = fbl::RefPtr<File>::Downcast(file)->GetIno();
+
+    // The truncation returns with the new size, leaving the file's blocks to the background.
+    ASSERT_EQ(file->Truncate(kMinfsBlockSize), ZX_OK);
+    fs::VnodeAttributes attributes;
+    ASSERT_EQ(file->GetAttributes(&attributes), ZX_OK);
+    EXPECT_EQ(attributes.content_size, kMinfsBlockSize);
+    EXPECT_EQ(fs.Info().unlinked_head, ino);
+    EXPECT_GE(fs.Info().alloc_block_count, initial_block_count + kDenseBlocks);
+
+    loop.RunUntilIdle();
+    EXPECT_EQ(fs.Info().unlinked_head, 0u);
+    EXPECT_EQ(fs.Info().unlinked_tail, 0u);
+    EXPECT_EQ(fs.Info().alloc_block_count, initial_block_count + 1);
+    ASSERT_EQ(file->Close(), ZX_OK);
+  }
+  EXPECT_TRUE(Fsck(Runner::Destroy(std::move(fs_or.value())), FsckOptions()).is_ok());
+}
+
+TEST(LargeTruncateTest, ExtendingFinishesRelease) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+  MountOptions options;
+  options.purge_unlinked_in_background = true;
+  auto fs_or = Runner::Create(loop.dispatcher(), CreateMinfsDevice(), options);
+  ASSERT_TRUE(fs_or.is_ok());
+  Minfs& fs = fs_or->minfs();
+  {
+    auto root_or = fs.VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+    fbl::RefPtr<fs::Vnode> file;
+    ASSERT_EQ(root_or->Create("foo", 0, &file), ZX_OK);
+    ASSERT_NO_FATAL_FAILURE(WriteSparseFile(file.get()));
+    ASSERT_EQ(file->Truncate(kMinfsBlockSize), ZX_OK);
+    ASSERT_NE(fs.Info().unlinked_head, 0u);
+
+    // Growing the file again before the background release has run must not bring back the
+    // truncated contents.
+    ASSERT_EQ(file->Truncate(kDenseBlocks * kMinfsBlockSize), ZX_OK);
+    EXPECT_EQ(fs.Info().unlinked_head, 0u);
+    std::vector<uint8_t> data(kMinfsBlockSize);
+    size_t read;
+    ASSERT_EQ(file->Read(data.data(), data.size(), 2 * kMinfsBlockSize, &read), ZX_OK);
+    ASSERT_EQ(read, data.size());
+    EXPECT_EQ(data, std::vector<uint8_t>(kMinfsBlockSize, 0));
+    ASSERT_EQ(file->Close(), ZX_OK);
+  }
+  loop.RunUntilIdle();
+  EXPECT_TRUE(Fsck(Runner::Destroy(std::move(fs_or.value())), FsckOptions()).is_ok());
+}
+
+TEST(LargeTruncateTest, PendingReleaseResumesOnRemount) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+  MountOptions options;
+  options.purge_unlinked_in_background = true;
+  auto fs_or = Runner::Create(loop.dispatcher(), CreateMinfsDevice(), options);
+  ASSERT_TRUE(fs_or.is_ok());
+  const uint32_t initial_block_count = fs_or->minfs().Info().alloc_block_count;
+  {
+    auto root_or = fs_or->minfs().VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+    fbl::RefPtr<fs::Vnode> file;
+    ASSERT_EQ(root_or->Create("foo", 0, &file), ZX_OK);
+    ASSERT_NO_FATAL_FAILURE(WriteSparseFile(file.get()));
+    ASSERT_EQ(file->Truncate(kMinfsBlockSize), ZX_OK);
+    ASSERT_EQ(file->Close(), ZX_OK);
+  }
+
+  // Unmount before the background release has run. The volume is consistent, and the next mount
+  // completes the release.
+  auto bcache_or = Fsck(Runner::Destroy(std::move(fs_or.value())), FsckOptions());
+  ASSERT_TRUE(bcache_or.is_ok());
+  fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), MountOptions());
+  ASSERT_TRUE(fs_or.is_ok());
+  EXPECT_EQ(fs_or->minfs().Info().unlinked_head, 0u);
+  EXPECT_EQ(fs_or->minfs().Info().alloc_block_count, initial_block_count + 1);
+  EXPECT_TRUE(Fsck(Runner::Destroy(std::move(fs_or.value())), FsckOptions()).is_ok());
+}
+
 }  // namespace
 }  // namespace minfs
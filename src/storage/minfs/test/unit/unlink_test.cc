@@ -5,6 +5,8 @@
 #include <lib/async-loop/cpp/loop.h>
 #include <lib/async-loop/default.h>
 
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include "src/lib/storage/block_client/cpp/fake_block_device.h"
@@ -12,7 +14,10 @@
 #include "src/storage/minfs/directory.h"
 #include "src/storage/minfs/file.h"
 #include "src/storage/minfs/format.h"
+#include "src/storage/minfs/fsck.h"
+#include "src/storage/minfs/minfs_private.h"
 #include "src/storage/minfs/runner.h"
+#include "src/storage/minfs/transaction_limits.h"
 
 namespace minfs {
 namespace {
@@ -87,5 +92,223 @@ TEST(UnlinkTest, UnlinkedDirectoryFailure) {
   [[maybe_unused]] auto bcache = Runner::Destroy(std::move(fs_or.value()));
 }
 
+TEST(UnlinkTest, PurgeUnlinkedSkipsOpenVnodes) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+
+  constexpr uint64_t kBlockCount = 1 << 20;
+  auto device = std::make_unique<FakeBlockDevice>(kBlockCount, kMinfsBlockSize);
+
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+  ASSERT_TRUE(Mkfs(bcache_or.value().get()).is_ok());
+
+  auto fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), MountOptions());
+  ASSERT_TRUE(fs_or.is_ok());
+  {
+    auto root_or = fs_or->minfs().VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+
+    // Unlink several files while they are still open, leaving them on the unlinked list.
+    constexpr int kFileCount = 4;
+    fbl::RefPtr<fs::Vnode> children[kFileCount];
+    for (auto& child : children) {
+      ASSERT_EQ(root_or->Create("foo", 0, &child), ZX_OK);
+      ASSERT_EQ(root_or->Unlink("foo", /*must_be_dir=*/false), ZX_OK);
+    }
+    EXPECT_NE(fs_or->minfs().Info().unlinked_head, 0u);
+
+    // Open vnodes are purged when they are closed, not by a purge of the unlinked list.
+    size_t purged_count;
+    auto progress_or = fs_or->minfs().PurgeUnlinkedBatch(&purged_count);
+    ASSERT_TRUE(progress_or.is_ok());
+    EXPECT_FALSE(progress_or.value());
+    EXPECT_EQ(purged_count, 0u);
+
+    for (auto& child : children) {
+      EXPECT_EQ(child->Close(), ZX_OK);
+    }
+    EXPECT_EQ(fs_or->minfs().Info().unlinked_head, 0u);
+    EXPECT_EQ(fs_or->minfs().Info().unlinked_tail, 0u);
+  }
+
+  [[maybe_unused]] auto bcache = Runner::Destroy(std::move(fs_or.value()));
+}
+
+TEST(UnlinkTest, LargeFileBlocksAreReleasedInBackground) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+
+  constexpr uint64_t kBlockCount = 1 << 20;
+  auto device = std::make_unique<FakeBlockDevice>(kBlockCount, kMinfsBlockSize);
+
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+  ASSERT_TRUE(Mkfs(bcache_or.value().get()).is_ok());
+
+  MountOptions options = {};
+  options.purge_unlinked_in_background = true;
+  auto fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), options);
+  ASSERT_TRUE(fs_or.is_ok());
+  Minfs& fs = fs_or->minfs();
+  const uint32_t initial_block_count = fs.Info().alloc_block_count;
+  {
+    auto root_or = fs.VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+
+    // Write a file which takes several transactions to release.
+    constexpr size_t kFileBlocks = 3 * TransactionLimits::kMaxReleaseBlocks;
+    fbl::RefPtr<fs::Vnode> child;
+    ASSERT_EQ(root_or->Create("foo", 0, &child), ZX_OK);
+    std::vector<uint8_t> data(TransactionLimits::kMaxWriteBytes, 0xaa);
+    for (size_t offset = 0; offset < kFileBlocks * kMinfsBlockSize; offset += data.size()) {
+      size_t written;
+      ASSERT_EQ(child->Write(data.data(), data.size(), offset, &written), ZX_OK);
+      ASSERT_EQ(written, data.size());
+    }
+    const ino_t ino = fbl::RefPtr<File>::Downcast(child)->GetIno();
+    ASSERT_EQ(child->Close(), ZX_OK);
+    child.reset();
+    ASSERT_GE(fs.Info().alloc_block_count, initial_block_count + kFileBlocks);
+
+    // Unlinking queues the file for the background purge rather than freeing its blocks.
+    ASSERT_EQ(root_or->Unlink("foo", /*must_be_dir=*/false), ZX_OK);
+    EXPECT_EQ(fs.Info().unlinked_head, ino);
+    EXPECT_GE(fs.Info().alloc_block_count, initial_block_count + kFileBlocks);
+  }
+
+  loop.RunUntilIdle();
+  EXPECT_EQ(fs.Info().unlinked_head, 0u);
+  EXPECT_EQ(fs.Info().unlinked_tail, 0u);
+  EXPECT_EQ(fs.Info().alloc_block_count, initial_block_count);
+
+  [[maybe_unused]] auto bcache = Runner::Destroy(std::move(fs_or.value()));
+}
+
+// Returns a volume holding |count| orphans, as left by a crash while files which had been unlinked
+// were still open. Each orphan has one data block.
+zx::status<std::unique_ptr<Bcache>> CreateOrphans(async::Loop& loop, int count) {
+  constexpr uint64_t kBlockCount = 1 << 17;
+  auto device = std::make_unique<FakeBlockDevice>(kBlockCount, kMinfsBlockSize);
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  if (bcache_or.is_error()) {
+    return bcache_or.take_error();
+  }
+  if (auto status = Mkfs(bcache_or.value().get()); status.is_error()) {
+    return status.take_error();
+  }
+  auto fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), MountOptions());
+  if (fs_or.is_error()) {
+    return fs_or.take_error();
+  }
+  Minfs& fs = fs_or->minfs();
+  Bcache& bcache = *fs.GetMutableBcache();
+
+  std::vector<fbl::RefPtr<fs::Vnode>> children(count);
+  {
+    auto root_or = fs.VnodeGet(kMinfsRootIno);
+    if (root_or.is_error()) {
+      return root_or.take_error();
+    }
+    std::vector<uint8_t> data(kMinfsBlockSize, 0xaa);
+    for (auto& child : children) {
+      size_t written;
+      if (zx_status_t status = root_or->Create("foo", 0, &child); status != ZX_OK) {
+        return zx::error(status);
+      }
+      if (zx_status_t status = child->Write(data.data(), data.size(), 0, &written);
+          status != ZX_OK) {
+        return zx::error(status);
+      }
+      if (zx_status_t status = root_or->Unlink("foo", /*must_be_dir=*/false); status != ZX_OK) {
+        return zx::error(status);
+      }
+    }
+  }
+
+  // Take a copy of the device while the files are open, as a crash would leave it.
+  if (auto status = fs.BlockingJournalSync(); status.is_error()) {
+    return status.take_error();
+  }
+  std::vector<uint8_t> image(size_t{bcache.Maxblk()} * kMinfsBlockSize);
+  for (blk_t bno = 0; bno < bcache.Maxblk(); ++bno) {
+    if (auto status = bcache.Readblk(bno, &image[size_t{bno} * kMinfsBlockSize]);
+        status.is_error()) {
+      return status.take_error();
+    }
+  }
+
+  for (auto& child : children) {
+    if (zx_status_t status = child->Close(); status != ZX_OK) {
+      return zx::error(status);
+    }
+  }
+  children.clear();
+  std::unique_ptr<Bcache> result = Runner::Destroy(std::move(fs_or.value()));
+  for (blk_t bno = 0; bno < result->Maxblk(); ++bno) {
+    if (auto status = result->Writeblk(bno, &image[size_t{bno} * kMinfsBlockSize]);
+        status.is_error()) {
+      return status.take_error();
+    }
+  }
+  return zx::ok(std::move(result));
+}
+
+TEST(UnlinkTest, OrphansArePurgedInBatchesAfterRemount) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+  constexpr int kOrphanCount = 64;
+  auto bcache_or = CreateOrphans(loop, kOrphanCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+
+  // Mount without running the background purge, so that the test can run it a batch at a time.
+  MountOptions options = {};
+  options.purge_unlinked_in_background = true;
+  auto fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), options);
+  ASSERT_TRUE(fs_or.is_ok());
+  Minfs& fs = fs_or->minfs();
+  ASSERT_NE(fs.Info().unlinked_head, 0u);
+  const uint32_t orphaned_inode_count = fs.Info().alloc_inode_count;
+
+  int batches = 0;
+  size_t total_purged = 0;
+  while (fs.Info().unlinked_head != 0) {
+    size_t purged_count;
+    auto progress_or = fs.PurgeUnlinkedBatch(&purged_count);
+    ASSERT_TRUE(progress_or.is_ok());
+    ASSERT_TRUE(progress_or.value());
+    ++batches;
+    total_purged += purged_count;
+  }
+  EXPECT_EQ(total_purged, size_t{kOrphanCount});
+  EXPECT_LT(batches, kOrphanCount);
+  EXPECT_EQ(fs.Info().unlinked_tail, 0u);
+  EXPECT_EQ(fs.Info().alloc_inode_count, orphaned_inode_count - kOrphanCount);
+
+  auto bcache = Runner::Destroy(std::move(fs_or.value()));
+  EXPECT_TRUE(Fsck(std::move(bcache), FsckOptions()).is_ok());
+}
+
+TEST(UnlinkTest, MountPurgesOrphansInBackground) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+  constexpr int kOrphanCount = 64;
+  auto bcache_or = CreateOrphans(loop, kOrphanCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+
+  MountOptions options = {};
+  options.purge_unlinked_in_background = true;
+  auto fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), options);
+  ASSERT_TRUE(fs_or.is_ok());
+  Minfs& fs = fs_or->minfs();
+
+  // The mount returns before the orphans are purged, and the purge runs on the dispatcher.
+  EXPECT_NE(fs.Info().unlinked_head, 0u);
+  const uint32_t orphaned_inode_count = fs.Info().alloc_inode_count;
+  loop.RunUntilIdle();
+  EXPECT_EQ(fs.Info().unlinked_head, 0u);
+  EXPECT_EQ(fs.Info().unlinked_tail, 0u);
+  EXPECT_EQ(fs.Info().alloc_inode_count, orphaned_inode_count - kOrphanCount);
+
+  auto bcache = Runner::Destroy(std::move(fs_or.value()));
+  EXPECT_TRUE(Fsck(std::move(bcache), FsckOptions()).is_ok());
+}
+
 }  // namespace
 }  // namespace minfs
@@ -0,0 +1,125 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/write_amplification.h"
+
+#include <lib/async-loop/cpp/loop.h>
+#include <lib/async-loop/default.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "src/lib/storage/block_client/cpp/fake_block_device.h"
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/format.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/runner.h"
+
+namespace minfs {
+namespace {
+
+using block_client::FakeBlockDevice;
+using Category = WriteAmplification::Category;
+
+storage::Operation Write(uint64_t block, uint64_t length) {
+  return storage::Operation{
+      .type = storage::OperationType::kWrite, .dev_offset = block, .length = length};
+}
+
+class WriteAmplificationTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    Superblock info = {};
+    info.ibm_block = 8;
+    info.abm_block = 9;
+    info.ino_block = 10;
+    info.integrity_start_block = 20;
+    info.dat_block = 40;
+    accounting_.SetLayout(info);
+  }
+
+  IoAccounting accounting_;
+};
+
+TEST_F(WriteAmplificationTest, AttributesDeviceBytesToCategories) {
+  WriteAmplification amplification(&accounting_);
+  EXPECT_EQ(amplification.Cumulative().Ratio(), 0.0);
+
+  amplification.RecordLogicalWrite(2 * kMinfsBlockSize);
+  accounting_.RecordDevice(Write(21, 3));
+  accounting_.RecordDevice(Write(8, 1));
+  accounting_.RecordDevice(Write(12, 1));
+  accounting_.RecordDevice(Write(45, 3));
+  accounting_.RecordTransaction(Write(47, 1), IoSource::kIndirect);
+
+  const WriteAmplification::Totals totals = amplification.Cumulative();
+  EXPECT_EQ(totals.logical_bytes, 2 * kMinfsBlockSize);
+  EXPECT_EQ(totals.DeviceBytes(), 8 * kMinfsBlockSize);
+  EXPECT_EQ(totals.Ratio(), 4.0);
+  EXPECT_EQ(totals.Ratio(Category::kJournal), 1.5);
+  EXPECT_EQ(totals.Ratio(Category::kBitmap), 0.5);
+  EXPECT_EQ(totals.Ratio(Category::kInodeTable), 0.5);
+  EXPECT_EQ(totals.Ratio(Category::kIndirect), 0.5);
+  EXPECT_EQ(totals.Ratio(Category::kData), 1.0);
+  EXPECT_EQ(totals.Ratio(Category::kSuperblock), 0.0);
+}
+
+TEST_F(WriteAmplificationTest, WindowsCoverTheTimeSinceThePreviousWindow) {
+  const auto start = WriteAmplification::Clock::now();
+  WriteAmplification amplification(&accounting_, std::chrono::seconds(1));
+
+  amplification.RecordLogicalWrite(kMinfsBlockSize);
+  accounting_.RecordDevice(Write(45, 2));
+  EXPECT_EQ(amplification.Window(start).logical_bytes, 0u);
+  EXPECT_EQ(amplification.Window(start + std::chrono::seconds(2)).Ratio(), 2.0);
+
+  amplification.RecordLogicalWrite(kMinfsBlockSize);
+  accounting_.RecordDevice(Write(45, 1));
+  // The window has not ended, so the previous one is still reported.
+  EXPECT_EQ(amplification.Window(start + std::chrono::milliseconds(2500)).Ratio(), 2.0);
+  EXPECT_EQ(amplification.Window(start + std::chrono::seconds(4)).Ratio(), 1.0);
+  EXPECT_EQ(amplification.Cumulative().Ratio(), 1.5);
+
+  accounting_.Reset();
+  amplification.Reset();
+  EXPECT_EQ(amplification.Cumulative().DeviceBytes(), 0u);
+  EXPECT_EQ(amplification.Window(start + std::chrono::seconds(8)).DeviceBytes(), 0u);
+}
+
+TEST(WriteAmplificationMinfsTest, FileWritesAreAmplifiedByMetadata) {
+  async::Loop loop(&kAsyncLoopConfigAttachToCurrentThread);
+  constexpr uint64_t kBlockCount = 1 << 15;
+  auto device = std::make_unique<FakeBlockDevice>(kBlockCount, kMinfsBlockSize);
+  auto bcache_or = Bcache::Create(std::move(device), kBlockCount);
+  ASSERT_TRUE(bcache_or.is_ok());
+  ASSERT_TRUE(Mkfs(bcache_or.value().get()).is_ok());
+  auto fs_or = Runner::Create(loop.dispatcher(), std::move(bcache_or.value()), MountOptions());
+  ASSERT_TRUE(fs_or.is_ok());
+  fs_or->minfs().GetIoAccounting()->Reset();
+  WriteAmplification& amplification = fs_or->minfs().GetWriteAmplification();
+  amplification.Reset();
+  {
+    auto root_or = fs_or->minfs().VnodeGet(kMinfsRootIno);
+    ASSERT_TRUE(root_or.is_ok());
+    fbl::RefPtr<fs::Vnode> file;
+    ASSERT_EQ(root_or->Create("file", 0, &file), ZX_OK);
+    std::vector<uint8_t> data(16 * kMinfsBlockSize, 'x');
+    size_t written;
+    ASSERT_EQ(file->Write(data.data(), data.size(), 0, &written), ZX_OK);
+    ASSERT_EQ(written, data.size());
+    ASSERT_EQ(file->Close(), ZX_OK);
+  }
+  ASSERT_TRUE(fs_or->minfs().BlockingJournalSync().is_ok());
+
+  const WriteAmplification::Totals totals = amplification.Cumulative();
+  EXPECT_EQ(totals.logical_bytes, 16 * kMinfsBlockSize);
+  EXPECT_GE(totals.device_bytes[static_cast<size_t>(Category::kData)], totals.logical_bytes);
+  EXPECT_GT(totals.device_bytes[static_cast<size_t>(Category::kJournal)], 0u);
+  EXPECT_GT(totals.Ratio(), 1.0);
+  Runner::Destroy(std::move(fs_or.value()));
+}
+
+}  // namespace
+}  // namespace minfs
@@ -0,0 +1,152 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Defragments a minfs image on the host, or reports how fragmented it is.
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <lib/fit/defer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <string>
+
+#include <fbl/unique_fd.h>
+
+#include "src/storage/minfs/bcache.h"
+#include "src/storage/minfs/defrag.h"
+#include "src/storage/minfs/host_trace.h"
+#include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/runner.h"
+
+namespace {
+
+void Usage() {
+  fprintf(stderr,
+          "usage: minfs_defrag [options] <image>\n"
+          "\n"
+          "  --report                Report fragmentation without changing the image\n"
+          "  --top <n>               List the <n> most fragmented files (default 10)\n"
+          "  --trace <path>          Write a Chrome JSON trace of the run to <path>\n");
+}
+
+void PrintReport(const minfs::FragmentationReport& report, size_t top) {
+  const uint64_t files = report.files.size();
+  printf("%" PRIu64 " of %" PRIu64 " files fragmented; %" PRIu64 " blocks in %" PRIu64
+         " extents (%.2f per file)\n",
+         report.fragmented_files, files, report.blocks, report.extents,
+         files ? static_cast<double>(report.extents) / static_cast<double>(files) : 0.0);
+  printf("%" PRIu64 " free blocks in %" PRIu64 " extents, the largest %" PRIu64 " blocks\n",
+         report.free_blocks, report.free_extents, report.largest_free_extent);
+  for (size_t i = 0; i < std::min(top, report.files.size()); ++i) {
+    const minfs::FileFragmentation& file = report.files[i];
+    if (file.extents <= 1) {
+      break;
+    }
+    printf("  inode %u: %" PRIu64 " blocks in %" PRIu64 " extents\n", file.ino, file.blocks,
+           file.extents);
+  }
+}
+
+// Mounts |path| and prints its fragmentation.
+int Report(const std::string& path, size_t top) {
+  fbl::unique_fd fd(open(path.c_str(), O_RDONLY));
+  struct stat s;
+  if (!fd || fstat(fd.get(), &s) < 0) {
+    fprintf(stderr, "Cannot open %s\n", path.c_str());
+    return 1;
+  }
+  auto bcache_or = minfs::Bcache::Create(
+      std::move(fd), static_cast<uint32_t>(s.st_size / minfs::kMinfsBlockSize));
+  if (bcache_or.is_error()) {
+    return 1;
+  }
+  auto runner_or = minfs::Runner::Create(
+      nullptr, std::move(bcache_or.value()),
+      minfs::MountOptions{.writability = minfs::Writability::ReadOnlyDisk, .quiet = true});
+  if (runner_or.is_error()) {
+    fprintf(stderr, "Cannot mount %s\n", path.c_str());
+    return 1;
+  }
+  auto report_or = minfs::GetFragmentationReport(runner_or->minfs());
+  minfs::Runner::Destroy(std::move(runner_or.value()));
+  if (report_or.is_error()) {
+    return 1;
+  }
+  PrintReport(report_or.value(), top);
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  enum {
+    kReport = 1,
+    kTop,
+    kTrace,
+    kHelp,
+  };
+  static const option kOptions[] = {
+      {"report", no_argument, nullptr, kReport},
+      {"top", required_argument, nullptr, kTop},
+      {"trace", required_argument, nullptr, kTrace},
+      {"help", no_argument, nullptr, kHelp},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  bool report_only = false;
+  size_t top = 10;
+  std::string trace_path;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", kOptions, nullptr)) != -1) {
+    switch (opt) {
+      case kReport:
+        report_only = true;
+        break;
+      case kTop:
+        top = strtoul(optarg, nullptr, 0);
+        break;
+      case kTrace:
+        trace_path = optarg;
+        break;
+      default:
+        Usage();
+        return opt == kHelp ? 0 : 1;
+    }
+  }
+  if (optind != argc - 1) {
+    Usage();
+    return 1;
+  }
+  const std::string image = argv[optind];
+
+  // Written however this returns, so that failures can be profiled too.
+  auto write_trace = fit::defer([&trace_path] {
+    if (!trace_path.empty()) {
+      minfs::StopHostTrace();
+      [[maybe_unused]] auto status = minfs::WriteHostTrace(trace_path);
+    }
+  });
+  if (!trace_path.empty()) {
+    minfs::StartHostTrace();
+  }
+
+  if (report_only) {
+    return Report(image, top);
+  }
+
+  auto stats_or = minfs::Defragment(image);
+  if (stats_or.is_error()) {
+    fprintf(stderr, "Failed to defragment %s\n", image.c_str());
+    return 1;
+  }
+  printf("Moved %" PRIu64 " blocks of %" PRIu64 " files; %" PRIu64
+         " files had no free run large enough; %" PRIu64 " files were left fragmented\n",
+         stats_or->blocks_moved, stats_or->files_moved, stats_or->files_skipped,
+         stats_or->files_left_fragmented);
+  return Report(image, top);
+}
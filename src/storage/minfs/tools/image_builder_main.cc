@@ -0,0 +1,223 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Builds a minfs image from manifests and directory trees on the host.
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <lib/fit/defer.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "src/storage/minfs/compact.h"
+#include "src/storage/minfs/host_trace.h"
+#include "src/storage/minfs/image_builder.h"
+
+namespace {
+
+void Usage() {
+  fprintf(stderr,
+          "usage: minfs_image_builder [options] <image>\n"
+          "\n"
+          "Sources:\n"
+          "  --manifest <path>       Add each destination=source line of a manifest\n"
+          "  --tree <dst>=<src>      Add the host directory <src> at <dst> in the image\n"
+          "\n"
+          "Format:\n"
+          "  --extent-inodes         Map blocks with extent trees\n"
+          "  --inline-data           Store small files and directories in their inodes\n"
+          "  --large-files           Allow files of 4 GiB and larger\n"
+          "  --dir-index             Hash index directories\n"
+          "  --checksums             Checksum metadata\n"
+          "  --reserve-inodes <n>    Leave <n> inodes free\n"
+          "  --reserve-blocks <n>    Leave <n> data blocks free\n"
+          "\n"
+          "Building:\n"
+          "  --threads <n>           Read sources with <n> threads (default 4)\n"
+          "  --buffer-mb <n>         Read at most <n> MiB ahead of the writer (default 64)\n"
+          "  --sparse                Leave zero and free blocks as holes in the image file\n"
+          "  --compact               Move data down into free blocks once it is written\n"
+          "  --plan                  Print the size of the image without writing it\n"
+          "  --trace <path>          Write a Chrome JSON trace of the build to <path>\n"
+          "\n"
+          "  --compact-existing      Compact <image> in place, leaving free blocks as holes,\n"
+          "                          rather than building it\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  enum {
+    kManifest = 1,
+    kTree,
+    kExtentInodes,
+    kInlineData,
+    kLargeFiles,
+    kDirIndex,
+    kChecksums,
+    kReserveInodes,
+    kReserveBlocks,
+    kThreads,
+    kBufferMb,
+    kSparse,
+    kCompact,
+    kPlan,
+    kCompactExisting,
+    kTrace,
+    kHelp,
+  };
+  static const option kOptions[] = {
+      {"manifest", required_argument, nullptr, kManifest},
+      {"tree", required_argument, nullptr, kTree},
+      {"extent-inodes", no_argument, nullptr, kExtentInodes},
+      {"inline-data", no_argument, nullptr, kInlineData},
+      {"large-files", no_argument, nullptr, kLargeFiles},
+      {"dir-index", no_argument, nullptr, kDirIndex},
+      {"checksums", no_argument, nullptr, kChecksums},
+      {"reserve-inodes", required_argument, nullptr, kReserveInodes},
+      {"reserve-blocks", required_argument, nullptr, kReserveBlocks},
+      {"threads", required_argument, nullptr, kThreads},
+      {"buffer-mb", required_argument, nullptr, kBufferMb},
+      {"sparse", no_argument, nullptr, kSparse},
+      {"compact", no_argument, nullptr, kCompact},
+      {"plan", no_argument, nullptr, kPlan},
+      {"compact-existing", no_argument, nullptr, kCompactExisting},
+      {"trace", required_argument, nullptr, kTrace},
+      {"help", no_argument, nullptr, kHelp},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  // Sources are added once all of the options are known.
+  std::vector<std::pair<int, std::string>> sources;
+  minfs::ImageBuilder::Options options;
+  bool plan_only = false;
+  bool compact_existing = false;
+  std::string trace_path;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", kOptions, nullptr)) != -1) {
+    switch (opt) {
+      case kManifest:
+      case kTree:
+        sources.emplace_back(opt, optarg);
+        break;
+      case kExtentInodes:
+        options.format.extent_inodes = true;
+        break;
+      case kInlineData:
+        options.format.inline_data = true;
+        break;
+      case kLargeFiles:
+        options.format.large_files = true;
+        break;
+      case kDirIndex:
+        options.format.dir_index = true;
+        break;
+      case kChecksums:
+        options.format.metadata_checksums = true;
+        break;
+      case kReserveInodes:
+        options.reserve_inodes = static_cast<uint32_t>(strtoul(optarg, nullptr, 0));
+        break;
+      case kReserveBlocks:
+        options.reserve_data_blocks = strtoull(optarg, nullptr, 0);
+        break;
+      case kThreads:
+        options.reader_threads = static_cast<uint32_t>(strtoul(optarg, nullptr, 0));
+        break;
+      case kBufferMb:
+        options.max_buffered_bytes = strtoull(optarg, nullptr, 0) << 20;
+        break;
+      case kSparse:
+        options.sparse = true;
+        break;
+      case kCompact:
+        options.compact = true;
+        break;
+      case kPlan:
+        plan_only = true;
+        break;
+      case kCompactExisting:
+        compact_existing = true;
+        break;
+      case kTrace:
+        trace_path = optarg;
+        break;
+      default:
+        Usage();
+        return opt == kHelp ? 0 : 1;
+    }
+  }
+  if (optind != argc - 1) {
+    Usage();
+    return 1;
+  }
+  const std::string image = argv[optind];
+
+  // Written however this returns, so that failures can be profiled too.
+  auto write_trace = fit::defer([&trace_path] {
+    if (!trace_path.empty()) {
+      minfs::StopHostTrace();
+      [[maybe_unused]] auto status = minfs::WriteHostTrace(trace_path);
+    }
+  });
+  if (!trace_path.empty()) {
+    minfs::StartHostTrace();
+  }
+
+  if (compact_existing) {
+    auto stats_or = minfs::CompactImage(image);
+    if (stats_or.is_error()) {
+      fprintf(stderr, "Failed to compact %s\n", image.c_str());
+      return 1;
+    }
+    printf("Moved %" PRIu64 " blocks; data ends at block %u rather than %u\n",
+           stats_or->blocks_moved, stats_or->high_water_after, stats_or->high_water_before);
+    return 0;
+  }
+
+  minfs::ImageBuilder builder(options);
+  for (const auto& [kind, argument] : sources) {
+    zx::status<> status = zx::ok();
+    if (kind == kManifest) {
+      status = builder.AddManifest(argument);
+    } else {
+      size_t equals = argument.find('=');
+      if (equals == std::string::npos) {
+        fprintf(stderr, "--tree expects <dst>=<src>, not %s\n", argument.c_str());
+        return 1;
+      }
+      status = builder.AddTree(argument.substr(equals + 1),
+                               std::string_view(argument).substr(0, equals));
+    }
+    if (status.is_error()) {
+      return 1;
+    }
+  }
+
+  auto plan_or = builder.GetPlan();
+  if (plan_or.is_error()) {
+    return 1;
+  }
+  const minfs::ImageBuilder::Plan& plan = plan_or.value();
+  printf("%" PRIu64 " files (%" PRIu64 " bytes) in %" PRIu64 " directories: %u inodes, %" PRIu64
+         " data blocks, %u blocks\n",
+         plan.file_count, plan.file_bytes, plan.directory_count, plan.inode_count,
+         plan.data_blocks, plan.device_blocks);
+  if (plan_only) {
+    return 0;
+  }
+
+  auto allocated_or = builder.Build(image);
+  if (allocated_or.is_error()) {
+    fprintf(stderr, "Failed to build %s\n", image.c_str());
+    return 1;
+  }
+  printf("%" PRIu64 " bytes allocated on the host\n", allocated_or.value());
+  return 0;
+}
@@ -0,0 +1,23 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_STORAGE_MINFS_TRACE_H_
+#define SRC_STORAGE_MINFS_TRACE_H_
+
+#include "src/lib/storage/vfs/cpp/trace.h"
+
+#ifndef __Fuchsia__
+#include "src/storage/minfs/host_trace.h"
+
+// The vfs library defines TRACE_DURATION as a no-op on host. Record the spans with
+// HostTraceDuration instead, which costs a relaxed load while tracing is off.
+#define MINFS_TRACE_CONCAT_INNER(a, b) a##b
+#define MINFS_TRACE_CONCAT(a, b) MINFS_TRACE_CONCAT_INNER(a, b)
+#undef TRACE_DURATION
+#define TRACE_DURATION(category, name, args...) \
+  ::minfs::HostTraceDuration MINFS_TRACE_CONCAT(minfs_trace_duration_, __LINE__)(category, name, \
+                                                                                 ##args)
+#endif
+
+#endif  // SRC_STORAGE_MINFS_TRACE_H_
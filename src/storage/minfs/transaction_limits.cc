@@ -77,12 +77,26 @@ zx::status<blk_t> GetRequiredBlockCount(size_t offset, size_t length, size_t blo
   return zx::ok(reserve_blocks);
 }
 
+zx::status<blk_t> GetRequiredBlockCount(const Superblock& info, size_t offset, size_t length) {
+  zx::status<blk_t> pointer_blocks = GetRequiredBlockCount(offset, length, info.BlockSize());
+  if (pointer_blocks.is_error() || !info.UsesExtents() || length == 0) {
+    return pointer_blocks;
+  }
+
+  // Mapping a block can split one extent tree node at each level below the root and, if the root
+  // is full, move its records into a new node; either way no more than kMinfsMaxExtentDepth nodes.
+  const blk_t data_blocks = static_cast<blk_t>((offset + length - 1) / info.BlockSize() -
+                                               offset / info.BlockSize() + 1);
+  return zx::ok(data_blocks * (1 + kMinfsMaxExtentDepth));
+}
+
 TransactionLimits::TransactionLimits(const Superblock& info) : block_size_(info.BlockSize()) {
-  CalculateDataBlocks();
+  CalculateDataBlocks(info);
+  CalculateChecksumTableBlocks(info, GetBlockBitmapBlocks(info));
   CalculateIntegrityBlocks(GetBlockBitmapBlocks(info));
 }
 
-void TransactionLimits::CalculateDataBlocks() {
+void TransactionLimits::CalculateDataBlocks(const Superblock& info) {
   // If we ever increase the number of doubly indirect blocks, we will need to update this offset
   // to be 1 byte before the end of the first doubly indirect block.
   const blk_t offset =
@@ -92,21 +106,40 @@ void TransactionLimits::CalculateDataBlocks() {
   // because following that constraint makes it a little harder to predict where the most
   // significant cross-block write would be. This means we may overestimate the maximum number of
   // directory blocks by some amount, but this is better than an understimate.
-  blk_t max_directory_blocks =
-      GetRequiredBlockCount(offset, kMinfsMaxDirentSize, BlockSize()).value();
+  blk_t max_directory_blocks = GetRequiredBlockCount(info, offset, kMinfsMaxDirentSize).value();
 
-  max_data_blocks_ = GetRequiredBlockCount(offset, kMaxWriteBytes, BlockSize()).value();
+  max_data_blocks_ = GetRequiredBlockCount(info, offset, kMaxWriteBytes).value();
 
   blk_t direct_blocks =
       static_cast<blk_t>((fbl::round_up(kMaxWriteBytes, BlockSize()) / BlockSize()) + 1);
   blk_t max_indirect_blocks = max_data_blocks_ - direct_blocks;
 
   max_meta_data_blocks_ = std::max(max_directory_blocks, max_indirect_blocks);
+  if (info.UsesExtents()) {
+    // As well as the extent tree nodes a write adds, it may modify as many existing nodes.
+    max_meta_data_blocks_ *= 2;
+  }
+}
+
+void TransactionLimits::CalculateChecksumTableBlocks(const Superblock& info,
+                                                     blk_t block_bitmap_blocks) {
+  if (!info.UsesChecksums()) {
+    max_checksum_table_blocks_ = 0;
+    return;
+  }
+  // The entries of the block bitmap blocks are contiguous, so span at most one more table block
+  // than they fill, and the inode bitmap block's entry may be in another. Each metadata block
+  // written, and each data block allocated (which clears its entry), may dirty one more.
+  const blk_t bitmap_table_blocks =
+      fbl::round_up(block_bitmap_blocks, kMinfsChecksumsPerBlock) / kMinfsChecksumsPerBlock + 1 +
+      kMaxInodeBitmapBlocks;
+  max_checksum_table_blocks_ = bitmap_table_blocks + max_meta_data_blocks_ + max_data_blocks_;
 }
 
 void TransactionLimits::CalculateIntegrityBlocks(blk_t block_bitmap_blocks) {
   max_entry_data_blocks_ = kMaxSuperblockBlocks + kMaxInodeBitmapBlocks + block_bitmap_blocks +
-                           kMaxInodeTableBlocks + max_meta_data_blocks_;
+                           kMaxInodeTableBlocks + max_meta_data_blocks_ +
+                           max_checksum_table_blocks_;
 
   // Ensure we have enough space to fit all the block numbers that may be updated in one
   // transaction. This may spill over into multiple blocks.
@@ -120,9 +153,9 @@ void TransactionLimits::CalculateIntegrityBlocks(blk_t block_bitmap_blocks) {
   // For revocation records, we need to know the maximum number of metadata blocks within the
   // data section of Minfs that can be deleted within one operation. This is either a directory
   // vnode's maximum possible number of data blocks + indirect blocks, or a data vnode's maximum
-  // possible number of indirect blocks.
+  // possible number of indirect blocks. Indexed directories are the larger kind.
   blk_t maximum_directory_blocks =
-      GetRequiredBlockCount(0, kMinfsMaxDirectorySize, BlockSize()).value();
+      GetRequiredBlockCount(0, kMinfsMaxIndexedDirectorySize, BlockSize()).value();
   blk_t maximum_indirect_blocks = kMinfsIndirect + kMinfsDoublyIndirect * kMinfsDirectPerIndirect;
   blk_t revocation_blocks =
       fbl::round_up(std::max(maximum_directory_blocks, maximum_indirect_blocks),
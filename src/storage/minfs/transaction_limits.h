@@ -21,6 +21,11 @@ blk_t GetBlockBitmapBlocks(const Superblock& info);
 // and |length|.
 zx::status<blk_t> GetRequiredBlockCount(size_t offset, size_t length, size_t block_size);
 
+// Returns the required number of blocks for a write at the given |offset| and |length| to a
+// volume described by |info|. On volumes which use extents, this allows for the extent tree nodes
+// the write might add, rather than for indirect blocks.
+zx::status<blk_t> GetRequiredBlockCount(const Superblock& info, size_t offset, size_t length);
+
 // Calculates and tracks the number of Minfs metadata / data blocks that can be modified within one
 // transaction, as well as the corresponding Journal sizes.
 // Once we can grow the block bitmap, we will need to be able to recalculate these limits.
@@ -42,6 +47,10 @@ class TransactionLimits {
   // blocks.
   blk_t GetMaximumDataBlocks() const { return max_data_blocks_; }
 
+  // Returns the maximum number of checksum table blocks (see Superblock::csum_block) that can be
+  // modified within one transaction, which is zero on volumes without checksums.
+  blk_t GetMaximumChecksumTableBlocks() const { return max_checksum_table_blocks_; }
+
   // Returns the maximum number of data blocks that can be included in a journal entry,
   // i.e. the total number of blocks that can be held in a transaction enqueued to the journal.
   blk_t GetMaximumEntryDataBlocks() const { return max_entry_data_blocks_; }
@@ -80,6 +89,11 @@ class TransactionLimits {
   // TODO(planders): Internally break up large write requests so they fit within this constraint.
   static constexpr size_t kMaxWriteBytes = (1 << 16);
 
+  // The largest number of mapped file blocks that a truncation or a purge should release within
+  // one transaction. Larger releases are split across several transactions, each of which skips
+  // any holes, so that no single transaction holds up the journal for long.
+  static constexpr blk_t kMaxReleaseBlocks = 1024;
+
   // Number of metadata blocks required for the whole journal - 1 Superblock.
   static constexpr blk_t kJournalMetadataBlocks = 1;
 
@@ -90,7 +104,11 @@ class TransactionLimits {
  private:
   // Calculates the maximum number of data and metadata blocks that can be updated during a
   // single transaction.
-  void CalculateDataBlocks();
+  void CalculateDataBlocks(const Superblock& info);
+
+  // Calculates the maximum number of checksum table blocks that can be updated during a single
+  // transaction.
+  void CalculateChecksumTableBlocks(const Superblock& info, blk_t block_bitmap_blocks);
 
   // Calculates the maximum journal entry size and the minimum size required for the integrity
   // section of Minfs (journal + backup superblock).
@@ -108,6 +126,7 @@ class TransactionLimits {
   uint32_t block_size_ = {};
   blk_t max_meta_data_blocks_;
   blk_t max_data_blocks_;
+  blk_t max_checksum_table_blocks_ = 0;
   blk_t max_entry_data_blocks_;
   blk_t max_entry_blocks_;
   blk_t min_integrity_blocks_;
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <fcntl.h>
+#include <lib/fit/defer.h>
 #include <lib/syslog/cpp/macros.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,14 +12,15 @@
 #include <unistd.h>
 #include <zircon/time.h>
 
+#include <algorithm>
 #include <cstdint>
+#include <limits>
 #include <memory>
 #include <string_view>
 
 #include <fbl/algorithm.h>
 #include <safemath/checked_math.h>
 
-#include "src/lib/storage/vfs/cpp/trace.h"
 #include "src/lib/storage/vfs/cpp/vfs_types.h"
 
 #ifdef __Fuchsia__
@@ -30,9 +32,11 @@
 #include <fbl/auto_lock.h>
 #endif
 
+#include "src/storage/minfs/checksum.h"
 #include "src/storage/minfs/directory.h"
 #include "src/storage/minfs/file.h"
 #include "src/storage/minfs/minfs_private.h"
+#include "src/storage/minfs/trace.h"
 #include "src/storage/minfs/unowned_vmo_buffer.h"
 #include "src/storage/minfs/vnode.h"
 
@@ -72,31 +76,60 @@ void VnodeMinfs::InodeSync(PendingWork* transaction, uint32_t flags) {
   fs_->InodeUpdate(transaction, ino_, &inode_);
 }
 
+void VnodeMinfs::DeleteBlocks(PendingWork* transaction, blk_t vmo_offset, blk_t dev_offset,
+                              blk_t count) {
+  for (blk_t i = 0; i < count; ++i) {
+    DeleteBlock(transaction, vmo_offset + i, dev_offset + i, /*indirect=*/false);
+  }
+}
+
 // Delete all blocks (relative to a file) from "start" (inclusive) to the end of
 // the file. Does not update mtime/atime.
 zx::status<> VnodeMinfs::BlocksShrink(PendingWork* transaction, blk_t start) {
+  auto released_or = BlocksRelease(transaction, start, std::numeric_limits<uint64_t>::max());
+  if (released_or.is_error())
+    return released_or.take_error();
+  ZX_DEBUG_ASSERT(released_or.value());
+  return zx::ok();
+}
+
+zx::status<bool> VnodeMinfs::BlocksRelease(PendingWork* transaction, blk_t start,
+                                           uint64_t max_blocks) {
+  if (IsInline()) {
+    // Inline data occupies no blocks.
+    return zx::ok(true);
+  }
   VnodeMapper mapper(this);
   VnodeIterator iterator;
   if (auto status = iterator.Init(&mapper, transaction, start); status.is_error())
-    return status;
-  uint64_t block_count = VnodeMapper::kMaxBlocks - start;
+    return status.take_error();
+  uint64_t block_count = mapper.MaxBlocks() - start;
   while (block_count > 0) {
-    uint64_t count;
+    // Both sparse ranges and physically contiguous runs of allocated blocks are handled as a
+    // whole, so that the allocator sees one range per extent rather than one call per block.
+    uint64_t count = iterator.GetContiguousBlockCount(block_count);
     if (iterator.Blk() == 0) {
-      count = iterator.GetContiguousBlockCount(block_count);
+      if (auto status = iterator.Advance(count); status.is_error())
+        return status.take_error();
     } else {
-      count = 1;
-      DeleteBlock(transaction, static_cast<blk_t>(iterator.file_block()), iterator.Blk(),
-                  /*indirect=*/false);
-      if (auto status = iterator.SetBlk(0); status.is_error())
-        return status;
+      ZX_DEBUG_ASSERT(count > 0);
+      if (max_blocks == 0) {
+        // Mapped blocks remain beyond the budget.
+        if (auto status = iterator.Flush(); status.is_error())
+          return status.take_error();
+        return zx::ok(false);
+      }
+      count = std::min(count, max_blocks);
+      DeleteBlocks(transaction, static_cast<blk_t>(iterator.file_block()), iterator.Blk(),
+                   static_cast<blk_t>(count));
+      if (auto status = iterator.Unmap(count); status.is_error())
+        return status.take_error();
+      max_blocks -= count;
     }
-    if (auto status = iterator.Advance(count); status.is_error())
-      return status;
     block_count -= count;
   }
   if (auto status = iterator.Flush(); status.is_error())
-    return status;
+    return status.take_error();
   // Shrink the buffer backing the virtual indirect file.
   if (indirect_file_) {
     uint64_t indirect_block_pointers;
@@ -112,6 +145,25 @@ zx::status<> VnodeMinfs::BlocksShrink(PendingWork* transaction, blk_t start) {
         fbl::round_up(indirect_block_pointers * sizeof(blk_t), fs_->BlockSize()) /
         fs_->BlockSize());
   }
+  return zx::ok(true);
+}
+
+bool VnodeMinfs::IsReleasePending() const {
+  return !IsUnlinked() && (inode_.last_inode != 0 || inode_.next_inode != 0 ||
+                           fs_->Info().unlinked_head == ino_);
+}
+
+zx::status<> VnodeMinfs::FinishRelease() {
+  while (IsReleasePending()) {
+    auto transaction_or = fs_->BeginTransaction(0, 0);
+    if (transaction_or.is_error()) {
+      return transaction_or.take_error();
+    }
+    if (auto status = fs_->ReleaseStep(transaction_or.value().get(), this); status.is_error()) {
+      return status.take_error();
+    }
+    fs_->CommitTransaction(std::move(transaction_or.value()));
+  }
   return zx::ok();
 }
 
@@ -126,6 +178,64 @@ zx::status<LazyBuffer*> VnodeMinfs::GetIndirectFile() {
   return zx::ok(indirect_file_.get());
 }
 
+zx::status<ExtentTree*> VnodeMinfs::GetExtentTree() {
+  ZX_DEBUG_ASSERT(fs_->Info().UsesExtents());
+  if (!extent_tree_) {
+    zx::status<std::unique_ptr<ExtentTree>> tree =
+        ExtentTree::Load(
+            inode_,
+            [this](blk_t block, void* data) -> zx::status<> {
+              if (block >= fs_->Info().block_count)
+                return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+              return fs_->ReadDat(block, data);
+            },
+            fs_->Info().UsesChecksums());
+    if (tree.is_error()) {
+      FX_LOGS(ERROR) << "Failed to load the extent tree of inode " << ino_ << ": "
+                     << tree.status_string();
+      return tree.take_error();
+    }
+    extent_tree_ = std::move(tree).value();
+  }
+  return zx::ok(extent_tree_.get());
+}
+
+zx::status<> VnodeMinfs::FlushExtentTree(PendingWork* transaction) {
+  if (!extent_tree_ || !extent_tree_->IsDirty())
+    return zx::ok();
+#ifdef __Fuchsia__
+  if (!extent_buffer_) {
+    zx::status<std::unique_ptr<LazyBuffer>> buffer = LazyBuffer::Create(
+        fs_->bc_.get(), "minfs-extent-file", static_cast<uint32_t>(fs_->BlockSize()));
+    if (buffer.is_error())
+      return buffer.take_error();
+    extent_buffer_ = std::move(buffer).value();
+  }
+  return extent_tree_->Flush(
+      [this, transaction](size_t slot, blk_t block, const void* data) -> zx::status<> {
+        if (extent_buffer_->size() < (slot + 1) * fs_->BlockSize()) {
+          if (auto status = extent_buffer_->Grow(slot + 1); status.is_error())
+            return status.take_error();
+        }
+        memcpy(extent_buffer_->buffer().Data(slot), data, fs_->BlockSize());
+        transaction->EnqueueMetadata(
+            storage::Operation{
+                .type = storage::OperationType::kWrite,
+                .vmo_offset = slot,
+                .dev_offset = fs_->Info().dat_block + block,
+                .length = 1,
+            },
+            &extent_buffer_->buffer());
+        return zx::ok();
+      });
+#else
+  // As with the indirect file, host side code writes the nodes to the device immediately.
+  return extent_tree_->Flush([this](size_t slot, blk_t block, const void* data) {
+    return fs_->WriteMetadataBlock(fs_->Info().dat_block + block, data);
+  });
+#endif
+}
+
 #ifdef __Fuchsia__
 
 // TODO(smklein): Even this hack can be optimized; a bitmap could be used to
@@ -136,6 +246,7 @@ zx::status<> VnodeMinfs::InitVmo() {
   if (vmo_.is_valid()) {
     return zx::ok();
   }
+  ScopedLatency latency(fs_->Latencies(), LatencyPhase::kInitVmo);
 
   const size_t vmo_size = fbl::round_up(GetSize(), fs_->BlockSize());
   if (zx_status_t status = zx::vmo::create(vmo_size, ZX_VMO_RESIZABLE, &vmo_); status != ZX_OK) {
@@ -151,17 +262,32 @@ zx::status<> VnodeMinfs::InitVmo() {
     return zx::error(status);
   }
 
+  // Inline data is read directly from the inode, and only copied into the VMO by
+  // ConvertInlineToBlocks.
+  if (IsInline()) {
+    return zx::ok();
+  }
+
   fs::BufferedOperationsBuilder builder;
   VnodeMapper mapper(this);
   VnodeIterator iterator;
   if (auto status = iterator.Init(&mapper, nullptr, 0); status.is_error())
     return status.take_error();
   uint64_t block_count = vmo_size / fs_->BlockSize();
+  // Count the file's extents on the way, for the background defragmenter.
+  uint64_t mapped_blocks = 0;
+  uint64_t extents = 0;
+  blk_t extent_end = 0;
   while (block_count > 0) {
     blk_t block = iterator.Blk();
     uint64_t count = iterator.GetContiguousBlockCount(block_count);
     if (block) {
       fs_->ValidateBno(block);
+      mapped_blocks += count;
+      if (block != extent_end) {
+        ++extents;
+      }
+      extent_end = block + static_cast<blk_t>(count);
       fs::internal::BorrowedBuffer buffer(vmoid_.get());
       builder.Add(storage::Operation{.type = storage::OperationType::kRead,
                                      .vmo_offset = iterator.file_block(),
@@ -174,8 +300,36 @@ zx::status<> VnodeMinfs::InitVmo() {
     block_count -= count;
   }
 
-  zx_status_t status = fs_->GetMutableBcache()->RunRequests(builder.TakeOperations());
-  return zx::make_status(status);
+  std::vector<storage::BufferedOperation> operations = builder.TakeOperations();
+  if (zx_status_t status = fs_->GetMutableBcache()->RunRequests(operations); status != ZX_OK) {
+    return zx::error(status);
+  }
+
+  // The blocks of directories are metadata, so may have checksums.
+  if (IsDirectory() && fs_->checksums()) {
+    for (const storage::BufferedOperation& operation : operations) {
+      if (auto status = fs_->checksums()->VerifyVmo(vmo_, operation.op.vmo_offset,
+                                                    static_cast<blk_t>(operation.op.dev_offset),
+                                                    static_cast<blk_t>(operation.op.length));
+          status.is_error()) {
+        FX_LOGS(ERROR) << "Failed to verify the blocks of directory " << ino_;
+        return status.take_error();
+      }
+    }
+  }
+  if (!IsDirectory()) {
+    fs_->NoteFragmentation(GetIno(), mapped_blocks, extents);
+  }
+  return zx::ok();
+}
+
+#else
+
+zx::status<> VnodeMinfs::WriteDataBlock(blk_t bno, const void* data) {
+  if (IsDirectory()) {
+    return fs_->WriteMetadataBlock(fs_->Info().dat_block + bno, data);
+  }
+  return fs_->bc_->Writeblk(fs_->Info().dat_block + bno, data);
 }
 
 #endif
@@ -186,6 +340,68 @@ void VnodeMinfs::AllocateIndirect(PendingWork* transaction, blk_t* block) {
   inode_.block_count++;
 }
 
+zx::status<> VnodeMinfs::ConvertInlineToBlocks(Transaction* transaction) {
+  if (!IsInline()) {
+    return zx::ok();
+  }
+  const size_t size = GetSize();
+  ZX_DEBUG_ASSERT(size <= kMinfsInlineDataSize);
+  uint8_t data[kMinfsInlineDataSize];
+  memcpy(data, GetInlineData(), kMinfsInlineDataSize);
+
+#ifdef __Fuchsia__
+  // Data is written back from the VMO, so that is where the inline data goes.
+  if (auto status = InitVmo(); status.is_error()) {
+    return status.take_error();
+  }
+  if (size > 0) {
+    if (vmo_size_ < fs_->BlockSize()) {
+      if (zx_status_t status = vmo_.set_size(fs_->BlockSize()); status != ZX_OK) {
+        return zx::error(status);
+      }
+      vmo_size_ = fs_->BlockSize();
+    }
+    if (zx_status_t status = vmo_.write(data, 0, size); status != ZX_OK) {
+      return zx::error(status);
+    }
+  }
+#endif
+
+  // The block pointers (or extent root) which the data occupied start out empty.
+  inode_.flags &= ~kMinfsInodeFlagInlineData;
+  memset(GetInlineData(), 0, kMinfsInlineDataSize);
+  if (size == 0) {
+    return zx::ok();
+  }
+
+  auto restore = fit::defer([&]() {
+    inode_.flags |= kMinfsInodeFlagInlineData;
+    memcpy(GetInlineData(), data, kMinfsInlineDataSize);
+  });
+#ifdef __Fuchsia__
+  if (!HasPendingAllocation(0)) {
+    auto bno_or = BlockGetWritable(transaction, 0);
+    if (bno_or.is_error()) {
+      return bno_or.take_error();
+    }
+    IssueWriteback(transaction, 0, bno_or.value() + fs_->Info().dat_block, 1);
+  }
+#else
+  auto bno_or = BlockGetWritable(transaction, 0);
+  if (bno_or.is_error()) {
+    return bno_or.take_error();
+  }
+  char bdata[fs_->BlockSize()];
+  memset(bdata, 0, fs_->BlockSize());
+  memcpy(bdata, data, size);
+  if (auto status = WriteDataBlock(bno_or.value(), bdata); status.is_error()) {
+    return status.take_error();
+  }
+#endif
+  restore.cancel();
+  return zx::ok();
+}
+
 zx::status<blk_t> VnodeMinfs::BlockGetWritable(Transaction* transaction, blk_t n) {
   VnodeMapper mapper(this);
   VnodeIterator iterator;
@@ -244,6 +460,16 @@ zx::status<> VnodeMinfs::WriteExactInternal(Transaction* transaction, const void
 zx::status<> VnodeMinfs::RemoveInodeLink(Transaction* transaction) {
   ZX_ASSERT(inode_.link_count > 0);
 
+  // A file queued for the release of its truncated blocks leaves the unlinked list before it is
+  // unlinked, which frees those blocks along with the rest.
+  if (inode_.link_count == 1 && IsReleasePending()) {
+    if (auto status = fs_->RemoveUnlinked(transaction, this); status.is_error()) {
+      return status;
+    }
+    SetLastInode(0);
+    SetNextInode(0);
+  }
+
   // This effectively 'unlinks' the target node without deleting the direntry
   inode_.link_count--;
   if (IsDirectory()) {
@@ -273,7 +499,9 @@ zx::status<> VnodeMinfs::RemoveInodeLink(Transaction* transaction) {
         return status;
       }
     } else {
-      fs_->AddUnlinked(transaction, this);
+      if (auto status = fs_->AddUnlinked(transaction, this); status.is_error()) {
+        return status;
+      }
       if (IsDirectory()) {
         // If it's a directory, we need to remove the . and .. entries, which should be the only
         // entries.
@@ -325,6 +553,10 @@ VnodeMinfs::~VnodeMinfs() {
     auto status = indirect_file_->Detach(fs_->bc_.get());
     ZX_DEBUG_ASSERT(status.is_ok());
   }
+  if (extent_buffer_) {
+    auto status = extent_buffer_->Detach(fs_->bc_.get());
+    ZX_DEBUG_ASSERT(status.is_ok());
+  }
 }
 
 zx::status<> VnodeMinfs::Purge(Transaction* transaction) {
@@ -334,6 +566,13 @@ zx::status<> VnodeMinfs::Purge(Transaction* transaction) {
   }
   ZX_DEBUG_ASSERT(IsUnlinked());
   fs_->VnodeRelease(this);
+#ifdef __Fuchsia__
+  if (fs_->ShouldDeferPurge(*this)) {
+    // Freeing a large file's blocks can take many transactions; leave that to the background purge
+    // so that the caller is not held up.
+    return fs_->DeferPurge(transaction, this);
+  }
+#endif
   return fs_->InoFree(transaction, this);
 }
 
@@ -351,7 +590,11 @@ zx::status<> VnodeMinfs::RemoveUnlinked() {
   // vnode so that we keep the vnode around until the transaction is complete.
   transaction_or->PinVnode(fbl::RefPtr(this));
 
-  fs_->RemoveUnlinked(transaction_or.value().get(), this);
+  if (auto status = fs_->RemoveUnlinked(transaction_or.value().get(), this); status.is_error()) {
+    // As above, the inode will be cleaned up, or reported by fsck, on a later mount.
+    fs_->VnodeRelease(this);
+    return status;
+  }
   if (auto status = Purge(transaction_or.value().get()); status.is_error()) {
     return status;
   }
@@ -395,6 +638,12 @@ zx::status<> VnodeMinfs::ReadInternal(PendingWork* transaction, void* vdata, siz
     len = GetSize() - off;
   }
 
+  if (IsInline()) {
+    memcpy(vdata, GetInlineData() + off, len);
+    *actual = len;
+    return zx::ok();
+  }
+
 #ifdef __Fuchsia__
   if (auto status = InitVmo(); status.is_error()) {
     return status.take_error();
@@ -409,7 +658,7 @@ zx::status<> VnodeMinfs::ReadInternal(PendingWork* transaction, void* vdata, siz
   uint32_t n = static_cast<uint32_t>(off / fs_->BlockSize());
   size_t adjust = off % fs_->BlockSize();
 
-  while ((len > 0) && (n < kMinfsMaxFileBlock)) {
+  while ((len > 0) && (n < fs_->Info().MaxFileBlock())) {
     size_t xfer;
     if (len > (fs_->BlockSize() - adjust)) {
       xfer = fs_->BlockSize() - adjust;
@@ -448,12 +697,28 @@ zx::status<> VnodeMinfs::WriteInternal(Transaction* transaction, const uint8_t*
                                        size_t off, size_t* actual) {
   // We should be called after validating offset and length. Assert if they are invalid.
   auto new_size_or = safemath::CheckAdd(len, off);
-  ZX_ASSERT(new_size_or.IsValid() && new_size_or.ValueOrDie() <= kMinfsMaxFileSize);
+  ZX_ASSERT(new_size_or.IsValid() && new_size_or.ValueOrDie() <= fs_->Info().MaxFileSize());
 
   if (len == 0) {
     *actual = 0;
     return zx::ok();
   }
+
+  if (IsInline()) {
+    if (off + len <= kMinfsInlineDataSize) {
+      // Bytes between the old size and |off| are already zero.
+      memcpy(GetInlineData() + off, data, len);
+      if (off + len > GetSize()) {
+        SetSize(off + len);
+      }
+      *actual = len;
+      return zx::ok();
+    }
+    if (auto status = ConvertInlineToBlocks(transaction); status.is_error()) {
+      return status;
+    }
+  }
+
 #ifdef __Fuchsia__
   // TODO(planders): Once we are splitting up write transactions, assert this on host as well.
   ZX_DEBUG_ASSERT(len <= TransactionLimits::kMaxWriteBytes);
@@ -470,7 +735,7 @@ zx::status<> VnodeMinfs::WriteInternal(Transaction* transaction, const uint8_t*
   size_t adjust = off % fs_->BlockSize();
 
   while (len > 0) {
-    ZX_ASSERT(n < kMinfsMaxFileBlock);
+    ZX_ASSERT(n < fs_->Info().MaxFileBlock());
     size_t xfer;
     if (len > (fs_->BlockSize() - adjust)) {
       xfer = fs_->BlockSize() - adjust;
@@ -479,7 +744,7 @@ zx::status<> VnodeMinfs::WriteInternal(Transaction* transaction, const uint8_t*
     }
 
 #ifdef __Fuchsia__
-    size_t xfer_off = n * fs_->BlockSize() + adjust;
+    size_t xfer_off = size_t{n} * fs_->BlockSize() + adjust;
     if ((xfer_off + xfer) > vmo_size_) {
       size_t new_size = fbl::round_up(xfer_off + xfer, fs_->BlockSize());
       ZX_DEBUG_ASSERT(new_size >= GetSize());  // Overflow.
@@ -518,8 +783,7 @@ zx::status<> VnodeMinfs::WriteInternal(Transaction* transaction, const uint8_t*
     if (len < fs_->BlockSize() && max_size >= GetSize()) {
       memset(wdata + adjust + xfer, 0, fs_->BlockSize() - (adjust + xfer));
     }
-    if (auto status = fs_->bc_->Writeblk(bno_or.value() + fs_->Info().dat_block, wdata);
-        status.is_error()) {
+    if (auto status = WriteDataBlock(bno_or.value(), wdata); status.is_error()) {
       break;
     }
 #endif  // __Fuchsia__
@@ -534,7 +798,7 @@ zx::status<> VnodeMinfs::WriteInternal(Transaction* transaction, const uint8_t*
   if (len == 0) {
     // If more than zero bytes were requested, but zero bytes were written,
     // return an error explicitly (rather than zero).
-    if (off >= kMinfsMaxFileSize) {
+    if (off >= fs_->Info().MaxFileSize()) {
       return zx::error(ZX_ERR_FILE_BIG);
     }
 
@@ -543,7 +807,7 @@ zx::status<> VnodeMinfs::WriteInternal(Transaction* transaction, const uint8_t*
   }
 
   if ((off + len) > GetSize()) {
-    SetSize(static_cast<uint32_t>(off + len));
+    SetSize(off + len);
   }
 
   *actual = len;
@@ -633,11 +897,21 @@ void VnodeMinfs::Allocate(Minfs* fs, uint32_t type, fbl::RefPtr<VnodeMinfs>* out
   } else {
     (*out)->inode_.link_count = 1;
   }
+  if (type == kMinfsTypeDir && fs->Info().UsesDirIndex()) {
+    // Indexed directories always have an index block, so they are never inline.
+    (*out)->inode_.flags |= kMinfsInodeFlagDirIndex;
+  } else if (fs->Info().UsesInlineData()) {
+    (*out)->inode_.flags |= kMinfsInodeFlagInlineData;
+  }
 }
 
-void VnodeMinfs::Recreate(Minfs* fs, ino_t ino, fbl::RefPtr<VnodeMinfs>* out) {
+zx::status<> VnodeMinfs::Recreate(Minfs* fs, ino_t ino, fbl::RefPtr<VnodeMinfs>* out) {
   Inode inode;
   fs->InodeLoad(ino, &inode);
+  if (fs->Info().UsesChecksums() && !VerifyInodeChecksum(ino, inode)) {
+    FX_LOGS(ERROR) << "Inode " << ino << " failed checksum verification";
+    return zx::error(ZX_ERR_IO_DATA_INTEGRITY);
+  }
   if (inode.magic == kMinfsMagicDir) {
     *out = fbl::AdoptRef(new Directory(fs));
   } else {
@@ -646,7 +920,8 @@ void VnodeMinfs::Recreate(Minfs* fs, ino_t ino, fbl::RefPtr<VnodeMinfs>* out) {
   memcpy(&(*out)->inode_, &inode, sizeof(inode));
 
   (*out)->ino_ = ino;
-  (*out)->SetSize(static_cast<uint32_t>((*out)->inode_.size));
+  (*out)->SetSize(GetInodeSize((*out)->inode_));
+  return zx::ok();
 }
 
 #ifdef __Fuchsia__
@@ -683,7 +958,21 @@ void VnodeMinfs::GetAllocatedRegions(GetAllocatedRegionsRequestView request,
 
 zx::status<> VnodeMinfs::TruncateInternal(Transaction* transaction, size_t len) {
   // We should be called after validating length. Assert if len is unexpected.
-  ZX_ASSERT(len <= kMinfsMaxFileSize);
+  ZX_ASSERT(len <= fs_->Info().MaxFileSize());
+
+  if (IsInline()) {
+    if (len <= kMinfsInlineDataSize) {
+      // Keep the bytes beyond the end of the data zeroed.
+      if (len < GetSize()) {
+        memset(GetInlineData() + len, 0, GetSize() - len);
+      }
+      SetSize(len);
+      return zx::ok();
+    }
+    if (auto status = ConvertInlineToBlocks(transaction); status.is_error()) {
+      return status;
+    }
+  }
 
 #ifdef __Fuchsia__
   // TODO(smklein): We should only init up to 'len'; no need
@@ -704,7 +993,20 @@ zx::status<> VnodeMinfs::TruncateInternal(Transaction* transaction, size_t len)
     // [start_bno, EOF) blocks should be deleted entirely.
     blk_t start_bno = static_cast<blk_t>((len % fs_->BlockSize() == 0) ? trunc_bno : trunc_bno + 1);
 
-    if (auto shrink_or = BlocksShrink(transaction, start_bno); shrink_or.is_error()) {
+    const uint64_t end_bno =
+        fbl::round_up(inode_size, uint64_t{fs_->BlockSize()}) / fs_->BlockSize();
+    if (IsReleasePending()) {
+      // The blocks beyond the size of the file are already being released.
+    } else if (!IsDirectory() && !IsUnlinked() &&
+               inode_.block_count > TransactionLimits::kMaxReleaseBlocks &&
+               end_bno - start_bno > TransactionLimits::kMaxReleaseBlocks) {
+      // Freeing this many blocks may not fit in one transaction. Only the new size is persisted
+      // here, along with the file's place on the unlinked list, from which the blocks beyond the
+      // size are released by later transactions, or by the purge on the next mount.
+      if (auto status = fs_->AddPendingRelease(transaction, this); status.is_error()) {
+        return status.take_error();
+      }
+    } else if (auto shrink_or = BlocksShrink(transaction, start_bno); shrink_or.is_error()) {
       return shrink_or.take_error();
     }
 
@@ -727,8 +1029,8 @@ zx::status<> VnodeMinfs::TruncateInternal(Transaction* transaction, size_t len)
 #endif
     // Shrink the size to be block-aligned if we are removing blocks from
     // the end of the vnode.
-    if (start_bno * fs_->BlockSize() < inode_size) {
-      SetSize(static_cast<uint32_t>(start_bno * fs_->BlockSize()));
+    if (uint64_t{start_bno} * fs_->BlockSize() < inode_size) {
+      SetSize(uint64_t{start_bno} * fs_->BlockSize());
     }
 
     // Write zeroes to the rest of the remaining block, if it exists
@@ -775,7 +1077,7 @@ zx::status<> VnodeMinfs::TruncateInternal(Transaction* transaction, size_t len)
           return zx::error(ZX_ERR_IO);
         }
         memset(bdata + adjust, 0, fs_->BlockSize() - adjust);
-        if (fs_->bc_->Writeblk(bno + fs_->Info().dat_block, bdata).is_error()) {
+        if (WriteDataBlock(bno, bdata).is_error()) {
           return zx::error(ZX_ERR_IO);
         }
       }
@@ -783,7 +1085,7 @@ zx::status<> VnodeMinfs::TruncateInternal(Transaction* transaction, size_t len)
     }
   } else if (len > inode_size) {
     // Truncate should make the file longer, filled with zeroes.
-    if (kMinfsMaxFileSize < len) {
+    if (fs_->Info().MaxFileSize() < len) {
       return zx::error(ZX_ERR_INVALID_ARGS);
     }
 #ifdef __Fuchsia__
@@ -799,7 +1101,7 @@ zx::status<> VnodeMinfs::TruncateInternal(Transaction* transaction, size_t len)
 
   // Setting the size does not ensure the on-disk inode is updated. Ensuring
   // writeback occurs is the responsibility of the caller.
-  SetSize(static_cast<uint32_t>(len));
+  SetSize(len);
   return zx::ok();
 }
 
@@ -33,6 +33,7 @@
 
 #include "src/lib/storage/vfs/cpp/vfs.h"
 #include "src/lib/storage/vfs/cpp/vnode.h"
+#include "src/storage/minfs/extent_tree.h"
 #include "src/storage/minfs/format.h"
 #include "src/storage/minfs/lazy_buffer.h"
 #include "src/storage/minfs/minfs.h"
@@ -75,10 +76,12 @@ class VnodeMinfs : public fs::Vnode,
   // Does not allocate an inode number for the Vnode.
   static void Allocate(Minfs* fs, uint32_t type, fbl::RefPtr<VnodeMinfs>* out);
 
-  // Allocates a Vnode, loading |ino| from storage.
+  // Allocates a Vnode, loading |ino| from storage. On volumes with inode checksums, fails with
+  // ZX_ERR_IO_DATA_INTEGRITY unless the inode is in use and its checksum matches, so that nothing
+  // is done with the contents of a corrupt inode.
   //
   // Doesn't update create / modify times of the node.
-  static void Recreate(Minfs* fs, ino_t ino, fbl::RefPtr<VnodeMinfs>* out);
+  [[nodiscard]] static zx::status<> Recreate(Minfs* fs, ino_t ino, fbl::RefPtr<VnodeMinfs>* out);
 
   bool IsUnlinked() const { return inode_.link_count == 0; }
 
@@ -97,6 +100,10 @@ class VnodeMinfs : public fs::Vnode,
 
   void MarkPurged() { inode_.magic = kMinfsMagicPurged; }
 
+  // Returns true if the inode holds its data inline rather than in blocks (see
+  // kMinfsInodeFlagInlineData).
+  bool IsInline() const { return (inode_.flags & kMinfsInodeFlagInlineData) != 0; }
+
   static size_t GetHash(ino_t key) { return fnv1a_tiny(key, kMinfsHashBits); }
 
   // fs::Vnode interface (invoked publicly).
@@ -137,9 +144,7 @@ class VnodeMinfs : public fs::Vnode,
   // Sets the new size of the vnode.
   // Should update the in-memory representation of the Vnode, but not necessarily
   // write it out to persistent storage.
-  //
-  // TODO(unknown): Upgrade internal size to 64-bit integer.
-  virtual void SetSize(uint32_t new_size) = 0;
+  virtual void SetSize(uint64_t new_size) = 0;
 
   // Accesses a block in the vnode at |vmo_offset| relative to the start of the file,
   // which was previously at the device offset |dev_offset|.
@@ -158,6 +163,11 @@ class VnodeMinfs : public fs::Vnode,
   virtual void DeleteBlock(PendingWork* transaction, blk_t vmo_offset, blk_t dev_offset,
                            bool indirect) = 0;
 
+  // Deletes the |count| direct blocks starting at |vmo_offset| within the file, which are
+  // allocated to the contiguous on-disk blocks starting at |dev_offset|.
+  virtual void DeleteBlocks(PendingWork* transaction, blk_t vmo_offset, blk_t dev_offset,
+                            blk_t count);
+
 #ifdef __Fuchsia__
   // Instructs the Vnode to write out |count| blocks of the vnode, starting at local
   // offset |vmo_offset|, corresponding to on-disk offset |dev_offset|.
@@ -218,16 +228,47 @@ class VnodeMinfs : public fs::Vnode,
   // Initializes (if necessary) and returns the indirect file.
   [[nodiscard]] zx::status<LazyBuffer*> GetIndirectFile();
 
+  // Loads (if necessary) and returns the extent tree. Only valid on volumes which use extents.
+  [[nodiscard]] zx::status<ExtentTree*> GetExtentTree();
+
+  // Writes out the modified nodes of the extent tree. The root of the tree is part of the inode and
+  // is written by InodeSync.
+  [[nodiscard]] zx::status<> FlushExtentTree(PendingWork* transaction);
+
+  // Moves the inline data of the inode, if any, to a data block and clears
+  // kMinfsInodeFlagInlineData, so that the vnode can grow beyond kMinfsInlineDataSize bytes.
+  [[nodiscard]] zx::status<> ConvertInlineToBlocks(Transaction* transaction);
+
   // Deletes all blocks (relative to a file) from "start" (inclusive) to the end
   // of the file. Does not update mtime/atime.
-  // This can be extended to return indices of deleted bnos, or to delete a specific number of
-  // bnos
   zx::status<> BlocksShrink(PendingWork* transaction, blk_t start);
 
+  // Deletes up to |max_blocks| data blocks from "start" (inclusive) onwards, lowest first, along
+  // with any indirect blocks or extent nodes they leave empty. Unmapped ranges are skipped without
+  // counting towards |max_blocks|. Returns true if no mapped blocks remain from "start" onwards.
+  zx::status<bool> BlocksRelease(PendingWork* transaction, blk_t start, uint64_t max_blocks);
+
+  // Returns true if this file is linked but queued on the unlinked list, because blocks beyond its
+  // size are still to be released (see |Minfs::AddPendingRelease|).
+  bool IsReleasePending() const;
+
+  // Releases the blocks beyond the size of the file, if any are still pending, over as many
+  // transactions as that takes. Must be called before the file is extended, so that the file does
+  // not regain blocks which were truncated away.
+  [[nodiscard]] zx::status<> FinishRelease();
+
  protected:
   // fs::Vnode protected interface.
   void RecycleNode() final;
 
+#ifdef __Fuchsia__
+  // Initializes vmo that contains file's data by reading data from the disk.
+  // Since we cannot yet register the filesystem as a paging service (and
+  // cleanly fault on pages when they are actually needed), we currently read an
+  // entire file to a VMO when a file's data block are accessed.
+  zx::status<> InitVmo();
+#endif
+
  private:
   // fs::Vnode private interface.
   zx_status_t CloseNode() final;
@@ -247,7 +288,11 @@ class VnodeMinfs : public fs::Vnode,
   // Does not allocate any blocks, direct or indirect, to acquire this block.
   zx::status<blk_t> BlockGetReadable(blk_t n);
 
-  // Deletes this Vnode from disk, freeing the inode and blocks.
+  // Returns the inline data of the inode, which is only meaningful if IsInline().
+  uint8_t* GetInlineData() { return reinterpret_cast<uint8_t*>(inode_.dnum); }
+
+  // Deletes this Vnode from disk, freeing the inode and blocks. Large files may instead be queued
+  // on the unlinked list and freed in the background (see |Minfs::ShouldDeferPurge|).
   //
   // Must only be called on Vnodes which
   // - Have no open fds
@@ -260,16 +305,14 @@ class VnodeMinfs : public fs::Vnode,
 
   void Sync(SyncCallback closure) final;
 
-  // Initializes vmo that contains file's data by reading data from the disk.
-  // Since we cannot yet register the filesystem as a paging service (and
-  // cleanly fault on pages when they are actually needed), we currently read an
-  // entire file to a VMO when a file's data block are accessed.
-  zx::status<> InitVmo();
-
   // Use the watcher container to implement a directory watcher
   void Notify(std::string_view name, fuchsia_io::wire::WatchEvent event) final;
   zx_status_t WatchDir(fs::Vfs* vfs, fuchsia_io::wire::WatchMask mask, uint32_t options,
                        fidl::ServerEnd<fuchsia_io::DirectoryWatcher> watcher) final;
+#else
+  // Writes |data| to data block |bno| of the volume immediately. The blocks of directories are
+  // metadata, so have their checksums recorded.
+  [[nodiscard]] zx::status<> WriteDataBlock(blk_t bno, const void* data);
 #endif
 
   Minfs* const fs_;
@@ -289,6 +332,11 @@ class VnodeMinfs : public fs::Vnode,
   // It is created on-demand.
   std::unique_ptr<LazyBuffer> indirect_file_;
 
+  // The extent tree of an extent-mapped inode, loaded on demand, and a buffer in which modified
+  // nodes are staged for writing, indexed by the slot the tree assigns to each node.
+  std::unique_ptr<ExtentTree> extent_tree_;
+  std::unique_ptr<LazyBuffer> extent_buffer_;
+
   ino_t ino_{};
 
   // DataBlockAssigner may modify this field asynchronously, so a valid Transaction object must
@@ -6,7 +6,7 @@
 
 namespace minfs {
 
-void PendingAllocationData::Reset(blk_t size) {
+void PendingAllocationData::Reset(uint64_t size) {
   new_blocks_ = 0;
   node_size_ = size;
   block_map_.ClearAll();
@@ -47,4 +47,10 @@ bool PendingAllocationData::ClearPending(blk_t block_num, bool allocated) {
   return false;
 }
 
+blk_t PendingAllocationData::ClearPendingAllocated(blk_t start, blk_t count) {
+  size_t initial_bits = block_map_.num_bits();
+  ZX_ASSERT(block_map_.Clear(start, start + count) == ZX_OK);
+  return static_cast<blk_t>(initial_bits - block_map_.num_bits());
+}
+
 }  // namespace minfs
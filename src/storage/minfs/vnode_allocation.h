@@ -25,7 +25,7 @@ class PendingAllocationData {
   ~PendingAllocationData() { ZX_DEBUG_ASSERT(IsEmpty()); }
 
   // Clears out all allocation/reservation data.
-  void Reset(blk_t size);
+  void Reset(uint64_t size);
 
   // Returns the |start| and |count| of the first range in the block_map_.
   zx_status_t GetNextRange(blk_t* start, blk_t* count) const;
@@ -45,15 +45,19 @@ class PendingAllocationData {
   // (i.e., it was set in the map initially).
   bool ClearPending(blk_t block_num, bool allocated);
 
+  // Clears the |count| blocks starting at |start| from the block_map_, all of which were previously
+  // allocated. Returns the number of blocks which were cleared from the map.
+  blk_t ClearPendingAllocated(blk_t start, blk_t count);
+
   // Returns the count of pending blocks which are not already allocated.
   blk_t GetNewPending() const { return new_blocks_; }
 
   // Returns the total number of pending blocks.
   blk_t GetTotalPending() const { return static_cast<blk_t>(block_map_.num_bits()); }
 
-  blk_t GetNodeSize() const { return node_size_; }
+  uint64_t GetNodeSize() const { return node_size_; }
 
-  void SetNodeSize(blk_t size) { node_size_ = size; }
+  void SetNodeSize(uint64_t size) { node_size_ = size; }
 
   // Iterate over the ranges in the bitmap.  Modifying the list while
   // iterating over it may yield undefined results.
@@ -71,7 +75,7 @@ class PendingAllocationData {
   blk_t new_blocks_ = 0;
 
   // The expected size of the vnode after all blocks in block_map_ have been allocated.
-  blk_t node_size_ = 0;
+  uint64_t node_size_ = 0;
 
   // Map of relative data blocks to be allocated at a later time.
   bitmap::RleBitmapBase<blk_t> block_map_;
@@ -121,7 +121,7 @@ BaseBufferView::Flusher GetIndirectFlusher(VnodeMinfs* vnode, LazyBuffer* file,
         [vnode](ResizeableBufferType* buffer, BlockRange range, DeviceBlock device_block) {
           return EnumerateBlocks(
               range, [vnode, buffer, range, device_block](BlockRange r) -> zx::status<uint64_t> {
-                auto status = vnode->Vfs()->GetMutableBcache()->Writeblk(
+                auto status = vnode->Vfs()->WriteMetadataBlock(
                     static_cast<blk_t>(device_block.block() + (r.Start() - range.Start())),
                     buffer->Data(r.Start()));
                 if (status.is_ok()) {
@@ -136,6 +136,29 @@ BaseBufferView::Flusher GetIndirectFlusher(VnodeMinfs* vnode, LazyBuffer* file,
 #endif
 }
 
+// Allocates the nodes of an extent tree in the same way as indirect blocks.
+class ExtentNodeAllocator : public ExtentTree::NodeAllocator {
+ public:
+  ExtentNodeAllocator(VnodeMinfs* vnode, PendingWork* transaction)
+      : vnode_(*vnode), transaction_(transaction) {
+    ZX_ASSERT(transaction != nullptr);
+  }
+
+  blk_t AllocateNode() override {
+    blk_t block = 0;
+    vnode_.AllocateIndirect(transaction_, &block);
+    return block;
+  }
+
+  void FreeNode(blk_t block) override {
+    vnode_.DeleteBlock(transaction_, 0, block, /*indirect=*/true);
+  }
+
+ private:
+  VnodeMinfs& vnode_;
+  PendingWork* transaction_;
+};
+
 // -- View Getters --
 //
 // These functions are helpers that set up BufferView objects for ranges of block pointers.
@@ -256,6 +279,10 @@ zx::status<std::pair<blk_t, uint64_t>> VnodeMapper::MapToBlk(BlockRange range) {
   return zx::ok(std::make_pair(iterator.Blk(), iterator.GetContiguousBlockCount(range.Length())));
 }
 
+uint64_t VnodeMapper::MaxBlocks() const {
+  return vnode_.Vfs()->Info().UsesExtents() ? kMinfsMaxExtentFileBlock : kMaxBlocks;
+}
+
 zx::status<DeviceBlockRange> VnodeMapper::Map(BlockRange range) {
   zx::status<std::pair<blk_t, uint64_t>> status = MapToBlk(range);
   if (status.is_error())
@@ -268,10 +295,24 @@ zx::status<DeviceBlockRange> VnodeMapper::Map(BlockRange range) {
 
 zx::status<> VnodeIterator::Init(VnodeMapper* mapper, PendingWork* transaction,
                                  uint64_t file_block) {
+  // Inline data has no block mapping to iterate over.
+  ZX_DEBUG_ASSERT(!mapper->vnode().IsInline());
   mapper_ = mapper;
   transaction_ = transaction;
   file_block_ = file_block;
   contiguous_block_count_ = 0;
+  extent_tree_ = nullptr;
+  extent_tree_dirty_ = false;
+  if (mapper->vnode().Vfs()->Info().UsesExtents()) {
+    if (file_block > kMinfsMaxExtentFileBlock)
+      return zx::error(ZX_ERR_OUT_OF_RANGE);
+    zx::status<ExtentTree*> tree = mapper->vnode().GetExtentTree();
+    if (tree.is_error())
+      return tree.take_error();
+    extent_tree_ = tree.value();
+    level_count_ = 0;
+    return zx::ok();
+  }
   // The file block determines the number of levels of views that we need, and the view-getters
   // that we need to use.
   if (file_block < VnodeMapper::kIndirectFileStartBlock) {
@@ -366,7 +407,42 @@ zx::status<> VnodeIterator::SetBlk(Level* level, blk_t block) {
   return zx::ok();
 }
 
+zx::status<> VnodeIterator::SetExtentBlk(blk_t block) {
+  if (file_block_ >= kMinfsMaxExtentFileBlock)
+    return zx::error(ZX_ERR_OUT_OF_RANGE);
+  ExtentNodeAllocator allocator(&mapper_->vnode(), transaction_);
+  if (auto status = extent_tree_->Set(file_block_, block, &allocator); status.is_error())
+    return status;
+  extent_tree_->WriteRoot(mapper_->vnode().GetMutableInode());
+  extent_tree_dirty_ = true;
+  return zx::ok();
+}
+
+zx::status<> VnodeIterator::Unmap(uint64_t count) {
+  if (extent_tree_) {
+    ExtentNodeAllocator allocator(&mapper_->vnode(), transaction_);
+    if (auto status = extent_tree_->Unmap(file_block_, count, &allocator); status.is_error())
+      return status;
+    extent_tree_->WriteRoot(mapper_->vnode().GetMutableInode());
+    extent_tree_dirty_ = true;
+    return Advance(count);
+  }
+  for (uint64_t i = 0; i < count; ++i) {
+    if (auto status = SetBlk(0); status.is_error())
+      return status;
+    if (auto status = Advance(); status.is_error())
+      return status;
+  }
+  return zx::ok();
+}
+
 uint64_t VnodeIterator::GetContiguousBlockCount(uint64_t max_blocks) const {
+  if (extent_tree_) {
+    if (file_block_ >= kMinfsMaxExtentFileBlock)
+      return 0;
+    const uint64_t count = std::min(max_blocks, kMinfsMaxExtentFileBlock - file_block_);
+    return extent_tree_->Lookup(file_block_, count).second;
+  }
   if (level_count_ == 0)
     return 0;
   if (contiguous_block_count_ == 0)
@@ -457,6 +533,15 @@ zx::status<> VnodeIterator::FlushLevel(int level) {
 zx::status<> VnodeIterator::Flush() {
   if (!transaction_)
     return zx::ok();  // Iterator is read-only.
+  if (extent_tree_) {
+    if (!extent_tree_dirty_)
+      return zx::ok();
+    extent_tree_dirty_ = false;
+    if (auto status = mapper_->vnode().FlushExtentTree(transaction_); status.is_error())
+      return status;
+    mapper_->vnode().InodeSync(transaction_, kMxFsSyncDefault);
+    return zx::ok();
+  }
   for (int level = 0; level < level_count_; ++level) {
     auto status = FlushLevel(level);
     if (status.is_error())
@@ -466,6 +551,13 @@ zx::status<> VnodeIterator::Flush() {
 }
 
 zx::status<> VnodeIterator::Advance(const uint64_t advance) {
+  if (extent_tree_) {
+    // The whole tree is in memory, so there is nothing to flush or load.
+    if (advance > kMinfsMaxExtentFileBlock - file_block_)
+      return zx::error(ZX_ERR_OUT_OF_RANGE);
+    file_block_ += advance;
+    return zx::ok();
+  }
   if (level_count_ == 0) {
     return advance == 0 ? zx::ok() : zx::make_status(ZX_ERR_BAD_STATE);
   }
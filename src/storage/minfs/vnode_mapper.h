@@ -10,6 +10,7 @@
 #include <range/range.h>
 
 #include "src/storage/minfs/buffer_view.h"
+#include "src/storage/minfs/extent_tree.h"
 #include "src/storage/minfs/lazy_reader.h"
 #include "src/storage/minfs/pending_work.h"
 
@@ -53,11 +54,16 @@ class VnodeMapper : public MapperInterface {
       kMinfsDirect + kMinfsDirectPerIndirect * kMinfsIndirect;
   static constexpr uint64_t kMaxBlocks =
       kDoubleIndirectFileStartBlock + kMinfsDirectPerDindirect * kMinfsDoublyIndirect;
+  static_assert(kMaxBlocks == kMinfsMaxPointerFileBlock);
 
   explicit VnodeMapper(VnodeMinfs* vnode) : vnode_(*vnode) {}
 
   VnodeMinfs& vnode() { return vnode_; }
 
+  // Returns the number of file blocks the vnode's block map can address: kMaxBlocks for block
+  // pointers, or kMinfsMaxExtentFileBlock for extent trees.
+  uint64_t MaxBlocks() const;
+
   // MapperInterface:
 
   zx::status<DeviceBlockRange> Map(BlockRange range) override;
@@ -76,7 +82,8 @@ class VnodeMapper : public MapperInterface {
 };
 
 // Iterator that keeps track of block pointers for a given file block. Depending on the file
-// block, there can be up to three levels of block pointers.
+// block, there can be up to three levels of block pointers. On volumes which use extents, the
+// iterator instead looks blocks up in the vnode's extent tree.
 //
 // Example use, reading a range of blocks:
 //
@@ -121,12 +128,23 @@ class VnodeIterator {
 
   // Returns the target block as a blk_t. Zero is special and means the block is unmapped/sparse.
   blk_t Blk() const {
+    if (extent_tree_) {
+      return file_block_ < kMinfsMaxExtentFileBlock
+                 ? extent_tree_->Lookup(file_block_, 1).first
+                 : 0;
+    }
     return level_count_ > 0 && levels_[0].remaining() > 0 ? levels_[0].blk() : 0;
   }
 
   // Sets the target block. The iterator will need to be flushed after calling this (by calling the
   // Flush method).
-  [[nodiscard]] zx::status<> SetBlk(blk_t block) { return SetBlk(levels_.data(), block); }
+  [[nodiscard]] zx::status<> SetBlk(blk_t block) {
+    return extent_tree_ ? SetExtentBlk(block) : SetBlk(levels_.data(), block);
+  }
+
+  // Unmaps |count| blocks from the current block and advances past them. The blocks themselves
+  // are not freed. The iterator will need to be flushed after calling this.
+  [[nodiscard]] zx::status<> Unmap(uint64_t count);
 
   // Returns the length in blocks of a contiguous range at most |max_blocks|. For
   // efficiency/simplicity reasons, it might return fewer than there actually are.
@@ -191,6 +209,9 @@ class VnodeIterator {
   // Sets a block pointer in the given level.
   zx::status<> SetBlk(Level* level, blk_t block);
 
+  // Maps the current block to |block| in the extent tree.
+  zx::status<> SetExtentBlk(blk_t block);
+
   // The owning mapper.
   VnodeMapper* mapper_ = nullptr;
   // A transaction to be used for allocations, or nullptr if read-only.
@@ -203,6 +224,10 @@ class VnodeIterator {
   int level_count_ = 0;
   // The level information.
   std::array<Level, kMaxLevels> levels_;
+  // The vnode's extent tree if the volume uses extents, in which case there are no levels.
+  ExtentTree* extent_tree_ = nullptr;
+  // Set if this iterator has modified the extent tree since it was last flushed.
+  bool extent_tree_dirty_ = false;
 };
 
 }  // namespace minfs
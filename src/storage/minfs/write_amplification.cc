@@ -0,0 +1,145 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/storage/minfs/write_amplification.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+namespace minfs {
+namespace {
+
+using View = IoAccounting::View;
+
+// Returns |end| - |start|, counting totals which went backwards (after a reset) from zero.
+WriteAmplification::Totals Difference(const WriteAmplification::Totals& end,
+                                      const WriteAmplification::Totals& start) {
+  WriteAmplification::Totals result;
+  result.logical_bytes =
+      end.logical_bytes >= start.logical_bytes ? end.logical_bytes - start.logical_bytes : 0;
+  for (size_t i = 0; i < WriteAmplification::kCategoryCount; ++i) {
+    result.device_bytes[i] =
+        end.device_bytes[i] >= start.device_bytes[i] ? end.device_bytes[i] - start.device_bytes[i]
+                                                     : 0;
+  }
+  return result;
+}
+
+std::string TotalsToJson(const WriteAmplification::Totals& totals) {
+  char buffer[128];
+  snprintf(buffer, sizeof(buffer),
+           "{\"ratio\": %.3f, \"logical_bytes\": %" PRIu64 ", \"device_bytes\": %" PRIu64,
+           totals.Ratio(), totals.logical_bytes, totals.DeviceBytes());
+  std::string json = buffer;
+  json += ", \"by_category\": {";
+  for (size_t i = 0; i < WriteAmplification::kCategoryCount; ++i) {
+    const auto category = static_cast<WriteAmplification::Category>(i);
+    snprintf(buffer, sizeof(buffer), "%s\"%s\": {\"bytes\": %" PRIu64 ", \"ratio\": %.3f}",
+             i ? ", " : "", WriteAmplification::CategoryName(category), totals.device_bytes[i],
+             totals.Ratio(category));
+    json += buffer;
+  }
+  return json + "}}";
+}
+
+}  // namespace
+
+uint64_t WriteAmplification::Totals::DeviceBytes() const {
+  uint64_t total = 0;
+  for (uint64_t bytes : device_bytes) {
+    total += bytes;
+  }
+  return total;
+}
+
+double WriteAmplification::Totals::Ratio() const {
+  return logical_bytes ? static_cast<double>(DeviceBytes()) / static_cast<double>(logical_bytes)
+                       : 0.0;
+}
+
+double WriteAmplification::Totals::Ratio(Category category) const {
+  return logical_bytes ? static_cast<double>(device_bytes[static_cast<size_t>(category)]) /
+                             static_cast<double>(logical_bytes)
+                       : 0.0;
+}
+
+WriteAmplification::WriteAmplification(const IoAccounting* io_accounting,
+                                       Clock::duration window)
+    : io_accounting_(io_accounting), window_(window), window_start_(Clock::now()) {}
+
+WriteAmplification::Totals WriteAmplification::Cumulative() const {
+  auto device_bytes = [this](IoSource source) {
+    return io_accounting_->Get(View::kDevice, /*write=*/true, source).bytes;
+  };
+  Totals totals;
+  totals.logical_bytes = logical_bytes_.load(std::memory_order_relaxed);
+  auto set = [&totals](Category category, uint64_t bytes) {
+    totals.device_bytes[static_cast<size_t>(category)] = bytes;
+  };
+  set(Category::kJournal, device_bytes(IoSource::kJournal));
+  set(Category::kSuperblock, device_bytes(IoSource::kSuperblock));
+  set(Category::kBitmap,
+      device_bytes(IoSource::kInodeBitmap) + device_bytes(IoSource::kBlockBitmap));
+  set(Category::kInodeTable, device_bytes(IoSource::kInodeTable));
+  // Indirect blocks reach the data region of the device when the journal writes them back, once
+  // for each time they were enqueued.
+  const uint64_t data_region = device_bytes(IoSource::kData);
+  const uint64_t indirect =
+      std::min(data_region,
+               io_accounting_->Get(View::kTransaction, /*write=*/true, IoSource::kIndirect).bytes);
+  set(Category::kIndirect, indirect);
+  set(Category::kData, data_region - indirect);
+  return totals;
+}
+
+WriteAmplification::Totals WriteAmplification::Window(Clock::time_point now) const {
+  std::lock_guard lock(window_mutex_);
+  if (now - window_start_ >= window_) {
+    const Totals current = Cumulative();
+    last_window_ = Difference(current, window_start_totals_);
+    window_start_totals_ = current;
+    window_start_ = now;
+  }
+  return last_window_;
+}
+
+void WriteAmplification::Reset() {
+  logical_bytes_.store(0, std::memory_order_relaxed);
+  std::lock_guard lock(window_mutex_);
+  window_start_ = Clock::now();
+  window_start_totals_ = Totals();
+  last_window_ = Totals();
+}
+
+std::string WriteAmplification::ToJson(Clock::time_point now) const {
+  char window_seconds[32];
+  snprintf(window_seconds, sizeof(window_seconds), "%.3f",
+           std::chrono::duration<double>(window_).count());
+  return "{\"cumulative\": " + TotalsToJson(Cumulative()) + ", \"window\": " +
+         TotalsToJson(Window(now)) + ", \"window_seconds\": " + window_seconds + "}";
+}
+
+const char* WriteAmplification::CategoryName(Category category) {
+  switch (category) {
+    case Category::kJournal:
+      return "journal";
+    case Category::kSuperblock:
+      return "superblock";
+    case Category::kBitmap:
+      return "bitmap";
+    case Category::kInodeTable:
+      return "inode_table";
+    case Category::kIndirect:
+      return "indirect";
+    case Category::kData:
+      return "data";
+    case Category::kCount:
+      break;
+  }
+  return "unknown";
+}
+
+}  // namespace minfs
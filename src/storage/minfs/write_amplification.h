@@ -0,0 +1,85 @@
+// Copyright 2022 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SRC_STORAGE_MINFS_WRITE_AMPLIFICATION_H_
+#define SRC_STORAGE_MINFS_WRITE_AMPLIFICATION_H_
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include "src/storage/minfs/io_accounting.h"
+
+namespace minfs {
+
+// Relates the bytes written to the device to the bytes written to files by users.
+//
+// The device bytes come from the device view of an IoAccounting, with the data region split into
+// indirect blocks (as enqueued by transactions) and the rest. The host writes indirect blocks
+// directly rather than through transactions, so there they are counted as data. Directory blocks
+// are counted as data too.
+class WriteAmplification {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  enum class Category { kJournal, kSuperblock, kBitmap, kInodeTable, kIndirect, kData, kCount };
+  static constexpr size_t kCategoryCount = static_cast<size_t>(Category::kCount);
+
+  static constexpr std::chrono::seconds kDefaultWindow = std::chrono::seconds(10);
+
+  struct Totals {
+    uint64_t logical_bytes = 0;
+    std::array<uint64_t, kCategoryCount> device_bytes = {};
+
+    uint64_t DeviceBytes() const;
+    // Returns the bytes written to the device, in all or in |category|, for each byte written by
+    // users, or zero if users wrote nothing.
+    double Ratio() const;
+    double Ratio(Category category) const;
+  };
+
+  // |io_accounting| must outlive this object.
+  explicit WriteAmplification(const IoAccounting* io_accounting,
+                              Clock::duration window = kDefaultWindow);
+  WriteAmplification(const WriteAmplification&) = delete;
+  WriteAmplification& operator=(const WriteAmplification&) = delete;
+
+  // Records |bytes| written to a file by a user.
+  void RecordLogicalWrite(uint64_t bytes) {
+    logical_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  // Returns the totals since the last Reset, which must go with every reset of the IoAccounting.
+  Totals Cumulative() const;
+
+  // Returns the totals of the last complete window. Windows are only ended by calls to this, so a
+  // window which ends at |now| covers the time since the previous one ended, which may be more
+  // than the window length if this is not called often.
+  Totals Window(Clock::time_point now = Clock::now()) const;
+
+  void Reset();
+
+  // Returns the cumulative and windowed ratios and bytes of each category as a JSON object.
+  std::string ToJson(Clock::time_point now = Clock::now()) const;
+
+  static const char* CategoryName(Category category);
+
+ private:
+  const IoAccounting* const io_accounting_;
+  const Clock::duration window_;
+  std::atomic<uint64_t> logical_bytes_ = 0;
+
+  mutable std::mutex window_mutex_;
+  mutable Clock::time_point window_start_;
+  mutable Totals window_start_totals_;
+  mutable Totals last_window_;
+};
+
+}  // namespace minfs
+
+#endif  // SRC_STORAGE_MINFS_WRITE_AMPLIFICATION_H_
@@ -71,13 +71,13 @@ Transaction::Transaction(TransactionalFs* minfs,
                          std::unique_ptr<CachedBlockTransaction> cached_transaction)
     :
 #ifdef __Fuchsia__
-      lock_(minfs->GetLock()),
+      lock_(minfs->GetLock(), minfs->GetLockProfile(), LockSite::kTransaction),
 #endif
       inode_reservation_(&minfs->GetInodeAllocator()),
       block_reservation_(cached_transaction == nullptr
                              ? std::make_unique<AllocatorReservation>(&minfs->GetBlockAllocator())
-                             : cached_transaction->TakeBlockReservations()) {
-}
+                             : cached_transaction->TakeBlockReservations()),
+      io_accounting_(minfs->GetIoAccounting()) {}
 
 Transaction::~Transaction() {
   // Unreserve all reserved inodes/blocks while the lock is still held.
@@ -88,13 +88,20 @@ Transaction::~Transaction() {
 }
 
 #ifdef __Fuchsia__
-void Transaction::EnqueueMetadata(storage::Operation operation, storage::BlockBuffer* buffer) {
+void Transaction::EnqueueMetadata(storage::Operation operation, storage::BlockBuffer* buffer,
+                                  IoSource data_source) {
+  if (io_accounting_) {
+    io_accounting_->RecordTransaction(operation, data_source);
+  }
   storage::UnbufferedOperation unbuffered_operation = {.vmo = zx::unowned_vmo(buffer->Vmo()),
                                                        .op = operation};
   metadata_operations_.Add(std::move(unbuffered_operation));
 }
 
 void Transaction::EnqueueData(storage::Operation operation, storage::BlockBuffer* buffer) {
+  if (io_accounting_) {
+    io_accounting_->RecordTransaction(operation, IoSource::kFileData);
+  }
   storage::UnbufferedOperation unbuffered_operation = {.vmo = zx::unowned_vmo(buffer->Vmo()),
                                                        .op = operation};
   data_operations_.Add(std::move(unbuffered_operation));
@@ -108,18 +115,32 @@ void Transaction::PinVnode(fbl::RefPtr<VnodeMinfs> vnode) {
     }
   }
 
+  if (pinned_vnodes_.capacity() == 0) {
+    pinned_vnodes_ = VectorPool<fbl::RefPtr<VnodeMinfs>>::Take();
+  }
   pinned_vnodes_.push_back(std::move(vnode));
 }
 
 std::vector<fbl::RefPtr<VnodeMinfs>> Transaction::RemovePinnedVnodes() {
   return std::move(pinned_vnodes_);
 }
+
+void Transaction::ReleasePinnedVnodes(std::vector<fbl::RefPtr<VnodeMinfs>> pinned_vnodes) {
+  VectorPool<fbl::RefPtr<VnodeMinfs>>::Give(std::move(pinned_vnodes));
+}
 #else
-void Transaction::EnqueueMetadata(storage::Operation operation, storage::BlockBuffer* buffer) {
+void Transaction::EnqueueMetadata(storage::Operation operation, storage::BlockBuffer* buffer,
+                                  IoSource data_source) {
+  if (io_accounting_) {
+    io_accounting_->RecordTransaction(operation, data_source);
+  }
   builder_.Add(operation, buffer);
 }
 
 void Transaction::EnqueueData(storage::Operation operation, storage::BlockBuffer* buffer) {
+  if (io_accounting_) {
+    io_accounting_->RecordTransaction(operation, IoSource::kFileData);
+  }
   builder_.Add(operation, buffer);
 }
 
@@ -35,6 +35,9 @@
 #include "src/storage/minfs/bcache.h"
 #include "src/storage/minfs/cached_block_transaction.h"
 #include "src/storage/minfs/format.h"
+#include "src/storage/minfs/io_accounting.h"
+#include "src/storage/minfs/lock_profile.h"
+#include "src/storage/minfs/object_pool.h"
 #include "src/storage/minfs/pending_work.h"
 
 namespace minfs {
@@ -51,7 +54,9 @@ class VnodeMinfs;
 // inode table, as well as the Vnode block count and inode size may in the near future be modified
 // asynchronously. Since these modifications require a Transaction to be in progress, this lock
 // will protect against multiple simultaneous writes to these structures.
-class Transaction final : public PendingWork {
+//
+// Transactions are created at a high rate, so their memory is recycled through an ObjectPool.
+class Transaction final : public PendingWork, public PooledObject<Transaction> {
  public:
   static zx::status<std::unique_ptr<Transaction>> Create(TransactionalFs* minfs,
                                                          size_t reserve_inodes,
@@ -75,15 +80,27 @@ class Transaction final : public PendingWork {
   ////////////////
   // PendingWork interface.
 
-  void EnqueueMetadata(storage::Operation operation, storage::BlockBuffer* buffer) final;
+  // Metadata in the data region is accounted as indirect blocks unless enqueued with a source.
+  void EnqueueMetadata(storage::Operation operation, storage::BlockBuffer* buffer) final {
+    EnqueueMetadata(operation, buffer, IoSource::kIndirect);
+  }
   void EnqueueData(storage::Operation operation, storage::BlockBuffer* buffer) final;
 
   size_t AllocateBlock() final { return block_reservation_->Allocate(); }
 
   void DeallocateBlock(size_t block) final { return block_reservation_->Deallocate(block); }
 
+  void DeallocateBlocks(size_t start, size_t count) final {
+    return block_reservation_->Deallocate(start, count);
+  }
+
   ////////////////
   // Other methods.
+
+  // Enqueues metadata, accounting for it as |data_source| if it is in the data region.
+  void EnqueueMetadata(storage::Operation operation, storage::BlockBuffer* buffer,
+                       IoSource data_source);
+
   size_t AllocateInode() { return inode_reservation_.Allocate(); }
 
   void PinVnode(fbl::RefPtr<VnodeMinfs> vnode);
@@ -103,10 +120,16 @@ class Transaction final : public PendingWork {
     return data_operations_.TakeOperations();
   }
 
-  size_t SwapBlock(size_t old_bno) { return block_reservation_->Swap(old_bno); }
+  size_t SwapBlock(size_t old_bno, size_t hint = 0) {
+    return block_reservation_->Swap(old_bno, hint);
+  }
 
   std::vector<fbl::RefPtr<VnodeMinfs>> RemovePinnedVnodes();
 
+  // Unpins the vnodes returned by RemovePinnedVnodes and recycles the vector for later
+  // transactions.
+  static void ReleasePinnedVnodes(std::vector<fbl::RefPtr<VnodeMinfs>> pinned_vnodes);
+
   // Returns the block reservations within |transaction| and consumes |transaction|.
   // Asserts that there are no inode reservations.
   static std::unique_ptr<AllocatorReservation> TakeBlockReservations(
@@ -123,7 +146,7 @@ class Transaction final : public PendingWork {
 
  private:
 #ifdef __Fuchsia__
-  fbl::AutoLock<fbl::Mutex> lock_;
+  ProfiledLock<fbl::Mutex> lock_;
   storage::UnbufferedOperationsBuilder metadata_operations_;
   storage::UnbufferedOperationsBuilder data_operations_;
   std::vector<fbl::RefPtr<VnodeMinfs>> pinned_vnodes_;
@@ -133,6 +156,7 @@ class Transaction final : public PendingWork {
 
   AllocatorReservation inode_reservation_;
   std::unique_ptr<AllocatorReservation> block_reservation_;
+  IoAccounting* const io_accounting_;
 };
 
 }  // namespace minfs